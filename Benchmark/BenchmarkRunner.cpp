@@ -0,0 +1,143 @@
+#include "BenchmarkRunner.h"
+#include <algorithm>
+#include <iomanip>
+
+namespace
+{
+	std::string EscapeJson(const std::string& text)
+	{
+		std::string escaped;
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+				escaped += '\\';
+			escaped += c;
+		}
+		return escaped;
+	}
+
+	double GetBytesPerSecond(const BenchmarkResult& result)
+	{
+		return result.meanNanoseconds > 0.0 ? result.bytesPerIteration * 1e9 / result.meanNanoseconds : 0.0;
+	}
+}
+
+BenchmarkRunner::BenchmarkRunner(const std::string& filter, double minSeconds, unsigned long long maxIterations) :
+	m_filter(filter),
+	m_minSeconds(minSeconds),
+	m_maxIterations(std::max(1ull, maxIterations))
+{
+}
+
+
+
+bool BenchmarkRunner::IsSelected(const std::string& name) const
+{
+	return m_filter.empty() || name.find(m_filter) != std::string::npos;
+}
+
+
+
+BenchmarkResult* BenchmarkRunner::Run(const std::string& name, const Parameters& parameters, unsigned long long bytesPerIteration,
+	const std::function<bool()>& body)
+{
+	if (!IsSelected(name))
+		return nullptr;
+
+	// one untimed call warms caches and lazy initialization
+	if (!body())
+		return nullptr;
+
+	std::vector<double> samples;
+	double total = 0.0;
+	while (samples.size() < m_maxIterations && total < m_minSeconds * 1e9)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		const bool more = body();
+		const double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		samples.push_back(elapsed);
+		total += elapsed;
+		if (!more)
+			break;
+	}
+
+	std::sort(samples.begin(), samples.end());
+	BenchmarkResult result;
+	result.name = name;
+	result.parameters = parameters;
+	result.iterations = samples.size();
+	result.bytesPerIteration = bytesPerIteration;
+	result.meanNanoseconds = total / samples.size();
+	result.medianNanoseconds = samples[samples.size() / 2];
+	result.p90Nanoseconds = samples[samples.size() * 9 / 10];
+	result.minNanoseconds = samples.front();
+	m_results.push_back(result);
+	return &m_results.back();
+}
+
+
+
+BenchmarkResult* BenchmarkRunner::Record(const std::string& name, const Parameters& parameters, unsigned long long iterations,
+	double seconds, unsigned long long bytesPerIteration)
+{
+	if (!IsSelected(name) || !iterations)
+		return nullptr;
+
+	BenchmarkResult result;
+	result.name = name;
+	result.parameters = parameters;
+	result.iterations = iterations;
+	result.bytesPerIteration = bytesPerIteration;
+	result.meanNanoseconds = seconds * 1e9 / iterations;
+	result.medianNanoseconds = result.p90Nanoseconds = result.minNanoseconds = result.meanNanoseconds;
+	m_results.push_back(result);
+	return &m_results.back();
+}
+
+
+
+void BenchmarkRunner::PrintTable(std::ostream& stream) const
+{
+	for (const auto& result : m_results)
+	{
+		std::string name = result.name;
+		for (const auto& parameter : result.parameters)
+			name += " " + parameter.first + "=" + parameter.second;
+
+		stream << std::left << std::setw(52) << name << std::right << std::fixed << std::setprecision(0)
+			<< std::setw(14) << result.medianNanoseconds << " ns"
+			<< std::setw(12) << result.iterations << " it";
+		if (result.bytesPerIteration)
+			stream << std::setprecision(1) << std::setw(10) << GetBytesPerSecond(result) / (1024.0 * 1024.0) << " MiB/s";
+		for (const auto& counter : result.counters)
+			stream << std::setprecision(3) << "  " << counter.first << "=" << counter.second;
+		stream << std::defaultfloat << std::endl;
+	}
+}
+
+
+
+void BenchmarkRunner::PrintJson(std::ostream& stream, const std::string& label) const
+{
+	stream << std::setprecision(10) << "{\n  \"label\": \"" << EscapeJson(label) << "\",\n  \"results\": [";
+	for (size_t i = 0; i < m_results.size(); i++)
+	{
+		const BenchmarkResult& result = m_results[i];
+		stream << (i ? ",\n" : "\n") << "    { \"name\": \"" << EscapeJson(result.name) << "\", \"parameters\": {";
+		for (size_t p = 0; p < result.parameters.size(); p++)
+		{
+			stream << (p ? ", \"" : " \"") << EscapeJson(result.parameters[p].first) << "\": \"" << EscapeJson(result.parameters[p].second) << "\"";
+		}
+		stream << " }, \"iterations\": " << result.iterations
+			<< ", \"mean_ns\": " << result.meanNanoseconds
+			<< ", \"median_ns\": " << result.medianNanoseconds
+			<< ", \"p90_ns\": " << result.p90Nanoseconds
+			<< ", \"min_ns\": " << result.minNanoseconds
+			<< ", \"bytes_per_iteration\": " << result.bytesPerIteration
+			<< ", \"bytes_per_second\": " << GetBytesPerSecond(result);
+		for (const auto& counter : result.counters)
+			stream << ", \"" << EscapeJson(counter.first) << "\": " << counter.second;
+		stream << " }";
+	}
+	stream << "\n  ]\n}" << std::endl;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <deque>
+#include <vector>
+
+struct BenchmarkResult
+{
+	std::string name;
+	std::vector<std::pair<std::string, std::string>> parameters;
+	unsigned long long iterations = 0;
+	unsigned long long bytesPerIteration = 0;
+	double meanNanoseconds = 0.0;
+	double medianNanoseconds = 0.0;
+	double p90Nanoseconds = 0.0;
+	double minNanoseconds = 0.0;
+	std::vector<std::pair<std::string, double>> counters;     // case specific values (ratio, exactness, ...)
+};
+
+
+
+// Runs benchmark cases and reports them as a table and as JSON. A case is timed iteration by
+// iteration until it ran for the minimum time, so medians and percentiles are available as well.
+class BenchmarkRunner
+{
+public:
+	using Parameters = std::vector<std::pair<std::string, std::string>>;
+
+	BenchmarkRunner(const std::string& filter, double minSeconds, unsigned long long maxIterations);
+
+	bool IsSelected(const std::string& name) const;
+
+	//-- Times body per call, body returns false to stop early (e.g. a resource ran out).
+	BenchmarkResult* Run(const std::string& name, const Parameters& parameters, unsigned long long bytesPerIteration,
+		const std::function<bool()>& body);
+
+	//-- For cases that time themselves (streams, batches): iterations took seconds in total.
+	BenchmarkResult* Record(const std::string& name, const Parameters& parameters, unsigned long long iterations,
+		double seconds, unsigned long long bytesPerIteration);
+
+	void PrintTable(std::ostream& stream) const;
+	void PrintJson(std::ostream& stream, const std::string& label) const;
+
+private:
+	std::string m_filter;
+	double m_minSeconds;
+	unsigned long long m_maxIterations;
+	std::deque<BenchmarkResult> m_results;       // stable addresses for the returned results
+};
@@ -0,0 +1,342 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../OpenAL/Sound.h"
+#include "../OpenAL/LosslessCodec.h"
+#include "../SocketsClientServer/SocketCreator.h"
+#include "BenchmarkRunner.h"
+#include "SyncHarness.h"
+
+namespace
+{
+	constexpr size_t FRAME_SIZE = 4096;
+	constexpr size_t WIRE_FRAME_SIZE = FRAME_SIZE + sizeof(MYWAVEFORMATEX);
+	constexpr unsigned int STREAMING_BUFFERS_PER_BATCH = 200;
+
+	class LoopbackEndpoint : public SocketCreator
+	{
+	public:
+		explicit LoopbackEndpoint(bool isServer) : SocketCreator(isServer) {}
+		bool Listen() { return listen(mainSocket, 1) != SOCKET_ERROR; }
+		SOCKET Accept() { return accept(mainSocket, nullptr, nullptr); }
+		SOCKET GetSocket() const noexcept { return mainSocket; }
+	};
+
+	// Tonal material with a little noise, used when no wave file is given.
+	void CreateTestSignal(MYWAVEFORMATEX& waveFormat, std::vector<char>& data, unsigned int seconds)
+	{
+		waveFormat = MYWAVEFORMATEX{};
+		waveFormat.wFormatTag = WAVE_FORMAT_PCM;
+		waveFormat.nChannels = 2;
+		waveFormat.nSamplesPerSec = 44100;
+		waveFormat.wBitsPerSample = 16;
+		waveFormat.nBlockAlign = 4;
+		waveFormat.nAvgBytesPerSec = waveFormat.nSamplesPerSec * waveFormat.nBlockAlign;
+
+		std::mt19937 random(42);
+		std::uniform_int_distribution<int> noise(-64, 64);
+		const size_t frames = waveFormat.nSamplesPerSec * seconds;
+		data.resize(frames * waveFormat.nBlockAlign);
+		int16_t* samples = reinterpret_cast<int16_t*>(data.data());
+		for (size_t i = 0; i < frames; i++)
+		{
+			const double tone = 9000.0 * std::sin(i * 0.0627) + 4000.0 * std::sin(i * 0.0031);
+			samples[2 * i] = static_cast<int16_t>(tone + noise(random));
+			samples[2 * i + 1] = static_cast<int16_t>(tone * 0.7 + noise(random));
+		}
+	}
+
+	bool WriteWaveFile(const std::string& path, const MYWAVEFORMATEX& waveFormat, const std::vector<char>& data)
+	{
+		const uint32_t formatSize = sizeof(MYWAVEFORMATEX) - sizeof(waveFormat.cbSize);
+		const uint32_t dataSize = static_cast<uint32_t>(data.size());
+		const uint32_t riffSize = 4 + 8 + formatSize + 8 + dataSize;
+		const uint32_t riff = mmioFOURCC('R', 'I', 'F', 'F'), wave = mmioFOURCC('W', 'A', 'V', 'E');
+		const uint32_t fmt = mmioFOURCC('f', 'm', 't', ' '), dataTag = mmioFOURCC('d', 'a', 't', 'a');
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&riff), 4).write(reinterpret_cast<const char*>(&riffSize), 4)
+			.write(reinterpret_cast<const char*>(&wave), 4)
+			.write(reinterpret_cast<const char*>(&fmt), 4).write(reinterpret_cast<const char*>(&formatSize), 4)
+			.write(reinterpret_cast<const char*>(&waveFormat), formatSize)
+			.write(reinterpret_cast<const char*>(&dataTag), 4).write(reinterpret_cast<const char*>(&dataSize), 4)
+			.write(data.data(), data.size());
+		return static_cast<bool>(file);
+	}
+
+	double SecondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void BenchmarkLoadFile(BenchmarkRunner& runner, const std::filesystem::path& directory, std::vector<std::string>& createdFiles)
+	{
+		for (unsigned int seconds : { 1u, 10u, 60u })
+		{
+			MYWAVEFORMATEX waveFormat;
+			std::vector<char> data;
+			CreateTestSignal(waveFormat, data, seconds);
+			const std::string path = (directory / ("benchmark_" + std::to_string(seconds) + "s.wav")).string();
+			if (!WriteWaveFile(path, waveFormat, data))
+				continue;
+			createdFiles.push_back(path);
+
+			runner.Run("SoundFile::LoadFile", { { "seconds", std::to_string(seconds) } }, data.size(), [&]()
+			{
+				SoundFile soundFile;
+				return soundFile.LoadFile(path);
+			});
+		}
+	}
+
+	void BenchmarkGetDividedData(BenchmarkRunner& runner, const std::string& path)
+	{
+		if (!runner.IsSelected("Sound::GetDividedData"))
+			return;
+
+		Sound sound(path, false);
+		const size_t size = sound.GetSoundFile().GetSoundData().size();
+		runner.Run("Sound::GetDividedData", { { "chunk", std::to_string(FRAME_SIZE) } }, size, [&]()
+		{
+			std::deque<std::vector<char>> dividedData;
+			int bytesPerSecond = 0;
+			sound.GetDividedData(dividedData, FRAME_SIZE, &bytesPerSecond);
+			return !dividedData.empty();
+		});
+	}
+
+	void BenchmarkFormatConversion(BenchmarkRunner& runner, const MYWAVEFORMATEX& waveFormat)
+	{
+		std::vector<char> trailer = Sound::ConvertMyWaveFormatToData(waveFormat);
+		volatile size_t sink = 0;
+		runner.Run("Sound::ConvertMyWaveFormatToData", {}, sizeof(MYWAVEFORMATEX), [&]()
+		{
+			sink = sink + Sound::ConvertMyWaveFormatToData(waveFormat).size();
+			return true;
+		});
+		runner.Run("Sound::ConvertDataToFormat", {}, sizeof(MYWAVEFORMATEX), [&]()
+		{
+			sink = sink + Sound::ConvertDataToFormat(trailer).nSamplesPerSec;
+			return true;
+		});
+	}
+
+	void BenchmarkLosslessCodec(BenchmarkRunner& runner, const std::vector<char>& data, const MYWAVEFORMATEX& waveFormat)
+	{
+		if (!LosslessCodec::CanEncode(waveFormat))
+			return;
+
+		const size_t inputSize = LosslessCodec::GetFrameInputSize(FRAME_SIZE, waveFormat);
+		const MYWAVEFORMATEX encodedFormat = LosslessCodec::GetEncodedFormat(waveFormat);
+		std::vector<std::vector<char>> frames;
+		size_t encodedBytes = 0;
+		BenchmarkResult* encode = runner.Run("LosslessCodec::EncodeFrame", { { "frame", std::to_string(FRAME_SIZE) } }, data.size(), [&]()
+		{
+			frames.clear();
+			encodedBytes = 0;
+			for (size_t position = 0; position < data.size(); position += inputSize)
+			{
+				frames.emplace_back();
+				LosslessCodec::EncodeFrame(data.data() + position, std::min(inputSize, data.size() - position), waveFormat, frames.back());
+				encodedBytes += frames.back().size();
+			}
+			return true;
+		});
+		if (encode && encodedBytes)
+			encode->counters.emplace_back("ratio", double(data.size()) / encodedBytes);
+
+		if (frames.empty())
+			return;
+		bool exact = true;
+		std::vector<char> decoded;
+		BenchmarkResult* decode = runner.Run("LosslessCodec::DecodeFrame", { { "frame", std::to_string(FRAME_SIZE) } }, data.size(), [&]()
+		{
+			size_t position = 0;
+			for (const auto& frame : frames)
+			{
+				exact = LosslessCodec::DecodeFrame(frame.data(), frame.size(), encodedFormat, decoded)
+					&& std::memcmp(decoded.data(), data.data() + position, decoded.size()) == 0 && exact;
+				position += decoded.size();
+			}
+			exact = exact && position == data.size();
+			return true;
+		});
+		if (decode)
+			decode->counters.emplace_back("exact", exact ? 1.0 : 0.0);
+	}
+
+	void BenchmarkLoopback(BenchmarkRunner& runner, double minSeconds)
+	{
+		const std::string name = "SocketCreator::Send+Receive";
+		if (!runner.IsSelected(name))
+			return;
+
+		LoopbackEndpoint server(true);
+		if (!server.Listen())
+			return;
+		SOCKET accepted = INVALID_SOCKET;
+		std::thread acceptor([&]() { accepted = server.Accept(); });
+		LoopbackEndpoint client(false);
+		acceptor.join();
+		if (accepted == INVALID_SOCKET)
+			return;
+
+		// the sender streams whole wire frames, the receiver drains them the way the client does
+		const unsigned long long frames = std::max(1000ull, static_cast<unsigned long long>(minSeconds * 200000));
+		const std::vector<char> frame(WIRE_FRAME_SIZE, 1);
+		const auto start = std::chrono::steady_clock::now();
+		std::thread sender([&]()
+		{
+			for (unsigned long long i = 0; i < frames; i++)
+			{
+				if (server.Send(accepted, frame.data(), static_cast<int>(frame.size())) <= 0)
+					break;
+			}
+		});
+
+		unsigned long long received = 0;
+		while (received < frames * frame.size())
+		{
+			const int result = client.Receive(client.GetSocket(), sizeof(MYWAVEFORMATEX), [&](void*, int size) { received += size; });
+			if (result <= 0)
+				break;
+		}
+		const double seconds = SecondsSince(start);
+		sender.join();
+		closesocket(accepted);
+		client.CloseSocket();
+		server.CloseSocket();
+		runner.Record(name, { { "frame", std::to_string(frame.size()) } }, received / frame.size(), seconds, frame.size());
+	}
+
+	void BenchmarkQueueAndPlayData(BenchmarkRunner& runner, const MYWAVEFORMATEX& waveFormat, const std::vector<char>& data)
+	{
+		const std::string name = "CSoundController::QueueAndPlayData";
+		if (!runner.IsSelected(name))
+			return;
+
+		// the client queues a quarter second per buffer; every streaming sound owns MAX_BUFFERS_FOR_QUEUE
+		// buffers and a playing device frees them only in real time, so each batch gets a fresh sound
+		const size_t chunk = std::min<size_t>(waveFormat.nAvgBytesPerSec / 4, data.size()) / waveFormat.nBlockAlign * waveFormat.nBlockAlign;
+		std::vector<char> buffer(data.begin(), data.begin() + chunk);
+
+		unsigned long long calls = 0;
+		double seconds = 0.0;
+		for (int batch = 0; batch < 5; batch++)
+		{
+			Sound sound(true);
+			const auto start = std::chrono::steady_clock::now();
+			for (unsigned int i = 0; i < STREAMING_BUFFERS_PER_BATCH; i++)
+				sound.PlayWithRowData(buffer.data(), static_cast<long>(buffer.size()), waveFormat);
+			seconds += SecondsSince(start);
+			calls += STREAMING_BUFFERS_PER_BATCH;
+		}
+
+		runner.Record(name, { { "chunk", std::to_string(chunk) } }, calls, seconds, chunk);
+	}
+
+	void BenchmarkSyncedPlayout(BenchmarkRunner& runner, double minSeconds)
+	{
+		const std::string name = "SyncedPlayout::Loopback";
+		if (!runner.IsSelected(name))
+			return;
+
+		// runs in real time: four rooms joining 0.7 s apart, then the rest of the run is measured
+		constexpr unsigned int CLIENTS = 4;
+		constexpr unsigned int DELAY = 500;
+		const SyncHarnessResult result = RunSyncHarness(CLIENTS, std::max(10.0, minSeconds * 20), DELAY);
+		if (!result.blocks)
+			return;
+		BenchmarkResult* sync = runner.Record(name, { { "clients", std::to_string(CLIENTS) }, { "delay", std::to_string(DELAY) } },
+			result.blocks, result.seconds, 0);
+		if (!sync)
+			return;
+		sync->counters.emplace_back("spread_p50_us", result.spreadP50);
+		sync->counters.emplace_back("spread_p99_us", result.spreadP99);
+		sync->counters.emplace_back("spread_max_us", result.spreadMax);
+		sync->counters.emplace_back("error_mean_us", result.errorMean);
+		sync->counters.emplace_back("clock_error_max_us", result.clockErrorMax);
+	}
+}
+
+// Benchmark [--json <file|->] [--label <text>] [--filter <name part>] [--min-time <seconds>] [--device] [wave file]
+int main(int argc, char* argv[])
+{
+	std::string jsonPath;
+	std::string label;
+	std::string filter;
+	std::string wavePath;
+	double minSeconds = 0.5;
+	bool realDevice = false;
+	for (int arg = 1; arg < argc; arg++)
+	{
+		const std::string option = argv[arg];
+		if (option == "--json" && arg + 1 < argc)
+			jsonPath = argv[++arg];
+		else if (option == "--label" && arg + 1 < argc)
+			label = argv[++arg];
+		else if (option == "--filter" && arg + 1 < argc)
+			filter = argv[++arg];
+		else if (option == "--min-time" && arg + 1 < argc)
+			minSeconds = std::atof(argv[++arg]);
+		else if (option == "--device")
+			realDevice = true;
+		else
+			wavePath = option;
+	}
+
+	// OpenAL Soft's null backend mixes without a sound card, so runs are comparable between machines
+	if (!realDevice)
+		_putenv_s("ALSOFT_DRIVERS", "null");
+
+	MYWAVEFORMATEX waveFormat;
+	std::vector<char> data;
+	SoundFile soundFile;
+	if (!wavePath.empty() && soundFile.LoadFile(wavePath))
+	{
+		waveFormat = soundFile.GetWaveFormat();
+		data.assign(soundFile.GetSoundData().begin(), soundFile.GetSoundData().end());
+	}
+	else
+	{
+		CreateTestSignal(waveFormat, data, 10);
+	}
+
+	const std::filesystem::path directory = std::filesystem::temp_directory_path();
+	const std::string signalPath = (directory / "benchmark_signal.wav").string();
+	std::vector<std::string> createdFiles;
+	if (WriteWaveFile(signalPath, waveFormat, data))
+		createdFiles.push_back(signalPath);
+
+	BenchmarkRunner runner(filter, minSeconds, 1000000);
+	BenchmarkLoadFile(runner, directory, createdFiles);
+	BenchmarkGetDividedData(runner, signalPath);
+	BenchmarkFormatConversion(runner, waveFormat);
+	BenchmarkLosslessCodec(runner, data, waveFormat);
+	BenchmarkLoopback(runner, minSeconds);
+	BenchmarkQueueAndPlayData(runner, waveFormat, data);
+	BenchmarkSyncedPlayout(runner, minSeconds);
+
+	runner.PrintTable(jsonPath == "-" ? std::cerr : std::cout);
+	if (jsonPath == "-")
+	{
+		runner.PrintJson(std::cout, label);
+	}
+	else if (!jsonPath.empty())
+	{
+		std::ofstream json(jsonPath, std::ios::trunc);
+		runner.PrintJson(json, label);
+	}
+
+	std::error_code error;
+	for (const auto& path : createdFiles)
+		std::filesystem::remove(path, error);
+}
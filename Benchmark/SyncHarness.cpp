@@ -0,0 +1,342 @@
+#include "SyncHarness.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "../OpenAL/Sound.h"
+#include "../OpenAL/SyncedPlayout.h"
+#include "../SocketsClientServer/ClockSync.h"
+#include "../SocketsClientServer/SocketCreator.h"
+#include "../SocketsClientServer/StreamClock.h"
+
+namespace
+{
+	constexpr unsigned int SAMPLE_RATE = 48000;
+	constexpr unsigned int FRAME_SAMPLES = SAMPLE_RATE / 50;           // 20 ms frames
+	constexpr unsigned int RENDER_FRAMES = SAMPLE_RATE / 100;          // 10 ms blocks
+	constexpr int RAMP_PERIOD = 32000;                                 // positions are told apart within a third of a second
+	constexpr long long STATION_CLOCK_SKEW = 37123456;                 // microseconds the station clock is ahead
+	constexpr long long STATION_LEAD = 100000;                         // microseconds the station sends ahead of the live edge
+	constexpr long long STATION_JITTER = 10000;                        // microseconds a send wanders, like packets on a network
+	// the device clock counts the frames mixed; the next frame goes out with the next block and is heard
+	// a block after that, see the render loop
+	constexpr long long LOOPBACK_LATENCY = 2000000000ll * RENDER_FRAMES / SAMPLE_RATE;
+	constexpr unsigned int JOIN_INTERVAL = 700;                        // miliseconds between two clients joining
+
+	class Endpoint : public SocketCreator
+	{
+	public:
+		explicit Endpoint(bool isServer) : SocketCreator(isServer) {}
+		bool Listen() { return listen(mainSocket, SOMAXCONN) != SOCKET_ERROR; }
+		SOCKET Accept()
+		{
+			const SOCKET socket = accept(mainSocket, nullptr, nullptr);
+			if (socket != INVALID_SOCKET)
+				SetNoDelay(socket);
+			return socket;
+		}
+		SOCKET GetSocket() const noexcept { return mainSocket; }
+	};
+
+	long long GetLocalTime()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	long long GetStationTime()
+	{
+		return GetLocalTime() + STATION_CLOCK_SKEW;
+	}
+
+	int16_t GetRampValue(long long position)
+	{
+		return static_cast<int16_t>(1 + position % RAMP_PERIOD);
+	}
+
+	// Distance of two ramp positions, the shorter way round.
+	long long GetRampDistance(long long from, long long to)
+	{
+		return ((to - from) % RAMP_PERIOD + RAMP_PERIOD + RAMP_PERIOD / 2) % RAMP_PERIOD - RAMP_PERIOD / 2;
+	}
+
+	MYWAVEFORMATEX GetRampFormat()
+	{
+		MYWAVEFORMATEX waveFormat{};
+		waveFormat.wFormatTag = WAVE_FORMAT_PCM;
+		waveFormat.nChannels = 2;
+		waveFormat.nSamplesPerSec = SAMPLE_RATE;
+		waveFormat.wBitsPerSample = 16;
+		waveFormat.nBlockAlign = 4;
+		waveFormat.nAvgBytesPerSec = SAMPLE_RATE * 4;
+		return waveFormat;
+	}
+
+	class Station
+	{
+	public:
+		explicit Station(Endpoint& endpoint) : m_endpoint(endpoint), m_streamStart(GetStationTime()) {}
+
+		long long GetStreamStart() const noexcept { return m_streamStart; }
+
+		void Accept(unsigned int clients, const std::atomic<bool>& stopping)
+		{
+			for (unsigned int i = 0; i < clients && !stopping; i++)
+			{
+				const SOCKET socket = m_endpoint.Accept();
+				if (socket == INVALID_SOCKET)
+					return;
+				std::lock_guard<std::mutex> guardLock(m_lock);
+				m_sockets.push_back(socket);
+				m_readers.emplace_back(&Station::Read, this, socket);
+			}
+		}
+
+		// Sends a frame per FRAME_SAMPLES on the server's stream clock, answers clock requests between frames.
+		void Stream(const std::atomic<bool>& stopping)
+		{
+			StreamClock clock(m_streamStart);
+			const MYWAVEFORMATEX waveFormat = GetRampFormat();
+			const std::vector<char> trailer = Sound::ConvertMyWaveFormatToData(waveFormat);
+			std::vector<char> frame(FRAME_SAMPLES * waveFormat.nBlockAlign + trailer.size());
+			StreamPacketHeader header{ STREAM_PACKET_MAGIC, static_cast<uint32_t>(frame.size()), static_cast<uint16_t>(PacketType::Audio), 0, 0, 20, 0 };
+			// without the jitter the clients would read the device clocks in the same phase of every render
+			// block, on a real network the arrivals wander
+			std::mt19937 random(SAMPLE_RATE);
+			std::uniform_int_distribution<long long> jitter(0, STATION_JITTER);
+			for (long long position = 0; !stopping; position += FRAME_SAMPLES)
+			{
+				const long long sendTime = static_cast<long long>(clock.GetSendTime(STATION_LEAD)) + jitter(random);
+				std::this_thread::sleep_for(std::chrono::microseconds(std::max(0ll, sendTime - GetStationTime())));
+
+				int16_t* samples = reinterpret_cast<int16_t*>(frame.data());
+				for (unsigned int i = 0; i < FRAME_SAMPLES; i++)
+					samples[2 * i] = samples[2 * i + 1] = GetRampValue(position + i);
+				std::copy(trailer.begin(), trailer.end(), frame.end() - trailer.size());
+				header.timestamp = clock.GetLiveEdge();
+
+				std::vector<SOCKET> sockets;
+				std::vector<std::pair<SOCKET, ClockExchange>> requests;
+				{
+					std::lock_guard<std::mutex> guardLock(m_lock);
+					sockets = m_sockets;
+					requests.swap(m_requests);
+				}
+				for (SOCKET socket : sockets)
+					m_endpoint.SendPacket(socket, header, frame.data(), static_cast<int>(frame.size()));
+				for (auto& request : requests)
+				{
+					const StreamPacketHeader response{ STREAM_PACKET_MAGIC, sizeof(ClockExchange), static_cast<uint16_t>(PacketType::ClockResponse), 0, 0, 0, 0 };
+					request.second.transmit = static_cast<uint64_t>(GetStationTime());
+					m_endpoint.SendPacket(request.first, response, &request.second, sizeof(request.second));
+				}
+				header.sequence++;
+				clock.Advance(FRAME_SAMPLES, SAMPLE_RATE);
+			}
+		}
+
+		// Closing the sockets ends the clients and the readers.
+		void Close()
+		{
+			std::vector<std::thread> readers;
+			{
+				std::lock_guard<std::mutex> guardLock(m_lock);
+				for (SOCKET socket : m_sockets)
+					closesocket(socket);
+				readers.swap(m_readers);
+			}
+			for (std::thread& reader : readers)
+				reader.join();
+		}
+
+	private:
+		void Read(SOCKET socket)
+		{
+			PacketAssembler assembler;
+			StreamPacketHeader header;
+			const char* payload = nullptr;
+			char buffer[512];
+			int size = 0;
+			while ((size = recv(socket, buffer, sizeof(buffer), 0)) > 0)
+			{
+				const long long received = GetStationTime();
+				assembler.Append(buffer, size);
+				while (assembler.Next(header, payload))
+				{
+					if (header.type != static_cast<uint16_t>(PacketType::ClockRequest) || header.size != sizeof(ClockExchange))
+						continue;
+					ClockExchange request;
+					std::memcpy(&request, payload, sizeof(request));
+					request.receive = static_cast<uint64_t>(received);
+					std::lock_guard<std::mutex> guardLock(m_lock);
+					m_requests.emplace_back(socket, request);
+				}
+			}
+		}
+
+		Endpoint& m_endpoint;
+		long long m_streamStart;
+		std::mutex m_lock;
+		std::vector<SOCKET> m_sockets;
+		std::vector<std::thread> m_readers;
+		std::vector<std::pair<SOCKET, ClockExchange>> m_requests;
+	};
+
+	// One room: receives the station, keeps its clock and plays on its own loopback device.
+	void RunClient(const PlayoutDevice& device, unsigned int delay, std::atomic<long long>& clockError)
+	{
+		Endpoint endpoint(false);
+		if (!device.MakeCurrent())
+			return;
+
+		ClockSync clock;
+		SyncedPlayout playout(device, delay);
+		PacketAssembler assembler;
+		StreamPacketHeader header;
+		const char* packet = nullptr;
+		while (true)
+		{
+			const int result = endpoint.Receive(endpoint.GetSocket(), 0, [&](void* received, int size)
+			{
+				assembler.Append(static_cast<const char*>(received), size);
+			});
+			const long long received = GetLocalTime();
+			if (result <= 0 || assembler.IsCorrupt())
+				break;
+
+			while (assembler.Next(header, packet))
+			{
+				if (header.type == static_cast<uint16_t>(PacketType::Audio) && header.size > sizeof(MYWAVEFORMATEX))
+				{
+					const size_t size = header.size - sizeof(MYWAVEFORMATEX);
+					std::vector<char> trailer(packet + size, packet + header.size);
+					playout.Queue(packet, size, Sound::ConvertDataToFormat(trailer), header.timestamp);
+				}
+				else if (header.type == static_cast<uint16_t>(PacketType::ClockResponse) && header.size == sizeof(ClockExchange))
+				{
+					ClockExchange response;
+					std::memcpy(&response, packet, sizeof(response));
+					if (!clock.OnResponse(response, received))
+						continue;
+					playout.SetClockOffset(clock.GetOffset());
+					const long long error = std::abs(clock.GetOffset() + STATION_CLOCK_SKEW);
+					long long worst = clockError;
+					while (error > worst && !clockError.compare_exchange_weak(worst, error))
+						;
+				}
+			}
+
+			ClockExchange request;
+			if (clock.NextRequest(GetLocalTime(), request))
+			{
+				const StreamPacketHeader requestHeader{ STREAM_PACKET_MAGIC, sizeof(request), static_cast<uint16_t>(PacketType::ClockRequest), 0, 0, 0, 0 };
+				endpoint.SendPacket(endpoint.GetSocket(), requestHeader, &request, sizeof(request));
+			}
+			playout.Update();
+		}
+		endpoint.CloseSocket();
+	}
+
+	double GetPercentile(const std::vector<double>& sorted, double percentile)
+	{
+		if (sorted.empty())
+			return 0.0;
+		return sorted[std::min(sorted.size() - 1, static_cast<size_t>(percentile * sorted.size()))];
+	}
+}
+
+
+
+SyncHarnessResult RunSyncHarness(unsigned int clients, double seconds, unsigned int delay)
+{
+	SyncHarnessResult result;
+	result.clients = clients;
+
+	std::vector<std::unique_ptr<PlayoutDevice>> devices;
+	for (unsigned int i = 0; i < clients; i++)
+	{
+		devices.push_back(std::make_unique<PlayoutDevice>(SAMPLE_RATE, LOOPBACK_LATENCY));
+		if (!devices.back()->IsOpen())
+			return result;
+	}
+
+	Endpoint server(true);
+	if (!server.Listen())
+		return result;
+
+	std::atomic<bool> stopping = false;
+	std::atomic<long long> clockError = 0;
+	Station station(server);
+	std::thread acceptor(&Station::Accept, &station, clients, std::cref(stopping));
+	std::thread streamer(&Station::Stream, &station, std::cref(stopping));
+	std::vector<std::thread> rooms;
+	for (unsigned int i = 0; i < clients; i++)
+	{
+		rooms.emplace_back([&, i]()
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(i * JOIN_INTERVAL));
+			if (!stopping)
+				RunClient(*devices[i], delay, clockError);
+		});
+	}
+
+	// the devices are rendered in lockstep; a loopback device works like a sound card with one block of
+	// buffer, a block is heard from the moment the next one is asked for
+	const auto start = std::chrono::steady_clock::now();
+	const std::chrono::microseconds block(1000000ll * RENDER_FRAMES / SAMPLE_RATE);
+	const auto measureFrom = start + std::chrono::milliseconds((clients - 1) * JOIN_INTERVAL + delay + 1000);
+	const auto end = start + std::chrono::microseconds(static_cast<long long>(seconds * 1000000));
+	std::vector<float> samples(RENDER_FRAMES * 2);
+	std::vector<long long> positions(clients);
+	std::vector<double> spreads;
+	double errors = 0.0;
+	for (auto tick = start; tick < end; tick += block)
+	{
+		std::this_thread::sleep_until(tick);
+		bool playing = true;
+		for (unsigned int i = 0; i < clients; i++)
+		{
+			devices[i]->Render(samples.data(), RENDER_FRAMES);
+			positions[i] = std::lround(samples[0] * 32768.0f) - 1;
+			playing = playing && positions[i] >= 0;
+		}
+		if (!playing || tick < measureFrom)
+			continue;
+
+		const long long heard = std::chrono::duration_cast<std::chrono::microseconds>((tick + block).time_since_epoch()).count();
+		const long long scheduled = (heard + STATION_CLOCK_SKEW - delay * 1000ll - station.GetStreamStart()) * SAMPLE_RATE / 1000000;
+		long long earliest = 0;
+		long long latest = 0;
+		for (unsigned int i = 0; i < clients; i++)
+		{
+			const long long distance = GetRampDistance(positions[0], positions[i]);
+			earliest = std::min(earliest, distance);
+			latest = std::max(latest, distance);
+			errors += std::abs(GetRampDistance(positions[i], scheduled)) * 1000000.0 / SAMPLE_RATE;
+		}
+		spreads.push_back((latest - earliest) * 1000000.0 / SAMPLE_RATE);
+	}
+
+	stopping = true;
+	streamer.join();
+	server.CloseSocket();
+	acceptor.join();
+	station.Close();
+	for (std::thread& room : rooms)
+		room.join();
+
+	std::sort(spreads.begin(), spreads.end());
+	result.blocks = spreads.size();
+	result.seconds = spreads.size() * RENDER_FRAMES / static_cast<double>(SAMPLE_RATE);
+	result.spreadP50 = GetPercentile(spreads, 0.5);
+	result.spreadP99 = GetPercentile(spreads, 0.99);
+	result.spreadMax = spreads.empty() ? 0.0 : spreads.back();
+	result.errorMean = spreads.empty() ? 0.0 : errors / (spreads.size() * clients);
+	result.clockErrorMax = static_cast<double>(clockError);
+	return result;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+struct SyncHarnessResult
+{
+	unsigned int clients = 0;
+	unsigned long long blocks = 0;      // rendered blocks in which every client played
+	double seconds = 0.0;
+	double spreadP50 = 0.0;             // microseconds between the earliest and the latest client in a block
+	double spreadP99 = 0.0;
+	double spreadMax = 0.0;
+	double errorMean = 0.0;             // microseconds the clients are off the schedule, mean of the absolute values
+	double clockErrorMax = 0.0;         // microseconds the worst clock offset estimate was off
+};
+
+// A station and several synchronized clients in one process, talking over loopback TCP. The station
+// runs on a clock of its own and sends a ramp, every sample holds its position in the stream. Each
+// client estimates the station clock with ClockSync and plays through SyncedPlayout on a loopback
+// device; the clients join one after the other. All devices are rendered side by side in real time,
+// the positions they put out in the same block show how far apart the rooms would hear the station.
+SyncHarnessResult RunSyncHarness(unsigned int clients, double seconds, unsigned int delay);
@@ -1,6 +1,15 @@
 #include "ClientSideApplication.h"
+#include "../OpenAL/AdpcmEncoder.h"
+#include "../SocketsClientServer/EventLoop.h"
+#include <cmath>
+#include <cstring>
+#include <sstream>
 
-ClientSideApplication::ClientSideApplication() : SocketCreator(false)
+ClientSideApplication::ClientSideApplication(unsigned int syncDelay, int port) :
+    SocketCreator(false, port),
+    m_metricsExporter(std::string(METRICS_SEGMENT) + "-" + std::to_string(GetCurrentProcessId())),
+    m_syncDelay(syncDelay),
+    m_nextControlId(1)
 {
 
 }
@@ -9,53 +18,391 @@ ClientSideApplication::ClientSideApplication() : SocketCreator(false)
 
 void ClientSideApplication::ListenForMessage()
 {
-    std::shared_ptr<Sound> sound = std::make_shared<Sound>(false);
     bool firstTimePlay = false;
-    unsigned long long memoryUsed = 0;
+    static const MetricCounter playedBytes("client.played.bytes");
+    static const MetricCounter packets("client.packets");
+    static const MetricCounter decodeErrors("client.decode.errors");
+    static const MetricGauge clockOffset("client.clock.offset_us");
+    static const MetricGauge syncError("client.sync.error_us");
+    static const MetricGauge driftEstimate("client.drift.estimate_ppm");
+    static const MetricGauge driftCorrection("client.drift.correction_ppm");
     std::vector<char> dataToPlay;
-    while (true)
+    PlayoutTelemetry telemetry;
+
+    // the server paces the stream on its clock and the sound card plays it on another, the resampler
+    // keeps the buffer from growing or draining over a long session; SyncedPlayout corrects by itself
+    DriftEstimator drift;
+    DriftResampler resampler;
+    std::vector<char> resampled;
+    MYWAVEFORMATEX playingFormat{};
+    MYWAVEFORMATEX pendingFormat{};            // of dataToPlay
+
+    // synchronized playback runs on a device of its own, the controller restarts stopped sources by
+    // itself, which would throw the schedule off
+    std::unique_ptr<PlayoutDevice> device;
+    std::unique_ptr<SyncedPlayout> synced;
+    if (m_syncDelay)
+    {
+        device = std::make_unique<PlayoutDevice>();
+        if (device->IsOpen() && device->MakeCurrent())
+        {
+            synced = std::make_unique<SyncedPlayout>(*device, m_syncDelay);
+            synced->SetQueuedCallback([&telemetry](unsigned long long sampleFrames, unsigned int sampleRate, unsigned long long edge)
+                {
+                    telemetry.OnQueued(sampleFrames, sampleRate, edge);
+                });
+        }
+        else
+        {
+            std::cout << "SYNCED PLAYBACK UNAVAILABLE" << std::endl;
+        }
+    }
+
+    std::shared_ptr<Sound> sound;
+    if (!synced)
     {
-       
-        int result = Receive(mainSocket, 18, [&](void* object, int size)
+        sound = std::make_shared<Sound>(false);
+        const ALuint source = sound->GetSoundInfo().source;
+        CSoundController::Get().RegisterSoundStatusChangeCallback([&telemetry, source](uint object, ISoundController::StatusChange status)
+            {
+                if (object == source && status == ISoundController::StatusChange::Stopped)
+                    telemetry.OnStopped();
+            });
+    }
+    auto queue = [&](const MYWAVEFORMATEX& format)
+        {
+            // a new format is a new stream to the resampler, the depth it settles at is taken anew
+            if (playingFormat.nAvgBytesPerSec && (format.nSamplesPerSec != playingFormat.nSamplesPerSec || format.nBlockAlign != playingFormat.nBlockAlign))
+                drift.Reset();
+            std::vector<char>* played = &dataToPlay;
+            if (DriftResampler::CanResample(format))
+            {
+                resampled.clear();
+                resampler.SetRatio(drift.GetRatio());
+                resampler.Process(dataToPlay.data(), dataToPlay.size(), format, resampled);
+                played = &resampled;
+            }
+            sound->PlayWithRowData(played->data(), played->size(), format);
+            const unsigned int samplesPerBlock = AdpcmEncoder::GetSamplesPerBlock(format);
+            if (format.nBlockAlign)
+                telemetry.OnQueued(played->size() / format.nBlockAlign * (samplesPerBlock ? samplesPerBlock : 1), format.nSamplesPerSec);
+            playedBytes.Add(dataToPlay.size());
+            playingFormat = format;
+            dataToPlay.clear();
+        };
+    auto playPacket = [&](const char* object, int size, unsigned long long timestamp)
+        {
+            if (size < 18)
+                return;
+            std::vector<char> data, format;
+            data = std::vector<char>((char*)object, (char*)object + size - 18);
+            format = std::vector<char>((char*)object + size - 18, (char*)object + size);
+            auto newFormat = Sound::ConvertDataToFormat(format);
+            if (newFormat.wFormatTag == WAVE_FORMAT_LOSSLESS_RICE)
             {
-                std::vector<char> data, format;
-                data = std::vector<char>((char*)object, (char*)object + size - 18);
-                format = std::vector<char>((char*)object + size - 18, (char*)object + size);
-                auto newFormat = Sound::ConvertDataToFormat(format);
-                if (!firstTimePlay)
+                std::vector<char> decoded;
+                if (!LosslessCodec::DecodeFrame(data.data(), data.size(), newFormat, decoded))
                 {
-                    dataToPlay.insert(dataToPlay.end(), data.begin(), data.end());
-                    if (dataToPlay.size() >= newFormat.nAvgBytesPerSec * 2)
+                    decodeErrors.Add();
+                    return;
+                }
+                data.swap(decoded);
+                newFormat = LosslessCodec::GetDecodedFormat(newFormat);
+            }
+            if (synced)
+            {
+                synced->Queue(data.data(), data.size(), newFormat, timestamp);
+                playedBytes.Add(data.size());
+                return;
+            }
+            if (!firstTimePlay)
+            {
+                dataToPlay.insert(dataToPlay.end(), data.begin(), data.end());
+                if (dataToPlay.size() >= newFormat.nAvgBytesPerSec * 2)
+                {
+                    queue(newFormat);
+                    sound->PlaySource();
+                    firstTimePlay = true;
+                }
+            }
+            else
+            {
+                // queued by the refill, once the sound card is done with a buffer
+                dataToPlay.insert(dataToPlay.end(), data.begin(), data.end());
+                pendingFormat = newFormat;
+            }
+        };
+
+    // a lost connection is resumed under the session's token, the server sends what was missed meanwhile
+    uint64_t session = 0;
+    uint32_t lastSequence = 0;
+    bool played = false;
+    ResumeBuffer resume;
+    const ResumeBuffer::Play playAudio = [&](const StreamPacketHeader& audio, const char* payload)
+        {
+            telemetry.OnPacket(audio);
+            playPacket(payload, static_cast<int>(audio.size), audio.timestamp);
+            lastSequence = audio.sequence;
+            played = true;
+        };
+
+    // a server of a cluster sends subscriptions to stations of other members there
+    std::string redirectTo;
+    ControlRequest redirected{};
+    unsigned int redirects = 0;
+
+    // the receiving and the refilling take turns on this thread: the stream is read once the socket has
+    // data, the source is refilled as OpenAL reports the buffers it finished (AL_SOFT_events), without
+    // those every REFILL_INTERVAL once a quarter second is pending
+    EventLoop loop;
+    EventLoop::Signal buffersCompleted(loop);
+    bool listening = true;
+    if (sound)
+    {
+        const ALuint source = sound->GetSoundInfo().source;
+        CSoundController::Get().RegisterBufferCompletedCallback([&buffersCompleted, source](uint object, uint buffers)
+            {
+                if (object == source)
+                    buffersCompleted.Raise(buffers);
+            });
+    }
+    auto refill = [&]() -> Task<>
+        {
+            while (listening)
+            {
+                const unsigned int completed = co_await buffersCompleted.Wait(REFILL_INTERVAL);
+                if (!firstTimePlay || dataToPlay.empty())
+                    continue;
+                if (completed || dataToPlay.size() >= pendingFormat.nAvgBytesPerSec / 4)
+                    queue(pendingFormat);
+            }
+            loop.Stop();
+        };
+
+    auto receive = [&]() -> Task<>
+        {
+            PacketAssembler assembler;
+            StreamPacketHeader header;
+            const char* packet = nullptr;
+            while (true)
+            {
+                // the socket stays blocking for the console's sends, the recv after it is ready returns right away
+                if (mainSocket != INVALID_SOCKET)
+                    co_await loop.Ready(mainSocket, POLLRDNORM);
+                int result = Receive(mainSocket, 0, [&](void* received, int receivedSize)
+                    {
+                        assembler.Append((const char*)received, receivedSize);
+                    });
+                const long long received = GetLocalTime();
+                if (result <= 0 || assembler.IsCorrupt())
+                {
+                    if (result < 0)
+                    {
+                        // Receive closed it already, the handle may be given out again
+                        std::lock_guard<std::mutex> guardLock(lock);
+                        mainSocket = INVALID_SOCKET;
+                    }
+                    // what is queued for the sound card plays on meanwhile, the refill waits until the stream is back
+                    if (firstTimePlay && !dataToPlay.empty())
+                        queue(pendingFormat);
+                    if (!session || !played || !ResumeSession(session, lastSequence))
+                        break;
+                    assembler.Reset();
+                    m_clock = ClockSync();
+                    resume.Start(lastSequence);
+                    continue;
+                }
+
+                while (assembler.Next(header, packet))
+                {
+                    packets.Add();
+                    if (header.type == static_cast<uint16_t>(PacketType::Audio))
+                    {
+                        if (resume.IsActive())
+                            resume.Push(header, packet, playAudio);
+                        else
+                            playAudio(header, packet);
+                    }
+                    else if (header.type == static_cast<uint16_t>(PacketType::Session) && header.size == sizeof(SessionInfo))
+                    {
+                        SessionInfo info;
+                        std::memcpy(&info, packet, sizeof(info));
+                        if (info.flags & (SESSION_RESUMED | SESSION_UNKNOWN))
+                        {
+                            std::cout << ((info.flags & SESSION_RESUMED) ? "SESSION RESUMED" : "SESSION EXPIRED") << std::endl;
+                            resume.OnSession((info.flags & SESSION_RESUMED) != 0, info.sequence, info.count, playAudio);
+                            // the buffer drained while the connection was lost and refills with what is sent again
+                            drift.Reset();
+                        }
+                        session = info.token;
+                    }
+                    else if (header.type == static_cast<uint16_t>(PacketType::ClockResponse) && header.size == sizeof(ClockExchange))
                     {
-                        sound->PlayWithRowData(dataToPlay.data(), dataToPlay.size(), newFormat);
-                        sound->PlaySource();
-                        firstTimePlay = true;
-                        memoryUsed += dataToPlay.size();
-                        dataToPlay.clear();
+                        ClockExchange response;
+                        std::memcpy(&response, packet, sizeof(response));
+                        if (m_clock.OnResponse(response, received))
+                        {
+                            telemetry.SetClockOffset(m_clock.GetOffset());
+                            if (synced)
+                                synced->SetClockOffset(m_clock.GetOffset());
+                            clockOffset.Set(m_clock.GetOffset());
+                        }
+                    }
+                    else if (header.type == static_cast<uint16_t>(PacketType::ControlAck) && header.size >= sizeof(ControlAck))
+                    {
+                        ControlAck ack;
+                        std::memcpy(&ack, packet, sizeof(ack));
+                        const char* name = GetControlCommandName(static_cast<ControlCommand>(ack.command));
+                        std::cout << "ACK " << ack.id << " " << (name ? name : "?") << " " << GetControlStatusName(static_cast<ControlStatus>(ack.status))
+                            << " " << ack.position / 1000 << "/" << ack.duration / 1000 << "s" << ((ack.flags & CONTROL_ACK_PAUSED) ? " PAUSED" : "");
+                        if (header.size > sizeof(ack))
+                            std::cout << " " << std::string(packet + sizeof(ack), header.size - sizeof(ack));
+                        std::cout << std::endl;
+                        if (ack.status == static_cast<uint8_t>(ControlStatus::Redirect) && ack.command == static_cast<uint8_t>(ControlCommand::Subscribe) && header.size > sizeof(ack))
+                        {
+                            redirectTo.assign(packet + sizeof(ack), header.size - sizeof(ack));
+                            redirected = ControlRequest{ ack.id, ack.station, ack.command, 0, 0 };
+                        }
+                        else if (ack.status == static_cast<uint8_t>(ControlStatus::Ok))
+                        {
+                            redirects = 0;
+                        }
+                    }
+                    else if (header.type == static_cast<uint16_t>(PacketType::Metrics))
+                    {
+                        std::cout << std::string(packet, header.size) << std::endl;
                     }
                 }
-                else
+
+                if (!redirectTo.empty())
                 {
-                    dataToPlay.insert(dataToPlay.end(), data.begin(), data.end());
-                    if (dataToPlay.size() >= newFormat.nAvgBytesPerSec / 4)
+                    // the subscription goes to the owner under the same id, the stream of this server ends here
+                    std::string host;
+                    int port = PORT;
+                    bool connected = false;
+                    if (redirects++ < MAX_REDIRECTS && ParseEndpoint(redirectTo, host, port))
                     {
-                        sound->PlayWithRowData(dataToPlay.data(), dataToPlay.size(), newFormat);
-                        memoryUsed += dataToPlay.size();
-                        std::cout << memoryUsed << std::endl;
-                        dataToPlay.clear();
+                        std::lock_guard<std::mutex> guardLock(lock);
+                        connected = Reconnect(host, port);
+                    }
+                    std::cout << (connected ? "CONNECTED " : "REDIRECT FAILED ") << redirectTo << std::endl;
+                    redirectTo.clear();
+                    if (connected)
+                    {
+                        assembler.Reset();
+                        m_clock = ClockSync();
+                        SendToServer(PacketType::Control, &redirected, sizeof(redirected));
                     }
                 }
-            });
+
+                ClockExchange request;
+                if (m_clock.NextRequest(GetLocalTime(), request))
+                    SendToServer(PacketType::ClockRequest, &request, sizeof(request));
+                if (synced)
+                {
+                    synced->Update();
+                    syncError.Set(synced->GetError());
+                }
+
+                PlayoutReport report;
+                if (telemetry.Sample(synced ? synced->GetPlayout() : sound->GetPlayout(), report))
+                    SendToServer(PacketType::PlayoutReport, &report, sizeof(report));
+                if (!synced && telemetry.IsStarted() && playingFormat.nAvgBytesPerSec)
+                {
+                    const unsigned long long pending = dataToPlay.size() * 1000000ull / playingFormat.nAvgBytesPerSec;
+                    drift.OnDepth(GetLocalTime(), static_cast<long long>(telemetry.GetQueued() + pending));
+                    driftEstimate.Set(std::llround(drift.GetDrift()));
+                    driftCorrection.Set(std::llround(drift.GetCorrection()));
+                }
+            }
+            listening = false;
+            buffersCompleted.Raise();
+        };
+
+    loop.Spawn(receive());
+    loop.Spawn(refill());
+    loop.Run();
+    if (sound)
+    {
+        CSoundController::Get().RegisterBufferCompletedCallback(nullptr);
+        CSoundController::Get().RegisterSoundStatusChangeCallback(nullptr);
     }
 }
 
 void ClientSideApplication::Wait() noexcept
 {
     listener = std::thread(&ClientSideApplication::ListenForMessage, this);
-    while (true)
+    std::string line;
+    while (std::getline(std::cin, line))
     {
-        std::string message;
-        std::cin >> message;
-        Send(mainSocket, message.data(), message.size());
+        std::istringstream words(line);
+        std::string name;
+        if (!(words >> name))
+            continue;
+
+        ControlCommand command;
+        if (!FindControlCommand(name.c_str(), command))
+        {
+            // anything else goes to the server as text, METRICS_COMMAND among them
+            SendToServer(PacketType::Command, name.data(), static_cast<int>(name.size()));
+            continue;
+        }
+
+        // "subscribe 2" picks the station, "seek 90000" the miliseconds into the track
+        unsigned long long argument = 0;
+        words >> argument;
+        ControlRequest request{ m_nextControlId++, DEFAULT_STATION, static_cast<uint8_t>(command), 0, 0 };
+        if (command == ControlCommand::Subscribe || command == ControlCommand::Unsubscribe)
+            request.station = static_cast<uint16_t>(argument);
+        else
+            request.argument = argument;
+        SendToServer(PacketType::Control, &request, sizeof(request));
     }
+    listener.join();
+}
+
+
+
+int ClientSideApplication::SendToServer(PacketType type, const void* data, int size)
+{
+    const StreamPacketHeader header{ STREAM_PACKET_MAGIC, static_cast<uint32_t>(size), static_cast<uint16_t>(type), 0, 0, 0, 0 };
+    std::lock_guard<std::mutex> guardLock(lock);
+    return SendPacket(mainSocket, header, data, size);
+}
+
+
+
+bool ClientSideApplication::ResumeSession(uint64_t token, uint32_t sequence)
+{
+    static const MetricCounter resumes("client.session.resumes");
+
+    std::cout << "CONNECTION LOST" << std::endl;
+    const long long giveUp = GetLocalTime() + RESUME_TIMEOUT * 1000ll;
+    while (GetLocalTime() < giveUp)
+    {
+        bool connected = false;
+        {
+            std::lock_guard<std::mutex> guardLock(lock);
+            connected = Reconnect(GetAddress(), GetPort());
+        }
+        if (connected)
+        {
+            const ResumeRequest request{ token, sequence, 0 };
+            if (SendToServer(PacketType::Resume, &request, sizeof(request)) != -1)
+            {
+                resumes.Add();
+                std::cout << "RECONNECTED" << std::endl;
+                return true;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(RESUME_RETRY_DELAY));
+    }
+    return false;
+}
+
+
+
+long long ClientSideApplication::GetLocalTime()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
@@ -5,20 +5,51 @@
 #include <mutex>
 #include <thread>
 #include "../OpenAL/Sound.h"
+#include "../OpenAL/LosslessCodec.h"
 #include <WS2tcpip.h>
 #include <WinSock2.h>
 #include <functional>
 #include "../SocketsClientServer/SocketCreator.h"
+#include "../SocketsClientServer/Metrics.h"
+#include "../SocketsClientServer/ClockSync.h"
+#include "../OpenAL/SyncedPlayout.h"
+#include "../OpenAL/DriftResampler.h"
+#include "PlayoutTelemetry.h"
+#include "DriftEstimator.h"
+#include "ResumeBuffer.h"
 #pragma lib("SocketCreator.lib")
 
+constexpr const char* METRICS_SEGMENT = "SocketStreamingClient";
+
 class ClientSideApplication : public SocketCreator
 {
 public:
-	ClientSideApplication();
+	//-- syncDelay > 0 plays the stream that many miliseconds behind the live edge, in step with every
+	//-- other client doing the same (SyncedPlayout); 0 plays it as soon as the prebuffer is full.
+	//-- port picks the server on this machine, an origin or a relay.
+	explicit ClientSideApplication(unsigned int syncDelay = 0, int port = PORT);
 	virtual void ListenForMessage() final;
+	//-- Sends what is typed on the console: control commands (see GetControlCommandName) as
+	//-- ControlRequest, any other word as text.
 	void Wait() noexcept;
 private:
+	static constexpr unsigned int MAX_REDIRECTS = 3;   // in a row, members that disagree about the owner for a moment
+	static constexpr unsigned int RESUME_TIMEOUT = 10000;      // miliseconds, about as long as the server keeps a lost session
+	static constexpr unsigned int RESUME_RETRY_DELAY = 250;    // miliseconds between connection attempts
+	static constexpr unsigned int REFILL_INTERVAL = 250;       // miliseconds, how long the refill waits for OpenAL to report a buffer
+
+	//-- Sends one packet to the server, the listener thread and the console share the socket.
+	int SendToServer(PacketType type, const void* data, int size);
+	//-- Connects again after the connection was lost and asks the server to go on with the session from
+	//-- the frame after sequence, false when the server stayed out of reach.
+	bool ResumeSession(uint64_t token, uint32_t sequence);
+	static long long GetLocalTime();
+
 	std::mutex lock;
 	std::thread listener;
+	MetricsExporter m_metricsExporter;         // shared memory segment METRICS_SEGMENT-<process id>
+	unsigned int m_syncDelay;
+	ClockSync m_clock;                         // server clock on the local steady clock
+	uint32_t m_nextControlId;                  // console thread only
 };
 
@@ -0,0 +1,70 @@
+#include "DriftEstimator.h"
+#include <algorithm>
+#include <cmath>
+
+DriftEstimator::DriftEstimator() :
+	m_start(0),
+	m_started(false),
+	m_bucketStart(0),
+	m_bucketDepth(0),
+	m_target(0),
+	m_hasTarget(false),
+	m_depthError(0),
+	m_drift(0.0),
+	m_correction(0.0)
+{
+}
+
+
+
+void DriftEstimator::OnDepth(long long now, long long depth)
+{
+	if (!m_started)
+	{
+		m_start = now;
+		m_bucketStart = now;
+		m_bucketDepth = depth;
+		m_started = true;
+		return;
+	}
+
+	if (now - m_bucketStart < BUCKET)
+	{
+		m_bucketDepth = std::min(m_bucketDepth, depth);
+		return;
+	}
+
+	if (now - m_start >= SETTLE)
+		Update(m_bucketDepth, (now - m_bucketStart) / 1000000.0);
+	m_bucketStart = now;
+	m_bucketDepth = depth;
+}
+
+
+
+void DriftEstimator::Reset() noexcept
+{
+	m_started = false;
+	m_hasTarget = false;
+	m_depthError = 0;
+	m_correction = m_drift;
+}
+
+
+
+void DriftEstimator::Update(long long depth, double seconds)
+{
+	if (!m_hasTarget)
+	{
+		m_target = depth;
+		m_hasTarget = true;
+	}
+
+	// a growing buffer means the server is faster, the input has to be played faster (fewer output
+	// frames per input frame); the integral stops while the correction is at its limit
+	m_depthError = depth - m_target;
+	const double proportional = KP * m_depthError;
+	if (std::abs(proportional + m_drift) < MAX_CORRECTION)
+		m_drift += KI * m_depthError * seconds;
+	m_correction = std::clamp(proportional + m_drift, -MAX_CORRECTION, MAX_CORRECTION);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+// Tells how much faster the server paces the stream than the local sound card plays it, from the audio
+// buffered on the client over time, and how to resample so that the buffer (and with it the latency)
+// stays where it was once playback settled.
+//
+// The depth is noisy, packets arrive in bursts and buffers are queued in chunks, so only the smallest
+// depth of every BUCKET counts. A PI loop turns the depth error into a correction: the proportional part
+// brings the depth back within a few minutes, the integral part converges on the drift of the two
+// clocks and holds it for as long as the session lasts. The loop is critically damped (KI = KP^2 / 4).
+class DriftEstimator
+{
+public:
+	static constexpr long long BUCKET = 1000000;            // microseconds
+	static constexpr long long SETTLE = 10000000;           // microseconds of playback before the target depth is taken
+	static constexpr double KP = 0.01;                      // ppm per microsecond of depth error
+	static constexpr double KI = KP * KP / 4;               // ppm per microsecond and second
+	static constexpr double MAX_CORRECTION = 500.0;         // ppm, less than a cent of pitch
+
+	DriftEstimator();
+
+	//-- Microseconds of audio buffered on the client (queued and not queued yet) at local time now.
+	void OnDepth(long long now, long long depth);
+
+	//-- Output sample frames per input frame for DriftResampler.
+	double GetRatio() const noexcept { return 1.0 - m_correction / 1000000.0; }
+	//-- Parts per million the server clock runs faster than the sound card, 0 until the loop has a target.
+	double GetDrift() const noexcept { return m_drift; }
+	double GetCorrection() const noexcept { return m_correction; }
+	long long GetDepthError() const noexcept { return m_depthError; }
+
+	//-- Starts over, for a new stream; the drift estimate is kept, the clocks did not change.
+	void Reset() noexcept;
+
+private:
+	void Update(long long depth, double seconds);
+
+	long long m_start;
+	bool m_started;
+	long long m_bucketStart;
+	long long m_bucketDepth;            // smallest depth in the current bucket
+	long long m_target;
+	bool m_hasTarget;
+	long long m_depthError;
+	double m_drift;                     // integral part, ppm
+	double m_correction;                // ppm, positive plays the input faster
+};
@@ -0,0 +1,186 @@
+#include "PlayoutTelemetry.h"
+#include "../SocketsClientServer/Metrics.h"
+#include <algorithm>
+
+namespace
+{
+	struct PlayoutMetrics
+	{
+		MetricHistogram latency{ "client.latency_us" };
+		MetricGauge queued{ "client.queued_ms" };
+		MetricCounter starvations{ "client.starvations" };
+		MetricCounter starved{ "client.starved_ms" };
+	};
+
+	const PlayoutMetrics& GetMetrics()
+	{
+		static const PlayoutMetrics metrics;
+		return metrics;
+	}
+
+	uint32_t ToMiliseconds(long long microseconds)
+	{
+		return static_cast<uint32_t>(std::clamp<long long>(microseconds / 1000, 0, UINT32_MAX));
+	}
+}
+
+
+
+PlayoutTelemetry::PlayoutTelemetry(unsigned int reportInterval) :
+	m_reportInterval(reportInterval),
+	m_clockOffset(0),
+	m_hasClockOffset(false),
+	m_clockOffsetFixed(false),
+	m_pendingEdge(0),
+	m_pendingSequence(0),
+	m_queuedEdge(0),
+	m_queuedSequence(0),
+	m_hasQueued(false),
+	m_sampleRate(0),
+	m_started(false),
+	m_starving(false),
+	m_stoppedEvents(0),
+	m_seenStoppedEvents(0),
+	m_queued(0)
+{
+	ResetInterval(Clock::now());
+}
+
+
+
+void PlayoutTelemetry::OnPacket(const StreamPacketHeader& header)
+{
+	const long long offset = GetNow() - static_cast<long long>(header.timestamp);
+	if (!m_clockOffsetFixed && (!m_hasClockOffset || offset < m_clockOffset))
+	{
+		m_clockOffset = offset;
+		m_hasClockOffset = true;
+	}
+	m_pendingEdge = header.timestamp + header.duration * 1000ull;
+	m_pendingSequence = header.sequence;
+}
+
+
+
+void PlayoutTelemetry::OnQueued(unsigned long long sampleFrames, unsigned int sampleRate)
+{
+	OnQueued(sampleFrames, sampleRate, m_pendingEdge);
+}
+
+
+
+void PlayoutTelemetry::OnQueued(unsigned long long sampleFrames, unsigned int sampleRate, unsigned long long edge)
+{
+	if (!sampleRate)
+		return;
+	m_bufferFrames.push_back(sampleFrames);
+	if (m_bufferFrames.size() > MAX_TRACKED_BUFFERS)
+		m_bufferFrames.pop_front();
+	m_sampleRate = sampleRate;
+	m_queuedEdge = edge;
+	m_queuedSequence = m_pendingSequence;
+	m_hasQueued = true;
+}
+
+
+
+void PlayoutTelemetry::SetClockOffset(long long offset) noexcept
+{
+	m_clockOffset = offset;
+	m_hasClockOffset = true;
+	m_clockOffsetFixed = true;
+}
+
+
+
+bool PlayoutTelemetry::Sample(const SourcePlayout& playout, PlayoutReport& report)
+{
+	const Clock::time_point now = Clock::now();
+	if (m_hasQueued && playout.state == AL_PLAYING)
+		m_started = true;
+
+	if (m_started)
+	{
+		// the buffers still queued are the newest ones this client queued
+		const size_t queuedBuffers = std::min<size_t>(std::max(playout.queuedBuffers, 0), m_bufferFrames.size());
+		unsigned long long queuedFrames = 0;
+		for (size_t i = m_bufferFrames.size() - queuedBuffers; i < m_bufferFrames.size(); i++)
+			queuedFrames += m_bufferFrames[i];
+		const unsigned long long remaining = queuedFrames - std::min<unsigned long long>(queuedFrames, playout.sampleOffset);
+
+		m_queued = remaining * 1000000 / m_sampleRate;
+		m_deviceLatency = playout.latency / 1000;
+		m_hasDeviceLatency = playout.hasLatency;
+		m_latency = GetNow() + static_cast<long long>(m_queued) + m_deviceLatency - (static_cast<long long>(m_queuedEdge) + m_clockOffset);
+		m_minLatency = m_hasLatency ? std::min(m_minLatency, m_latency) : m_latency;
+		m_maxLatency = m_hasLatency ? std::max(m_maxLatency, m_latency) : m_latency;
+		m_hasLatency = true;
+		GetMetrics().latency.Record(static_cast<uint64_t>(std::max(0ll, m_latency)));
+		GetMetrics().queued.Set(static_cast<int64_t>(m_queued / 1000));
+
+		// a source without pending buffers has nothing to play; the event callback restarts a stopped
+		// source at once, so stop events between two samples count as well
+		const bool dry = playout.queuedBuffers - playout.processedBuffers <= 0 || playout.state != AL_PLAYING;
+		const unsigned int stoppedEvents = m_stoppedEvents;
+		unsigned int starvations = stoppedEvents - m_seenStoppedEvents;
+		m_seenStoppedEvents = stoppedEvents;
+		if (dry && !m_starving)
+		{
+			starvations = std::max(starvations, 1u);
+			m_starving = true;
+			m_starvingSince = now;
+		}
+		else if (m_starving)
+		{
+			const double starved = std::chrono::duration<double, std::milli>(now - m_starvingSince).count();
+			m_starved += starved;
+			GetMetrics().starved.Add(static_cast<uint64_t>(starved));
+			m_starvingSince = now;
+			m_starving = dry;
+		}
+		m_starvations += starvations;
+		GetMetrics().starvations.Add(starvations);
+	}
+
+	if (now - m_intervalStart < std::chrono::milliseconds(m_reportInterval))
+		return false;
+
+	report = PlayoutReport{};
+	report.sequence = m_queuedSequence;
+	report.interval = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now - m_intervalStart).count());
+	if (m_hasLatency)
+	{
+		report.latency = ToMiliseconds(m_latency);
+		report.minLatency = ToMiliseconds(m_minLatency);
+		report.maxLatency = ToMiliseconds(m_maxLatency);
+	}
+	report.queued = ToMiliseconds(static_cast<long long>(m_queued));
+	report.deviceLatency = static_cast<uint32_t>(std::clamp<long long>(m_deviceLatency, 0, UINT32_MAX));
+	report.starvations = static_cast<uint16_t>(std::min<unsigned int>(m_starvations, UINT16_MAX));
+	report.starved = static_cast<uint32_t>(m_starved);
+	report.flags = static_cast<uint16_t>((m_hasDeviceLatency ? PLAYOUT_REPORT_DEVICE_LATENCY : 0) | (m_started ? PLAYOUT_REPORT_PLAYING : 0));
+	ResetInterval(now);
+	return true;
+}
+
+
+
+long long PlayoutTelemetry::GetNow()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count();
+}
+
+
+
+void PlayoutTelemetry::ResetInterval(Clock::time_point now)
+{
+	m_intervalStart = now;
+	m_latency = 0;
+	m_minLatency = 0;
+	m_maxLatency = 0;
+	m_hasLatency = false;
+	m_deviceLatency = 0;
+	m_hasDeviceLatency = false;
+	m_starvations = 0;
+	m_starved = 0.0;
+}
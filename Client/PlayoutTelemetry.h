@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include "../OpenAL/GCSoundController.h"
+#include "../SocketsClientServer/StreamProtocol.h"
+
+// Measures what the listener actually hears: how long after the live edge a sample comes out of the
+// speaker and how often the output queue runs dry.
+//
+// Latency of the newest queued sample = local time it reaches the speaker (now + audio still queued in
+// front of it + device latency from AL_SOFT_source_latency) - its live edge on the server clock mapped to
+// the local clock. Until a clock offset is set, the smallest arrival - live edge difference seen serves
+// as offset, which treats the fastest packet as if it had no network delay.
+class PlayoutTelemetry
+{
+public:
+	static constexpr unsigned int DEFAULT_REPORT_INTERVAL = 5000;  // miliseconds
+	static constexpr size_t MAX_TRACKED_BUFFERS = 256;
+
+	explicit PlayoutTelemetry(unsigned int reportInterval = DEFAULT_REPORT_INTERVAL);
+
+	//-- A packet arrived, its audio goes into the output buffer filled next.
+	void OnPacket(const StreamPacketHeader& header);
+
+	//-- The audio of the packets since the last call was queued as one output buffer.
+	void OnQueued(unsigned long long sampleFrames, unsigned int sampleRate);
+
+	//-- One output buffer was queued whose last sample is live at edge (server clock), for players that
+	//-- do not queue whole packets (SyncedPlayout).
+	void OnQueued(unsigned long long sampleFrames, unsigned int sampleRate, unsigned long long edge);
+
+	//-- The source stopped, called from the OpenAL event thread.
+	void OnStopped() noexcept { m_stoppedEvents++; }
+
+	//-- Microseconds to add to a server timestamp to get the local steady clock.
+	void SetClockOffset(long long offset) noexcept;
+
+	//-- Takes a measurement, returns true with report filled once a report interval is complete.
+	bool Sample(const SourcePlayout& playout, PlayoutReport& report);
+
+	bool IsStarted() const noexcept { return m_started; }
+	//-- Microseconds of audio still queued on the source at the last Sample.
+	unsigned long long GetQueued() const noexcept { return m_queued; }
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	static long long GetNow();
+	void ResetInterval(Clock::time_point now);
+
+	unsigned int m_reportInterval;
+	long long m_clockOffset;
+	bool m_hasClockOffset;
+	bool m_clockOffsetFixed;
+
+	unsigned long long m_pendingEdge;   // server clock end of the newest packet not queued yet
+	uint32_t m_pendingSequence;
+	unsigned long long m_queuedEdge;    // server clock end of the newest queued sample
+	uint32_t m_queuedSequence;
+	bool m_hasQueued;
+	std::deque<unsigned long long> m_bufferFrames;  // sample frames of the buffers queued, newest last
+	unsigned int m_sampleRate;
+
+	bool m_started;
+	bool m_starving;
+	Clock::time_point m_starvingSince;
+	std::atomic<unsigned int> m_stoppedEvents;
+	unsigned int m_seenStoppedEvents;
+	unsigned long long m_queued;        // microseconds, last measurement
+
+	Clock::time_point m_intervalStart;
+	long long m_latency;                // microseconds, last measurement
+	long long m_minLatency;
+	long long m_maxLatency;
+	bool m_hasLatency;
+	long long m_deviceLatency;          // microseconds
+	bool m_hasDeviceLatency;
+	unsigned int m_starvations;
+	double m_starved;                   // miliseconds
+};
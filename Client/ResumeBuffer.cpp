@@ -0,0 +1,79 @@
+#include "ResumeBuffer.h"
+
+namespace
+{
+	// relative sequence numbers from here on are frames from before the loss
+	constexpr uint32_t OLDER = 0x80000000u;
+}
+
+
+
+void ResumeBuffer::Start(uint32_t last)
+{
+	m_active = true;
+	m_answered = false;
+	m_base = last;
+	m_next = 1;
+	m_live = 1;
+	m_held.clear();
+}
+
+
+
+void ResumeBuffer::OnSession(bool resumed, uint32_t first, uint32_t count, const Play& play)
+{
+	if (!m_active || m_answered)
+		return;
+	m_answered = true;
+	const uint32_t offset = first - m_base;
+	if (resumed && offset && offset < OLDER)
+	{
+		m_next = offset;
+		m_live = offset + count;
+	}
+	else
+	{
+		// nothing comes again, what waits is all there is
+		m_next = m_held.empty() ? m_next : m_held.begin()->first;
+		m_live = m_next;
+	}
+	Release(play);
+}
+
+
+
+void ResumeBuffer::Push(const StreamPacketHeader& header, const char* payload, const Play& play)
+{
+	const uint32_t offset = header.sequence - m_base;
+	if (!offset || offset >= OLDER || (m_answered && offset < m_next))
+		return;
+	if (!m_held.count(offset))
+		m_held.emplace(offset, Frame{ header, std::vector<char>(payload, payload + header.size) });
+
+	// a server that does not answer is no reason to hold the stream forever
+	if (!m_answered && m_held.size() > MAX_HELD_FRAMES)
+		OnSession(false, 0, 0, play);
+	else if (m_answered)
+		Release(play);
+}
+
+
+
+void ResumeBuffer::Release(const Play& play)
+{
+	while (!m_held.empty() && m_held.begin()->first < m_next)
+		m_held.erase(m_held.begin());
+	if (m_held.size() > MAX_HELD_FRAMES)
+		m_live = m_next = m_held.begin()->first;
+
+	// the frames sent again in order; once they are all in, the live ones as they are
+	while (!m_held.empty() && (m_held.begin()->first == m_next || m_next >= m_live))
+	{
+		const Frame& frame = m_held.begin()->second;
+		play(frame.header, frame.payload.data());
+		m_next = m_held.begin()->first + 1;
+		m_held.erase(m_held.begin());
+	}
+	if (m_held.empty() && m_next >= m_live)
+		m_active = false;
+}
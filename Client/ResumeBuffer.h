@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+#include "../SocketsClientServer/StreamProtocol.h"
+
+// Puts the audio of a resumed session back in order. After a reconnect the server sends again the frames
+// the client missed, but frames of the live stream may have arrived on the new connection ahead of them;
+// those wait here until the frames sent again are all in. The stream is in order after that and the
+// buffer steps aside.
+//
+// Sequence numbers are kept relative to the last frame played before the loss, they wrap around.
+class ResumeBuffer
+{
+public:
+	using Play = std::function<void(const StreamPacketHeader& header, const char* payload)>;
+
+	static constexpr size_t MAX_HELD_FRAMES = 64;       // a frame the server sent again and that got lost is given up then
+
+	//-- The connection was replaced, last is the newest frame played on the old one.
+	void Start(uint32_t last);
+	//-- The answer of the server (SessionInfo): resumed, count frames from first on are sent again and
+	//-- the live stream follows them; not resumed, the session is a new one and what waits plays as it is.
+	void OnSession(bool resumed, uint32_t first, uint32_t count, const Play& play);
+	//-- Plays the frame and what waited for it, or keeps it until its turn.
+	void Push(const StreamPacketHeader& header, const char* payload, const Play& play);
+
+	bool IsActive() const noexcept { return m_active; }
+
+private:
+	struct Frame
+	{
+		StreamPacketHeader header;
+		std::vector<char> payload;
+	};
+
+	void Release(const Play& play);
+
+	bool m_active = false;
+	bool m_answered = false;
+	uint32_t m_base = 0;
+	uint32_t m_next = 1;                    // relative to m_base, the frame due to play
+	uint32_t m_live = 1;                    // relative to m_base, the first frame not sent again
+	std::map<uint32_t, Frame> m_held;       // relative to m_base
+};
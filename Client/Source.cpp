@@ -1,7 +1,21 @@
 #include "ClientSideApplication.h"
+#include <cctype>
+#include <cstdlib>
 
-int main()
+// Client [--sync [delay miliseconds]] [--port port]
+int main(int argc, char* argv[])
 {
-	ClientSideApplication app;
+	unsigned int syncDelay = 0;
+	int port = PORT;
+	for (int arg = 1; arg < argc; arg++)
+	{
+		const std::string option = argv[arg];
+		if (option == "--sync")
+			syncDelay = arg + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[arg + 1][0])) ? std::atoi(argv[++arg]) : SyncedPlayout::DEFAULT_DELAY;
+		else if (option == "--port" && arg + 1 < argc)
+			port = std::atoi(argv[++arg]);
+	}
+
+	ClientSideApplication app(syncDelay, port);
 	app.Wait();
-}
\ No newline at end of file
+}
@@ -0,0 +1,553 @@
+#include "ListenerSwarm.h"
+#include "../SocketsClientServer/StreamProtocol.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <random>
+#include <thread>
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	constexpr size_t READ_SIZE = 64 * 1024;
+	constexpr double SLOW_READ_QUANTUM = 4096.0;    // a slow reader waits until it may take that many bytes
+	constexpr int MAX_POLL_WAIT = 100;              // miliseconds, bounds how late departures are noticed
+
+	// The few socket calls that differ between Winsock and BSD sockets, load machines are usually Linux.
+#ifdef _WIN32
+	using NativeSocket = SOCKET;
+	using PollDescriptor = WSAPOLLFD;
+	constexpr NativeSocket BAD_SOCKET = INVALID_SOCKET;
+
+	struct SocketLibrary
+	{
+		SocketLibrary() { WSADATA data; WSAStartup(MAKEWORD(2, 2), &data); }
+		~SocketLibrary() { WSACleanup(); }
+	};
+
+	void CloseNative(NativeSocket socket) { closesocket(socket); }
+	bool WouldBlock() { const int error = WSAGetLastError(); return error == WSAEWOULDBLOCK || error == WSAEINPROGRESS; }
+	int PollSockets(PollDescriptor* descriptors, size_t count, int timeout) { return WSAPoll(descriptors, static_cast<ULONG>(count), timeout); }
+
+	bool SetNonBlocking(NativeSocket socket)
+	{
+		u_long mode = 1;
+		return ioctlsocket(socket, FIONBIO, &mode) == 0;
+	}
+#else
+	using NativeSocket = int;
+	using PollDescriptor = pollfd;
+	constexpr NativeSocket BAD_SOCKET = -1;
+
+	struct SocketLibrary { SocketLibrary() {} };
+
+	void CloseNative(NativeSocket socket) { close(socket); }
+	bool WouldBlock() { return errno == EWOULDBLOCK || errno == EAGAIN || errno == EINPROGRESS; }
+	int PollSockets(PollDescriptor* descriptors, size_t count, int timeout) { return poll(descriptors, count, timeout); }
+
+	bool SetNonBlocking(NativeSocket socket)
+	{
+		const int flags = fcntl(socket, F_GETFL, 0);
+		return flags != -1 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+	}
+#endif
+
+	int GetSocketError(NativeSocket socket)
+	{
+		int error = 0;
+		socklen_t length = sizeof(error);
+		if (getsockopt(socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &length) != 0)
+			return -1;
+		return error;
+	}
+
+	double Miliseconds(Clock::duration duration)
+	{
+		return std::chrono::duration<double, std::milli>(duration).count();
+	}
+
+	// Read by the progress line while the loops run.
+	struct SwarmCounters
+	{
+		std::atomic<unsigned long long> bytes = 0;
+		std::atomic<unsigned long long> packets = 0;
+		std::atomic<unsigned long long> underruns = 0;
+		std::atomic<unsigned int> active = 0;
+		std::atomic<unsigned int> peak = 0;
+
+		void Joined()
+		{
+			const unsigned int value = ++active;
+			unsigned int highest = peak;
+			while (value > highest && !peak.compare_exchange_weak(highest, value));
+		}
+	};
+
+	struct Listener
+	{
+		NativeSocket socket = BAD_SOCKET;
+		bool connected = false;
+		Clock::time_point joined;
+		Clock::time_point leaveAt;
+		Clock::time_point connectDeadline;
+		PacketAssembler assembler;
+
+		// a slow reader takes bytes off its socket through a token bucket
+		double tokens = 0.0;
+		Clock::time_point refilled;
+
+		// playout model of the client: prebuffer, then drain in real time
+		bool playing = false;
+		bool starving = false;
+		double buffered = 0.0;          // miliseconds of audio
+		Clock::time_point drained;
+
+		bool hasBaseline = false;
+		long long baseline = 0;         // smallest arrival time - live edge seen, microseconds
+
+		ListenerReport report;
+	};
+
+
+
+	// One thread's share of the swarm: joins, departures and every socket of its listeners.
+	class EventLoop
+	{
+	public:
+		EventLoop(const SwarmOptions& options, const sockaddr_in& server, unsigned int index, Clock::time_point end, SwarmCounters& counters) :
+			m_options(options),
+			m_server(server),
+			m_end(end),
+			m_counters(counters),
+			m_random(options.seed + index)
+		{
+			const unsigned int threads = std::max(1u, options.threads);
+			m_capacity = options.maxListeners / threads + (index < options.maxListeners % threads ? 1 : 0);
+			m_initial = options.listeners / threads + (index < options.listeners % threads ? 1 : 0);
+			m_arrivalRate = options.arrivalRate / threads;
+			m_burst = std::max(SLOW_READ_QUANTUM, options.slowReadRate / 10.0);
+			m_buffer.resize(READ_SIZE);
+		}
+
+		void Run()
+		{
+			Clock::time_point now = Clock::now();
+			for (unsigned int i = 0; i < m_initial; i++)
+				Join(now);
+			Clock::time_point nextArrival = m_arrivalRate > 0.0 ? now + NextInterval(m_arrivalRate) : Clock::time_point::max();
+
+			std::vector<PollDescriptor> descriptors;
+			std::vector<Listener*> owners;
+			while ((now = Clock::now()) < m_end)
+			{
+				for (; nextArrival <= now; nextArrival += NextInterval(m_arrivalRate))
+					Join(now);
+
+				Clock::time_point wake = std::min(m_end, nextArrival);
+				descriptors.clear();
+				owners.clear();
+				for (auto& listener : m_listeners)
+				{
+					if (now >= listener->leaveAt)
+					{
+						Leave(*listener, now, false);
+						continue;
+					}
+					if (!listener->connected && now >= listener->connectDeadline)
+					{
+						m_counters.active--;
+						Fail(*listener);
+						continue;
+					}
+
+					short events = 0;
+					if (!listener->connected)
+					{
+						events = POLLOUT;
+						wake = std::min(wake, listener->connectDeadline);
+					}
+					else if (listener->report.slow)
+					{
+						Refill(*listener, now);
+						if (listener->tokens >= SLOW_READ_QUANTUM)
+							events = POLLIN;
+						else
+							wake = std::min(wake, now + std::chrono::duration_cast<Clock::duration>(
+								std::chrono::duration<double>((SLOW_READ_QUANTUM - listener->tokens) / m_options.slowReadRate)));
+					}
+					else
+					{
+						events = POLLIN;
+					}
+					wake = std::min(wake, listener->leaveAt);
+					Advance(*listener, now);
+
+					if (events)
+					{
+						PollDescriptor descriptor{};
+						descriptor.fd = listener->socket;
+						descriptor.events = events;
+						descriptors.push_back(descriptor);
+						owners.push_back(listener.get());
+					}
+				}
+				Compact();
+
+				const int timeout = static_cast<int>(std::clamp(Miliseconds(wake - now) + 0.999, 0.0, static_cast<double>(MAX_POLL_WAIT)));
+				if (descriptors.empty())
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+					continue;
+				}
+				if (PollSockets(descriptors.data(), descriptors.size(), timeout) <= 0)
+					continue;
+
+				now = Clock::now();
+				for (size_t i = 0; i < descriptors.size(); i++)
+				{
+					if (!descriptors[i].revents)
+						continue;
+					Listener& listener = *owners[i];
+					if (!listener.connected)
+						Connected(listener, now);
+					else
+						Read(listener, now);
+				}
+				Compact();
+			}
+
+			now = Clock::now();
+			for (auto& listener : m_listeners)
+				Leave(*listener, now, false);
+			m_listeners.clear();
+		}
+
+		std::vector<ListenerReport> reports;
+		unsigned long long connectFailures = 0;
+		unsigned long long rejected = 0;
+
+	private:
+		Clock::duration NextInterval(double rate)
+		{
+			std::exponential_distribution<double> interval(rate);
+			return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval(m_random)));
+		}
+
+		void Join(Clock::time_point now)
+		{
+			if (m_listeners.size() >= m_capacity)
+			{
+				rejected++;
+				return;
+			}
+
+			auto listener = std::make_unique<Listener>();
+			listener->socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+			if (listener->socket == BAD_SOCKET || !SetNonBlocking(listener->socket))
+			{
+				Fail(*listener);
+				return;
+			}
+			if (connect(listener->socket, reinterpret_cast<const sockaddr*>(&m_server), sizeof(m_server)) == 0)
+				listener->connected = true;
+			else if (!WouldBlock())
+			{
+				Fail(*listener);
+				return;
+			}
+
+			std::uniform_real_distribution<double> share(0.0, 1.0);
+			listener->report.slow = share(m_random) < m_options.slowFraction;
+			listener->joined = now;
+			listener->refilled = now;
+			listener->connectDeadline = now + std::chrono::milliseconds(m_options.connectTimeout);
+			listener->leaveAt = m_options.meanSession > 0.0 ? now + NextInterval(1.0 / m_options.meanSession) : Clock::time_point::max();
+			m_listeners.push_back(std::move(listener));
+			m_counters.Joined();
+		}
+
+		void Connected(Listener& listener, Clock::time_point now)
+		{
+			if (GetSocketError(listener.socket) != 0)
+			{
+				m_counters.active--;
+				Fail(listener);
+				return;
+			}
+			listener.connected = true;
+			listener.refilled = now;
+		}
+
+		void Read(Listener& listener, Clock::time_point now)
+		{
+			size_t allowed = m_buffer.size();
+			if (listener.report.slow)
+				allowed = std::min(allowed, static_cast<size_t>(listener.tokens));
+
+			const int received = recv(listener.socket, m_buffer.data(), static_cast<int>(allowed), 0);
+			if (received < 0 && WouldBlock())
+				return;
+			if (received <= 0)
+			{
+				Leave(listener, now, true);
+				return;
+			}
+
+			listener.tokens -= received;
+			listener.report.bytes += received;
+			m_counters.bytes += received;
+			listener.assembler.Append(m_buffer.data(), received);
+
+			StreamPacketHeader header;
+			const char* payload;
+			while (listener.assembler.Next(header, payload))
+			{
+				if (header.type == static_cast<uint16_t>(PacketType::Audio))
+					Deliver(listener, header, now);
+			}
+			if (listener.assembler.IsCorrupt())
+				Leave(listener, now, true);
+		}
+
+		void Deliver(Listener& listener, const StreamPacketHeader& header, Clock::time_point now)
+		{
+			ListenerReport& report = listener.report;
+			report.packets++;
+			report.audio += header.duration;
+			m_counters.packets++;
+
+			Advance(listener, now);
+			listener.buffered += header.duration;
+			listener.starving = false;
+			if (!listener.playing && listener.buffered >= m_options.prebuffer)
+			{
+				listener.playing = true;
+				listener.drained = now;
+				report.startup = Miliseconds(now - listener.joined);
+			}
+
+			const long long arrival = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+			const long long offset = arrival - static_cast<long long>(header.timestamp);
+			if (!listener.hasBaseline || offset < listener.baseline)
+			{
+				listener.baseline = offset;
+				listener.hasBaseline = true;
+			}
+			report.lag = (offset - listener.baseline) / 1000.0;
+			report.maxLag = std::max(report.maxLag, report.lag);
+		}
+
+		// Plays the buffered audio up to now, an empty buffer is an underrun. The model picks up again
+		// as soon as data arrives, so one starvation counts once however long it lasts.
+		void Advance(Listener& listener, Clock::time_point now)
+		{
+			if (!listener.playing)
+				return;
+			listener.buffered -= Miliseconds(now - listener.drained);
+			listener.drained = now;
+			if (listener.buffered >= 0.0)
+				return;
+
+			if (!listener.starving)
+			{
+				listener.report.underruns++;
+				m_counters.underruns++;
+				listener.starving = true;
+			}
+			listener.report.stalled -= listener.buffered;
+			listener.buffered = 0.0;
+		}
+
+		void Refill(Listener& listener, Clock::time_point now)
+		{
+			const double seconds = std::chrono::duration<double>(now - listener.refilled).count();
+			listener.tokens = std::min(m_burst, listener.tokens + seconds * m_options.slowReadRate);
+			listener.refilled = now;
+		}
+
+		void Leave(Listener& listener, Clock::time_point now, bool dropped)
+		{
+			if (listener.socket == BAD_SOCKET)
+				return;
+			Advance(listener, now);
+			listener.report.dropped = dropped;
+			listener.report.seconds = std::chrono::duration<double>(now - listener.joined).count();
+			reports.push_back(listener.report);
+			CloseNative(listener.socket);
+			listener.socket = BAD_SOCKET;
+			m_counters.active--;
+		}
+
+		// A listener that never got connected has nothing to report.
+		void Fail(Listener& listener)
+		{
+			connectFailures++;
+			if (listener.socket != BAD_SOCKET)
+				CloseNative(listener.socket);
+			listener.socket = BAD_SOCKET;
+		}
+
+		void Compact()
+		{
+			m_listeners.erase(std::remove_if(m_listeners.begin(), m_listeners.end(),
+				[](const std::unique_ptr<Listener>& listener) { return listener->socket == BAD_SOCKET; }), m_listeners.end());
+		}
+
+		const SwarmOptions& m_options;
+		sockaddr_in m_server;
+		Clock::time_point m_end;
+		SwarmCounters& m_counters;
+		std::mt19937 m_random;
+		size_t m_capacity;
+		unsigned int m_initial;
+		double m_arrivalRate;
+		double m_burst;                 // bytes a slow reader may take at once
+		std::vector<char> m_buffer;
+		std::vector<std::unique_ptr<Listener>> m_listeners;
+	};
+
+	double Percentile(std::vector<double>& values, double fraction)
+	{
+		if (values.empty())
+			return 0.0;
+		std::sort(values.begin(), values.end());
+		return values[std::min(values.size() - 1, static_cast<size_t>(fraction * values.size()))];
+	}
+
+	void PrintLag(const char* name, std::vector<double> lags, std::ostream& stream)
+	{
+		stream << "  " << std::left << std::setw(8) << name << std::right << std::setw(6) << lags.size() << " listeners"
+			<< " p50 " << std::setw(8) << Percentile(lags, 0.50)
+			<< " p95 " << std::setw(8) << Percentile(lags, 0.95)
+			<< " p99 " << std::setw(8) << Percentile(lags, 0.99)
+			<< " max " << std::setw(8) << Percentile(lags, 1.0) << std::endl;
+	}
+}
+
+
+
+ListenerSwarm::ListenerSwarm(const SwarmOptions& options) : m_options(options)
+{
+	m_options.threads = std::max(1u, m_options.threads);
+}
+
+
+
+SwarmReport ListenerSwarm::Run(std::ostream& progress)
+{
+	SocketLibrary library;
+	SwarmReport report;
+	sockaddr_in server{};
+	server.sin_family = AF_INET;
+	server.sin_port = htons(m_options.port);
+	if (inet_pton(AF_INET, m_options.address.c_str(), &server.sin_addr) != 1)
+	{
+		progress << "BAD ADDRESS " << m_options.address << std::endl;
+		return report;
+	}
+
+	const Clock::time_point start = Clock::now();
+	const Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_options.seconds));
+	SwarmCounters counters;
+	std::vector<std::unique_ptr<EventLoop>> loops;
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < m_options.threads; i++)
+		loops.push_back(std::make_unique<EventLoop>(m_options, server, i, end, counters));
+	for (auto& loop : loops)
+		threads.emplace_back(&EventLoop::Run, loop.get());
+
+	if (m_options.reportInterval > 0.0)
+	{
+		const auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_options.reportInterval));
+		unsigned long long lastBytes = 0;
+		unsigned long long lastPackets = 0;
+		for (Clock::time_point next = start + interval; next < end; next += interval)
+		{
+			std::this_thread::sleep_until(next);
+			const unsigned long long bytes = counters.bytes;
+			const unsigned long long packets = counters.packets;
+			progress << std::fixed << std::setprecision(1) << std::setw(7) << std::chrono::duration<double>(next - start).count() << " s"
+				<< std::setw(7) << counters.active.load() << " listeners"
+				<< std::setw(9) << (bytes - lastBytes) * 8.0 / m_options.reportInterval / 1e6 << " Mbit/s"
+				<< std::setw(9) << std::setprecision(0) << (packets - lastPackets) / m_options.reportInterval << " packets/s"
+				<< std::setw(7) << counters.underruns.load() << " underruns" << std::defaultfloat << std::setprecision(6) << std::endl;
+			lastBytes = bytes;
+			lastPackets = packets;
+		}
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+	report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	report.peakListeners = counters.peak;
+	for (auto& loop : loops)
+	{
+		report.listeners.insert(report.listeners.end(), loop->reports.begin(), loop->reports.end());
+		report.connectFailures += loop->connectFailures;
+		report.rejected += loop->rejected;
+	}
+	return report;
+}
+
+
+
+void ListenerSwarm::Print(const SwarmReport& report, std::ostream& stream)
+{
+	size_t slow = 0, dropped = 0, starved = 0;
+	unsigned long long bytes = 0, packets = 0, underruns = 0;
+	double stalled = 0.0, perListener = 0.0;
+	std::vector<double> startups, lags, slowLags, steadyLags;
+	for (const auto& listener : report.listeners)
+	{
+		slow += listener.slow;
+		dropped += listener.dropped;
+		starved += listener.underruns > 0;
+		bytes += listener.bytes;
+		packets += listener.packets;
+		underruns += listener.underruns;
+		stalled += listener.stalled;
+		if (listener.seconds > 0.0)
+			perListener += listener.bytes / listener.seconds;
+		if (listener.startup >= 0.0)
+			startups.push_back(listener.startup);
+		if (listener.packets)
+		{
+			lags.push_back(listener.maxLag);
+			(listener.slow ? slowLags : steadyLags).push_back(listener.maxLag);
+		}
+	}
+
+	const double seconds = std::max(report.seconds, 1e-9);
+	const size_t count = std::max<size_t>(1, report.listeners.size());
+	stream << "LISTENERS " << report.listeners.size() << " (" << slow << " SLOW) PEAK " << report.peakListeners
+		<< " CONNECT FAILURES " << report.connectFailures << " REJECTED " << report.rejected << " DROPPED " << dropped
+		<< " IN " << report.seconds << " s" << std::endl;
+	stream << std::fixed << std::setprecision(1)
+		<< "THROUGHPUT " << bytes / seconds / (1024.0 * 1024.0) << " MiB/s " << packets / seconds << " packets/s "
+		<< perListener / count / 1024.0 << " KiB/s per listener" << std::endl;
+	stream << "STARTUP ms " << startups.size() << " started p50 " << Percentile(startups, 0.50)
+		<< " p95 " << Percentile(startups, 0.95) << " max " << Percentile(startups, 1.0) << std::endl;
+	stream << "MAX LAG BEHIND LIVE EDGE ms" << std::endl;
+	PrintLag("all", lags, stream);
+	PrintLag("steady", steadyLags, stream);
+	PrintLag("slow", slowLags, stream);
+	stream << "UNDERRUNS " << underruns << " IN " << starved << " LISTENERS (" << 100.0 * starved / count << " %) "
+		<< stalled / 1000.0 << " s SILENT" << std::defaultfloat << std::setprecision(6) << std::endl;
+}
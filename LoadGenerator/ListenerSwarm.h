@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct SwarmOptions
+{
+	std::string address = "127.0.0.1";
+	unsigned short port = 55555;
+	unsigned int threads = 1;
+	unsigned int listeners = 100;       // joining right at the start
+	unsigned int maxListeners = 1000;   // arrivals beyond it are turned away
+	double arrivalRate = 0.0;           // further listeners per second (poisson)
+	double meanSession = 0.0;           // seconds a listener stays on average (exponential), 0 stays to the end
+	double slowFraction = 0.0;          // share of listeners that read slower than the stream
+	unsigned int slowReadRate = 64 * 1024;  // bytes per second a slow reader takes off its socket
+	unsigned int prebuffer = 2000;      // miliseconds of audio a client buffers before it starts playing
+	unsigned int connectTimeout = 5000; // miliseconds
+	double seconds = 30.0;
+	double reportInterval = 1.0;        // progress line every that many seconds, 0 for none
+	uint32_t seed = 1;
+};
+
+// Everything one virtual listener saw between joining and leaving.
+struct ListenerReport
+{
+	bool slow = false;
+	bool dropped = false;               // the server closed the stream or sent garbage
+	double seconds = 0.0;
+	unsigned long long bytes = 0;
+	unsigned long long packets = 0;
+	unsigned long long audio = 0;       // miliseconds of audio received
+	double startup = -1.0;              // miliseconds from joining to playback, -1 never started
+	double maxLag = 0.0;                // miliseconds behind the live edge
+	double lag = 0.0;                   // when it left
+	unsigned int underruns = 0;
+	double stalled = 0.0;               // miliseconds of silence caused by underruns
+};
+
+struct SwarmReport
+{
+	std::vector<ListenerReport> listeners;
+	unsigned long long connectFailures = 0;
+	unsigned long long rejected = 0;    // arrivals over maxListeners
+	unsigned int peakListeners = 0;
+	double seconds = 0.0;
+};
+
+
+
+// Synthetic audience for the stream server. Every thread runs an event loop over many non-blocking
+// listener sockets that speak the client protocol but only model the playout buffer instead of opening
+// an audio device. Listeners arrive and leave at random, a share of them reads slower than the stream.
+//
+// Lag is measured against the packet timestamps: the smallest difference between arrival time and live
+// edge a listener has seen is its baseline (it absorbs the clock offset and network delay), anything
+// above it is time the listener fell behind.
+class ListenerSwarm
+{
+public:
+	explicit ListenerSwarm(const SwarmOptions& options);
+
+	//-- Runs for options.seconds, progress lines go to progress.
+	SwarmReport Run(std::ostream& progress);
+	static void Print(const SwarmReport& report, std::ostream& stream);
+
+private:
+	SwarmOptions m_options;
+};
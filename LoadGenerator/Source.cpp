@@ -0,0 +1,59 @@
+// Load generator for the stream server: a swarm of virtual listeners without audio devices.
+// Needs nothing but the socket API, so it also builds on a Linux load machine:
+//   g++ -std=c++20 -O2 -pthread Source.cpp ListenerSwarm.cpp ../SocketsClientServer/StreamProtocol.cpp -o LoadGenerator
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "ListenerSwarm.h"
+
+int main(int argc, char* argv[])
+{
+	SwarmOptions options;
+	for (int arg = 1; arg < argc; arg++)
+	{
+		const std::string option = argv[arg];
+		if (arg + 1 >= argc)
+		{
+			std::cout << "MISSING VALUE FOR " << option << std::endl;
+			return 1;
+		}
+
+		const char* value = argv[++arg];
+		if (option == "--address")
+			options.address = value;
+		else if (option == "--port")
+			options.port = static_cast<unsigned short>(std::atoi(value));
+		else if (option == "--threads")
+			options.threads = static_cast<unsigned int>(std::atoi(value));
+		else if (option == "--listeners")
+			options.listeners = static_cast<unsigned int>(std::atoi(value));
+		else if (option == "--max-listeners")
+			options.maxListeners = static_cast<unsigned int>(std::atoi(value));
+		else if (option == "--arrival-rate")
+			options.arrivalRate = std::atof(value);
+		else if (option == "--session")
+			options.meanSession = std::atof(value);
+		else if (option == "--slow-fraction")
+			options.slowFraction = std::atof(value);
+		else if (option == "--slow-rate")
+			options.slowReadRate = static_cast<unsigned int>(std::atof(value) * 1024);
+		else if (option == "--prebuffer")
+			options.prebuffer = static_cast<unsigned int>(std::atoi(value));
+		else if (option == "--seconds")
+			options.seconds = std::atof(value);
+		else if (option == "--report")
+			options.reportInterval = std::atof(value);
+		else if (option == "--seed")
+			options.seed = static_cast<uint32_t>(std::atoi(value));
+		else
+		{
+			std::cout << "UNKNOWN OPTION " << option << std::endl;
+			return 1;
+		}
+	}
+
+	ListenerSwarm swarm(options);
+	const SwarmReport report = swarm.Run(std::cout);
+	ListenerSwarm::Print(report, std::cout);
+	return report.listeners.empty() ? 1 : 0;
+}
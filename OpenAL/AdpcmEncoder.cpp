@@ -0,0 +1,152 @@
+#include "AdpcmEncoder.h"
+#include <algorithm>
+
+namespace
+{
+	constexpr int INDEX_TABLE[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+	constexpr int STEP_TABLE[89] =
+	{
+		7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66,
+		73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408,
+		449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+		2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630,
+		9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+	};
+
+	struct ImaState
+	{
+		int predictor = 0;
+		int index = 0;
+
+		uchar Encode(int sample)
+		{
+			int diff = sample - predictor;
+			uchar nibble = 0;
+			if (diff < 0)
+			{
+				nibble = 8;
+				diff = -diff;
+			}
+
+			int step = STEP_TABLE[index];
+			int delta = step >> 3;
+			if (diff >= step)
+			{
+				nibble |= 4;
+				diff -= step;
+				delta += step;
+			}
+			step >>= 1;
+			if (diff >= step)
+			{
+				nibble |= 2;
+				diff -= step;
+				delta += step;
+			}
+			step >>= 1;
+			if (diff >= step)
+			{
+				nibble |= 1;
+				delta += step;
+			}
+
+			predictor = std::clamp((nibble & 8) ? predictor - delta : predictor + delta, -32768, 32767);
+			index = std::clamp(index + INDEX_TABLE[nibble], 0, 88);
+			return nibble;
+		}
+	};
+}
+
+
+
+bool AdpcmEncoder::CanEncode(const MYWAVEFORMATEX& pcmFormat)
+{
+	return pcmFormat.wFormatTag == WAVE_FORMAT_PCM
+		&& pcmFormat.wBitsPerSample == 16
+		&& (pcmFormat.nChannels == 1 || pcmFormat.nChannels == 2);
+}
+
+
+
+MYWAVEFORMATEX AdpcmEncoder::GetIma4Format(const MYWAVEFORMATEX& pcmFormat)
+{
+	MYWAVEFORMATEX format = pcmFormat;
+	format.wFormatTag = WAVE_FORMAT_IMA_ADPCM;
+	format.wBitsPerSample = 4;
+	format.nBlockAlign = static_cast<WORD>(pcmFormat.nChannels * (4 + (IMA4_SAMPLES_PER_BLOCK - 1) / 2));
+	format.nAvgBytesPerSec = static_cast<DWORD>(static_cast<unsigned long long>(pcmFormat.nSamplesPerSec) * format.nBlockAlign / IMA4_SAMPLES_PER_BLOCK);
+	format.cbSize = 0;
+	return format;
+}
+
+
+
+std::vector<char> AdpcmEncoder::EncodeIma4(const char* data, size_t size, const MYWAVEFORMATEX& pcmFormat)
+{
+	std::vector<char> encoded;
+	if (!CanEncode(pcmFormat))
+		return encoded;
+
+	const size_t channels = pcmFormat.nChannels;
+	const size_t frames = size / pcmFormat.nBlockAlign;
+	const size_t blockAlign = GetIma4Format(pcmFormat).nBlockAlign;
+	const size_t blocks = (frames + IMA4_SAMPLES_PER_BLOCK - 1) / IMA4_SAMPLES_PER_BLOCK;
+	const int16_t* samples = reinterpret_cast<const int16_t*>(data);
+	encoded.resize(blocks * blockAlign);
+
+	ImaState states[2];
+	auto sampleAt = [&](size_t frame, size_t channel) -> int
+	{
+		return frame < frames ? samples[frame * channels + channel] : 0;
+	};
+
+	for (size_t block = 0; block < blocks; block++)
+	{
+		const size_t firstFrame = block * IMA4_SAMPLES_PER_BLOCK;
+		uchar* output = reinterpret_cast<uchar*>(encoded.data()) + block * blockAlign;
+
+		// block header: first sample verbatim plus the step index, per channel
+		for (size_t channel = 0; channel < channels; channel++)
+		{
+			ImaState& state = states[channel];
+			state.predictor = sampleAt(firstFrame, channel);
+			*output++ = static_cast<uchar>(state.predictor & 0xFF);
+			*output++ = static_cast<uchar>((state.predictor >> 8) & 0xFF);
+			*output++ = static_cast<uchar>(state.index);
+			*output++ = 0;
+		}
+
+		// then 8 samples of every channel packed into 4 bytes, low nibble first
+		for (size_t group = 0; group < (IMA4_SAMPLES_PER_BLOCK - 1) / 8; group++)
+		{
+			const size_t groupFrame = firstFrame + 1 + group * 8;
+			for (size_t channel = 0; channel < channels; channel++)
+			{
+				for (size_t pair = 0; pair < 4; pair++)
+				{
+					const uchar low = states[channel].Encode(sampleAt(groupFrame + pair * 2, channel));
+					const uchar high = states[channel].Encode(sampleAt(groupFrame + pair * 2 + 1, channel));
+					*output++ = static_cast<uchar>(low | (high << 4));
+				}
+			}
+		}
+	}
+
+	return encoded;
+}
+
+
+
+unsigned int AdpcmEncoder::GetSamplesPerBlock(const MYWAVEFORMATEX& waveFormat)
+{
+	if (!waveFormat.nChannels)
+		return 0;
+
+	const unsigned int channelBytes = waveFormat.nBlockAlign / waveFormat.nChannels;
+	if (waveFormat.wFormatTag == WAVE_FORMAT_IMA_ADPCM && channelBytes > 4)
+		return (channelBytes - 4) * 2 + 1;
+	if (waveFormat.wFormatTag == WAVE_FORMAT_ADPCM && channelBytes > 7)
+		return (channelBytes - 7) * 2 + 2;
+	return 0;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <vector>
+#include "SoundFile.h"
+
+// IMA ADPCM in the block layout OpenAL Soft reads natively (AL_EXT_IMA4 + AL_SOFT_block_alignment),
+// which is also the layout of IMA ADPCM wave files.
+class AdpcmEncoder
+{
+public:
+	static constexpr unsigned int IMA4_SAMPLES_PER_BLOCK = 2041;     // 1024 bytes per channel and block
+
+	static bool CanEncode(const MYWAVEFORMATEX& pcmFormat);
+	static MYWAVEFORMATEX GetIma4Format(const MYWAVEFORMATEX& pcmFormat);
+
+	//-- Encodes 16 bit PCM, the last block is padded with silence.
+	static std::vector<char> EncodeIma4(const char* data, size_t size, const MYWAVEFORMATEX& pcmFormat);
+
+	//-- Samples per channel in one block of an IMA or MS ADPCM format, 0 for anything else.
+	static unsigned int GetSamplesPerBlock(const MYWAVEFORMATEX& waveFormat);
+};
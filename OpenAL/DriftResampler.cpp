@@ -0,0 +1,139 @@
+#include "DriftResampler.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	constexpr double PI = 3.14159265358979323846;
+	constexpr double CUTOFF = 0.95;     // of the Nyquist frequency, a ratio of 1 - MAX_DEVIATION must not alias
+	constexpr unsigned int CENTER = DriftResampler::TAPS / 2 - 1;   // tap of the input frame at or before the position
+}
+
+
+
+DriftResampler::DriftResampler() :
+	m_ratio(1.0),
+	m_position(0.0),
+	m_channels(0),
+	m_sampleRate(0)
+{
+}
+
+
+
+bool DriftResampler::CanResample(const MYWAVEFORMATEX& waveFormat)
+{
+	return waveFormat.wFormatTag == WAVE_FORMAT_PCM && waveFormat.wBitsPerSample == 16 && waveFormat.nChannels
+		&& waveFormat.nBlockAlign == waveFormat.nChannels * 2;
+}
+
+
+
+void DriftResampler::SetRatio(double ratio) noexcept
+{
+	m_ratio = std::clamp(ratio, 1.0 - MAX_DEVIATION, 1.0 + MAX_DEVIATION);
+}
+
+
+
+void DriftResampler::Process(const char* data, size_t size, const MYWAVEFORMATEX& waveFormat, std::vector<char>& output)
+{
+	if (!CanResample(waveFormat))
+	{
+		output.insert(output.end(), data, data + size);
+		return;
+	}
+	if (waveFormat.nChannels != m_channels || waveFormat.nSamplesPerSec != m_sampleRate)
+	{
+		m_channels = waveFormat.nChannels;
+		m_sampleRate = waveFormat.nSamplesPerSec;
+		Reset();
+	}
+
+	const size_t samples = size / waveFormat.nBlockAlign * m_channels;
+	const size_t start = m_history.size();
+	m_history.resize(start + samples);
+	for (size_t i = 0; i < samples; i++)
+	{
+		int16_t sample;
+		std::memcpy(&sample, data + i * 2, 2);
+		m_history[start + i] = sample;
+	}
+
+	const std::vector<float>& table = GetTable();
+	const size_t frames = m_history.size() / m_channels;
+	const double step = 1.0 / m_ratio;
+	std::array<float, TAPS> taps;
+	output.reserve(output.size() + static_cast<size_t>((frames - TAPS) * m_ratio + 1) * waveFormat.nBlockAlign);
+	while (static_cast<size_t>(m_position) + TAPS / 2 < frames)
+	{
+		const size_t frame = static_cast<size_t>(m_position);
+		const double phase = (m_position - frame) * PHASES;
+		const size_t row = static_cast<size_t>(phase);
+		const float mix = static_cast<float>(phase - row);
+		const float* first = &table[row * TAPS];
+		const float* second = first + TAPS;
+		for (unsigned int k = 0; k < TAPS; k++)
+			taps[k] = first[k] + (second[k] - first[k]) * mix;
+
+		const float* input = &m_history[(frame - CENTER) * m_channels];
+		for (unsigned int channel = 0; channel < m_channels; channel++)
+		{
+			float sum = 0.0f;
+			for (unsigned int k = 0; k < TAPS; k++)
+				sum += input[k * m_channels + channel] * taps[k];
+			const int16_t sample = static_cast<int16_t>(std::clamp(std::lround(sum), -32768l, 32767l));
+			const char* bytes = reinterpret_cast<const char*>(&sample);
+			output.insert(output.end(), bytes, bytes + 2);
+		}
+		m_position += step;
+	}
+
+	// the last TAPS frames are what the next output frames still reach back to
+	const size_t dropped = frames - TAPS;
+	m_history.erase(m_history.begin(), m_history.begin() + dropped * m_channels);
+	m_position -= static_cast<double>(dropped);
+}
+
+
+
+void DriftResampler::Reset()
+{
+	// TAPS frames of silence before the stream, the first output frame is the first input frame
+	m_history.assign(static_cast<size_t>(TAPS) * m_channels, 0.0f);
+	m_position = TAPS;
+}
+
+
+
+const std::vector<float>& DriftResampler::GetTable()
+{
+	// one row of taps for every fractional position, plus the position 1 to interpolate towards; every
+	// row is normalized so that the gain at 0 Hz stays exactly 1
+	static const std::vector<float> table = []()
+	{
+		std::vector<float> rows((PHASES + 1) * TAPS);
+		for (unsigned int row = 0; row <= PHASES; row++)
+		{
+			const double fraction = static_cast<double>(row) / PHASES;
+			double sum = 0.0;
+			std::array<double, TAPS> taps;
+			for (unsigned int k = 0; k < TAPS; k++)
+			{
+				const double distance = static_cast<double>(k) - CENTER - fraction;
+				const double x = PI * CUTOFF * distance;
+				const double sinc = x == 0.0 ? 1.0 : std::sin(x) / x;
+				const double window = (distance + TAPS / 2.0) / TAPS;     // 0 to 1 across the taps
+				const double blackman = 0.42 - 0.5 * std::cos(2.0 * PI * window) + 0.08 * std::cos(4.0 * PI * window);
+				taps[k] = sinc * blackman;
+				sum += taps[k];
+			}
+			for (unsigned int k = 0; k < TAPS; k++)
+				rows[row * TAPS + k] = static_cast<float>(taps[k] / sum);
+		}
+		return rows;
+	}();
+	return table;
+}
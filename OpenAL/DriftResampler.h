@@ -0,0 +1,38 @@
+#pragma once
+#include <vector>
+#include "SoundFile.h"
+
+// Resamples 16 bit PCM by a ratio a few hundred ppm away from 1, to make up for a sender whose clock runs
+// a little faster or slower than the sound card. Band limited interpolation (windowed sinc, TAPS taps
+// from a table of PHASES fractional positions) keeps the treble untouched while the position between two
+// samples sweeps slowly through the stream, which plain linear interpolation would turn into a slowly
+// breathing low pass. The ratio can change with every call, the stream stays continuous across calls.
+class DriftResampler
+{
+public:
+	static constexpr unsigned int TAPS = 16;
+	static constexpr unsigned int PHASES = 256;
+	static constexpr double MAX_DEVIATION = 0.01;       // the ratio is kept within 1 +- MAX_DEVIATION
+
+	DriftResampler();
+
+	static bool CanResample(const MYWAVEFORMATEX& waveFormat);
+
+	//-- Output sample frames per input sample frame, above 1 stretches the audio.
+	void SetRatio(double ratio) noexcept;
+	double GetRatio() const noexcept { return m_ratio; }
+
+	//-- Appends the resampled data to output. The last TAPS / 2 input frames come out with the next call,
+	//-- the taps reach that far ahead; a new format starts a new stream. Other formats pass unchanged.
+	void Process(const char* data, size_t size, const MYWAVEFORMATEX& waveFormat, std::vector<char>& output);
+	void Reset();
+
+private:
+	static const std::vector<float>& GetTable();
+
+	double m_ratio;
+	double m_position;                  // input frame the next output frame is taken at, within m_history
+	unsigned int m_channels;
+	unsigned int m_sampleRate;
+	std::vector<float> m_history;       // the last TAPS input frames, interleaved, then the new input
+};
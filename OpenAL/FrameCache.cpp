@@ -0,0 +1,215 @@
+#include "FrameCache.h"
+#include "../SocketsClientServer/Metrics.h"
+#include <vector>
+
+namespace
+{
+	struct CacheMetrics
+	{
+		MetricCounter hits{ "framecache.hits" };
+		MetricCounter misses{ "framecache.misses" };
+		MetricCounter evictions{ "framecache.evictions" };
+		MetricCounter rejections{ "framecache.rejections" };   // loaded but not admitted, the caller still got the frames
+		MetricGauge bytes{ "framecache.bytes" };
+		MetricGauge entries{ "framecache.entries" };
+	};
+
+	const CacheMetrics& GetMetrics()
+	{
+		static const CacheMetrics metrics;
+		return metrics;
+	}
+}
+
+
+
+FrameCache& FrameCache::Get()
+{
+	static FrameCache instance{};
+	return instance;
+}
+
+FrameCache::FrameCache() :
+	m_budget(DEFAULT_BUDGET),
+	m_bytes(0)
+{
+	// before the cache, so they outlive it at exit
+	GetMetrics();
+}
+
+
+
+void FrameCache::SetBudget(size_t bytes)
+{
+	std::lock_guard<std::mutex> guardLock(m_lock);
+	m_budget = bytes;
+	Shrink();
+}
+
+
+
+std::shared_ptr<const TrackContainer> FrameCache::Acquire(const std::string& trackPath, StreamEncoding encoding, size_t maxFrameSize)
+{
+	const std::string key = MakeKey(trackPath, encoding, maxFrameSize);
+	const size_t hash = std::hash<std::string>{}(key);
+	std::promise<std::shared_ptr<const TrackContainer>> loaded;
+	{
+		std::unique_lock<std::mutex> guardLock(m_lock);
+		m_sketch.Increment(hash);
+
+		auto entry = m_entries.find(key);
+		if (entry != m_entries.end())
+		{
+			GetMetrics().hits.Add();
+			m_recency.splice(m_recency.begin(), m_recency, entry->second.recency);
+			return entry->second.container;
+		}
+
+		auto loading = m_loading.find(key);
+		if (loading != m_loading.end())
+		{
+			GetMetrics().hits.Add();
+			auto pending = loading->second;
+			guardLock.unlock();
+			return pending.get();
+		}
+
+		GetMetrics().misses.Add();
+		m_loading.emplace(key, loaded.get_future().share());
+	}
+
+	auto container = std::make_shared<TrackContainer>();
+	container->OpenOrIngest(trackPath, encoding, maxFrameSize);
+	std::shared_ptr<const TrackContainer> result = std::move(container);
+	{
+		std::lock_guard<std::mutex> guardLock(m_lock);
+		m_loading.erase(key);
+		// entries released since the budget was lowered go first
+		Shrink();
+		if (result->IsOpen() && !Admit(key, hash, result))
+			GetMetrics().rejections.Add();
+	}
+	loaded.set_value(result);
+	return result;
+}
+
+
+
+std::string FrameCache::MakeKey(const std::string& trackPath, StreamEncoding encoding, size_t maxFrameSize)
+{
+	return trackPath + '|' + GetStreamEncodingName(encoding) + '|' + std::to_string(maxFrameSize);
+}
+
+
+
+bool FrameCache::Admit(const std::string& key, size_t hash, const std::shared_ptr<const TrackContainer>& container)
+{
+	const size_t bytes = container->GetImageSize();
+	if (bytes > m_budget || !MakeRoom(bytes, m_sketch.Estimate(hash)))
+		return false;
+
+	m_recency.push_front(key);
+	m_entries[key] = Entry{ container, hash, m_recency.begin() };
+	m_bytes += bytes;
+	GetMetrics().bytes.Add(static_cast<int64_t>(bytes));
+	GetMetrics().entries.Add(1);
+	return true;
+}
+
+
+
+bool FrameCache::MakeRoom(size_t bytes, unsigned int candidateFrequency)
+{
+	// the least recently used entries nobody is playing, as many as it takes; the candidate has to be
+	// asked for more often than every one of them, otherwise none is evicted
+	std::vector<std::list<std::string>::iterator> victims;
+	size_t freed = 0;
+	for (auto victim = m_recency.end(); m_bytes - freed + bytes > m_budget;)
+	{
+		if (victim == m_recency.begin())
+			return false;
+		const Entry& entry = m_entries.at(*--victim);
+		if (entry.container.use_count() > 1)
+			continue;
+		if (m_sketch.Estimate(entry.hash) >= candidateFrequency)
+			return false;
+		victims.push_back(victim);
+		freed += entry.container->GetImageSize();
+	}
+
+	for (const auto& victim : victims)
+		Evict(victim);
+	return true;
+}
+
+
+
+void FrameCache::Shrink()
+{
+	auto next = m_recency.end();
+	while (m_bytes > m_budget && next != m_recency.begin())
+	{
+		const auto victim = std::prev(next);
+		if (m_entries.at(*victim).container.use_count() > 1)
+			next = victim;
+		else
+			Evict(victim);
+	}
+}
+
+
+
+void FrameCache::Evict(std::list<std::string>::iterator victim)
+{
+	const auto entry = m_entries.find(*victim);
+	const size_t bytes = entry->second.container->GetImageSize();
+	m_bytes -= bytes;
+	m_entries.erase(entry);
+	m_recency.erase(victim);
+	GetMetrics().evictions.Add();
+	GetMetrics().bytes.Add(-static_cast<int64_t>(bytes));
+	GetMetrics().entries.Add(-1);
+}
+
+
+
+FrameCache::FrequencySketch::FrequencySketch() :
+	m_additions(0)
+{
+	for (auto& row : m_counters)
+		row.fill(0);
+}
+
+void FrameCache::FrequencySketch::Increment(size_t hash)
+{
+	for (size_t row = 0; row < DEPTH; row++)
+	{
+		uint8_t& counter = m_counters[row][GetIndex(hash, row)];
+		if (counter < 15)
+			counter++;
+	}
+
+	if (++m_additions == SAMPLE_SIZE)
+	{
+		for (auto& row : m_counters)
+			for (auto& counter : row)
+				counter >>= 1;
+		m_additions /= 2;
+	}
+}
+
+unsigned int FrameCache::FrequencySketch::Estimate(size_t hash) const
+{
+	unsigned int frequency = 15;
+	for (size_t row = 0; row < DEPTH; row++)
+		frequency = std::min<unsigned int>(frequency, m_counters[row][GetIndex(hash, row)]);
+	return frequency;
+}
+
+size_t FrameCache::FrequencySketch::GetIndex(size_t hash, size_t row)
+{
+	// one multiplicative hash per row derived from the key's hash
+	static constexpr uint64_t SEEDS[DEPTH] = { 0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull };
+	const uint64_t mixed = (static_cast<uint64_t>(hash) + row) * SEEDS[row];
+	return static_cast<size_t>(mixed >> 32) & (WIDTH - 1);
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <array>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "TrackContainer.h"
+
+
+
+// Process-wide cache of packetized tracks keyed by (track, encoding, frame size), shared by all
+// stations and sessions so a popular track is ingested once. The cache keeps to a byte budget: the
+// least recently used entry is the eviction victim, and a new track is only admitted over it when it
+// has been asked for more often (TinyLFU), so a one-off scan through the library can not flush it.
+// An entry is pinned while anyone outside the cache still holds it, playing tracks are never evicted.
+// Hits, misses, evictions, rejections and the bytes held are published as framecache.* metrics.
+class FrameCache
+{
+public:
+	static constexpr size_t DEFAULT_BUDGET = 256 * 1024 * 1024;
+
+	static FrameCache& Get();
+
+	//-- Evicts what it can right away, entries still pinned only go once they are released.
+	void SetBudget(size_t bytes);
+
+	//-- Returns the cached container, loading (and if needed ingesting) it on a miss. Concurrent
+	//-- misses on the same key wait for a single load. The container is never null but may be empty.
+	std::shared_ptr<const TrackContainer> Acquire(const std::string& trackPath, StreamEncoding encoding, size_t maxFrameSize);
+
+private:
+	// Count-min sketch of 4 bit counters, halved every SAMPLE_SIZE increments so old popularity fades.
+	class FrequencySketch
+	{
+	public:
+		static constexpr size_t WIDTH = 4096;
+		static constexpr size_t DEPTH = 4;
+		static constexpr size_t SAMPLE_SIZE = WIDTH * 10;
+
+		FrequencySketch();
+		void Increment(size_t hash);
+		unsigned int Estimate(size_t hash) const;
+
+	private:
+		static size_t GetIndex(size_t hash, size_t row);
+
+		std::array<std::array<uint8_t, WIDTH>, DEPTH> m_counters;
+		size_t m_additions;
+	};
+
+	struct Entry
+	{
+		std::shared_ptr<const TrackContainer> container;
+		size_t hash;
+		std::list<std::string>::iterator recency;
+	};
+
+	FrameCache();
+	static std::string MakeKey(const std::string& trackPath, StreamEncoding encoding, size_t maxFrameSize);
+	bool Admit(const std::string& key, size_t hash, const std::shared_ptr<const TrackContainer>& container);
+	//-- Room for a candidate, evicting only if every victim it takes is asked for less often; all or nothing.
+	bool MakeRoom(size_t bytes, unsigned int candidateFrequency);
+	//-- Back within the budget as far as unpinned entries allow, least recently used first.
+	void Shrink();
+	void Evict(std::list<std::string>::iterator victim);
+
+	mutable std::mutex m_lock;
+	size_t m_budget;
+	size_t m_bytes;
+	std::unordered_map<std::string, Entry> m_entries;
+	std::list<std::string> m_recency;       // most recently used first
+	std::unordered_map<std::string, std::shared_future<std::shared_ptr<const TrackContainer>>> m_loading;
+	FrequencySketch m_sketch;
+};
@@ -0,0 +1,58 @@
+#include "FrameEncoder.h"
+#include "AdpcmEncoder.h"
+#include "LosslessCodec.h"
+#include <algorithm>
+
+bool FrameEncoder::CanEncode(StreamEncoding encoding, const MYWAVEFORMATEX& pcmFormat)
+{
+	switch (encoding)
+	{
+		case StreamEncoding::Ima4:
+			return AdpcmEncoder::CanEncode(pcmFormat);
+		case StreamEncoding::Lossless:
+			return LosslessCodec::CanEncode(pcmFormat);
+		default:
+			return pcmFormat.nBlockAlign != 0;
+	}
+}
+
+
+
+EncodedTrack FrameEncoder::Encode(const char* data, size_t size, const MYWAVEFORMATEX& pcmFormat, StreamEncoding encoding, size_t maxFrameSize)
+{
+	EncodedTrack track;
+	if (!CanEncode(encoding, pcmFormat))
+		return track;
+
+	track.totalSamples = size / pcmFormat.nBlockAlign;
+	if (encoding == StreamEncoding::Ima4)
+	{
+		track.waveFormat = AdpcmEncoder::GetIma4Format(pcmFormat);
+		const std::vector<char> blocks = AdpcmEncoder::EncodeIma4(data, size, pcmFormat);
+		const size_t frameSize = std::max<size_t>(1, maxFrameSize / track.waveFormat.nBlockAlign) * track.waveFormat.nBlockAlign;
+		track.samplesPerFrame = static_cast<unsigned long>(frameSize / track.waveFormat.nBlockAlign * AdpcmEncoder::GetSamplesPerBlock(track.waveFormat));
+		for (size_t position = 0; position < blocks.size(); position += frameSize)
+			track.frames.emplace_back(blocks.begin() + position, blocks.begin() + std::min(blocks.size(), position + frameSize));
+		return track;
+	}
+
+	if (encoding == StreamEncoding::Lossless)
+	{
+		track.waveFormat = LosslessCodec::GetEncodedFormat(pcmFormat);
+		const size_t inputSize = LosslessCodec::GetFrameInputSize(maxFrameSize, pcmFormat);
+		track.samplesPerFrame = static_cast<unsigned long>(inputSize / pcmFormat.nBlockAlign);
+		for (size_t position = 0; position < size; position += inputSize)
+		{
+			track.frames.emplace_back();
+			LosslessCodec::EncodeFrame(data + position, std::min(inputSize, size - position), pcmFormat, track.frames.back());
+		}
+		return track;
+	}
+
+	track.waveFormat = pcmFormat;
+	const size_t frameSize = std::max<size_t>(pcmFormat.nBlockAlign, maxFrameSize - maxFrameSize % pcmFormat.nBlockAlign);
+	track.samplesPerFrame = static_cast<unsigned long>(frameSize / pcmFormat.nBlockAlign);
+	for (size_t position = 0; position < size; position += frameSize)
+		track.frames.emplace_back(data + position, data + std::min(size, position + frameSize));
+	return track;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <vector>
+#include "SoundFile.h"
+#include "StreamEncoding.h"
+
+// A track cut into wire payloads, every frame decodes on its own and carries waveFormat.
+struct EncodedTrack
+{
+	MYWAVEFORMATEX waveFormat;
+	std::vector<std::vector<char>> frames;
+	unsigned long samplesPerFrame;        // every frame but the last carries exactly this many sample frames
+	unsigned long long totalSamples;
+	EncodedTrack() :
+		samplesPerFrame(0),
+		totalSamples(0)
+	{
+		ZeroMemory(&waveFormat, sizeof(waveFormat));
+	}
+};
+
+
+
+class FrameEncoder
+{
+public:
+	static bool CanEncode(StreamEncoding encoding, const MYWAVEFORMATEX& pcmFormat);
+
+	//-- Cuts (and encodes) PCM data into frames of at most maxFrameSize bytes.
+	static EncodedTrack Encode(const char* data, size_t size, const MYWAVEFORMATEX& pcmFormat, StreamEncoding encoding, size_t maxFrameSize);
+};
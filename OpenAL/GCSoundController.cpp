@@ -1,4 +1,6 @@
 #include "GCSoundController.h"
+#include "AdpcmEncoder.h"
+#include "../SocketsClientServer/Metrics.h"
 #include <iostream>
 #pragma comment(lib, "../lib/OpenAL32.lib")
 
@@ -7,6 +9,7 @@ std::unique_ptr<ISoundController> CSoundController::g_testingInstance = nullptr;
 #endif
 std::recursive_mutex CSoundController::csSoundLock;
 ISoundController::SoundStatusChangeCallback CSoundController::m_statusChangeCallback;
+ISoundController::BufferCompletedCallback CSoundController::m_bufferCompletedCallback;
 std::unordered_map<ALuint, bool> CSoundController::m_shouldUnqueue;
 
 constexpr const char* GetErrorMessage(const uint& error)
@@ -38,6 +41,40 @@ bool GetALError(uint& error)
 
 
 
+ALenum GetALFormat(const MYWAVEFORMATEX& waveFormat)
+{
+  if (waveFormat.wFormatTag == WAVE_FORMAT_IMA_ADPCM)
+    return waveFormat.nChannels == 1 ? AL_FORMAT_MONO_IMA4 : AL_FORMAT_STEREO_IMA4;
+  if (waveFormat.wFormatTag == WAVE_FORMAT_ADPCM)
+    return waveFormat.nChannels == 1 ? AL_FORMAT_MONO_MSADPCM_SOFT : AL_FORMAT_STEREO_MSADPCM_SOFT;
+
+  if (waveFormat.nChannels == 1 && waveFormat.wBitsPerSample == 8)
+    return AL_FORMAT_MONO8;
+  else if (waveFormat.nChannels == 1 && waveFormat.wBitsPerSample == 16)
+    return AL_FORMAT_MONO16;
+  else if (waveFormat.nChannels == 2 && waveFormat.wBitsPerSample == 8)
+    return AL_FORMAT_STEREO8;
+  else if (waveFormat.nChannels == 2 && waveFormat.wBitsPerSample == 16)
+    return AL_FORMAT_STEREO16;
+  else if (waveFormat.nChannels == 1 && waveFormat.wBitsPerSample == 32)
+    return AL_FORMAT_MONO_FLOAT32;
+  else if (waveFormat.nChannels == 2 && waveFormat.wBitsPerSample == 32)
+    return AL_FORMAT_STEREO_FLOAT32;
+  return 0;
+}
+
+
+
+// ADPCM blocks are handed to OpenAL as they came off the wire, it only needs to know their size
+// (0 resets a reused buffer to the default alignment for PCM)
+void SetBufferData(ALuint buffer, const MYWAVEFORMATEX& waveFormat, const void* data, ALsizei size)
+{
+  alBufferi(buffer, AL_UNPACK_BLOCK_ALIGNMENT_SOFT, AdpcmEncoder::GetSamplesPerBlock(waveFormat));
+  alBufferData(buffer, GetALFormat(waveFormat), data, size, waveFormat.nSamplesPerSec);
+}
+
+
+
 CSoundController::CSoundController() : m_alcDevice(nullptr), m_alcContext(nullptr), m_initialized(false)
 {
   m_alcDevice = alcOpenDevice(nullptr);
@@ -91,21 +128,47 @@ void CSoundController::RegisterSoundStatusChangeCallback(SoundStatusChangeCallba
     m_statusChangeCallback = callback;
   }
 
+  EnableEvent(AL_EVENT_TYPE_SOURCE_STATE_CHANGED_SOFT, true);
+}
+
+void CSoundController::RegisterBufferCompletedCallback(BufferCompletedCallback callback)
+{
+  {
+    // taken by EventCallBack for the whole call, a callback replaced here is not running anymore
+    std::lock_guard lock(csSoundLock);
+    m_bufferCompletedCallback = callback;
+  }
+
+  // an event for every buffer played is only worth it while somebody listens
+  EnableEvent(AL_EVENT_TYPE_BUFFER_COMPLETED_SOFT, callback != nullptr);
+}
+
+void CSoundController::EnableEvent(ALenum eventType, bool enable)
+{
   if (!alIsExtensionPresent("AL_SOFT_EVENTS"))
   {
     return;
   }
 
-  std::vector<ALenum> evt_types = { AL_EVENT_TYPE_SOURCE_STATE_CHANGED_SOFT };
   auto alEventCallbackSOFT = reinterpret_cast<LPALEVENTCALLBACKSOFT>(alGetProcAddress("alEventCallbackSOFT"));
   auto alEventControlSOFT = reinterpret_cast<LPALEVENTCONTROLSOFT>(alGetProcAddress("alEventControlSOFT"));
-  alEventControlSOFT(evt_types.size(), evt_types.data(), AL_TRUE);
+  alEventControlSOFT(1, &eventType, enable ? AL_TRUE : AL_FALSE);
   alEventCallbackSOFT(EventCallBack, nullptr);
 }
 
 
 void AL_APIENTRY CSoundController::EventCallBack(ALenum eventType, ALuint object, ALuint param, ALsizei length, const ALchar* message, void* userParam)
 {
+  if (eventType == AL_EVENT_TYPE_BUFFER_COMPLETED_SOFT)
+  {
+    // param is the number of buffers, the source unqueues them where it refills; called under the lock
+    // so whoever registers nullptr can free what the callback reaches right after
+    std::lock_guard lock(csSoundLock);
+    if (m_bufferCompletedCallback)
+      m_bufferCompletedCallback(object, param);
+    return;
+  }
+
   SoundStatusChangeCallback callback = nullptr;
   {
     std::lock_guard lock(csSoundLock);
@@ -476,6 +539,40 @@ ulong CSoundController::GetCurrentPosition(const SoundInfo& soundInfo) const
   return alPosition;
 }
 
+SourcePlayout CSoundController::GetSourcePlayout(const SoundInfo& soundInfo) const
+{
+  SourcePlayout playout;
+  if (!m_initialized || !alIsSource(soundInfo.source))
+    return playout;
+
+  alGetSourcei(soundInfo.source, AL_SOURCE_STATE, &playout.state);
+  alGetSourcei(soundInfo.source, AL_BUFFERS_QUEUED, &playout.queuedBuffers);
+  alGetSourcei(soundInfo.source, AL_BUFFERS_PROCESSED, &playout.processedBuffers);
+
+  static const LPALGETSOURCEI64VSOFT getSourcei64v = alIsExtensionPresent("AL_SOFT_source_latency")
+    ? reinterpret_cast<LPALGETSOURCEI64VSOFT>(alGetProcAddress("alGetSourcei64vSOFT")) : nullptr;
+  if (getSourcei64v)
+  {
+    // sample offset in 32.32 fixed point and the latency in nanoseconds, read atomically
+    ALint64SOFT values[2] = { 0, 0 };
+    getSourcei64v(soundInfo.source, AL_SAMPLE_OFFSET_LATENCY_SOFT, values);
+    playout.sampleOffset = values[0] >> 32;
+    playout.latency = values[1];
+    playout.hasLatency = true;
+  }
+  else
+  {
+    ALint sampleOffset = 0;
+    alGetSourcei(soundInfo.source, AL_SAMPLE_OFFSET, &sampleOffset);
+    playout.sampleOffset = sampleOffset;
+  }
+
+  LogIfOpenALError("Could not query playout of source", soundInfo);
+  return playout;
+}
+
+
+
 void CSoundController::FullStopBuffer(const SoundInfo& info)
 {
 
@@ -496,27 +593,12 @@ void CSoundController::CreateNewSourceAndBuffer(const SoundFile& soundFile, Soun
   if (!m_initialized)
     return;
 
-  ALenum alDefaultFormat = 0;
-
   MYWAVEFORMATEX waveFormat=soundFile.GetWaveFormat();
   const std::vector<uchar> &vecSoundData=soundFile.GetSoundData();
 
-  if (waveFormat.nChannels == 1 && waveFormat.wBitsPerSample == 8)
-    alDefaultFormat = AL_FORMAT_MONO8;
-  else if (waveFormat.nChannels == 1 && waveFormat.wBitsPerSample == 16)
-    alDefaultFormat = AL_FORMAT_MONO16;
-  else if (waveFormat.nChannels == 2 && waveFormat.wBitsPerSample == 8)
-    alDefaultFormat = AL_FORMAT_STEREO8;
-  else if (waveFormat.nChannels == 2 && waveFormat.wBitsPerSample == 16)
-    alDefaultFormat = AL_FORMAT_STEREO16;
-  else if (waveFormat.nChannels == 1 && waveFormat.wBitsPerSample == 32)
-    alDefaultFormat = AL_FORMAT_MONO_FLOAT32;
-  else if (waveFormat.nChannels == 2 && waveFormat.wBitsPerSample == 32)
-    alDefaultFormat = AL_FORMAT_STEREO_FLOAT32;
-
   ALuint alBuffer;
   CreateBuffer(alBuffer, soundInfo);
-  alBufferData(alBuffer, alDefaultFormat, vecSoundData.data(), vecSoundData.size(), waveFormat.nSamplesPerSec);
+  SetBufferData(alBuffer, waveFormat, vecSoundData.data(), vecSoundData.size());
 
   if (LogIfOpenALError("Could not bind buffer with data", soundInfo))
   {
@@ -569,47 +651,43 @@ void CSoundController::PlaySource(ALuint source)
 
 void CSoundController::QueueAndPlayData(void* data, long size, const MYWAVEFORMATEX& waveFormat, ALuint buffer, const ALuint source, bool unqueue)
 {
-
-    ALenum alDefaultFormat = 0;
-
-    if (waveFormat.nChannels == 1 && waveFormat.wBitsPerSample == 8)
-        alDefaultFormat = AL_FORMAT_MONO8;
-    else if (waveFormat.nChannels == 1 && waveFormat.wBitsPerSample == 16)
-        alDefaultFormat = AL_FORMAT_MONO16;
-    else if (waveFormat.nChannels == 2 && waveFormat.wBitsPerSample == 8)
-        alDefaultFormat = AL_FORMAT_STEREO8;
-    else if (waveFormat.nChannels == 2 && waveFormat.wBitsPerSample == 16)
-        alDefaultFormat = AL_FORMAT_STEREO16;
-    else if (waveFormat.nChannels == 1 && waveFormat.wBitsPerSample == 32)
-        alDefaultFormat = AL_FORMAT_MONO_FLOAT32;
-    else if (waveFormat.nChannels == 2 && waveFormat.wBitsPerSample == 32)
-        alDefaultFormat = AL_FORMAT_STEREO_FLOAT32;
-
-
+    static const MetricCounter queuedBuffers("openal.queue.buffers");
+    static const MetricCounter recycledBuffers("openal.queue.recycled");
+    static const MetricCounter queuedBytes("openal.queue.bytes");
+    static const MetricCounter queueMisses("openal.queue.no_free_buffer");
+    static const MetricHistogram queueTime("openal.queue.us");
+    MetricTimer timer(queueTime);
 
     ALuint unqueued = 0;
     if (buffer == 255)
     {
         ALuint unqueued2 = UnqueueBuffer(source);
         m_shouldUnqueue[unqueued2] = true;
-        alBufferData(unqueued2, alDefaultFormat, data, size, waveFormat.nSamplesPerSec);
+        SetBufferData(unqueued2, waveFormat, data, size);
         alSourceQueueBuffers(source, 1, &unqueued2);
-        std::cout << "QUEUED BUFFER AFTER UNQEUEING" << unqueued2 << std::endl;
+        recycledBuffers.Add();
+        queuedBuffers.Add();
+        queuedBytes.Add(size);
     }
     else
     {
+        bool queued = false;
         for (const auto& val : m_shouldUnqueue)
         {
             if (val.second == false)
             {
                 unqueued = val.first;
                 m_shouldUnqueue[unqueued] = true;
-                alBufferData(unqueued, alDefaultFormat, data, size, waveFormat.nSamplesPerSec);
-                std::cout << "QUEUED BUFFER" << unqueued << std::endl;
+                SetBufferData(unqueued, waveFormat, data, size);
                 alSourceQueueBuffers(source, 1, &unqueued);
+                queuedBuffers.Add();
+                queuedBytes.Add(size);
+                queued = true;
                 break;
             }
         }
+        if (!queued)
+            queueMisses.Add();
     }
 
     static bool start = false;
@@ -25,6 +25,22 @@ struct SoundInfo
   {}
 };
 
+// Where a streaming source is in its buffer queue.
+struct SourcePlayout
+{
+  ALint state = AL_INITIAL;
+  ALint queuedBuffers = 0;              // including the processed ones not unqueued yet
+  ALint processedBuffers = 0;
+  ALint64SOFT sampleOffset = 0;         // sample frames into the queue
+  ALint64SOFT latency = 0;              // nanoseconds until the current sample reaches the device output
+  bool hasLatency = false;              // AL_SOFT_source_latency is available
+};
+
+ALenum GetALFormat(const MYWAVEFORMATEX& waveFormat);
+
+// Fills buffer with PCM or ADPCM (as it came off the wire) data.
+void SetBufferData(ALuint buffer, const MYWAVEFORMATEX& waveFormat, const void* data, ALsizei size);
+
 class ISoundController
 {
 public:
@@ -62,10 +78,18 @@ public:
 
   virtual void PlaySource(ALuint source) = 0;
 
+  virtual SourcePlayout GetSourcePlayout(const SoundInfo& soundInfo) const = 0;
+
   enum class StatusChange : uint8_t { Paused, Stopped };
 
   using SoundStatusChangeCallback = std::function<void (uint object, StatusChange status)>;
   virtual void RegisterSoundStatusChangeCallback(SoundStatusChangeCallback callback) = 0;
+
+  // OpenAL finished playing buffers of a streaming source (AL_SOFT_events), called on OpenAL's event
+  // thread; raising an EventLoop::Signal there lets a coroutine co_await the buffers it can refill.
+  // Once nullptr is registered no call of the previous callback is running or will be made.
+  using BufferCompletedCallback = std::function<void (uint source, uint buffers)>;
+  virtual void RegisterBufferCompletedCallback(BufferCompletedCallback callback) = 0;
 };
 
 class CSoundController : public ISoundController
@@ -80,6 +104,8 @@ public:
 
   void RegisterSoundStatusChangeCallback(SoundStatusChangeCallback callback);
 
+  void RegisterBufferCompletedCallback(BufferCompletedCallback callback) override;
+
   void DeleteSource(const SoundInfo& soundInfo, bool deleteFromList = true) override;
 
   void StopSound(const SoundInfo& soundInfo) override;
@@ -112,6 +138,8 @@ public:
 
   void PlaySource(ALuint source) override;
 
+  SourcePlayout GetSourcePlayout(const SoundInfo& soundInfo) const override;
+
   static void AL_APIENTRY EventCallBack(ALenum eventType, ALuint object, ALuint param,
     ALsizei length, const ALchar* message,
     void* userParam);
@@ -131,6 +159,7 @@ protected:
 private:
   static std::recursive_mutex csSoundLock;
   static SoundStatusChangeCallback m_statusChangeCallback;
+  static BufferCompletedCallback m_bufferCompletedCallback;
   std::atomic_bool m_initialized;
   ALCdevice* m_alcDevice;
   ALCcontext* m_alcContext;
@@ -149,5 +178,7 @@ private:
 
   bool LogIfOpenALError(const char* message, const SoundInfo& soundInfo) const;
 
+  static void EnableEvent(ALenum eventType, bool enable);
+
   int UnqueueBuffer(const ALuint& source);
 };
\ No newline at end of file
@@ -0,0 +1,417 @@
+#include "LosslessCodec.h"
+#include <array>
+#include <bit>
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+	constexpr uchar MODE_INDEPENDENT = 0;
+	constexpr uchar MODE_LEFT_SIDE = 1;
+	constexpr uchar MODE_VERBATIM = 0xFF;
+	constexpr uchar MAX_ORDER = 4;
+	constexpr uchar MAX_RICE_PARAMETER = 30;
+	constexpr size_t FRAME_HEADER_SIZE = 3;
+
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(std::vector<char>& output) : m_output(output) {}
+
+		void Write(uint32_t value, int count)
+		{
+			if (!count)
+				return;
+			m_accumulator = (m_accumulator << count) | (value & (0xFFFFFFFFu >> (32 - count)));
+			m_bits += count;
+			while (m_bits >= 8)
+			{
+				m_bits -= 8;
+				m_output.push_back(static_cast<char>(m_accumulator >> m_bits));
+			}
+		}
+
+		void WriteRice(int32_t residual, int parameter)
+		{
+			const uint32_t folded = (static_cast<uint32_t>(residual) << 1) ^ static_cast<uint32_t>(residual >> 31);
+			uint32_t quotient = folded >> parameter;
+			while (quotient >= 31)
+			{
+				Write(0, 31);
+				quotient -= 31;
+			}
+			Write(1, quotient + 1);
+			Write(folded, parameter);
+		}
+
+		void Flush()
+		{
+			if (m_bits)
+				m_output.push_back(static_cast<char>(m_accumulator << (8 - m_bits)));
+			m_bits = 0;
+		}
+
+	private:
+		std::vector<char>& m_output;
+		uint64_t m_accumulator = 0;
+		int m_bits = 0;
+	};
+
+	// MSB first reader with a 64 bit window, unary prefixes are decoded with one count of leading zeros.
+	class BitReader
+	{
+	public:
+		BitReader(const uchar* data, size_t size) : m_data(data), m_size(size) {}
+
+		bool IsOverrun() const noexcept { return m_position > m_size + 8; }
+
+		uint32_t Read(int count)
+		{
+			if (!count)
+				return 0;
+			Refill();
+			const uint32_t value = static_cast<uint32_t>(m_window >> (64 - count));
+			m_window <<= count;
+			m_bits -= count;
+			return value;
+		}
+
+		int32_t ReadRice(int parameter)
+		{
+			uint32_t quotient = 0;
+			while (true)
+			{
+				Refill();
+				if (m_window)
+				{
+					const int zeros = std::countl_zero(m_window);
+					quotient += zeros;
+					m_window <<= zeros;
+					m_window <<= 1;
+					m_bits -= zeros + 1;
+					break;
+				}
+				quotient += m_bits;
+				m_bits = 0;
+				if (IsOverrun())
+					return 0;
+			}
+			const uint32_t folded = (quotient << parameter) | Read(parameter);
+			return static_cast<int32_t>(folded >> 1) ^ -static_cast<int32_t>(folded & 1);
+		}
+
+	private:
+		void Refill()
+		{
+			while (m_bits <= 56)
+			{
+				const uint64_t byte = m_position < m_size ? m_data[m_position] : 0;
+				m_position++;
+				m_window |= byte << (56 - m_bits);
+				m_bits += 8;
+			}
+		}
+
+		const uchar* m_data;
+		size_t m_size;
+		size_t m_position = 0;
+		uint64_t m_window = 0;
+		int m_bits = 0;
+	};
+
+	void ComputeResiduals(const int32_t* samples, size_t count, int order, int32_t* residuals)
+	{
+		switch (order)
+		{
+			case 0:
+				for (size_t i = 0; i < count; i++)
+					residuals[i] = samples[i];
+				break;
+			case 1:
+				for (size_t i = 1; i < count; i++)
+					residuals[i] = samples[i] - samples[i - 1];
+				break;
+			case 2:
+				for (size_t i = 2; i < count; i++)
+					residuals[i] = samples[i] - 2 * samples[i - 1] + samples[i - 2];
+				break;
+			case 3:
+				for (size_t i = 3; i < count; i++)
+					residuals[i] = samples[i] - 3 * samples[i - 1] + 3 * samples[i - 2] - samples[i - 3];
+				break;
+			default:
+				for (size_t i = 4; i < count; i++)
+					residuals[i] = samples[i] - 4 * samples[i - 1] + 6 * samples[i - 2] - 4 * samples[i - 3] + samples[i - 4];
+				break;
+		}
+	}
+
+	void Reconstruct(int32_t* samples, size_t count, int order)
+	{
+		switch (order)
+		{
+			case 1:
+				for (size_t i = 1; i < count; i++)
+					samples[i] += samples[i - 1];
+				break;
+			case 2:
+				for (size_t i = 2; i < count; i++)
+					samples[i] += 2 * samples[i - 1] - samples[i - 2];
+				break;
+			case 3:
+				for (size_t i = 3; i < count; i++)
+					samples[i] += 3 * samples[i - 1] - 3 * samples[i - 2] + samples[i - 3];
+				break;
+			case 4:
+				for (size_t i = 4; i < count; i++)
+					samples[i] += 4 * samples[i - 1] - 6 * samples[i - 2] + 4 * samples[i - 3] - samples[i - 4];
+				break;
+			default:
+				break;
+		}
+	}
+
+	struct Subframe
+	{
+		int order = 0;
+		int parameter = 0;
+		uint64_t cost = 0;
+		std::vector<int32_t> residuals;
+	};
+
+	// Picks the predictor with the smallest residual magnitude and the matching Rice parameter.
+	Subframe AnalyzeChannel(const std::vector<int32_t>& samples)
+	{
+		Subframe best;
+		best.cost = UINT64_MAX;
+		std::vector<int32_t> residuals(samples.size());
+		const size_t maxOrder = std::min<size_t>(MAX_ORDER, samples.size());
+
+		for (size_t order = 0; order <= maxOrder; order++)
+		{
+			ComputeResiduals(samples.data(), samples.size(), static_cast<int>(order), residuals.data());
+			uint64_t sum = 0;
+			for (size_t i = order; i < samples.size(); i++)
+				sum += static_cast<uint64_t>(std::abs(residuals[i]));
+
+			const uint64_t count = std::max<uint64_t>(1, samples.size() - order);
+			int parameter = 0;
+			while (parameter < MAX_RICE_PARAMETER && (count << parameter) < sum)
+				parameter++;
+
+			// unary part plus stop bit plus the low bits, warm up samples are stored verbatim
+			const uint64_t cost = (sum * 2 >> parameter) + count * (parameter + 1) + order * 32;
+			if (cost < best.cost)
+			{
+				best.order = static_cast<int>(order);
+				best.parameter = parameter;
+				best.cost = cost;
+				best.residuals = residuals;
+			}
+		}
+		return best;
+	}
+
+	void WriteInt32(std::vector<char>& output, int32_t value)
+	{
+		for (int byte = 0; byte < 4; byte++)
+			output.push_back(static_cast<char>((static_cast<uint32_t>(value) >> (byte * 8)) & 0xFF));
+	}
+
+	int32_t ReadInt32(const uchar* input)
+	{
+		return static_cast<int32_t>(input[0] | (input[1] << 8) | (input[2] << 16) | (static_cast<uint32_t>(input[3]) << 24));
+	}
+}
+
+
+
+bool LosslessCodec::CanEncode(const MYWAVEFORMATEX& pcmFormat)
+{
+	return pcmFormat.wFormatTag == WAVE_FORMAT_PCM
+		&& pcmFormat.wBitsPerSample == 16
+		&& (pcmFormat.nChannels == 1 || pcmFormat.nChannels == 2);
+}
+
+
+
+MYWAVEFORMATEX LosslessCodec::GetEncodedFormat(const MYWAVEFORMATEX& pcmFormat)
+{
+	MYWAVEFORMATEX format = pcmFormat;
+	format.wFormatTag = WAVE_FORMAT_LOSSLESS_RICE;
+	return format;
+}
+
+
+
+MYWAVEFORMATEX LosslessCodec::GetDecodedFormat(const MYWAVEFORMATEX& encodedFormat)
+{
+	MYWAVEFORMATEX format = encodedFormat;
+	format.wFormatTag = WAVE_FORMAT_PCM;
+	return format;
+}
+
+
+
+size_t LosslessCodec::GetFrameInputSize(size_t maxFrameSize, const MYWAVEFORMATEX& pcmFormat)
+{
+	// a frame counts its sample frames in 16 bits, EncodeFrame would drop whatever is past that
+	const size_t input = maxFrameSize > MAX_FRAME_OVERHEAD ? maxFrameSize - MAX_FRAME_OVERHEAD : 0;
+	if (!pcmFormat.nBlockAlign)
+		return input;
+	return std::min<size_t>(input - input % pcmFormat.nBlockAlign, static_cast<size_t>(UINT16_MAX) * pcmFormat.nBlockAlign);
+}
+
+
+
+void LosslessCodec::EncodeFrame(const char* data, size_t size, const MYWAVEFORMATEX& pcmFormat, std::vector<char>& frame)
+{
+	frame.clear();
+	const size_t channels = pcmFormat.nChannels;
+	const size_t frames = std::min<size_t>(size / pcmFormat.nBlockAlign, UINT16_MAX);
+	const int16_t* samples = reinterpret_cast<const int16_t*>(data);
+
+	std::array<std::vector<int32_t>, 2> input;
+	for (size_t channel = 0; channel < channels; channel++)
+	{
+		input[channel].resize(frames);
+		for (size_t i = 0; i < frames; i++)
+			input[channel][i] = samples[i * channels + channel];
+	}
+
+	uchar mode = MODE_INDEPENDENT;
+	std::array<Subframe, 2> subframes;
+	subframes[0] = AnalyzeChannel(input[0]);
+	if (channels == 2)
+	{
+		subframes[1] = AnalyzeChannel(input[1]);
+		std::vector<int32_t> side(frames);
+		for (size_t i = 0; i < frames; i++)
+			side[i] = input[0][i] - input[1][i];
+		Subframe sideSubframe = AnalyzeChannel(side);
+		if (sideSubframe.cost < subframes[1].cost)
+		{
+			mode = MODE_LEFT_SIDE;
+			subframes[1] = std::move(sideSubframe);
+			input[1] = std::move(side);
+		}
+	}
+
+	frame.push_back(static_cast<char>(frames & 0xFF));
+	frame.push_back(static_cast<char>(frames >> 8));
+	frame.push_back(static_cast<char>(mode));
+	for (size_t channel = 0; channel < channels; channel++)
+	{
+		frame.push_back(static_cast<char>(subframes[channel].order));
+		frame.push_back(static_cast<char>(subframes[channel].parameter));
+		for (int i = 0; i < subframes[channel].order; i++)
+			WriteInt32(frame, input[channel][i]);
+	}
+
+	BitWriter writer(frame);
+	for (size_t channel = 0; channel < channels; channel++)
+	{
+		const Subframe& subframe = subframes[channel];
+		for (size_t i = subframe.order; i < frames; i++)
+			writer.WriteRice(subframe.residuals[i], subframe.parameter);
+	}
+	writer.Flush();
+
+	// noise does not compress, it is cheaper to send it as it is
+	const size_t rawSize = frames * pcmFormat.nBlockAlign;
+	if (frame.size() >= FRAME_HEADER_SIZE + rawSize)
+	{
+		frame.resize(FRAME_HEADER_SIZE);
+		frame[2] = static_cast<char>(MODE_VERBATIM);
+		frame.insert(frame.end(), data, data + rawSize);
+	}
+}
+
+
+
+size_t LosslessCodec::GetFrameCount(const char* frame, size_t size)
+{
+	if (size < FRAME_HEADER_SIZE)
+		return 0;
+	return static_cast<uchar>(frame[0]) | (static_cast<uchar>(frame[1]) << 8);
+}
+
+
+
+bool LosslessCodec::DecodeFrame(const char* frame, size_t size, const MYWAVEFORMATEX& encodedFormat, std::vector<char>& pcm)
+{
+	const uchar* input = reinterpret_cast<const uchar*>(frame);
+	const size_t channels = encodedFormat.nChannels;
+	if (size < FRAME_HEADER_SIZE || (channels != 1 && channels != 2) || encodedFormat.wBitsPerSample != 16)
+		return false;
+
+	const size_t frames = input[0] | (input[1] << 8);
+	const uchar mode = input[2];
+	const size_t rawSize = frames * encodedFormat.nBlockAlign;
+	pcm.resize(rawSize);
+
+	if (mode == MODE_VERBATIM)
+	{
+		if (size < FRAME_HEADER_SIZE + rawSize)
+			return false;
+		std::memcpy(pcm.data(), input + FRAME_HEADER_SIZE, rawSize);
+		return true;
+	}
+
+	if (mode != MODE_INDEPENDENT && !(mode == MODE_LEFT_SIDE && channels == 2))
+		return false;
+
+	size_t position = FRAME_HEADER_SIZE;
+	std::array<std::vector<int32_t>, 2> output;
+	std::array<int, 2> orders{};
+	std::array<int, 2> parameters{};
+	for (size_t channel = 0; channel < channels; channel++)
+	{
+		if (position + 2 > size)
+			return false;
+		orders[channel] = input[position++];
+		parameters[channel] = input[position++];
+		if (orders[channel] > MAX_ORDER || orders[channel] > int(frames) || parameters[channel] > MAX_RICE_PARAMETER
+			|| position + orders[channel] * 4 > size)
+			return false;
+
+		output[channel].resize(frames);
+		for (int i = 0; i < orders[channel]; i++, position += 4)
+			output[channel][i] = ReadInt32(input + position);
+	}
+
+	BitReader reader(input + position, size - position);
+	for (size_t channel = 0; channel < channels; channel++)
+	{
+		int32_t* samples = output[channel].data();
+		for (size_t i = orders[channel]; i < frames; i++)
+			samples[i] = reader.ReadRice(parameters[channel]);
+		if (reader.IsOverrun())
+			return false;
+		Reconstruct(samples, frames, orders[channel]);
+	}
+
+	// decorrelation and interleaving are straight loops without dependencies, the compiler vectorizes them
+	int16_t* samples = reinterpret_cast<int16_t*>(pcm.data());
+	if (channels == 1)
+	{
+		const int32_t* mono = output[0].data();
+		for (size_t i = 0; i < frames; i++)
+			samples[i] = static_cast<int16_t>(mono[i]);
+		return true;
+	}
+
+	const int32_t* left = output[0].data();
+	int32_t* right = output[1].data();
+	if (mode == MODE_LEFT_SIDE)
+	{
+		for (size_t i = 0; i < frames; i++)
+			right[i] = left[i] - right[i];
+	}
+	for (size_t i = 0; i < frames; i++)
+	{
+		samples[2 * i] = static_cast<int16_t>(left[i]);
+		samples[2 * i + 1] = static_cast<int16_t>(right[i]);
+	}
+	return true;
+}
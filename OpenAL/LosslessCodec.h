@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+#include "SoundFile.h"
+
+#ifndef WAVE_FORMAT_LOSSLESS_RICE
+#define WAVE_FORMAT_LOSSLESS_RICE   0x4C52
+#endif
+
+// Bit-exact frame codec for 16 bit PCM: fixed polynomial prediction (order 0-4, as in FLAC) with
+// left/side stereo decorrelation and Rice coded residuals. Every frame decodes on its own.
+//
+// Frame layout: u16 frame count, u8 channel mode, then per channel u8 order, u8 rice parameter
+// and order * i32 warm up samples, followed by the residual bit stream of all channels.
+class LosslessCodec
+{
+public:
+	static constexpr unsigned int MAX_FRAME_OVERHEAD = 16;
+
+	static bool CanEncode(const MYWAVEFORMATEX& pcmFormat);
+	static MYWAVEFORMATEX GetEncodedFormat(const MYWAVEFORMATEX& pcmFormat);
+	static MYWAVEFORMATEX GetDecodedFormat(const MYWAVEFORMATEX& encodedFormat);
+
+	//-- Largest PCM input whose frame (even a verbatim one) still fits into maxFrameSize bytes, at most UINT16_MAX sample frames.
+	static size_t GetFrameInputSize(size_t maxFrameSize, const MYWAVEFORMATEX& pcmFormat);
+
+	static void EncodeFrame(const char* data, size_t size, const MYWAVEFORMATEX& pcmFormat, std::vector<char>& frame);
+
+	//-- Sample frames carried by an encoded frame, read from its header.
+	static size_t GetFrameCount(const char* frame, size_t size);
+
+	//-- Returns false for a malformed frame, pcm is resized to the decoded data.
+	static bool DecodeFrame(const char* frame, size_t size, const MYWAVEFORMATEX& encodedFormat, std::vector<char>& pcm);
+};
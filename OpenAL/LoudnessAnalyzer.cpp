@@ -0,0 +1,323 @@
+#include "LoudnessAnalyzer.h"
+#include "TrackSidecar.h"
+#include <array>
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+	constexpr uint32_t LOUDNESS_MAGIC = mmioFOURCC('L', 'D', 'N', 'S');
+	constexpr uint32_t LOUDNESS_VERSION = 2;
+	constexpr size_t BLOCK_FRAMES = 1024;
+	constexpr size_t OVERSAMPLING = 4;
+	constexpr size_t PHASE_TAPS = 12;
+	constexpr double ABSOLUTE_GATE = -70.0;
+	constexpr double RELATIVE_GATE = -10.0;
+	constexpr double PI = 3.14159265358979323846;
+
+#pragma pack(1)
+	struct LoudnessRecord
+	{
+		float integratedLoudness;
+		float truePeak;
+		float replayGain;
+	};
+#pragma pack()
+
+	struct Biquad
+	{
+		double b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+		double z1 = 0.0, z2 = 0.0;
+
+		inline double Process(double in)
+		{
+			const double out = b0 * in + z1;
+			z1 = b1 * in - a1 * out + z2;
+			z2 = b2 * in - a2 * out;
+			return out;
+		}
+	};
+
+	// K-weighting (BS.1770 pre-filter + RLB high pass), coefficients re-derived for the track's sample rate.
+	void CreateKWeighting(double sampleRate, Biquad& shelf, Biquad& highPass)
+	{
+		double f0 = 1681.974450955533;
+		const double gain = 3.999843853973347;
+		double q = 0.7071752369554196;
+		double k = std::tan(PI * f0 / sampleRate);
+		const double vh = std::pow(10.0, gain / 20.0);
+		const double vb = std::pow(vh, 0.4996667741545416);
+		double a0 = 1.0 + k / q + k * k;
+		shelf.b0 = (vh + vb * k / q + k * k) / a0;
+		shelf.b1 = 2.0 * (k * k - vh) / a0;
+		shelf.b2 = (vh - vb * k / q + k * k) / a0;
+		shelf.a1 = 2.0 * (k * k - 1.0) / a0;
+		shelf.a2 = (1.0 - k / q + k * k) / a0;
+
+		f0 = 38.13547087602444;
+		q = 0.5003270373238773;
+		k = std::tan(PI * f0 / sampleRate);
+		a0 = 1.0 + k / q + k * k;
+		highPass.b0 = 1.0;
+		highPass.b1 = -2.0;
+		highPass.b2 = 1.0;
+		highPass.a1 = 2.0 * (k * k - 1.0) / a0;
+		highPass.a2 = (1.0 - k / q + k * k) / a0;
+	}
+
+	using PhaseTable = std::array<std::array<float, PHASE_TAPS>, OVERSAMPLING>;
+
+	// Polyphase windowed-sinc interpolator used for the 4x oversampled true peak.
+	const PhaseTable& GetInterpolationTable()
+	{
+		static const PhaseTable table = []
+		{
+			PhaseTable result{};
+			constexpr double center = double(OVERSAMPLING * PHASE_TAPS / 2);
+			for (size_t phase = 0; phase < OVERSAMPLING; phase++)
+			{
+				for (size_t tap = 0; tap < PHASE_TAPS; tap++)
+				{
+					const double n = double(tap * OVERSAMPLING + phase) - center;
+					const double t = n / OVERSAMPLING;
+					const double sinc = (t == 0.0) ? 1.0 : std::sin(PI * t) / (PI * t);
+					const double window = 0.5 + 0.5 * std::cos(PI * n / center);
+					result[phase][tap] = static_cast<float>(sinc * window);
+				}
+			}
+			return result;
+		}();
+		return table;
+	}
+
+	struct ChannelState
+	{
+		Biquad shelf;
+		Biquad highPass;
+		std::vector<float> work = std::vector<float>(PHASE_TAPS - 1 + BLOCK_FRAMES, 0.0f);
+	};
+
+	float ReadSample(const uchar* frame, size_t channel, WORD bitsPerSample)
+	{
+		switch (bitsPerSample)
+		{
+			case 8:
+				return (float(frame[channel]) - 128.0f) / 128.0f;
+			case 16:
+				return float(reinterpret_cast<const int16_t*>(frame)[channel]) / 32768.0f;
+			case 32:
+				return reinterpret_cast<const float*>(frame)[channel];
+			default:
+				return 0.0f;
+		}
+	}
+
+	double PowerToLoudness(double power)
+	{
+		return -0.691 + 10.0 * std::log10(power);
+	}
+}
+
+
+
+float LoudnessInfo::GetLinearGain() const
+{
+	return std::pow(10.0f, replayGain / 20.0f);
+}
+
+
+
+LoudnessInfo LoudnessAnalyzer::Analyze(const SoundFile& soundFile)
+{
+	LoudnessInfo info;
+	const MYWAVEFORMATEX waveFormat = soundFile.GetWaveFormat();
+	const std::vector<uchar>& data = soundFile.GetSoundData();
+	if (!waveFormat.nChannels || !waveFormat.nBlockAlign || !waveFormat.nSamplesPerSec)
+		return info;
+
+	const size_t channels = waveFormat.nChannels;
+	const size_t totalFrames = data.size() / waveFormat.nBlockAlign;
+	const size_t subBlockFrames = std::max<size_t>(1, waveFormat.nSamplesPerSec / 10);
+	const PhaseTable& phases = GetInterpolationTable();
+
+	std::vector<ChannelState> states(channels);
+	for (auto& state : states)
+		CreateKWeighting(waveFormat.nSamplesPerSec, state.shelf, state.highPass);
+
+	std::vector<double> subBlockPower;
+	subBlockPower.reserve(totalFrames / subBlockFrames + 1);
+	std::vector<double> frameEnergy(BLOCK_FRAMES);
+	std::array<float, BLOCK_FRAMES> oversampled;
+	double subBlockEnergy = 0.0;
+	size_t subBlockFill = 0;
+	float peak = 0.0f;
+
+	for (size_t first = 0; first < totalFrames; first += BLOCK_FRAMES)
+	{
+		const size_t frames = std::min(BLOCK_FRAMES, totalFrames - first);
+		std::fill(frameEnergy.begin(), frameEnergy.begin() + frames, 0.0);
+
+		for (size_t channel = 0; channel < channels; channel++)
+		{
+			ChannelState& state = states[channel];
+			float* samples = state.work.data() + PHASE_TAPS - 1;
+			const uchar* frame = data.data() + first * waveFormat.nBlockAlign;
+			for (size_t i = 0; i < frames; i++, frame += waveFormat.nBlockAlign)
+				samples[i] = ReadSample(frame, channel, waveFormat.wBitsPerSample);
+
+			// K-weighted energy, the only serial part of the pass
+			for (size_t i = 0; i < frames; i++)
+			{
+				const double weighted = state.highPass.Process(state.shelf.Process(samples[i]));
+				frameEnergy[i] += weighted * weighted;
+			}
+
+			// true peak, each phase is a short FIR across the whole block so the loops vectorize
+			for (size_t phase = 0; phase < OVERSAMPLING; phase++)
+			{
+				std::fill(oversampled.begin(), oversampled.begin() + frames, 0.0f);
+				for (size_t tap = 0; tap < PHASE_TAPS; tap++)
+				{
+					const float coefficient = phases[phase][tap];
+					const float* source = state.work.data() + PHASE_TAPS - 1 - tap;
+					for (size_t i = 0; i < frames; i++)
+						oversampled[i] += coefficient * source[i];
+				}
+				for (size_t i = 0; i < frames; i++)
+					peak = std::max(peak, std::abs(oversampled[i]));
+			}
+
+			std::copy(samples + frames - (PHASE_TAPS - 1), samples + frames, state.work.begin());
+		}
+
+		for (size_t i = 0; i < frames; i++)
+		{
+			subBlockEnergy += frameEnergy[i];
+			if (++subBlockFill == subBlockFrames)
+			{
+				subBlockPower.push_back(subBlockEnergy / subBlockFrames);
+				subBlockEnergy = 0.0;
+				subBlockFill = 0;
+			}
+		}
+	}
+
+	info.truePeak = peak;
+
+	// gating blocks are 400 ms long with 75% overlap, i.e. four consecutive 100 ms sub blocks
+	std::vector<double> blockPower;
+	for (size_t block = 0; block + 4 <= subBlockPower.size(); block++)
+	{
+		const double power = (subBlockPower[block] + subBlockPower[block + 1] + subBlockPower[block + 2] + subBlockPower[block + 3]) / 4.0;
+		if (power > 0.0 && PowerToLoudness(power) > ABSOLUTE_GATE)
+			blockPower.push_back(power);
+	}
+
+	if (blockPower.empty())
+		return info;
+
+	double sum = 0.0;
+	for (double power : blockPower)
+		sum += power;
+	const double relativeGate = PowerToLoudness(sum / blockPower.size()) + RELATIVE_GATE;
+
+	sum = 0.0;
+	size_t gated = 0;
+	for (double power : blockPower)
+	{
+		if (PowerToLoudness(power) > relativeGate)
+		{
+			sum += power;
+			gated++;
+		}
+	}
+
+	if (!gated)
+		return info;
+
+	info.integratedLoudness = static_cast<float>(PowerToLoudness(sum / gated));
+	float gain = REFERENCE_LOUDNESS - info.integratedLoudness;
+	if (info.truePeak > 0.0f)
+		gain = std::min(gain, -20.0f * std::log10(info.truePeak));
+	info.replayGain = gain;
+	return info;
+}
+
+
+
+LoudnessInfo LoudnessAnalyzer::LoadOrAnalyze(const std::string& trackPath, const SoundFile& soundFile)
+{
+	LoudnessInfo info;
+	if (Load(trackPath, info))
+		return info;
+
+	info = Analyze(soundFile);
+	Save(trackPath, info);
+	return info;
+}
+
+
+
+bool LoudnessAnalyzer::Load(const std::string& trackPath, LoudnessInfo& info)
+{
+	LoudnessRecord record;
+	if (!TrackSidecar::Read(GetSidecarPath(trackPath), LOUDNESS_MAGIC, LOUDNESS_VERSION, TrackSidecar::GetSourceStamp(trackPath), record))
+		return false;
+
+	info.integratedLoudness = record.integratedLoudness;
+	info.truePeak = record.truePeak;
+	info.replayGain = record.replayGain;
+	return true;
+}
+
+
+
+bool LoudnessAnalyzer::Save(const std::string& trackPath, const LoudnessInfo& info)
+{
+	const LoudnessRecord record{ info.integratedLoudness, info.truePeak, info.replayGain };
+	return TrackSidecar::Write(GetSidecarPath(trackPath), LOUDNESS_MAGIC, LOUDNESS_VERSION, TrackSidecar::GetSourceStamp(trackPath), record);
+}
+
+
+
+std::string LoudnessAnalyzer::GetSidecarPath(const std::string& trackPath)
+{
+	return trackPath + ".loudness";
+}
+
+
+
+void LoudnessAnalyzer::ApplyGain(char* data, size_t size, const MYWAVEFORMATEX& waveFormat, float gain)
+{
+	if (gain == 1.0f)
+		return;
+
+	switch (waveFormat.wBitsPerSample)
+	{
+		case 8:
+		{
+			uchar* samples = reinterpret_cast<uchar*>(data);
+			for (size_t i = 0; i < size; i++)
+				samples[i] = static_cast<uchar>(std::clamp((float(samples[i]) - 128.0f) * gain + 128.0f, 0.0f, 255.0f));
+			break;
+		}
+		case 16:
+		{
+			int16_t* samples = reinterpret_cast<int16_t*>(data);
+			const size_t count = size / sizeof(int16_t);
+			for (size_t i = 0; i < count; i++)
+				samples[i] = static_cast<int16_t>(std::clamp(float(samples[i]) * gain, -32768.0f, 32767.0f));
+			break;
+		}
+		case 32:
+		{
+			float* samples = reinterpret_cast<float*>(data);
+			const size_t count = size / sizeof(float);
+			for (size_t i = 0; i < count; i++)
+				samples[i] *= gain;
+			break;
+		}
+		default:
+			break;
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "SoundFile.h"
+
+// Result of the ingest-time loudness analysis (ITU-R BS.1770 / ReplayGain 2.0).
+struct LoudnessInfo
+{
+	float integratedLoudness;   // LUFS
+	float truePeak;             // linear, 1.0 == full scale
+	float replayGain;           // dB, already limited so the true peak does not clip
+	LoudnessInfo() :
+		integratedLoudness(-70.0f),
+		truePeak(0.0f),
+		replayGain(0.0f)
+	{}
+	float GetLinearGain() const;
+};
+
+
+
+class LoudnessAnalyzer
+{
+public:
+	static constexpr float REFERENCE_LOUDNESS = -18.0f;
+
+	//-- Measures integrated loudness, true peak and replay gain in a single pass over the sound data.
+	static LoudnessInfo Analyze(const SoundFile& soundFile);
+
+	//-- Reads the analysis persisted next to the track, or analyzes and persists it when missing or the wave file changed.
+	static LoudnessInfo LoadOrAnalyze(const std::string& trackPath, const SoundFile& soundFile);
+	static bool Load(const std::string& trackPath, LoudnessInfo& info);
+	static bool Save(const std::string& trackPath, const LoudnessInfo& info);
+	static std::string GetSidecarPath(const std::string& trackPath);
+
+	//-- Fused gain stage, scales PCM data in place (saturating for integer formats).
+	static void ApplyGain(char* data, size_t size, const MYWAVEFORMATEX& waveFormat, float gain);
+};
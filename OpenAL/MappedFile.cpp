@@ -0,0 +1,86 @@
+#include "MappedFile.h"
+#include <filesystem>
+#include <fstream>
+
+MappedFile::MappedFile() :
+	m_file(INVALID_HANDLE_VALUE),
+	m_mapping(nullptr),
+	m_view(nullptr),
+	m_size(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+
+
+bool MappedFile::Write(const std::string& path, const std::vector<char>& image)
+{
+	if (image.empty())
+		return false;
+
+	const std::string temporaryPath = path + ".tmp";
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!file.write(image.data(), image.size()))
+			return false;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, path, error);
+	if (error)
+	{
+		std::filesystem::remove(temporaryPath, error);
+		return false;
+	}
+	return true;
+}
+
+
+
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE)
+		return false;
+
+	// an empty file can not be mapped
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(m_file, &fileSize) || fileSize.QuadPart <= 0)
+	{
+		Close();
+		return false;
+	}
+
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping)
+		m_view = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!m_view)
+	{
+		Close();
+		return false;
+	}
+	m_size = static_cast<size_t>(fileSize.QuadPart);
+	return true;
+}
+
+
+
+void MappedFile::Close()
+{
+	if (m_view)
+		UnmapViewOfFile(m_view);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+
+	m_file = INVALID_HANDLE_VALUE;
+	m_mapping = nullptr;
+	m_view = nullptr;
+	m_size = 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "SoundFile.h"
+
+// Read-only view of a whole file mapped into memory.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	//-- Writes the image next to path and renames it, so a reader never maps a half written file.
+	static bool Write(const std::string& path, const std::vector<char>& image);
+
+	bool Open(const std::string& path);
+	void Close();
+	bool IsOpen() const noexcept { return m_view != nullptr; }
+	const char* GetData() const noexcept { return m_view; }
+	size_t GetSize() const noexcept { return m_size; }
+
+private:
+	HANDLE m_file;
+	HANDLE m_mapping;
+	const char* m_view;
+	size_t m_size;
+};
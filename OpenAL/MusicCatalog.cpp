@@ -0,0 +1,256 @@
+#include "MusicCatalog.h"
+#include "AdpcmEncoder.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <unordered_map>
+
+namespace
+{
+	constexpr uint32_t CATALOG_MAGIC = mmioFOURCC('M', 'C', 'A', 'T');
+	constexpr uint32_t CATALOG_VERSION = 1;
+
+#pragma pack(1)
+	struct CatalogHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t trackCount;
+		uint32_t pathsSize;
+	};
+
+	struct CatalogRecord
+	{
+		MYWAVEFORMATEX waveFormat;
+		uint32_t dataOffset;
+		uint32_t dataSize;
+		uint32_t duration;
+		uint64_t fileSize;          // size and write time of the wave file, a changed file is parsed again
+		int64_t writeTime;
+		uint32_t pathOffset;
+		uint16_t pathLength;
+	};
+#pragma pack()
+
+	struct ScannedFile
+	{
+		std::string path;           // relative to the root
+		CatalogRecord record;
+		bool valid = false;
+	};
+
+	bool IsWaveFile(const std::filesystem::path& path)
+	{
+		std::string extension = path.extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return extension == ".wav";
+	}
+
+	unsigned int GetDuration(const MYWAVEFORMATEX& waveFormat, ulong dataSize)
+	{
+		if (!waveFormat.nBlockAlign || !waveFormat.nSamplesPerSec)
+			return 0;
+		const unsigned int samplesPerBlock = AdpcmEncoder::GetSamplesPerBlock(waveFormat);
+		const unsigned long long frames = static_cast<unsigned long long>(dataSize / waveFormat.nBlockAlign) * (samplesPerBlock ? samplesPerBlock : 1);
+		return static_cast<unsigned int>(frames * 1000 / waveFormat.nSamplesPerSec);
+	}
+}
+
+
+
+bool MusicCatalog::Build(const std::string& root, const std::string& indexPath, unsigned int threads)
+{
+	std::error_code error;
+	std::vector<ScannedFile> files;
+	for (std::filesystem::recursive_directory_iterator it(root, std::filesystem::directory_options::skip_permission_denied, error), end;
+		!error && it != end; it.increment(error))
+	{
+		if (it->is_regular_file(error) && IsWaveFile(it->path()))
+		{
+			files.emplace_back();
+			files.back().path = it->path().lexically_relative(root).generic_string();
+		}
+	}
+	if (error)
+		return false;
+	std::sort(files.begin(), files.end(), [](const ScannedFile& a, const ScannedFile& b) { return a.path < b.path; });
+
+	// unchanged files keep the record of the previous scan
+	MusicCatalog previous;
+	std::unordered_map<std::string, CatalogRecord> known;
+	if (previous.Open(root, indexPath))
+	{
+		for (size_t i = 0; i < previous.m_trackCount; i++)
+		{
+			CatalogRecord record;
+			std::memcpy(&record, previous.m_records + i * sizeof(CatalogRecord), sizeof(record));
+			if (static_cast<size_t>(record.pathOffset) + record.pathLength <= previous.m_pathsSize)
+				known.emplace(std::string(previous.m_paths + record.pathOffset, record.pathLength), record);
+		}
+	}
+
+	std::atomic<size_t> next = 0;
+	auto scan = [&]()
+	{
+		SoundFile soundFile;
+		for (size_t i = next++; i < files.size(); i = next++)
+		{
+			ScannedFile& file = files[i];
+			const std::string fullPath = root + "/" + file.path;
+			std::error_code statError;
+			const uint64_t fileSize = std::filesystem::file_size(fullPath, statError);
+			const int64_t writeTime = std::filesystem::last_write_time(fullPath, statError).time_since_epoch().count();
+			if (statError)
+				continue;
+
+			auto previousRecord = known.find(file.path);
+			if (previousRecord != known.end() && previousRecord->second.fileSize == fileSize && previousRecord->second.writeTime == writeTime)
+			{
+				file.record = previousRecord->second;
+				file.valid = true;
+				continue;
+			}
+
+			if (!soundFile.LoadHeader(fullPath))
+				continue;
+			ZeroMemory(&file.record, sizeof(file.record));
+			file.record.waveFormat = soundFile.GetWaveFormat();
+			file.record.dataOffset = soundFile.GetDataOffset();
+			file.record.dataSize = soundFile.GetDataSize();
+			file.record.duration = GetDuration(file.record.waveFormat, soundFile.GetDataSize());
+			file.record.fileSize = fileSize;
+			file.record.writeTime = writeTime;
+			file.valid = true;
+		}
+	};
+
+	if (!threads)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < std::min<size_t>(threads, files.size()); i++)
+		workers.emplace_back(scan);
+	scan();
+	for (auto& worker : workers)
+		worker.join();
+	previous.Close();
+
+	std::vector<char> paths;
+	std::vector<CatalogRecord> records;
+	for (auto& file : files)
+	{
+		if (!file.valid || file.path.size() > UINT16_MAX)
+			continue;
+		file.record.pathOffset = static_cast<uint32_t>(paths.size());
+		file.record.pathLength = static_cast<uint16_t>(file.path.size());
+		paths.insert(paths.end(), file.path.begin(), file.path.end());
+		records.push_back(file.record);
+	}
+
+	const CatalogHeader header{ CATALOG_MAGIC, CATALOG_VERSION, static_cast<uint32_t>(records.size()), static_cast<uint32_t>(paths.size()) };
+	std::vector<char> image(sizeof(header) + records.size() * sizeof(CatalogRecord) + paths.size());
+	std::memcpy(image.data(), &header, sizeof(header));
+	if (!records.empty())
+		std::memcpy(image.data() + sizeof(header), records.data(), records.size() * sizeof(CatalogRecord));
+	if (!paths.empty())
+		std::memcpy(image.data() + sizeof(header) + records.size() * sizeof(CatalogRecord), paths.data(), paths.size());
+	return MappedFile::Write(indexPath, image);
+}
+
+
+
+std::string MusicCatalog::GetIndexPath(const std::string& root)
+{
+	return root + "/library.mcat";
+}
+
+
+
+bool MusicCatalog::OpenOrBuild(const std::string& root, bool rescan)
+{
+	const std::string indexPath = GetIndexPath(root);
+	if (!rescan && Open(root, indexPath))
+		return true;
+	Close();
+	return Build(root, indexPath) && Open(root, indexPath);
+}
+
+
+
+bool MusicCatalog::Open(const std::string& root, const std::string& indexPath)
+{
+	Close();
+	if (!m_mappedFile.Open(indexPath) || m_mappedFile.GetSize() < sizeof(CatalogHeader))
+	{
+		Close();
+		return false;
+	}
+
+	CatalogHeader header;
+	std::memcpy(&header, m_mappedFile.GetData(), sizeof(header));
+	const size_t recordsEnd = sizeof(header) + static_cast<size_t>(header.trackCount) * sizeof(CatalogRecord);
+	if (header.magic != CATALOG_MAGIC || header.version != CATALOG_VERSION || recordsEnd + header.pathsSize > m_mappedFile.GetSize())
+	{
+		Close();
+		return false;
+	}
+
+	m_root = root;
+	m_records = m_mappedFile.GetData() + sizeof(header);
+	m_paths = m_mappedFile.GetData() + recordsEnd;
+	m_pathsSize = header.pathsSize;
+	m_trackCount = header.trackCount;
+	return true;
+}
+
+
+
+void MusicCatalog::Close()
+{
+	m_mappedFile.Close();
+	m_root.clear();
+	m_records = nullptr;
+	m_paths = nullptr;
+	m_pathsSize = 0;
+	m_trackCount = 0;
+}
+
+
+
+CatalogTrack MusicCatalog::GetTrack(size_t index) const
+{
+	CatalogRecord record;
+	std::memcpy(&record, m_records + index * sizeof(CatalogRecord), sizeof(record));
+
+	CatalogTrack track;
+	track.path = GetPath(index);
+	track.waveFormat = record.waveFormat;
+	track.dataOffset = record.dataOffset;
+	track.dataSize = record.dataSize;
+	track.duration = record.duration;
+	return track;
+}
+
+
+
+std::string MusicCatalog::GetPath(size_t index) const
+{
+	CatalogRecord record;
+	std::memcpy(&record, m_records + index * sizeof(CatalogRecord), sizeof(record));
+	if (static_cast<size_t>(record.pathOffset) + record.pathLength > m_pathsSize)
+		return {};
+	return m_root + "/" + std::string(m_paths + record.pathOffset, record.pathLength);
+}
+
+
+
+std::vector<std::string> MusicCatalog::GetPlaylist() const
+{
+	std::vector<std::string> playlist;
+	playlist.reserve(m_trackCount);
+	for (size_t i = 0; i < m_trackCount; i++)
+		playlist.push_back(GetPath(i));
+	return playlist;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+
+// One track of the library as recorded in the catalog index.
+struct CatalogTrack
+{
+	std::string path;
+	MYWAVEFORMATEX waveFormat;
+	ulong dataOffset;               // first byte of the sample data in the wave file
+	ulong dataSize;
+	unsigned int duration;          // miliseconds
+};
+
+
+
+// Library of wave files below a root directory. A scan parses only the RIFF headers of every file on
+// several threads and persists the result as a compact index (header, fixed size records, path strings)
+// that is mapped on the next start, so the library does not have to be read again.
+//
+// Index layout: CatalogHeader, trackCount * CatalogRecord, paths relative to the root (not terminated).
+class MusicCatalog
+{
+public:
+	MusicCatalog() = default;
+	MusicCatalog(const MusicCatalog&) = delete;
+	MusicCatalog& operator=(const MusicCatalog&) = delete;
+
+	//-- Scans root and writes the index, records of files whose size and write time did not change
+	//-- are taken over from the previous index. threads == 0 uses one thread per core.
+	static bool Build(const std::string& root, const std::string& indexPath, unsigned int threads = 0);
+	static std::string GetIndexPath(const std::string& root);
+
+	//-- Maps the index of root, scanning the library first when there is none (or rescan is set).
+	bool OpenOrBuild(const std::string& root, bool rescan = false);
+	bool Open(const std::string& root, const std::string& indexPath);
+	void Close();
+
+	size_t GetTrackCount() const noexcept { return m_trackCount; }
+	CatalogTrack GetTrack(size_t index) const;
+	std::string GetPath(size_t index) const;
+
+	//-- Every track of the library in path order.
+	std::vector<std::string> GetPlaylist() const;
+
+private:
+	std::string m_root;
+	MappedFile m_mappedFile;
+	const char* m_records = nullptr;
+	const char* m_paths = nullptr;
+	size_t m_pathsSize = 0;
+	size_t m_trackCount = 0;
+};
@@ -79,6 +79,7 @@ void Sound::GetDividedData(std::deque<std::vector<char>>& dividedData, unsigned
 			bytesToSend = m_ulSize - position;
 
 		std::vector<char> data = std::vector<char>(m_soundFile.GetSoundData().begin() + position, m_soundFile.GetSoundData().begin() + position + bytesToSend);
+		LoudnessAnalyzer::ApplyGain(data.data(), data.size(), waveFormat, m_streamGain);
 		dataToReturn.push_back(data);
 		if (position + bytesToSend > m_ulSize)
 			position = m_ulSize;
@@ -92,6 +93,18 @@ void Sound::GetDividedData(std::deque<std::vector<char>>& dividedData, unsigned
 
 }
 
+void Sound::NormalizeLoudness()
+{
+	m_loudness = LoudnessAnalyzer::LoadOrAnalyze(m_soundPath, m_soundFile);
+	const float gain = m_loudness.GetLinearGain();
+
+	// a sound with its own buffer plays locally, streamed sounds get the gain fused into their chunks
+	if (m_info.buffer)
+		CSoundController::Get().SetSourceVolume(m_info, gain);
+	else
+		m_streamGain = gain;
+}
+
 void Sound::PlaySource() const
 {
 	CSoundController::Get().PlaySource(m_info.source);
@@ -2,6 +2,7 @@
 #include <string>
 #include <bitset>
 #include "GCSoundController.h"
+#include "LoudnessAnalyzer.h"
 
 constexpr unsigned int MAX_BUFFERS_FOR_QUEUE = 256;
 
@@ -26,8 +27,12 @@ public:
 	void PlayWithRowData(void* data, long size, const MYWAVEFORMATEX& waveFormat);
 	void GetDividedData(std::deque<std::vector<char>>& dividedData, unsigned int lengthInMiliseconds, int* bytesPerSecond);
 	void PlaySource() const;
+	SourcePlayout GetPlayout() const { return CSoundController::Get().GetSourcePlayout(m_info); }
 	static std::vector<char> ConvertMyWaveFormatToData(const MYWAVEFORMATEX& format);
 	static MYWAVEFORMATEX ConvertDataToFormat(std::vector<char>& data);
+	void NormalizeLoudness();
+	const LoudnessInfo& GetLoudness() const noexcept { return m_loudness; }
+	float GetStreamGain() const noexcept { return m_streamGain; }
 
 private:
 	std::unordered_map<int, bool> m_isPlaying;
@@ -36,5 +41,7 @@ private:
 	SoundFile m_soundFile;
 	std::deque<ALuint> m_buffersForQueue;
 	unsigned int bufferToPlay;
+	LoudnessInfo m_loudness;
+	float m_streamGain = 1.0f;
 };
 
@@ -7,6 +7,12 @@ using ulong = unsigned long;
 #ifndef WAVE_FORMAT_PCM
 #define WAVE_FORMAT_PCM     1
 #endif
+#ifndef WAVE_FORMAT_ADPCM
+#define WAVE_FORMAT_ADPCM   0x0002
+#endif
+#ifndef WAVE_FORMAT_IMA_ADPCM
+#define WAVE_FORMAT_IMA_ADPCM   0x0011
+#endif
 
 #pragma pack(1)
 /*
@@ -55,77 +61,16 @@ public:
     //-- Loads the sound file (returns false when failed).
     bool LoadFile(const std::string& filePath)
     {
-        ZeroMemory(&m_waveFormat, sizeof(m_waveFormat));
-
         CFile file;
-        bool bResource = false;
-        ulong ulBufferSize = 0;
-        ulong ulDataSize = 0;
-        if (!bResource)
-        {
-
-            CA2T f(filePath.c_str());
-            if (!file.Open(f, CFile::modeRead | CFile::typeBinary | CFile::shareDenyNone))
-            {
-                return false; // not found
-            }
-
-            const ulong ulSize = 5 * sizeof(DWORD);
-            uchar aucHeader[ulSize];
-            if (file.Read(aucHeader, ulSize) != ulSize
-                || *(ulong*)aucHeader != mmioFOURCC('R', 'I', 'F', 'F')
-                || *(ulong*)(((uchar*)aucHeader) + sizeof(DWORD)) != (file.GetLength() - 2 * sizeof(DWORD))
-                || *(ulong*)(((uchar*)aucHeader) + 2 * sizeof(DWORD)) != mmioFOURCC('W', 'A', 'V', 'E'))
-            {
-                file.Close();
-                return false; // wrong format header
-            }
-
-            // check format chunk
-            ulong aulChunk[2];
-            aulChunk[0] = *(ulong*)(((uchar*)aucHeader) + 3 * sizeof(DWORD));
-            aulChunk[1] = *(ulong*)(((uchar*)aucHeader) + 4 * sizeof(DWORD));
-            const ulong ulSizePcmWaveFormat = sizeof(MYWAVEFORMATEX) - sizeof(m_waveFormat.cbSize);
-            while (!(aulChunk[0] == mmioFOURCC('f', 'm', 't', ' ') && aulChunk[1] >= ulSizePcmWaveFormat))
-            {
-                file.Seek(aulChunk[1], CFile::current);
-                if (file.Read(aulChunk, sizeof(aulChunk)) != sizeof(aulChunk))
-                {
-                    file.Close();
-                    return false; // wrong header
-                }
-            }
-
-            if (file.Read(&m_waveFormat, ulSizePcmWaveFormat) != ulSizePcmWaveFormat)
-            {
-                //TRACEE("ERROR: SoundFile (%s, %s): File header format (%s).\n", strPath.c_str(), strName.c_str(), strFile.c_str());
-                file.Close();
-                return false; // wrong header
-            }
-
-            aulChunk[1] -= ulSizePcmWaveFormat;       // ignore rest of fmt chunk
-
-            // search data chunk
-            do
-            {
-                file.Seek(aulChunk[1], CFile::current);
-                if (file.Read(aulChunk, sizeof(aulChunk)) != sizeof(aulChunk))
-                {
-                    //  TRACEE("ERROR: SoundFile (%s, %s): File header data (%s).\n", strPath.c_str(), strName.c_str(), strFile.c_str());
-                    file.Close();
-                    return false; // wrong header
-                }
-            } while (aulChunk[0] != mmioFOURCC('d', 'a', 't', 'a'));
-
-            ulDataSize = ulBufferSize = aulChunk[1];
-        }
+        if (!OpenAndWalkChunks(filePath, file))
+            return false;
 
         //--------------------------------------------------------------------------
         // Sounddaten in den Speicher laden
 
-        m_vecData.resize(ulBufferSize);
+        m_vecData.resize(m_ulDataSize);
         ulong ulReadOffset = 0;
-        if (file.Read(m_vecData.data() + ulReadOffset, ulDataSize) != ulDataSize)
+        if (file.Read(m_vecData.data() + ulReadOffset, m_ulDataSize) != m_ulDataSize)
         {
             //TRACEE("ERROR: SoundFile (%s, %s): File data (%lu).\n", strPath.c_str(), strName.c_str(), ulDataSize);
             file.Close();
@@ -136,6 +81,29 @@ public:
         return true;
     }
 
+    //-- Reads only the RIFF headers: wave format, data offset and size (returns false when failed).
+    bool LoadHeader(const std::string& filePath)
+    {
+        CFile file;
+        m_vecData.clear();
+        if (!OpenAndWalkChunks(filePath, file))
+            return false;
+
+        file.Close();
+        return true;
+    }
+
+    //-- Offset of the sample data in the file and its size in bytes.
+    ulong GetDataOffset() const
+    {
+        return m_ulDataOffset;
+    }
+
+    ulong GetDataSize() const
+    {
+        return m_ulDataSize;
+    }
+
     //-- Returns wave format (DirectSound buffer needs this structure).
     MYWAVEFORMATEX GetWaveFormat() const
     {
@@ -149,6 +117,72 @@ public:
     }
 
 private:
+    //-- Walks the RIFF chunks up to the data chunk, the file is left positioned at the sample data.
+    bool OpenAndWalkChunks(const std::string& filePath, CFile& file)
+    {
+        ZeroMemory(&m_waveFormat, sizeof(m_waveFormat));
+        m_ulDataOffset = m_ulDataSize = 0;
+
+        CA2T f(filePath.c_str());
+        if (!file.Open(f, CFile::modeRead | CFile::typeBinary | CFile::shareDenyNone))
+        {
+            return false; // not found
+        }
+
+        const ulong ulSize = 5 * sizeof(DWORD);
+        uchar aucHeader[ulSize];
+        if (file.Read(aucHeader, ulSize) != ulSize
+            || *(ulong*)aucHeader != mmioFOURCC('R', 'I', 'F', 'F')
+            || *(ulong*)(((uchar*)aucHeader) + sizeof(DWORD)) != (file.GetLength() - 2 * sizeof(DWORD))
+            || *(ulong*)(((uchar*)aucHeader) + 2 * sizeof(DWORD)) != mmioFOURCC('W', 'A', 'V', 'E'))
+        {
+            file.Close();
+            return false; // wrong format header
+        }
+
+        // check format chunk
+        ulong aulChunk[2];
+        aulChunk[0] = *(ulong*)(((uchar*)aucHeader) + 3 * sizeof(DWORD));
+        aulChunk[1] = *(ulong*)(((uchar*)aucHeader) + 4 * sizeof(DWORD));
+        const ulong ulSizePcmWaveFormat = sizeof(MYWAVEFORMATEX) - sizeof(m_waveFormat.cbSize);
+        while (!(aulChunk[0] == mmioFOURCC('f', 'm', 't', ' ') && aulChunk[1] >= ulSizePcmWaveFormat))
+        {
+            file.Seek(aulChunk[1], CFile::current);
+            if (file.Read(aulChunk, sizeof(aulChunk)) != sizeof(aulChunk))
+            {
+                file.Close();
+                return false; // wrong header
+            }
+        }
+
+        if (file.Read(&m_waveFormat, ulSizePcmWaveFormat) != ulSizePcmWaveFormat)
+        {
+            //TRACEE("ERROR: SoundFile (%s, %s): File header format (%s).\n", strPath.c_str(), strName.c_str(), strFile.c_str());
+            file.Close();
+            return false; // wrong header
+        }
+
+        aulChunk[1] -= ulSizePcmWaveFormat;       // ignore rest of fmt chunk
+
+        // search data chunk
+        do
+        {
+            file.Seek(aulChunk[1], CFile::current);
+            if (file.Read(aulChunk, sizeof(aulChunk)) != sizeof(aulChunk))
+            {
+                //  TRACEE("ERROR: SoundFile (%s, %s): File header data (%s).\n", strPath.c_str(), strName.c_str(), strFile.c_str());
+                file.Close();
+                return false; // wrong header
+            }
+        } while (aulChunk[0] != mmioFOURCC('d', 'a', 't', 'a'));
+
+        m_ulDataOffset = static_cast<ulong>(file.GetPosition());
+        m_ulDataSize = aulChunk[1];
+        return true;
+    }
+
     MYWAVEFORMATEX m_waveFormat;
     std::vector<uchar> m_vecData;
+    ulong m_ulDataOffset = 0;
+    ulong m_ulDataSize = 0;
 };
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+// Encoding of the audio payload on the wire, the packet's wave format tag tells the client which one arrived.
+enum class StreamEncoding : uint8_t
+{
+	Pcm,
+	Ima4,
+	Lossless
+};
+
+inline StreamEncoding ParseStreamEncoding(const std::string& name)
+{
+	if (name == "ima4")
+		return StreamEncoding::Ima4;
+	if (name == "lossless")
+		return StreamEncoding::Lossless;
+	return StreamEncoding::Pcm;
+}
+
+inline const char* GetStreamEncodingName(StreamEncoding encoding)
+{
+	switch (encoding)
+	{
+		case StreamEncoding::Ima4:
+			return "ima4";
+		case StreamEncoding::Lossless:
+			return "lossless";
+		default:
+			return "pcm";
+	}
+}
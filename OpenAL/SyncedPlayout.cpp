@@ -0,0 +1,477 @@
+#include "SyncedPlayout.h"
+#include "AdpcmEncoder.h"
+#include "../SocketsClientServer/Metrics.h"
+#include <algorithm>
+#include <chrono>
+
+PlayoutDevice::PlayoutDevice(unsigned int loopbackFrequency, long long loopbackLatency) :
+	m_device(nullptr),
+	m_context(nullptr),
+	m_getInteger64v(nullptr),
+	m_renderSamples(nullptr),
+	m_setThreadContext(nullptr),
+	m_loopbackLatency(loopbackFrequency ? loopbackLatency : 0)
+{
+	if (loopbackFrequency)
+	{
+		if (!alcIsExtensionPresent(nullptr, "ALC_SOFT_loopback"))
+			return;
+		auto openLoopback = reinterpret_cast<LPALCLOOPBACKOPENDEVICESOFT>(alcGetProcAddress(nullptr, "alcLoopbackOpenDeviceSOFT"));
+		m_renderSamples = reinterpret_cast<LPALCRENDERSAMPLESSOFT>(alcGetProcAddress(nullptr, "alcRenderSamplesSOFT"));
+		m_device = openLoopback ? openLoopback(nullptr) : nullptr;
+	}
+	else
+	{
+		m_device = alcOpenDevice(nullptr);
+	}
+	if (!m_device)
+		return;
+
+	// a loopback device takes its format from the context; without the limiter the mix of a direct
+	// channels source is exactly what was queued
+	const ALCint loopbackAttributes[] = { ALC_FORMAT_CHANNELS_SOFT, ALC_STEREO_SOFT, ALC_FORMAT_TYPE_SOFT, ALC_FLOAT_SOFT,
+		ALC_FREQUENCY, static_cast<ALCint>(loopbackFrequency), ALC_OUTPUT_LIMITER_SOFT, ALC_FALSE, 0 };
+	m_context = alcCreateContext(m_device, loopbackFrequency ? loopbackAttributes : nullptr);
+	if (!m_context)
+	{
+		alcCloseDevice(m_device);
+		m_device = nullptr;
+		return;
+	}
+
+	if (alcIsExtensionPresent(m_device, "ALC_SOFT_device_clock"))
+		m_getInteger64v = reinterpret_cast<LPALCGETINTEGER64VSOFT>(alcGetProcAddress(m_device, "alcGetInteger64vSOFT"));
+	if (alcIsExtensionPresent(m_device, "ALC_EXT_thread_local_context"))
+		m_setThreadContext = reinterpret_cast<PFNALCSETTHREADCONTEXTPROC>(alcGetProcAddress(m_device, "alcSetThreadContext"));
+}
+
+
+
+PlayoutDevice::~PlayoutDevice()
+{
+	if (!m_context)
+		return;
+
+	if (m_setThreadContext)
+		m_setThreadContext(nullptr);
+	if (alcGetCurrentContext() == m_context)
+		alcMakeContextCurrent(nullptr);
+	alcDestroyContext(m_context);
+	alcCloseDevice(m_device);
+}
+
+
+
+bool PlayoutDevice::MakeCurrent() const
+{
+	if (!m_context)
+		return false;
+	if (m_setThreadContext)
+		return m_setThreadContext(m_context) == ALC_TRUE;
+	return alcMakeContextCurrent(m_context) == ALC_TRUE;
+}
+
+
+
+bool PlayoutDevice::GetClockLatency(long long& clock, long long& latency) const
+{
+	if (!m_getInteger64v)
+		return false;
+
+	ALCint64SOFT values[2] = { 0, 0 };
+	m_getInteger64v(m_device, ALC_DEVICE_CLOCK_LATENCY_SOFT, 2, values);
+	clock = values[0];
+	latency = values[1] + m_loopbackLatency;
+	return true;
+}
+
+
+
+void PlayoutDevice::Render(float* samples, unsigned int frames) const
+{
+	if (m_renderSamples)
+		m_renderSamples(m_device, samples, static_cast<ALCsizei>(frames));
+}
+
+
+
+SyncedPlayout::SyncedPlayout(const PlayoutDevice& device, unsigned int delay) :
+	m_device(device),
+	m_delay(delay * 1000ll),
+	m_clockOffset(0),
+	m_hasClockOffset(false),
+	m_getSourcei64v(nullptr),
+	m_source(0),
+	m_playedFrames(0),
+	m_queuedFrames(0),
+	m_heardOffset(0),
+	m_hasDeviceClock(false),
+	m_playing(false),
+	m_error(0),
+	m_correction(0),
+	m_correctedAt(0)
+{
+	if (alIsExtensionPresent("AL_SOFT_source_latency"))
+		m_getSourcei64v = reinterpret_cast<LPALGETSOURCEI64VSOFT>(alGetProcAddress("alGetSourcei64vSOFT"));
+
+	alGetError();
+	alGenSources(1, &m_source);
+	if (alGetError() != AL_NO_ERROR)
+	{
+		m_source = 0;
+		return;
+	}
+	m_freeBuffers.resize(BUFFER_COUNT);
+	alGenBuffers(static_cast<ALsizei>(m_freeBuffers.size()), m_freeBuffers.data());
+
+	// the stream is music rather than a sound in space, its channels go to the speakers as they are
+	if (alIsExtensionPresent("AL_SOFT_direct_channels"))
+		alSourcei(m_source, AL_DIRECT_CHANNELS_SOFT, AL_TRUE);
+}
+
+
+
+SyncedPlayout::~SyncedPlayout()
+{
+	if (!m_source)
+		return;
+
+	alSourceStop(m_source);
+	alSourcei(m_source, AL_BUFFER, 0);
+	alDeleteSources(1, &m_source);
+	for (const Segment& segment : m_segments)
+		m_freeBuffers.push_back(segment.buffer);
+	alDeleteBuffers(static_cast<ALsizei>(m_freeBuffers.size()), m_freeBuffers.data());
+}
+
+
+
+void SyncedPlayout::SetClockOffset(long long offset) noexcept
+{
+	m_clockOffset = offset;
+	m_hasClockOffset = true;
+}
+
+
+
+void SyncedPlayout::Queue(const char* data, size_t size, const MYWAVEFORMATEX& waveFormat, unsigned long long serverTime)
+{
+	if (!size || !waveFormat.nBlockAlign || !waveFormat.nSamplesPerSec)
+		return;
+	if (m_pending.size() >= MAX_PENDING)
+		m_pending.pop_front();
+	m_pending.push_back(Block{ std::vector<char>(data, data + size), waveFormat, static_cast<long long>(serverTime) });
+}
+
+
+
+void SyncedPlayout::Update()
+{
+	static const MetricCounter restarts("openal.sync.restarts");
+
+	if (!m_source || !m_hasClockOffset)
+		return;
+
+	ReadDeviceClock();
+	if (m_playing)
+	{
+		ALint state = AL_INITIAL;
+		alGetSourcei(m_source, AL_SOURCE_STATE, &state);
+		if (state != AL_PLAYING)
+		{
+			// ran dry, start over on the schedule with what arrived since
+			restarts.Add();
+			Reset();
+		}
+	}
+
+	Reclaim();
+	if (m_playing)
+		Measure();
+	if (m_playing)
+		Refill();
+	else
+		Start();
+}
+
+
+
+SourcePlayout SyncedPlayout::GetPlayout() const
+{
+	SourcePlayout playout;
+	if (!m_source)
+		return playout;
+
+	alGetSourcei(m_source, AL_SOURCE_STATE, &playout.state);
+	alGetSourcei(m_source, AL_BUFFERS_QUEUED, &playout.queuedBuffers);
+	alGetSourcei(m_source, AL_BUFFERS_PROCESSED, &playout.processedBuffers);
+	if (m_getSourcei64v)
+	{
+		ALint64SOFT values[2] = { 0, 0 };
+		m_getSourcei64v(m_source, AL_SAMPLE_OFFSET_LATENCY_SOFT, values);
+		playout.sampleOffset = values[0] >> 32;
+		playout.latency = values[1];
+		playout.hasLatency = true;
+	}
+	else
+	{
+		ALint sampleOffset = 0;
+		alGetSourcei(m_source, AL_SAMPLE_OFFSET, &sampleOffset);
+		playout.sampleOffset = sampleOffset;
+	}
+	return playout;
+}
+
+
+
+long long SyncedPlayout::GetNow()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+
+unsigned int SyncedPlayout::GetFramesPerBlock(const MYWAVEFORMATEX& waveFormat)
+{
+	const unsigned int samplesPerBlock = AdpcmEncoder::GetSamplesPerBlock(waveFormat);
+	return samplesPerBlock ? samplesPerBlock : 1;
+}
+
+
+
+void SyncedPlayout::ReadDeviceClock()
+{
+	long long clock = 0;
+	long long latency = 0;
+	const long long before = GetNow();
+	if (!m_device.GetClockLatency(clock, latency))
+	{
+		m_hasDeviceClock = false;
+		return;
+	}
+	const long long after = GetNow();
+
+	// the device clock only moves when the device mixes, a reading taken right after a mix gives the
+	// smallest value and the others include the time since, so the smallest of the recent ones is kept
+	m_heardOffsets.push_back((before + after) / 2 + latency / 1000 - clock / 1000);
+	if (m_heardOffsets.size() > CLOCK_READINGS)
+		m_heardOffsets.pop_front();
+	m_heardOffset = *std::min_element(m_heardOffsets.begin(), m_heardOffsets.end());
+	m_hasDeviceClock = true;
+}
+
+
+
+void SyncedPlayout::Reclaim()
+{
+	ALint processed = 0;
+	alGetSourcei(m_source, AL_BUFFERS_PROCESSED, &processed);
+	for (; processed > 0 && !m_segments.empty(); processed--)
+	{
+		ALuint buffer = 0;
+		alSourceUnqueueBuffers(m_source, 1, &buffer);
+		m_playedFrames += m_segments.front().frames;
+		m_freeBuffers.push_back(m_segments.front().buffer);
+		m_segments.pop_front();
+	}
+}
+
+
+
+void SyncedPlayout::Start()
+{
+	static const MetricCounter starts("openal.sync.starts");
+
+	if (m_pending.empty() || m_freeBuffers.empty())
+		return;
+
+	// a source started now is mixed from the next device update on, heard a device latency later
+	long long clock = 0;
+	long long latency = 0;
+	const long long heard = m_hasDeviceClock && m_device.GetClockLatency(clock, latency) ? clock / 1000 + m_heardOffset : GetNow();
+	const Block& first = m_pending.front();
+	const long long lead = first.serverTime + m_clockOffset + m_delay - heard;
+	if (lead > MAX_QUEUED * 1000ll)
+		return;
+
+	const unsigned int sampleRate = first.waveFormat.nSamplesPerSec;
+	if (lead >= 0)
+	{
+		QueueSilence(lead * sampleRate / 1000000, first.waveFormat, first.serverTime);
+	}
+	else
+	{
+		Drop(-lead * sampleRate / 1000000);
+		if (m_pending.empty())
+			return;
+	}
+
+	Refill();
+	alSourcePlay(m_source);
+	m_playing = true;
+	starts.Add();
+}
+
+
+
+void SyncedPlayout::Measure()
+{
+	static const MetricHistogram errors("openal.sync.error_us");
+	static const MetricCounter corrections("openal.sync.corrections");
+
+	ALint64SOFT values[2] = { 0, 0 };
+	long long heard = 0;
+	if (m_getSourcei64v && m_hasDeviceClock)
+	{
+		// the sample offset and the device clock at which the source mixed it, read together
+		m_getSourcei64v(m_source, AL_SAMPLE_OFFSET_CLOCK_SOFT, values);
+		heard = values[1] / 1000 + m_heardOffset;
+	}
+	else
+	{
+		ALint sampleOffset = 0;
+		alGetSourcei(m_source, AL_SAMPLE_OFFSET, &sampleOffset);
+		values[0] = static_cast<ALint64SOFT>(sampleOffset) << 32;
+		heard = GetNow();
+	}
+
+	const unsigned long long position = m_playedFrames + static_cast<unsigned long long>(values[0] >> 32);
+	long long serverTime = 0;
+	if (!GetServerTime(position, serverTime))
+		return;
+	m_error = heard - (serverTime + m_clockOffset + m_delay);
+	errors.Record(static_cast<uint64_t>(std::abs(m_error)));
+
+	// a correction takes effect once the audio queued before it has played, until then the error stays
+	if (m_correction || position < m_correctedAt || std::abs(m_error) <= MAX_ERROR)
+		return;
+	if (std::abs(m_error) > MAX_QUEUED * 1000ll)
+	{
+		// the clock offset jumped, starting over is quicker than inserting or cutting that much
+		Reset();
+		return;
+	}
+	m_correction = m_error * m_segments.front().sampleRate / 1000000;
+	corrections.Add();
+}
+
+
+
+void SyncedPlayout::Refill()
+{
+	while (!m_pending.empty() && !m_freeBuffers.empty())
+	{
+		const Block& block = m_pending.front();
+		if ((m_queuedFrames - m_playedFrames) * 1000 >= static_cast<unsigned long long>(MAX_QUEUED) * block.waveFormat.nSamplesPerSec)
+			break;
+
+		if (m_correction)
+		{
+			m_correctedAt = m_queuedFrames;
+			if (m_correction > 0)
+				Drop(m_correction);
+			else
+				QueueSilence(-m_correction, block.waveFormat, block.serverTime);
+			m_correction = 0;
+			continue;
+		}
+
+		QueueBuffer(block.data.data(), block.data.size(), block.waveFormat, block.serverTime);
+		m_pending.pop_front();
+	}
+}
+
+
+
+void SyncedPlayout::Reset()
+{
+	alSourceStop(m_source);
+	alSourcei(m_source, AL_BUFFER, 0);
+	for (const Segment& segment : m_segments)
+		m_freeBuffers.push_back(segment.buffer);
+	m_segments.clear();
+	m_playedFrames = 0;
+	m_queuedFrames = 0;
+	m_correction = 0;
+	m_correctedAt = 0;
+	m_playing = false;
+}
+
+
+
+long long SyncedPlayout::Drop(long long frames)
+{
+	long long dropped = 0;
+	while (frames - dropped > 0 && !m_pending.empty())
+	{
+		Block& block = m_pending.front();
+		const unsigned int blockFrames = GetFramesPerBlock(block.waveFormat);
+		const size_t blocks = block.data.size() / block.waveFormat.nBlockAlign;
+		const size_t cut = std::min<size_t>(blocks, static_cast<size_t>((frames - dropped + blockFrames / 2) / blockFrames));
+		if (!cut)
+			break;
+
+		dropped += static_cast<long long>(cut) * blockFrames;
+		if (cut == blocks)
+		{
+			m_pending.pop_front();
+			continue;
+		}
+		block.data.erase(block.data.begin(), block.data.begin() + cut * block.waveFormat.nBlockAlign);
+		block.serverTime += static_cast<long long>(cut) * blockFrames * 1000000 / block.waveFormat.nSamplesPerSec;
+	}
+	return dropped;
+}
+
+
+
+void SyncedPlayout::QueueSilence(long long frames, const MYWAVEFORMATEX& waveFormat, long long serverTime)
+{
+	const unsigned int blockFrames = GetFramesPerBlock(waveFormat);
+	const size_t blocks = frames > 0 ? static_cast<size_t>((frames + blockFrames / 2) / blockFrames) : 0;
+	if (!blocks)
+		return;
+
+	// 8 bit PCM is unsigned, its silence sits in the middle; zeroed ADPCM blocks decode to silence
+	const char silent = waveFormat.wFormatTag == WAVE_FORMAT_PCM && waveFormat.wBitsPerSample == 8 ? static_cast<char>(0x80) : 0;
+	const std::vector<char> silence(blocks * waveFormat.nBlockAlign, silent);
+	QueueBuffer(silence.data(), silence.size(), waveFormat, serverTime - static_cast<long long>(blocks) * blockFrames * 1000000 / waveFormat.nSamplesPerSec);
+}
+
+
+
+void SyncedPlayout::QueueBuffer(const char* data, size_t size, const MYWAVEFORMATEX& waveFormat, long long serverTime)
+{
+	if (m_freeBuffers.empty())
+		return;
+
+	const ALuint buffer = m_freeBuffers.back();
+	m_freeBuffers.pop_back();
+	SetBufferData(buffer, waveFormat, data, static_cast<ALsizei>(size));
+	alSourceQueueBuffers(m_source, 1, &buffer);
+
+	const unsigned long long frames = size / waveFormat.nBlockAlign * GetFramesPerBlock(waveFormat);
+	m_segments.push_back(Segment{ buffer, frames, waveFormat.nSamplesPerSec, serverTime });
+	m_queuedFrames += frames;
+	if (m_queuedCallback)
+		m_queuedCallback(frames, waveFormat.nSamplesPerSec, static_cast<unsigned long long>(serverTime + static_cast<long long>(frames * 1000000 / waveFormat.nSamplesPerSec)));
+}
+
+
+
+bool SyncedPlayout::GetServerTime(unsigned long long position, long long& serverTime) const
+{
+	unsigned long long start = m_playedFrames;
+	for (size_t i = 0; i < m_segments.size(); i++)
+	{
+		// past the last segment the source ran dry, the time runs on from the last one
+		const Segment& segment = m_segments[i];
+		if (position < start + segment.frames || i + 1 == m_segments.size())
+		{
+			serverTime = segment.serverTime + static_cast<long long>(position - start) * 1000000 / segment.sampleRate;
+			return true;
+		}
+		start += segment.frames;
+	}
+	return false;
+}
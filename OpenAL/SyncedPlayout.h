@@ -0,0 +1,145 @@
+#pragma once
+#include <deque>
+#include <functional>
+#include <vector>
+#include "GCSoundController.h"
+
+// An OpenAL device with a context of its own, apart from CSoundController, so several can live in one
+// process. A loopback device (ALC_SOFT_loopback) has no sound card behind it, its owner pulls the mix
+// with Render; tests use them to listen to several clients side by side.
+class PlayoutDevice
+{
+public:
+	//-- Opens the default output device, or with loopbackFrequency a loopback device that mixes stereo float.
+	//-- OpenAL does not know what the owner of a loopback device does with the mix, loopbackLatency is the
+	//-- nanoseconds from the device clock of a sample to the moment it is heard.
+	explicit PlayoutDevice(unsigned int loopbackFrequency = 0, long long loopbackLatency = 0);
+	~PlayoutDevice();
+	PlayoutDevice(const PlayoutDevice&) = delete;
+	PlayoutDevice& operator=(const PlayoutDevice&) = delete;
+
+	bool IsOpen() const noexcept { return m_context != nullptr; }
+
+	//-- Makes the context current for the calling thread (ALC_EXT_thread_local_context), for the whole
+	//-- process where the extension is missing.
+	bool MakeCurrent() const;
+
+	//-- Device clock and how long until the sample mixed at that clock is heard, both nanoseconds and read
+	//-- together (ALC_DEVICE_CLOCK_LATENCY_SOFT). False without ALC_SOFT_device_clock.
+	bool GetClockLatency(long long& clock, long long& latency) const;
+
+	//-- Loopback devices only: mixes the next frames into samples (two floats per frame).
+	void Render(float* samples, unsigned int frames) const;
+
+private:
+	ALCdevice* m_device;
+	ALCcontext* m_context;
+	LPALCGETINTEGER64VSOFT m_getInteger64v;
+	LPALCRENDERSAMPLESSOFT m_renderSamples;
+	PFNALCSETTHREADCONTEXTPROC m_setThreadContext;
+	long long m_loopbackLatency;
+};
+
+
+
+// Plays a live stream on a schedule all clients of a station share: the sample that is live at server
+// time T leaves the speaker at T + delay. The clock offset (ClockSync) takes that to the local clock, the
+// device clock tells when a sample mixed now is heard and which sample the source mixed when
+// (AL_SAMPLE_OFFSET_CLOCK_SOFT), so the schedule error is measured where it matters, at the speaker.
+//
+// OpenAL has no way to start a source at a given time, the schedule is kept in the data instead: the
+// start is padded with silence or its late part cut off, and while playing an error above MAX_ERROR is
+// corrected by inserting silence or dropping sample frames in the audio queued next. Only MAX_QUEUED of
+// audio is handed to OpenAL ahead, the rest waits here, so a correction is heard soon. ADPCM can only be
+// cut in whole blocks, synchronized playback is meant for PCM and the decoded lossless stream.
+//
+// The device's context must be current on the calling thread for the lifetime of the object.
+class SyncedPlayout
+{
+public:
+	static constexpr unsigned int DEFAULT_DELAY = 1000;     // miliseconds from the live edge to the speaker
+	static constexpr long long MAX_ERROR = 2000;            // microseconds
+	static constexpr unsigned int MAX_QUEUED = 200;         // miliseconds handed to OpenAL ahead
+	static constexpr size_t BUFFER_COUNT = 32;
+	static constexpr size_t MAX_PENDING = 4096;             // packets kept before playback, the oldest go first
+	static constexpr size_t CLOCK_READINGS = 64;            // device clock readings the clock mapping comes from
+
+	//-- Sample frames handed to OpenAL and the server time at which the last of them is live.
+	using QueuedCallback = std::function<void(unsigned long long sampleFrames, unsigned int sampleRate, unsigned long long edge)>;
+
+	explicit SyncedPlayout(const PlayoutDevice& device, unsigned int delay = DEFAULT_DELAY);
+	~SyncedPlayout();
+	SyncedPlayout(const SyncedPlayout&) = delete;
+	SyncedPlayout& operator=(const SyncedPlayout&) = delete;
+
+	//-- Microseconds to add to a server time to get the local steady clock, see ClockSync::GetOffset.
+	void SetClockOffset(long long offset) noexcept;
+	void SetQueuedCallback(QueuedCallback callback) { m_queuedCallback = std::move(callback); }
+
+	//-- Audio that is live from serverTime (microseconds, server clock) on.
+	void Queue(const char* data, size_t size, const MYWAVEFORMATEX& waveFormat, unsigned long long serverTime);
+
+	//-- Starts playback when due, measures and corrects the schedule and refills the source. Call after
+	//-- Queue and at least every MAX_QUEUED / 2 miliseconds.
+	void Update();
+
+	bool IsPlaying() const noexcept { return m_playing; }
+	//-- Microseconds the speaker was behind the schedule at the last Update, negative when ahead.
+	long long GetError() const noexcept { return m_error; }
+	SourcePlayout GetPlayout() const;
+
+private:
+	struct Block
+	{
+		std::vector<char> data;
+		MYWAVEFORMATEX waveFormat;
+		long long serverTime;
+	};
+
+	struct Segment
+	{
+		ALuint buffer;
+		unsigned long long frames;
+		unsigned int sampleRate;
+		long long serverTime;       // of the first frame, for silence the time it stands in for
+	};
+
+	static long long GetNow();
+	static unsigned int GetFramesPerBlock(const MYWAVEFORMATEX& waveFormat);
+
+	void ReadDeviceClock();
+	void Reclaim();
+	void Start();
+	void Measure();
+	void Refill();
+	void Reset();
+
+	//-- Cuts frames (rounded to whole blocks) off the front of the pending audio, returns the frames cut.
+	long long Drop(long long frames);
+	void QueueSilence(long long frames, const MYWAVEFORMATEX& waveFormat, long long serverTime);
+	void QueueBuffer(const char* data, size_t size, const MYWAVEFORMATEX& waveFormat, long long serverTime);
+	bool GetServerTime(unsigned long long position, long long& serverTime) const;
+
+	const PlayoutDevice& m_device;
+	long long m_delay;                  // microseconds
+	long long m_clockOffset;
+	bool m_hasClockOffset;
+	QueuedCallback m_queuedCallback;
+	LPALGETSOURCEI64VSOFT m_getSourcei64v;
+
+	ALuint m_source;
+	std::vector<ALuint> m_freeBuffers;
+	std::deque<Block> m_pending;        // not handed to OpenAL yet
+	std::deque<Segment> m_segments;     // queued on the source, oldest first
+	unsigned long long m_playedFrames;  // position of the first queued segment
+	unsigned long long m_queuedFrames;  // position after the last queued segment
+
+	std::deque<long long> m_heardOffsets;
+	long long m_heardOffset;            // local time minus device clock of the moment a mixed sample is heard
+	bool m_hasDeviceClock;
+
+	bool m_playing;
+	long long m_error;
+	long long m_correction;             // sample frames to drop (positive) or insert as silence (negative)
+	unsigned long long m_correctedAt;   // position from which the last correction is heard
+};
@@ -0,0 +1,363 @@
+#include "TrackContainer.h"
+#include "Sound.h"
+#include "TrackTransition.h"
+#include "TrackSidecar.h"
+#include <cstring>
+
+namespace
+{
+	constexpr uint32_t CONTAINER_MAGIC = mmioFOURCC('M', 'S', 'T', 'C');
+	constexpr uint32_t CONTAINER_VERSION = 1;
+	constexpr size_t TRAILER_SIZE = sizeof(MYWAVEFORMATEX);
+
+#pragma pack(1)
+	struct ContainerHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		MYWAVEFORMATEX waveFormat;      // wire format of every frame
+		uint8_t encoding;
+		uint32_t maxFrameSize;
+		uint32_t frameCount;
+		uint32_t samplesPerFrame;
+		uint64_t totalSamples;
+		uint64_t sourceSize;            // size and write time of the wave file the container was built from
+		int64_t sourceTime;
+	};
+
+	struct SeekEntry
+	{
+		uint64_t offset;
+		uint32_t size;
+	};
+#pragma pack()
+}
+
+
+
+TrackContainer::TrackContainer() :
+	m_data(nullptr),
+	m_size(0),
+	m_seekTable(nullptr),
+	m_frameCount(0),
+	m_encoding(StreamEncoding::Pcm),
+	m_samplesPerFrame(0),
+	m_totalSamples(0)
+{
+	ZeroMemory(&m_waveFormat, sizeof(m_waveFormat));
+}
+
+TrackContainer::~TrackContainer()
+{
+	Close();
+}
+
+
+
+std::vector<char> TrackContainer::Ingest(const std::string& trackPath, StreamEncoding encoding, size_t maxFrameSize)
+{
+	SoundFile soundFile;
+	if (!soundFile.LoadFile(trackPath))
+		return {};
+	return Encode(trackPath, GetAudibleData(trackPath, soundFile), soundFile.GetWaveFormat(), encoding, maxFrameSize);
+}
+
+
+
+std::vector<char> TrackContainer::GetAudibleData(const std::string& trackPath, const SoundFile& soundFile)
+{
+	const LoudnessInfo loudness = LoudnessAnalyzer::LoadOrAnalyze(trackPath, soundFile);
+	const SilenceBounds bounds = TrackTransition::LoadOrDetect(trackPath, soundFile);
+	if (!bounds.GetLength())
+		return {};
+
+	const std::vector<uchar>& data = soundFile.GetSoundData();
+	std::vector<char> audible(data.begin() + bounds.head, data.begin() + bounds.tail);
+	LoudnessAnalyzer::ApplyGain(audible.data(), audible.size(), soundFile.GetWaveFormat(), loudness.GetLinearGain());
+	return audible;
+}
+
+
+
+std::vector<char> TrackContainer::Encode(const std::string& trackPath, const std::vector<char>& audible, const MYWAVEFORMATEX& waveFormat,
+	StreamEncoding encoding, size_t maxFrameSize)
+{
+	if (audible.empty())
+		return {};
+	if (!FrameEncoder::CanEncode(encoding, waveFormat))
+		encoding = StreamEncoding::Pcm;
+	const EncodedTrack track = FrameEncoder::Encode(audible.data(), audible.size(), waveFormat, encoding, maxFrameSize);
+
+	const SourceStamp source = TrackSidecar::GetSourceStamp(trackPath);
+	return Build(track, encoding, maxFrameSize, source.size, source.time);
+}
+
+
+
+bool TrackContainer::IsIngested(const std::string& trackPath, StreamEncoding encoding, size_t maxFrameSize)
+{
+	TrackContainer container;
+	return container.Open(GetContainerPath(trackPath, encoding)) && container.IsCurrent(trackPath, encoding, maxFrameSize);
+}
+
+
+
+std::vector<char> TrackContainer::Build(const EncodedTrack& track, StreamEncoding encoding, size_t maxFrameSize,
+	unsigned long long sourceSize, long long sourceTime)
+{
+	if (track.frames.empty())
+		return {};
+
+	const std::vector<char> trailer = Sound::ConvertMyWaveFormatToData(track.waveFormat);
+	const size_t tableSize = track.frames.size() * sizeof(SeekEntry);
+	size_t imageSize = sizeof(ContainerHeader) + tableSize;
+	for (const auto& frame : track.frames)
+		imageSize += frame.size() + trailer.size();
+
+	std::vector<char> image(imageSize);
+	ContainerHeader header;
+	ZeroMemory(&header, sizeof(header));
+	header.magic = CONTAINER_MAGIC;
+	header.version = CONTAINER_VERSION;
+	header.waveFormat = track.waveFormat;
+	header.encoding = static_cast<uint8_t>(encoding);
+	header.maxFrameSize = static_cast<uint32_t>(maxFrameSize);
+	header.frameCount = static_cast<uint32_t>(track.frames.size());
+	header.samplesPerFrame = track.samplesPerFrame;
+	header.totalSamples = track.totalSamples;
+	header.sourceSize = sourceSize;
+	header.sourceTime = sourceTime;
+	std::memcpy(image.data(), &header, sizeof(header));
+
+	char* table = image.data() + sizeof(ContainerHeader);
+	uint64_t offset = sizeof(ContainerHeader) + tableSize;
+	for (size_t i = 0; i < track.frames.size(); i++)
+	{
+		const auto& frame = track.frames[i];
+		const SeekEntry entry{ offset, static_cast<uint32_t>(frame.size() + trailer.size()) };
+		std::memcpy(table + i * sizeof(SeekEntry), &entry, sizeof(entry));
+		std::memcpy(image.data() + offset, frame.data(), frame.size());
+		std::memcpy(image.data() + offset + frame.size(), trailer.data(), trailer.size());
+		offset += entry.size;
+	}
+	return image;
+}
+
+
+
+bool TrackContainer::Write(const std::string& path, const std::vector<char>& image)
+{
+	return MappedFile::Write(path, image);
+}
+
+
+
+std::string TrackContainer::GetContainerPath(const std::string& trackPath, StreamEncoding encoding)
+{
+	return trackPath + "." + GetStreamEncodingName(encoding) + ".mstc";
+}
+
+
+
+bool TrackContainer::OpenOrIngest(const std::string& trackPath, StreamEncoding encoding, size_t maxFrameSize)
+{
+	const std::string path = GetContainerPath(trackPath, encoding);
+	if (Open(path) && IsCurrent(trackPath, encoding, maxFrameSize))
+		return true;
+	Close();
+
+	std::vector<char> image = Ingest(trackPath, encoding, maxFrameSize);
+	if (Write(path, image) && Open(path))
+		return true;
+	return Adopt(std::move(image));
+}
+
+
+
+bool TrackContainer::Open(const std::string& path)
+{
+	Close();
+	if (!m_mappedFile.Open(path) || !Attach(m_mappedFile.GetData(), m_mappedFile.GetSize()))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+
+
+bool TrackContainer::Adopt(std::vector<char> image)
+{
+	Close();
+	m_memory = std::move(image);
+	if (!Attach(m_memory.data(), m_memory.size()))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+
+
+void TrackContainer::Close()
+{
+	m_mappedFile.Close();
+	m_memory.clear();
+	m_data = nullptr;
+	m_size = 0;
+	m_seekTable = nullptr;
+	m_frameCount = 0;
+	m_samplesPerFrame = 0;
+	m_totalSamples = 0;
+}
+
+
+
+unsigned long long TrackContainer::GetDuration() const
+{
+	return m_waveFormat.nSamplesPerSec ? m_totalSamples * 1000 / m_waveFormat.nSamplesPerSec : 0;
+}
+
+
+
+const char* TrackContainer::GetFrame(size_t index, size_t& size) const
+{
+	if (index >= m_frameCount)
+	{
+		size = 0;
+		return nullptr;
+	}
+
+	SeekEntry entry;
+	std::memcpy(&entry, m_seekTable + index * sizeof(SeekEntry), sizeof(entry));
+	size = entry.size;
+	return m_data + entry.offset;
+}
+
+
+
+unsigned int TrackContainer::GetFrameDuration(size_t index) const
+{
+	if (!m_waveFormat.nSamplesPerSec)
+		return 0;
+	return static_cast<unsigned int>(static_cast<unsigned long long>(GetFrameSamples(index)) * 1000 / m_waveFormat.nSamplesPerSec);
+}
+
+
+
+unsigned long TrackContainer::GetFrameSamples(size_t index) const
+{
+	if (index >= m_frameCount)
+		return 0;
+	const unsigned long long start = static_cast<unsigned long long>(index) * m_samplesPerFrame;
+	return static_cast<unsigned long>(std::min<unsigned long long>(m_samplesPerFrame, m_totalSamples - std::min(start, m_totalSamples)));
+}
+
+
+
+unsigned long long TrackContainer::GetPcmSize() const
+{
+	return m_encoding == StreamEncoding::Pcm ? m_totalSamples * m_waveFormat.nBlockAlign : 0;
+}
+
+
+
+size_t TrackContainer::ReadPcm(unsigned long long offset, char* output, size_t size) const
+{
+	// every frame but the last holds exactly samplesPerFrame sample frames
+	const unsigned long long frameBytes = static_cast<unsigned long long>(m_samplesPerFrame) * m_waveFormat.nBlockAlign;
+	if (m_encoding != StreamEncoding::Pcm || !frameBytes)
+		return 0;
+
+	size_t copied = 0;
+	while (copied < size)
+	{
+		size_t frameSize;
+		const char* frame = GetFrame(static_cast<size_t>((offset + copied) / frameBytes), frameSize);
+		const size_t within = static_cast<size_t>((offset + copied) % frameBytes);
+		if (!frame || frameSize < TRAILER_SIZE + within)
+			break;
+		const size_t bytes = std::min(size - copied, frameSize - TRAILER_SIZE - within);
+		if (!bytes)
+			break;
+		std::memcpy(output + copied, frame + within, bytes);
+		copied += bytes;
+	}
+	return copied;
+}
+
+
+
+size_t TrackContainer::GetFrameIndex(unsigned long long miliseconds) const
+{
+	if (!m_samplesPerFrame)
+		return m_frameCount;
+	const unsigned long long sample = miliseconds * m_waveFormat.nSamplesPerSec / 1000;
+	return static_cast<size_t>(std::min<unsigned long long>(sample / m_samplesPerFrame, m_frameCount));
+}
+
+
+
+unsigned long long TrackContainer::GetFrameTime(size_t index) const
+{
+	if (!m_waveFormat.nSamplesPerSec)
+		return 0;
+	const unsigned long long sample = std::min<unsigned long long>(static_cast<unsigned long long>(index) * m_samplesPerFrame, m_totalSamples);
+	return sample * 1000 / m_waveFormat.nSamplesPerSec;
+}
+
+
+
+bool TrackContainer::Attach(const char* data, size_t size)
+{
+	if (size < sizeof(ContainerHeader))
+		return false;
+
+	ContainerHeader header;
+	std::memcpy(&header, data, sizeof(header));
+	if (header.magic != CONTAINER_MAGIC || header.version != CONTAINER_VERSION || !header.frameCount || !header.samplesPerFrame)
+		return false;
+
+	if (header.frameCount > (size - sizeof(ContainerHeader)) / sizeof(SeekEntry))
+		return false;
+	const size_t tableEnd = sizeof(ContainerHeader) + static_cast<size_t>(header.frameCount) * sizeof(SeekEntry);
+
+	// a truncated or corrupt file is refused here once, GetFrame hands out frames without checking them
+	unsigned long long frameEnd = tableEnd;
+	for (size_t index = 0; index < header.frameCount; index++)
+	{
+		SeekEntry entry;
+		std::memcpy(&entry, data + sizeof(ContainerHeader) + index * sizeof(SeekEntry), sizeof(entry));
+		if (entry.offset < frameEnd || entry.offset > size || entry.size > size - entry.offset || entry.size < TRAILER_SIZE)
+			return false;
+		frameEnd = entry.offset + entry.size;
+	}
+
+	m_data = data;
+	m_size = size;
+	m_seekTable = data + sizeof(ContainerHeader);
+	m_frameCount = header.frameCount;
+	m_waveFormat = header.waveFormat;
+	m_encoding = static_cast<StreamEncoding>(header.encoding);
+	m_samplesPerFrame = header.samplesPerFrame;
+	m_totalSamples = header.totalSamples;
+	return true;
+}
+
+
+
+bool TrackContainer::IsCurrent(const std::string& trackPath, StreamEncoding encoding, size_t maxFrameSize) const
+{
+	ContainerHeader header;
+	std::memcpy(&header, m_data, sizeof(header));
+	const SourceStamp source = TrackSidecar::GetSourceStamp(trackPath);
+
+	// a wave file that is gone leaves the container as the only copy, it stays usable
+	const bool sourceMatches = !source.size || (header.sourceSize == source.size && header.sourceTime == source.time);
+
+	// a track the encoding could not carry was stored as PCM, only the frame size decides then
+	return header.maxFrameSize == maxFrameSize && sourceMatches
+		&& (header.encoding == static_cast<uint8_t>(encoding) || header.encoding == static_cast<uint8_t>(StreamEncoding::Pcm));
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "FrameEncoder.h"
+#include "MappedFile.h"
+
+// Pre-packetized track written once at ingest: a header, a dense seek table and the frames exactly as
+// they go on the wire (payload followed by the wave format trailer). The server maps the file and sends
+// straight out of the mapping, seeking to a time or joining mid-track is a division and a table lookup.
+//
+// File layout: ContainerHeader, frameCount * SeekEntry { u64 offset, u32 size }, frame data.
+class TrackContainer
+{
+public:
+	TrackContainer();
+	~TrackContainer();
+	TrackContainer(const TrackContainer&) = delete;
+	TrackContainer& operator=(const TrackContainer&) = delete;
+
+	//-- Loudness gain and silence trimming are applied, then the audible range is cut into frames of
+	//-- at most maxFrameSize payload bytes. Formats the encoding can not carry fall back to PCM frames.
+	static std::vector<char> Ingest(const std::string& trackPath, StreamEncoding encoding, size_t maxFrameSize);
+
+	//-- Single steps of Ingest for pipelines running them separately.
+	static std::vector<char> GetAudibleData(const std::string& trackPath, const SoundFile& soundFile);
+	static std::vector<char> Encode(const std::string& trackPath, const std::vector<char>& audible, const MYWAVEFORMATEX& waveFormat,
+		StreamEncoding encoding, size_t maxFrameSize);
+	static bool IsIngested(const std::string& trackPath, StreamEncoding encoding, size_t maxFrameSize);
+	static std::vector<char> Build(const EncodedTrack& track, StreamEncoding encoding, size_t maxFrameSize,
+		unsigned long long sourceSize = 0, long long sourceTime = 0);
+	static bool Write(const std::string& path, const std::vector<char>& image);
+	static std::string GetContainerPath(const std::string& trackPath, StreamEncoding encoding);
+
+	//-- Maps the container of the track, ingesting and writing it first when it is missing or stale.
+	//-- If the container can not be written the image is served from memory instead.
+	bool OpenOrIngest(const std::string& trackPath, StreamEncoding encoding, size_t maxFrameSize);
+	bool Open(const std::string& path);
+	bool Adopt(std::vector<char> image);
+	void Close();
+
+	bool IsOpen() const noexcept { return m_frameCount != 0; }
+	size_t GetFrameCount() const noexcept { return m_frameCount; }
+	const MYWAVEFORMATEX& GetWaveFormat() const noexcept { return m_waveFormat; }
+	StreamEncoding GetEncoding() const noexcept { return m_encoding; }
+	size_t GetImageSize() const noexcept { return m_size; }
+	unsigned long long GetDuration() const;
+
+	//-- Wire frame at index (trailer included), size receives its length.
+	const char* GetFrame(size_t index, size_t& size) const;
+	unsigned int GetFrameDuration(size_t index) const;
+	//-- Sample frames of audio in the frame at index.
+	unsigned long GetFrameSamples(size_t index) const;
+
+	//-- Audio of a PCM container as one run of bytes, frame boundaries and trailers left out. ReadPcm
+	//-- copies what there is of size bytes from offset on and returns how much that was.
+	unsigned long long GetPcmSize() const;
+	size_t ReadPcm(unsigned long long offset, char* output, size_t size) const;
+
+	//-- Index of the frame playing at the given time, GetFrameCount() past the end.
+	size_t GetFrameIndex(unsigned long long miliseconds) const;
+	//-- Miliseconds into the track at which the frame at index starts.
+	unsigned long long GetFrameTime(size_t index) const;
+
+private:
+	bool Attach(const char* data, size_t size);
+	bool IsCurrent(const std::string& trackPath, StreamEncoding encoding, size_t maxFrameSize) const;
+
+	MappedFile m_mappedFile;
+	std::vector<char> m_memory;
+	const char* m_data;
+	size_t m_size;
+	const char* m_seekTable;
+	size_t m_frameCount;
+	MYWAVEFORMATEX m_waveFormat;
+	StreamEncoding m_encoding;
+	unsigned long m_samplesPerFrame;
+	unsigned long long m_totalSamples;
+};
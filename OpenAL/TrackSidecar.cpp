@@ -0,0 +1,55 @@
+#include "TrackSidecar.h"
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+#pragma pack(1)
+	struct SidecarHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+	};
+#pragma pack()
+}
+
+
+
+SourceStamp TrackSidecar::GetSourceStamp(const std::string& trackPath)
+{
+	SourceStamp stamp;
+	std::error_code error;
+	stamp.size = std::filesystem::file_size(trackPath, error);
+	if (error)
+		stamp.size = 0;
+	stamp.time = std::filesystem::last_write_time(trackPath, error).time_since_epoch().count();
+	if (error)
+		stamp.time = 0;
+	return stamp;
+}
+
+
+
+bool TrackSidecar::Read(const std::string& path, uint32_t magic, uint32_t version, const SourceStamp& stamp, void* record, size_t size)
+{
+	std::ifstream file(path, std::ios::binary);
+	SidecarHeader header;
+	return file.read(reinterpret_cast<char*>(&header), sizeof(header))
+		&& header.magic == magic
+		&& header.version == version
+		&& header.sourceSize == stamp.size
+		&& header.sourceTime == stamp.time
+		&& file.read(static_cast<char*>(record), size);
+}
+
+
+
+bool TrackSidecar::Write(const std::string& path, uint32_t magic, uint32_t version, const SourceStamp& stamp, const void* record, size_t size)
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	const SidecarHeader header{ magic, version, stamp.size, static_cast<int64_t>(stamp.time) };
+	return file.write(reinterpret_cast<const char*>(&header), sizeof(header))
+		&& file.write(static_cast<const char*>(record), size);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include "SoundFile.h"
+
+// Size and write time of a track's wave file, whatever was derived from it is only as current as these.
+struct SourceStamp
+{
+	unsigned long long size;    // 0 when the file is gone
+	long long time;
+	SourceStamp() :
+		size(0),
+		time(0)
+	{}
+	bool operator==(const SourceStamp& other) const noexcept { return size == other.size && time == other.time; }
+};
+
+
+
+// Small record persisted next to a track (loudness, silence bounds), stamped with the wave file it was
+// derived from so a replaced or re-encoded track is analyzed anew instead of keeping stale results.
+class TrackSidecar
+{
+public:
+	static SourceStamp GetSourceStamp(const std::string& trackPath);
+
+	//-- False when the sidecar is missing, of another format or version, or derived from another wave file.
+	template <typename Record>
+	static bool Read(const std::string& path, uint32_t magic, uint32_t version, const SourceStamp& stamp, Record& record)
+	{
+		return Read(path, magic, version, stamp, &record, sizeof(record));
+	}
+
+	template <typename Record>
+	static bool Write(const std::string& path, uint32_t magic, uint32_t version, const SourceStamp& stamp, const Record& record)
+	{
+		return Write(path, magic, version, stamp, &record, sizeof(record));
+	}
+
+private:
+	static bool Read(const std::string& path, uint32_t magic, uint32_t version, const SourceStamp& stamp, void* record, size_t size);
+	static bool Write(const std::string& path, uint32_t magic, uint32_t version, const SourceStamp& stamp, const void* record, size_t size);
+};
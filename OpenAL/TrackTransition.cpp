@@ -0,0 +1,262 @@
+#include "TrackTransition.h"
+#include "TrackSidecar.h"
+#include <cmath>
+#include <algorithm>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TRACK_TRANSITION_SSE2
+#endif
+
+namespace
+{
+	constexpr uint32_t SILENCE_MAGIC = mmioFOURCC('S', 'L', 'N', 'C');
+	constexpr uint32_t SILENCE_VERSION = 2;
+
+#pragma pack(1)
+	struct SilenceRecord
+	{
+		uint32_t head;
+		uint32_t tail;
+	};
+#pragma pack()
+
+	// Both scans return the index of a sample above the threshold (or count when there is none),
+	// the vector loop only narrows the position down to a block of samples.
+	size_t FindFirstLoud(const int16_t* samples, size_t count, int16_t threshold)
+	{
+		size_t i = 0;
+#ifdef TRACK_TRANSITION_SSE2
+		const __m128i upper = _mm_set1_epi16(threshold);
+		const __m128i lower = _mm_set1_epi16(static_cast<int16_t>(-threshold));
+		for (; i + 8 <= count; i += 8)
+		{
+			const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+			if (_mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi16(value, upper), _mm_cmplt_epi16(value, lower))))
+				break;
+		}
+#endif
+		for (; i < count; i++)
+		{
+			if (samples[i] > threshold || samples[i] < -threshold)
+				return i;
+		}
+		return count;
+	}
+
+	size_t FindLastLoud(const int16_t* samples, size_t count, int16_t threshold)
+	{
+		size_t i = count;
+#ifdef TRACK_TRANSITION_SSE2
+		const __m128i upper = _mm_set1_epi16(threshold);
+		const __m128i lower = _mm_set1_epi16(static_cast<int16_t>(-threshold));
+		for (; i >= 8; i -= 8)
+		{
+			const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i - 8));
+			if (_mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi16(value, upper), _mm_cmplt_epi16(value, lower))))
+				break;
+		}
+#endif
+		for (; i > 0; i--)
+		{
+			if (samples[i - 1] > threshold || samples[i - 1] < -threshold)
+				return i - 1;
+		}
+		return count;
+	}
+
+	size_t FindFirstLoud(const float* samples, size_t count, float threshold)
+	{
+		size_t i = 0;
+#ifdef TRACK_TRANSITION_SSE2
+		const __m128 limit = _mm_set1_ps(threshold);
+		const __m128 sign = _mm_set1_ps(-0.0f);
+		for (; i + 4 <= count; i += 4)
+		{
+			const __m128 value = _mm_andnot_ps(sign, _mm_loadu_ps(samples + i));
+			if (_mm_movemask_ps(_mm_cmpgt_ps(value, limit)))
+				break;
+		}
+#endif
+		for (; i < count; i++)
+		{
+			if (std::abs(samples[i]) > threshold)
+				return i;
+		}
+		return count;
+	}
+
+	size_t FindLastLoud(const float* samples, size_t count, float threshold)
+	{
+		size_t i = count;
+#ifdef TRACK_TRANSITION_SSE2
+		const __m128 limit = _mm_set1_ps(threshold);
+		const __m128 sign = _mm_set1_ps(-0.0f);
+		for (; i >= 4; i -= 4)
+		{
+			const __m128 value = _mm_andnot_ps(sign, _mm_loadu_ps(samples + i - 4));
+			if (_mm_movemask_ps(_mm_cmpgt_ps(value, limit)))
+				break;
+		}
+#endif
+		for (; i > 0; i--)
+		{
+			if (std::abs(samples[i - 1]) > threshold)
+				return i - 1;
+		}
+		return count;
+	}
+
+	size_t FindFirstLoud(const uchar* samples, size_t count, int threshold)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			if (std::abs(int(samples[i]) - 128) > threshold)
+				return i;
+		}
+		return count;
+	}
+
+	size_t FindLastLoud(const uchar* samples, size_t count, int threshold)
+	{
+		for (size_t i = count; i > 0; i--)
+		{
+			if (std::abs(int(samples[i - 1]) - 128) > threshold)
+				return i - 1;
+		}
+		return count;
+	}
+}
+
+
+
+SilenceBounds TrackTransition::DetectSilence(const SoundFile& soundFile, float thresholdDb)
+{
+	SilenceBounds bounds;
+	const MYWAVEFORMATEX waveFormat = soundFile.GetWaveFormat();
+	const std::vector<uchar>& data = soundFile.GetSoundData();
+	if (!waveFormat.nChannels || !waveFormat.nBlockAlign)
+		return bounds;
+
+	const float threshold = std::pow(10.0f, thresholdDb / 20.0f);
+	const size_t usable = data.size() - data.size() % waveFormat.nBlockAlign;
+	size_t first = 0;
+	size_t last = 0;
+	size_t count = 0;
+
+	switch (waveFormat.wBitsPerSample)
+	{
+		case 8:
+		{
+			count = usable;
+			first = FindFirstLoud(data.data(), count, int(threshold * 128.0f));
+			last = FindLastLoud(data.data(), count, int(threshold * 128.0f));
+			break;
+		}
+		case 16:
+		{
+			const int16_t* samples = reinterpret_cast<const int16_t*>(data.data());
+			count = usable / sizeof(int16_t);
+			first = FindFirstLoud(samples, count, static_cast<int16_t>(threshold * 32768.0f));
+			last = FindLastLoud(samples, count, static_cast<int16_t>(threshold * 32768.0f));
+			break;
+		}
+		case 32:
+		{
+			const float* samples = reinterpret_cast<const float*>(data.data());
+			count = usable / sizeof(float);
+			first = FindFirstLoud(samples, count, threshold);
+			last = FindLastLoud(samples, count, threshold);
+			break;
+		}
+		default:
+			bounds.tail = static_cast<ulong>(usable);
+			return bounds;
+	}
+
+	if (first == count)
+		return bounds;
+
+	bounds.head = static_cast<ulong>(first / waveFormat.nChannels * waveFormat.nBlockAlign);
+	bounds.tail = static_cast<ulong>((last / waveFormat.nChannels + 1) * waveFormat.nBlockAlign);
+	return bounds;
+}
+
+
+
+SilenceBounds TrackTransition::LoadOrDetect(const std::string& trackPath, const SoundFile& soundFile)
+{
+	const SourceStamp source = TrackSidecar::GetSourceStamp(trackPath);
+	SilenceRecord record;
+	if (TrackSidecar::Read(GetSidecarPath(trackPath), SILENCE_MAGIC, SILENCE_VERSION, source, record)
+		&& record.head <= record.tail
+		&& record.tail <= soundFile.GetSoundData().size())
+	{
+		SilenceBounds bounds;
+		bounds.head = record.head;
+		bounds.tail = record.tail;
+		return bounds;
+	}
+
+	const SilenceBounds bounds = DetectSilence(soundFile);
+	record = SilenceRecord{ static_cast<uint32_t>(bounds.head), static_cast<uint32_t>(bounds.tail) };
+	TrackSidecar::Write(GetSidecarPath(trackPath), SILENCE_MAGIC, SILENCE_VERSION, source, record);
+	return bounds;
+}
+
+
+
+std::string TrackTransition::GetSidecarPath(const std::string& trackPath)
+{
+	return trackPath + ".silence";
+}
+
+
+
+bool TrackTransition::CanJoin(const MYWAVEFORMATEX& from, const MYWAVEFORMATEX& to)
+{
+	return from.wFormatTag == to.wFormatTag
+		&& from.nChannels == to.nChannels
+		&& from.nSamplesPerSec == to.nSamplesPerSec
+		&& from.nBlockAlign == to.nBlockAlign
+		&& from.wBitsPerSample == to.wBitsPerSample;
+}
+
+
+
+bool TrackTransition::CanCrossfade(const MYWAVEFORMATEX& from, const MYWAVEFORMATEX& to)
+{
+	return CanJoin(from, to) && (from.wBitsPerSample == 16 || from.wBitsPerSample == 32);
+}
+
+
+
+void TrackTransition::Crossfade(const char* outgoing, const char* incoming, char* output, size_t size,
+	const MYWAVEFORMATEX& waveFormat, size_t fadeOffset, size_t fadeLength)
+{
+	const size_t frames = size / waveFormat.nBlockAlign;
+	const size_t firstFrame = fadeOffset / waveFormat.nBlockAlign;
+	const float fadeFrames = float(std::max<size_t>(1, fadeLength / waveFormat.nBlockAlign));
+
+	for (size_t frame = 0; frame < frames; frame++)
+	{
+		const float position = std::min(1.0f, float(firstFrame + frame) / fadeFrames);
+		const float outGain = std::sqrt(1.0f - position);
+		const float inGain = std::sqrt(position);
+
+		for (size_t channel = 0; channel < waveFormat.nChannels; channel++)
+		{
+			const size_t sample = frame * waveFormat.nChannels + channel;
+			if (waveFormat.wBitsPerSample == 16)
+			{
+				const float mixed = float(reinterpret_cast<const int16_t*>(outgoing)[sample]) * outGain
+					+ float(reinterpret_cast<const int16_t*>(incoming)[sample]) * inGain;
+				reinterpret_cast<int16_t*>(output)[sample] = static_cast<int16_t>(std::clamp(mixed, -32768.0f, 32767.0f));
+			}
+			else
+			{
+				reinterpret_cast<float*>(output)[sample] = reinterpret_cast<const float*>(outgoing)[sample] * outGain
+					+ reinterpret_cast<const float*>(incoming)[sample] * inGain;
+			}
+		}
+	}
+}
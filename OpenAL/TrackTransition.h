@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include "SoundFile.h"
+
+// Audible range of a track in bytes, always aligned to the wave format's block.
+struct SilenceBounds
+{
+	ulong head;     // first audible byte
+	ulong tail;     // one past the last audible byte
+	SilenceBounds() :
+		head(0),
+		tail(0)
+	{}
+	ulong GetLength() const noexcept { return tail > head ? tail - head : 0; }
+};
+
+
+
+class TrackTransition
+{
+public:
+	static constexpr float SILENCE_THRESHOLD_DB = -60.0f;
+
+	//-- Scans the silent head and tail of the track (SSE2 for 16 bit and float data).
+	static SilenceBounds DetectSilence(const SoundFile& soundFile, float thresholdDb = SILENCE_THRESHOLD_DB);
+
+	//-- Reads the bounds persisted next to the track, or detects and persists them when missing or the wave file changed.
+	static SilenceBounds LoadOrDetect(const std::string& trackPath, const SoundFile& soundFile);
+	static std::string GetSidecarPath(const std::string& trackPath);
+
+	//-- Tracks can be joined inside one chunk only when their formats match.
+	static bool CanJoin(const MYWAVEFORMATEX& from, const MYWAVEFORMATEX& to);
+	static bool CanCrossfade(const MYWAVEFORMATEX& from, const MYWAVEFORMATEX& to);
+
+	//-- Equal power crossfade of size bytes, fadeOffset and fadeLength are in bytes as well.
+	static void Crossfade(const char* outgoing, const char* incoming, char* output, size_t size,
+		const MYWAVEFORMATEX& waveFormat, size_t fadeOffset, size_t fadeLength);
+};
@@ -0,0 +1,75 @@
+#include "AdmissionControl.h"
+#include <algorithm>
+#include <cmath>
+#include "../SocketsClientServer/Metrics.h"
+
+AdmissionControl::AdmissionControl() :
+	m_tokens(ACCEPT_BURST),
+	m_refilled(0),
+	m_pressure(0),
+	m_measured(0)
+{
+}
+
+
+
+size_t AdmissionControl::GetAllowance(unsigned long long now, size_t open)
+{
+	static const MetricCounter paused("admission.paused");
+
+	if (m_refilled)
+		m_tokens = std::min(ACCEPT_BURST, m_tokens + ACCEPT_RATE * (now - m_refilled) / 1000000.0);
+	m_refilled = now;
+
+	if (open >= MAX_CONNECTIONS || IsUnderPressure(now))
+	{
+		paused.Add();
+		return 0;
+	}
+	return std::min(static_cast<size_t>(m_tokens), MAX_CONNECTIONS - open);
+}
+
+
+
+void AdmissionControl::OnAccepted(size_t count)
+{
+	m_tokens = std::max(0.0, m_tokens - static_cast<double>(count));
+}
+
+
+
+void AdmissionControl::OnBroadcast(unsigned long long now, unsigned long long sendTime, unsigned int duration)
+{
+	static const MetricGauge pressureGauge("admission.pressure_permille");
+
+	if (!duration)
+		return;
+	// rises with the first slow send and only eases off over the next few frames, admission stops at
+	// once and does not flap while the new listeners are still settling
+	const unsigned int sample = static_cast<unsigned int>(std::min<unsigned long long>(sendTime / duration, 10000));
+	const unsigned int previous = GetPressure(now);
+	const unsigned int pressure = sample > previous ? sample : (previous * 7 + sample) / 8;
+	m_pressure.store(pressure, std::memory_order_relaxed);
+	m_measured.store(now, std::memory_order_relaxed);
+	pressureGauge.Set(pressure);
+}
+
+
+
+bool AdmissionControl::IsUnderPressure(unsigned long long now) const noexcept
+{
+	return GetPressure(now) > STREAM_BUDGET;
+}
+
+
+
+unsigned int AdmissionControl::GetPressure(unsigned long long now) const noexcept
+{
+	// the two are stored apart, a frame going out meanwhile makes this off by one frame at most
+	const unsigned long long measured = m_measured.load(std::memory_order_relaxed);
+	const unsigned int pressure = m_pressure.load(std::memory_order_relaxed);
+	if (!measured || now <= measured + IDLE_AFTER * 1000ull)
+		return pressure;
+	const double idle = static_cast<double>(now - measured - IDLE_AFTER * 1000ull);
+	return static_cast<unsigned int>(pressure * std::exp2(-idle / (IDLE_HALF_LIFE * 1000.0)));
+}
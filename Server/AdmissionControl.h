@@ -0,0 +1,41 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+// How many waiting connections the acceptor may take in right now. A token bucket bounds the accept rate
+// to ACCEPT_RATE per second with bursts of ACCEPT_BURST, and nothing is admitted while the stream is under
+// pressure: sending a frame to all listeners took more than STREAM_BUDGET of the frame's duration lately,
+// or MAX_CONNECTIONS are open. What is not admitted stays in the listen backlog, so a reconnect storm is
+// taken in as fast as the stream can afford rather than all at once.
+//
+// The pressure is only measured when a frame goes out. Once none did for IDLE_AFTER (a paused station, a
+// relay that lost its upstream) it decays on its own, halving every IDLE_HALF_LIFE, so the gate does not
+// stay shut.
+class AdmissionControl
+{
+public:
+	static constexpr double ACCEPT_RATE = 10000;            // connections per second
+	static constexpr double ACCEPT_BURST = 500;
+	static constexpr size_t MAX_CONNECTIONS = 100000;
+	static constexpr unsigned int STREAM_BUDGET = 500;      // 1/1000 of a frame's duration the broadcast may take
+	static constexpr unsigned int IDLE_AFTER = 500;         // miliseconds, longer than any frame
+	static constexpr unsigned int IDLE_HALF_LIFE = 100;     // miliseconds
+
+	AdmissionControl();
+
+	//-- Connections that may be accepted at now (microseconds) with open ones open, the acceptor only.
+	size_t GetAllowance(unsigned long long now, size_t open);
+	void OnAccepted(size_t count);
+	//-- The stream sent a frame of duration miliseconds to all its listeners in sendTime microseconds, done at now.
+	void OnBroadcast(unsigned long long now, unsigned long long sendTime, unsigned int duration);
+	bool IsUnderPressure(unsigned long long now) const noexcept;
+
+private:
+	//-- Broadcast time per frame duration in 1/1000 as of now, decayed since the last frame.
+	unsigned int GetPressure(unsigned long long now) const noexcept;
+
+	double m_tokens;
+	unsigned long long m_refilled;                      // microseconds, 0 before the first allowance
+	std::atomic<unsigned int> m_pressure;               // as of the last frame
+	std::atomic<unsigned long long> m_measured;         // microseconds, when the last frame went out
+};
@@ -0,0 +1,77 @@
+#include "BroadcastRing.h"
+#include <algorithm>
+#include <cstring>
+
+BroadcastRing::BroadcastRing(size_t capacity) :
+	m_entries(capacity ? capacity : 1),
+	m_next(0),
+	m_size(0)
+{
+}
+
+
+
+void BroadcastRing::Push(uint32_t sequence, PacketMux::Packet packet)
+{
+	StreamPacketHeader header;
+	std::memcpy(&header, packet->data(), sizeof(header));
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_entries[m_next] = Entry{ sequence, header.duration, std::move(packet) };
+	m_next = (m_next + 1) % m_entries.size();
+	if (m_size < m_entries.size())
+		m_size++;
+}
+
+
+
+void BroadcastRing::Clear()
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	for (Entry& entry : m_entries)
+		entry = Entry();
+	m_next = 0;
+	m_size = 0;
+}
+
+
+
+std::vector<PacketMux::Packet> BroadcastRing::GetSince(uint32_t sequence) const
+{
+	std::vector<PacketMux::Packet> packets;
+	std::lock_guard<std::mutex> guard(m_lock);
+	const size_t oldest = (m_next + m_entries.size() - m_size) % m_entries.size();
+	for (size_t i = 0; i < m_size; i++)
+	{
+		const Entry& entry = m_entries[(oldest + i) % m_entries.size()];
+		if (static_cast<int32_t>(entry.sequence - sequence) > 0)
+			packets.push_back(entry.packet);
+	}
+	return packets;
+}
+
+
+
+std::vector<PacketMux::Packet> BroadcastRing::GetLast(unsigned int duration) const
+{
+	std::vector<PacketMux::Packet> packets;
+	std::lock_guard<std::mutex> guard(m_lock);
+	unsigned int total = 0;
+	for (size_t i = 1; i <= m_size; i++)
+	{
+		const Entry& entry = m_entries[(m_next + m_entries.size() - i) % m_entries.size()];
+		if (total + entry.duration > duration)
+			break;
+		total += entry.duration;
+		packets.push_back(entry.packet);
+	}
+	std::reverse(packets.begin(), packets.end());
+	return packets;
+}
+
+
+
+size_t BroadcastRing::GetSize() const
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_size;
+}
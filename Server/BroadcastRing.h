@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "../SocketsClientServer/PacketMux.h"
+
+// The last frames of a station as they went out to its listeners, whole packets by sequence number. The
+// stream pushes every frame it broadcasts, an origin from its station and a relay from its upstream, so
+// anything that has to send a listener frames it missed takes them from here instead of the source.
+class BroadcastRing
+{
+public:
+	explicit BroadcastRing(size_t capacity);
+
+	void Push(uint32_t sequence, PacketMux::Packet packet);
+	//-- The frames after sequence that are still kept, oldest first. Sequence numbers wrap around.
+	std::vector<PacketMux::Packet> GetSince(uint32_t sequence) const;
+	//-- The newest frames that last duration miliseconds together, oldest first.
+	std::vector<PacketMux::Packet> GetLast(unsigned int duration) const;
+
+	//-- Forgets every frame, for a stream whose sequence numbers start over.
+	void Clear();
+
+	size_t GetSize() const;
+	size_t GetCapacity() const noexcept { return m_entries.size(); }
+
+private:
+	struct Entry
+	{
+		uint32_t sequence = 0;
+		uint32_t duration = 0;          // miliseconds
+		PacketMux::Packet packet;
+	};
+
+	mutable std::mutex m_lock;
+	std::vector<Entry> m_entries;
+	size_t m_next;                  // where the next frame goes, the oldest once the ring is full
+	size_t m_size;
+};
@@ -0,0 +1,210 @@
+#include "ClusterMembership.h"
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include "../SocketsClientServer/SocketCreator.h"
+#include "../SocketsClientServer/Metrics.h"
+
+namespace
+{
+	// The connection a member sends its heartbeats to another one on, nothing comes back on it. Closed
+	// with the coroutine, also when the loop destroys it suspended.
+	class PeerSocket
+	{
+	public:
+		PeerSocket() : m_socket(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP))
+		{
+			if (m_socket != INVALID_SOCKET && !SocketCreator::SetNonBlocking(m_socket))
+				Close();
+		}
+		~PeerSocket() { Close(); }
+		PeerSocket(const PeerSocket&) = delete;
+		PeerSocket& operator=(const PeerSocket&) = delete;
+
+		SOCKET Get() const noexcept { return m_socket; }
+
+	private:
+		void Close() noexcept
+		{
+			if (m_socket != INVALID_SOCKET)
+				closesocket(m_socket);
+			m_socket = INVALID_SOCKET;
+		}
+
+		SOCKET m_socket;
+	};
+}
+
+
+
+ClusterMembership::ClusterMembership(const std::string& self, const std::vector<std::string>& seeds) :
+	m_self(self)
+{
+	{
+		std::lock_guard<std::mutex> guardLock(m_lock);
+		m_ring.Add(m_self);
+		for (const std::string& seed : seeds)
+			AddNode(seed);
+		CountMembers();
+	}
+	m_loop.Spawn(ExpireMembers());
+	m_thread = std::thread(&EventLoop::Run, &m_loop);
+}
+
+
+
+ClusterMembership::~ClusterMembership()
+{
+	// the coroutines are destroyed with the loop wherever they wait, nodes added meanwhile never start
+	m_loop.Stop();
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+
+
+void ClusterMembership::OnHeartbeat(const char* text, size_t size)
+{
+	static const MetricCounter heartbeats("cluster.heartbeats");
+	static const MetricCounter joins("cluster.joins");
+
+	heartbeats.Add();
+	std::istringstream nodes(std::string(text, size));
+	std::string sender;
+	if (!(nodes >> sender) || sender == m_self)
+		return;
+
+	std::lock_guard<std::mutex> guardLock(m_lock);
+	AddNode(sender);
+	m_lastHeard[sender] = GetTime();
+	if (m_ring.Add(sender))
+	{
+		joins.Add();
+		CountMembers();
+		std::cout << "CLUSTER JOIN " << sender << " " << m_ring.GetNodes().size() << " MEMBERS" << std::endl;
+	}
+
+	// the members the sender hears, this server connects to them too and is heard by them that way
+	std::string node;
+	while (nodes >> node)
+		AddNode(node);
+}
+
+
+
+std::string ClusterMembership::GetOwner(uint16_t station) const
+{
+	std::lock_guard<std::mutex> guardLock(m_lock);
+	return m_ring.GetOwner(station);
+}
+
+
+
+size_t ClusterMembership::GetMemberCount() const
+{
+	std::lock_guard<std::mutex> guardLock(m_lock);
+	return m_ring.GetNodes().size();
+}
+
+
+
+Task<> ClusterMembership::ExpireMembers()
+{
+	static const MetricCounter leaves("cluster.leaves");
+
+	while (true)
+	{
+		co_await m_loop.Sleep(HEARTBEAT_INTERVAL);
+		std::lock_guard<std::mutex> guardLock(m_lock);
+		const long long now = GetTime();
+		for (const auto& entry : m_lastHeard)
+		{
+			if (entry.second && now - entry.second > FAILURE_TIMEOUT && m_ring.Remove(entry.first))
+			{
+				leaves.Add();
+				CountMembers();
+				std::cout << "CLUSTER LEAVE " << entry.first << " " << m_ring.GetNodes().size() << " MEMBERS" << std::endl;
+			}
+		}
+	}
+}
+
+
+
+Task<> ClusterMembership::SendHeartbeats(std::string node)
+{
+	std::string host;
+	int port = 0;
+	if (!SocketCreator::ParseEndpoint(node, host, port))
+		co_return;
+	sockaddr_in peer{};
+	peer.sin_family = AF_INET;
+	peer.sin_port = htons(static_cast<u_short>(port));
+	if (InetPtonA(AF_INET, host.c_str(), &peer.sin_addr.S_un.S_addr) != 1)
+		co_return;
+
+	std::vector<char> packet;
+	while (true)
+	{
+		PeerSocket link;
+		if (link.Get() != INVALID_SOCKET && co_await m_loop.Connect(link.Get(), peer, CONNECT_TIMEOUT))
+		{
+			SocketCreator::SetNoDelay(link.Get());
+			while (true)
+			{
+				std::string heartbeat;
+				{
+					std::lock_guard<std::mutex> guardLock(m_lock);
+					heartbeat = GetHeartbeat();
+				}
+				const StreamPacketHeader header{ STREAM_PACKET_MAGIC, static_cast<uint32_t>(heartbeat.size()), static_cast<uint16_t>(PacketType::ClusterHeartbeat), 0, 0, 0, 0 };
+				packet.resize(sizeof(header) + heartbeat.size());
+				std::memcpy(packet.data(), &header, sizeof(header));
+				std::memcpy(packet.data() + sizeof(header), heartbeat.data(), heartbeat.size());
+				if (!co_await m_loop.Send(link.Get(), packet.data(), static_cast<int>(packet.size())))
+					break;
+				co_await m_loop.Sleep(HEARTBEAT_INTERVAL);
+			}
+		}
+		// a node that went away is tried again now and then, it may come back
+		co_await m_loop.Sleep(FAILURE_TIMEOUT);
+	}
+}
+
+
+
+void ClusterMembership::AddNode(const std::string& node)
+{
+	if (node == m_self || m_lastHeard.count(node))
+		return;
+	m_lastHeard.emplace(node, 0);
+	m_loop.Spawn(SendHeartbeats(node));
+}
+
+
+
+std::string ClusterMembership::GetHeartbeat() const
+{
+	std::string heartbeat = m_self;
+	for (const std::string& node : m_ring.GetNodes())
+	{
+		if (node != m_self)
+			heartbeat += " " + node;
+	}
+	return heartbeat;
+}
+
+
+
+void ClusterMembership::CountMembers()
+{
+	static const MetricGauge members("cluster.members");
+	members.Set(static_cast<int64_t>(m_ring.GetNodes().size()));
+}
+
+
+
+long long ClusterMembership::GetTime()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "HashRing.h"
+#include "../SocketsClientServer/EventLoop.h"
+
+// Which servers form the cluster right now, and through the HashRing which of them owns a station.
+// Every member keeps a connection to every other member it knows of and sends a ClusterHeartbeat on it
+// each HEARTBEAT_INTERVAL, naming itself and the members it hears. A member not heard for FAILURE_TIMEOUT
+// leaves the ring until it is heard again. A new server only needs one seed: the heartbeats of the seed
+// name all the others, which hear the newcomer as soon as it connected to them.
+//
+// Nodes are "host:port" as the servers listen, every member must use the same spelling for a node. The
+// heartbeats to each node and the expiry are coroutines on one EventLoop thread, however many nodes there are.
+class ClusterMembership
+{
+public:
+	static constexpr unsigned int HEARTBEAT_INTERVAL = 500;        // miliseconds
+	static constexpr unsigned int FAILURE_TIMEOUT = 2000;          // miliseconds
+	static constexpr unsigned int CONNECT_TIMEOUT = 1000;          // miliseconds
+
+	ClusterMembership(const std::string& self, const std::vector<std::string>& seeds);
+	~ClusterMembership();
+	ClusterMembership(const ClusterMembership&) = delete;
+	ClusterMembership& operator=(const ClusterMembership&) = delete;
+
+	//-- A heartbeat came in on one of the connections of the server.
+	void OnHeartbeat(const char* text, size_t size);
+
+	//-- The member owning the station, "host:port".
+	std::string GetOwner(uint16_t station) const;
+	const std::string& GetSelf() const noexcept { return m_self; }
+	size_t GetMemberCount() const;
+
+private:
+	//-- Expires the members not heard for too long.
+	Task<> ExpireMembers();
+	//-- Sends heartbeats to one node for as long as the membership lasts, one coroutine each.
+	Task<> SendHeartbeats(std::string node);
+	void AddNode(const std::string& node);
+	std::string GetHeartbeat() const;
+	void CountMembers();
+
+	static long long GetTime();
+
+	const std::string m_self;
+	mutable std::mutex m_lock;
+	HashRing m_ring;                                        // this server and the members heard lately
+	std::unordered_map<std::string, long long> m_lastHeard; // every node known, miliseconds, 0 never heard
+	EventLoop m_loop;
+	std::thread m_thread;
+};
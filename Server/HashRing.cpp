@@ -0,0 +1,83 @@
+#include "HashRing.h"
+#include <algorithm>
+
+namespace
+{
+	const std::string NO_NODE;
+}
+
+
+
+bool HashRing::Add(const std::string& node)
+{
+	const auto it = std::lower_bound(m_nodes.begin(), m_nodes.end(), node);
+	if (it != m_nodes.end() && *it == node)
+		return false;
+	m_nodes.insert(it, node);
+	Rebuild();
+	return true;
+}
+
+
+
+bool HashRing::Remove(const std::string& node)
+{
+	const auto it = std::lower_bound(m_nodes.begin(), m_nodes.end(), node);
+	if (it == m_nodes.end() || *it != node)
+		return false;
+	m_nodes.erase(it);
+	Rebuild();
+	return true;
+}
+
+
+
+const std::string& HashRing::GetOwner(uint16_t station) const
+{
+	if (m_points.empty())
+		return NO_NODE;
+	const uint64_t hash = Hash(&station, sizeof(station));
+	auto it = std::lower_bound(m_points.begin(), m_points.end(), std::make_pair(hash, size_t(0)));
+	if (it == m_points.end())
+		it = m_points.begin();
+	return m_nodes[it->second];
+}
+
+
+
+uint64_t HashRing::Hash(const void* data, size_t size) noexcept
+{
+	// FNV-1a, then the splitmix64 finalizer: consecutive station numbers and node names that only
+	// differ in the last digit must still land all over the ring
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	hash ^= hash >> 30;
+	hash *= 0xbf58476d1ce4e5b9ull;
+	hash ^= hash >> 27;
+	hash *= 0x94d049bb133111ebull;
+	hash ^= hash >> 31;
+	return hash;
+}
+
+
+
+void HashRing::Rebuild()
+{
+	// the points of a node only depend on its name, every member of the cluster builds the same ring
+	m_points.clear();
+	m_points.reserve(m_nodes.size() * VIRTUAL_NODES);
+	for (size_t node = 0; node < m_nodes.size(); node++)
+	{
+		for (unsigned int replica = 0; replica < VIRTUAL_NODES; replica++)
+		{
+			const std::string point = m_nodes[node] + "#" + std::to_string(replica);
+			m_points.emplace_back(Hash(point.data(), point.size()), node);
+		}
+	}
+	std::sort(m_points.begin(), m_points.end());
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Consistent hashing of stations onto the servers of a cluster. Every node is put on a 64 bit ring at
+// VIRTUAL_NODES pseudo random points, a station belongs to the node of the first point at or after the
+// station's own hash. Adding or removing one of N nodes only moves the stations between its points and
+// the points before them, about 1/N of all, and the virtual nodes keep the shares of the nodes within a
+// few percent of each other.
+class HashRing
+{
+public:
+	static constexpr unsigned int VIRTUAL_NODES = 160;
+
+	//-- True when the node was not on the ring yet.
+	bool Add(const std::string& node);
+	bool Remove(const std::string& node);
+
+	//-- Node owning the station, empty while the ring has no nodes.
+	const std::string& GetOwner(uint16_t station) const;
+	const std::vector<std::string>& GetNodes() const noexcept { return m_nodes; }
+
+	static uint64_t Hash(const void* data, size_t size) noexcept;
+
+private:
+	void Rebuild();
+
+	std::vector<std::string> m_nodes;                       // sorted
+	std::vector<std::pair<uint64_t, size_t>> m_points;      // sorted by hash, index into m_nodes
+};
@@ -0,0 +1,162 @@
+#include "IngestPipeline.h"
+#include <chrono>
+#include <iomanip>
+
+namespace
+{
+	constexpr const char* STAGE_NAMES[] = { "read", "analyze", "encode", "write" };
+	constexpr WORD WAVE_FORMAT_IEEE_FLOAT_TAG = 3;
+
+	bool IsSupported(const MYWAVEFORMATEX& waveFormat)
+	{
+		const bool pcm = waveFormat.wFormatTag == WAVE_FORMAT_PCM
+			&& (waveFormat.wBitsPerSample == 8 || waveFormat.wBitsPerSample == 16);
+		const bool floatingPoint = waveFormat.wFormatTag == WAVE_FORMAT_IEEE_FLOAT_TAG && waveFormat.wBitsPerSample == 32;
+		return (pcm || floatingPoint)
+			&& waveFormat.nChannels > 0 && waveFormat.nSamplesPerSec > 0
+			&& waveFormat.nBlockAlign == waveFormat.nChannels * waveFormat.wBitsPerSample / 8;
+	}
+}
+
+IngestPipeline::IngestPipeline(TaskPool& pool, StreamEncoding encoding, size_t maxFrameSize, size_t queueCapacity) :
+	m_pool(pool),
+	m_encoding(encoding),
+	m_maxFrameSize(maxFrameSize),
+	m_queueCapacity(std::max<size_t>(1, queueCapacity)),
+	m_remaining(0)
+{
+	m_stages[Read].concurrency = DISK_CONCURRENCY;
+	m_stages[Analyze].concurrency = pool.GetThreadCount();
+	m_stages[Encode].concurrency = pool.GetThreadCount();
+	m_stages[Write].concurrency = DISK_CONCURRENCY;
+}
+
+
+
+IngestReport IngestPipeline::Run(const std::vector<std::string>& tracks)
+{
+	const auto start = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> guardLock(m_lock);
+	m_report = IngestReport();
+	for (size_t stage = 0; stage < STAGE_COUNT; stage++)
+	{
+		m_report.stages[stage].name = STAGE_NAMES[stage];
+		m_report.stages[stage].concurrency = m_stages[stage].concurrency;
+	}
+
+	for (const auto& track : tracks)
+	{
+		m_stages[Read].input.push_back(std::make_shared<Item>());
+		m_stages[Read].input.back()->path = track;
+	}
+	m_remaining = tracks.size();
+
+	Schedule();
+	m_done.wait(guardLock, [this]() { return m_remaining == 0; });
+	m_report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return m_report;
+}
+
+
+
+void IngestPipeline::Print(const IngestReport& report, std::ostream& stream)
+{
+	stream << "INGESTED " << report.ingested << " SKIPPED " << report.skipped << " FAILED " << report.failed
+		<< " IN " << report.seconds << " s" << std::endl;
+
+	const double seconds = std::max(report.seconds, 1e-9);
+	for (const auto& stage : report.stages)
+	{
+		stream << std::left << std::setw(8) << stage.name << std::right
+			<< std::setw(8) << stage.items << " tracks "
+			<< std::setw(10) << std::fixed << std::setprecision(1) << stage.items / seconds << " tracks/s "
+			<< std::setw(10) << stage.bytes / seconds / (1024.0 * 1024.0) << " MiB/s "
+			<< std::setw(6) << 100.0 * stage.busySeconds / (seconds * std::max(1u, stage.concurrency)) << " % busy x" << stage.concurrency
+			<< std::defaultfloat << std::endl;
+	}
+}
+
+
+
+void IngestPipeline::Schedule()
+{
+	// later stages first, they free the room earlier stages are waiting for
+	for (int stage = Write; stage >= Read; stage--)
+	{
+		StageState& state = m_stages[stage];
+		while (!state.input.empty() && state.active < state.concurrency
+			&& (stage == Write || m_stages[stage + 1].input.size() + state.active < m_queueCapacity))
+		{
+			std::shared_ptr<Item> item = std::move(state.input.front());
+			state.input.pop_front();
+			state.active++;
+			m_pool.Submit(TaskPriority::Bulk, [this, stage, item]() { Process(static_cast<Stage>(stage), item); });
+		}
+	}
+}
+
+
+
+void IngestPipeline::Process(Stage stage, std::shared_ptr<Item> item)
+{
+	const auto start = std::chrono::steady_clock::now();
+	unsigned long long bytes = 0;
+	const Outcome outcome = Execute(stage, *item, bytes);
+	const double busy = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::lock_guard<std::mutex> guardLock(m_lock);
+	IngestStageReport& report = m_report.stages[stage];
+	report.items++;
+	report.bytes += bytes;
+	report.busySeconds += busy;
+	m_stages[stage].active--;
+
+	if (outcome == Outcome::Continue && stage != Write)
+	{
+		m_stages[stage + 1].input.push_back(std::move(item));
+	}
+	else
+	{
+		if (outcome == Outcome::Failed)
+			m_report.failed++;
+		else if (outcome == Outcome::Skipped)
+			m_report.skipped++;
+		else
+			m_report.ingested++;
+		if (--m_remaining == 0)
+			m_done.notify_all();
+	}
+	Schedule();
+}
+
+
+
+IngestPipeline::Outcome IngestPipeline::Execute(Stage stage, Item& item, unsigned long long& bytes)
+{
+	switch (stage)
+	{
+		case Read:
+			if (TrackContainer::IsIngested(item.path, m_encoding, m_maxFrameSize))
+				return Outcome::Skipped;
+			if (!item.soundFile.LoadFile(item.path) || !IsSupported(item.soundFile.GetWaveFormat()))
+				return Outcome::Failed;
+			item.waveFormat = item.soundFile.GetWaveFormat();
+			bytes = item.soundFile.GetSoundData().size();
+			return Outcome::Continue;
+
+		case Analyze:
+			bytes = item.soundFile.GetSoundData().size();
+			item.data = TrackContainer::GetAudibleData(item.path, item.soundFile);
+			item.soundFile = SoundFile();
+			return item.data.empty() ? Outcome::Failed : Outcome::Continue;
+
+		case Encode:
+			bytes = item.data.size();
+			item.data = TrackContainer::Encode(item.path, item.data, item.waveFormat, m_encoding, m_maxFrameSize);
+			return item.data.empty() ? Outcome::Failed : Outcome::Continue;
+
+		default:
+			bytes = item.data.size();
+			return MappedFile::Write(TrackContainer::GetContainerPath(item.path, m_encoding), item.data) ? Outcome::Continue : Outcome::Failed;
+	}
+}
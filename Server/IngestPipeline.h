@@ -0,0 +1,80 @@
+#pragma once
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "../OpenAL/TrackContainer.h"
+#include "../SocketsClientServer/TaskPool.h"
+
+struct IngestStageReport
+{
+	const char* name = "";
+	unsigned int concurrency = 0;
+	size_t items = 0;
+	unsigned long long bytes = 0;
+	double busySeconds = 0.0;           // summed over all tasks of the stage
+};
+
+struct IngestReport
+{
+	std::array<IngestStageReport, 4> stages;
+	size_t ingested = 0;
+	size_t skipped = 0;                 // container already up to date
+	size_t failed = 0;
+	double seconds = 0.0;
+};
+
+
+
+// Bulk ingest of many tracks: read -> analyze (loudness, silence) -> encode -> write container.
+// Every step of every track is a task on the work-stealing pool. Between two stages sits a bounded
+// queue, a stage only starts a track when the next queue has room for it, so memory stays bounded
+// and no worker ever blocks on a full queue. Reads and writes are limited to a few at a time to keep
+// the disk streaming, analysis and encoding use every core.
+class IngestPipeline
+{
+public:
+	static constexpr size_t DEFAULT_QUEUE_CAPACITY = 16;
+	static constexpr unsigned int DISK_CONCURRENCY = 2;
+
+	IngestPipeline(TaskPool& pool, StreamEncoding encoding, size_t maxFrameSize, size_t queueCapacity = DEFAULT_QUEUE_CAPACITY);
+	IngestReport Run(const std::vector<std::string>& tracks);
+	static void Print(const IngestReport& report, std::ostream& stream);
+
+private:
+	enum Stage { Read, Analyze, Encode, Write, STAGE_COUNT };
+	enum class Outcome { Continue, Skipped, Failed };
+
+	struct Item
+	{
+		std::string path;
+		SoundFile soundFile;
+		std::vector<char> data;
+		MYWAVEFORMATEX waveFormat;
+	};
+
+	struct StageState
+	{
+		std::deque<std::shared_ptr<Item>> input;
+		unsigned int active = 0;
+		unsigned int concurrency = 1;
+	};
+
+	void Schedule();
+	void Process(Stage stage, std::shared_ptr<Item> item);
+	Outcome Execute(Stage stage, Item& item, unsigned long long& bytes);
+
+	TaskPool& m_pool;
+	StreamEncoding m_encoding;
+	size_t m_maxFrameSize;
+	size_t m_queueCapacity;
+	std::mutex m_lock;
+	std::condition_variable m_done;
+	std::array<StageState, STAGE_COUNT> m_stages;
+	size_t m_remaining;
+	IngestReport m_report;
+};
@@ -0,0 +1,240 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// The listeners of a station, for the stream to go through every frame without a lock. A version is an
+// array that never changes once published: Read pins the current one and walks it, Insert and Remove copy
+// it with the change, swap it in with a compare and exchange and retire the old one. The stream's walk
+// therefore costs the same however fast listeners come and go; the copies are the writers' part, which
+// is why they change whole batches at once.
+//
+// Retired versions are reclaimed by epoch. Every reader announces the epoch it pinned in, a version
+// retired in epoch t is freed once no reader still announces t or older; writers reclaim after publishing
+// and readers when they unpin, so a long walk does not leave its versions for the next change. A listener
+// removed from the registry lives on in the versions that hold it, so whoever walks an older version may
+// still use it.
+//
+// There is a slot per hardware thread and a few more. A reader that finds none free does not wait: it
+// counts itself in as an overflow reader, and while any is in nothing is reclaimed.
+template <typename T>
+class ListenerRegistry
+{
+public:
+	using Listener = std::shared_ptr<T>;
+
+	static constexpr size_t EXTRA_READERS = 4;      // slots beyond one per hardware thread
+
+private:
+	struct Version
+	{
+		std::vector<Listener> listeners;
+		uint64_t retired = 0;                       // epoch
+		Version* nextRetired = nullptr;
+	};
+
+public:
+	// The listeners as of Read, unchanged for as long as the snapshot lives; it keeps them from being
+	// reclaimed meanwhile, so it should not outlive the walk.
+	class Snapshot
+	{
+	public:
+		~Snapshot() { m_registry.Unpin(m_slot); }
+		Snapshot(const Snapshot&) = delete;
+		Snapshot& operator=(const Snapshot&) = delete;
+
+		typename std::vector<Listener>::const_iterator begin() const noexcept { return m_version->listeners.begin(); }
+		typename std::vector<Listener>::const_iterator end() const noexcept { return m_version->listeners.end(); }
+		size_t size() const noexcept { return m_version->listeners.size(); }
+
+	private:
+		friend class ListenerRegistry;
+		Snapshot(ListenerRegistry& registry, std::atomic<uint64_t>* slot, const Version* version) :
+			m_registry(registry), m_slot(slot), m_version(version) {}
+
+		ListenerRegistry& m_registry;
+		std::atomic<uint64_t>* m_slot;              // nullptr for an overflow reader
+		const Version* m_version;
+	};
+
+	//-- readers: threads that pin at once without falling back to the overflow.
+	explicit ListenerRegistry(size_t readers = std::thread::hardware_concurrency() + EXTRA_READERS) :
+		m_current(new Version()),
+		m_epoch(1),
+		m_readers(std::max<size_t>(readers, 1)),
+		m_retired(nullptr)
+	{
+		for (std::atomic<uint64_t>& reader : m_readers)
+			reader.store(IDLE);
+	}
+
+	~ListenerRegistry()
+	{
+		delete m_current.load();
+		for (Version* version = m_retired.load(); version;)
+			delete std::exchange(version, version->nextRetired);
+	}
+
+	ListenerRegistry(const ListenerRegistry&) = delete;
+	ListenerRegistry& operator=(const ListenerRegistry&) = delete;
+
+	//-- Safe from any thread, without a lock.
+	Snapshot Read()
+	{
+		std::atomic<uint64_t>* slot = Pin();
+		return Snapshot(*this, slot, m_current.load());
+	}
+
+	//-- Both safe from any thread; the listeners are compared by identity, not by socket.
+	void Insert(const std::vector<Listener>& listeners)
+	{
+		if (listeners.empty())
+			return;
+		Publish([&listeners](const std::vector<Listener>& current, std::vector<Listener>& next)
+			{
+				next.reserve(current.size() + listeners.size());
+				next = current;
+				next.insert(next.end(), listeners.begin(), listeners.end());
+			});
+	}
+
+	void Remove(const std::vector<Listener>& listeners)
+	{
+		if (listeners.empty())
+			return;
+		std::vector<const T*> removed;
+		removed.reserve(listeners.size());
+		for (const Listener& listener : listeners)
+			removed.push_back(listener.get());
+		std::sort(removed.begin(), removed.end());
+		Publish([&removed](const std::vector<Listener>& current, std::vector<Listener>& next)
+			{
+				next.reserve(current.size());
+				for (const Listener& listener : current)
+				{
+					if (!std::binary_search(removed.begin(), removed.end(), listener.get()))
+						next.push_back(listener);
+				}
+			});
+	}
+
+	//-- Versions retired and not reclaimed yet, a reader that stays pinned keeps them.
+	size_t GetRetired() const
+	{
+		return m_retiredCount.load(std::memory_order_relaxed);
+	}
+
+private:
+	static constexpr uint64_t IDLE = UINT64_MAX;
+
+	std::atomic<uint64_t>* Pin()
+	{
+		for (std::atomic<uint64_t>& slot : m_readers)
+		{
+			// an epoch read before the slot was taken is older, which only holds back reclamation
+			uint64_t idle = IDLE;
+			if (slot.load(std::memory_order_relaxed) == IDLE && slot.compare_exchange_strong(idle, m_epoch.load()))
+				return &slot;
+		}
+		// counted in before the version is read, a reclaimer that misses the count cannot have retired it
+		m_overflowReaders.fetch_add(1);
+		return nullptr;
+	}
+
+	void Unpin(std::atomic<uint64_t>* slot)
+	{
+		if (slot)
+			slot->store(IDLE);
+		else
+			m_overflowReaders.fetch_sub(1);
+		if (m_retiredCount.load(std::memory_order_relaxed))
+			Reclaim();
+	}
+
+	template <typename Change>
+	void Publish(const Change& change)
+	{
+		Version* previous = nullptr;
+		{
+			// pinned while copying, another writer may retire the version being copied
+			Snapshot pinned = Read();
+			previous = const_cast<Version*>(pinned.m_version);
+			auto next = std::make_unique<Version>();
+			while (true)
+			{
+				next->listeners.clear();
+				change(previous->listeners, next->listeners);
+				if (m_current.compare_exchange_weak(previous, next.get()))
+					break;
+				// lost to another writer, the version it published is pinned as well: it was
+				// published after this reader announced its epoch
+			}
+			next.release();
+		}
+		Retire(previous);
+		Reclaim();
+	}
+
+	void Retire(Version* version)
+	{
+		// readers that pin from here on announce a later epoch and find the new version
+		version->retired = m_epoch.fetch_add(1);
+		m_retiredCount.fetch_add(1, std::memory_order_relaxed);
+		Push(version, version);
+	}
+
+	void Reclaim()
+	{
+		Version* retired = m_retired.exchange(nullptr);
+		if (!retired)
+			return;
+		uint64_t oldest = IDLE;
+		for (const std::atomic<uint64_t>& slot : m_readers)
+			oldest = std::min(oldest, slot.load());
+		if (m_overflowReaders.load())
+			oldest = 0;
+
+		Version* keptFirst = nullptr;
+		Version* keptLast = nullptr;
+		size_t reclaimed = 0;
+		while (retired)
+		{
+			Version* version = std::exchange(retired, retired->nextRetired);
+			if (version->retired < oldest)
+			{
+				delete version;
+				reclaimed++;
+				continue;
+			}
+			version->nextRetired = nullptr;
+			if (keptLast)
+				keptLast->nextRetired = version;
+			else
+				keptFirst = version;
+			keptLast = version;
+		}
+		m_retiredCount.fetch_sub(reclaimed, std::memory_order_relaxed);
+		if (keptFirst)
+			Push(keptFirst, keptLast);
+	}
+
+	//-- Puts the chain from first to last on the retired list.
+	void Push(Version* first, Version* last)
+	{
+		Version* head = m_retired.load();
+		do
+			last->nextRetired = head;
+		while (!m_retired.compare_exchange_weak(head, first));
+	}
+
+	std::atomic<Version*> m_current;
+	std::atomic<uint64_t> m_epoch;
+	std::vector<std::atomic<uint64_t>> m_readers;                 // the epoch each reader pinned in, IDLE for none
+	std::atomic<size_t> m_overflowReaders = 0;                    // pinned without a slot
+	std::atomic<Version*> m_retired;                              // versions waiting for their readers to leave
+	std::atomic<size_t> m_retiredCount = 0;
+};
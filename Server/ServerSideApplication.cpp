@@ -1,103 +1,1120 @@
 #include "ServerSideApplication.h"
+#include <cstddef>
+#include <cstring>
+#include "../SocketsClientServer/StreamClock.h"
 
 
-void ServerSideApplication::ListenForSockets()
+void ServerSideApplication::AcceptConnections()
 {
+	static const MetricCounter accepted("accept.connections");
+	static const MetricHistogram batchSize("accept.batch");
+
+	if (listen(mainSocket, SOMAXCONN) == SOCKET_ERROR || !SetNonBlocking(mainSocket))
+	{
+		std::cout << "LISTEN ERROR" << std::endl;
+		StopReactors();
+		return;
+	}
+	std::cout << "LISTENING " << m_reactors.size() << " REACTORS" << std::endl;
+
+	std::vector<std::shared_ptr<Connection>> batch;
+	std::vector<std::vector<std::shared_ptr<Connection>>> handOff(m_reactors.size());
 	while (true)
 	{
-		if (listen(mainSocket, 1) == SOCKET_ERROR)
+		// while nothing is admitted the connections wait in the backlog, the stream goes first
+		const size_t allowance = m_admission.GetAllowance(GetServerTime(), GetOpenConnections());
+		if (!allowance)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(ADMISSION_RETRY));
+			continue;
+		}
+		WSAPOLLFD descriptor{ mainSocket, POLLRDNORM, 0 };
+		if (WSAPoll(&descriptor, 1, MAX_POLL_WAIT) == SOCKET_ERROR)
+		{
+			std::cout << "POLL FAILED" << WSAGetLastError() << std::endl;
+			break;
+		}
+		if (!descriptor.revents)
+			continue;
+
+		// everything waiting up to the allowance, not one connection per poll
+		batch.clear();
+		while (batch.size() < allowance)
+		{
+			const SOCKET acceptSocket = accept(mainSocket, nullptr, nullptr);
+			if (acceptSocket == INVALID_SOCKET)
+			{
+				// a client that gave up while in the backlog is no reason to stop
+				const int error = WSAGetLastError();
+				if (error != WSAEWOULDBLOCK && error != WSAECONNRESET)
+					std::cout << "ACCEPT FAILED" << error << std::endl;
+				break;
+			}
+			SetNoDelay(acceptSocket);
+			if (!PacketMux::PrepareSocket(acceptSocket))
+				std::cout << "SOCKET SETUP FAILED" << WSAGetLastError() << std::endl;
+			batch.push_back(std::make_shared<Connection>(acceptSocket));
+			// a member of the cluster that greeted already is never offered to the stream
+			if (IsPeerGreeting(acceptSocket))
+				MarkPeer(*batch.back());
+		}
+		if (batch.empty())
+			continue;
+		m_admission.OnAccepted(batch.size());
+		accepted.Add(batch.size());
+		batchSize.Record(batch.size());
+
+		// the token goes out before the first frame, the stream only finds the connections after this
+		OpenSessions(batch);
+		m_connections.Insert(batch);
+		// the least loaded reactor takes each, and every reactor is woken once for the batch
+		for (const std::shared_ptr<Connection>& connection : batch)
+		{
+			size_t target = 0;
+			for (size_t i = 1; i < m_reactors.size(); i++)
+			{
+				if (m_reactors[i]->load < m_reactors[target]->load)
+					target = i;
+			}
+			m_reactors[target]->load++;
+			handOff[target].push_back(connection);
+		}
+		for (size_t i = 0; i < m_reactors.size(); i++)
+		{
+			if (handOff[i].empty())
+				continue;
+			{
+				std::lock_guard<std::mutex> guardLock(m_reactors[i]->lock);
+				m_reactors[i]->incoming.insert(m_reactors[i]->incoming.end(), handOff[i].begin(), handOff[i].end());
+			}
+			m_reactors[i]->waker.Wake();
+			handOff[i].clear();
+		}
+	}
+	StopReactors();
+}
+
+
+
+void ServerSideApplication::ServeConnections(Reactor& reactor)
+{
+	static const MetricCounter closedConnections("accept.closed");
+
+	std::vector<WSAPOLLFD> descriptors;
+	std::vector<std::shared_ptr<Connection>> connections;
+	std::vector<std::shared_ptr<Connection>> closed;
+	while (!reactor.stopping)
+	{
+		{
+			std::lock_guard<std::mutex> guardLock(reactor.lock);
+			connections.insert(connections.end(), reactor.incoming.begin(), reactor.incoming.end());
+			reactor.incoming.clear();
+		}
+
+		descriptors.clear();
+		if (reactor.waker.IsOpen())
+			descriptors.push_back(WSAPOLLFD{ reactor.waker.GetSocket(), POLLRDNORM, 0 });
+		const size_t first = descriptors.size();
+		for (size_t i = 0; i < connections.size();)
+		{
+			if (connections[i]->closed)
+			{
+				closed.push_back(std::move(connections[i]));
+				connections[i] = std::move(connections.back());
+				connections.pop_back();
+				continue;
+			}
+			// a connection whose answers pile up is not read from until they left, the client
+			// notices through its own send buffer
+			const Connection& connection = *connections[i];
+			const SHORT events = (connection.mux.IsControlFull() ? 0 : POLLRDNORM) | (connection.mux.HasPending() ? POLLWRNORM : 0);
+			descriptors.push_back(WSAPOLLFD{ connection.socket, events, 0 });
+			i++;
+		}
+		if (!closed.empty())
+		{
+			// the stream may still walk them in an older snapshot, their closed mux keeps it off the
+			// socket once the handle is reused; the registry frees them when no snapshot holds them
+			m_connections.Remove(closed);
+			for (const std::shared_ptr<Connection>& connection : closed)
+			{
+				if (connection->peer)
+					m_peerConnections--;
+				DetachSession(*connection);
+				CloseConnection(*connection);
+			}
+			reactor.load -= closed.size();
+			closedConnections.Add(closed.size());
+			closed.clear();
+		}
+
+		if (descriptors.empty())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(MAX_POLL_WAIT));
+			continue;
+		}
+		if (WSAPoll(descriptors.data(), static_cast<ULONG>(descriptors.size()), MAX_POLL_WAIT) == SOCKET_ERROR)
 		{
-			std::cout << "LISTEN ERROR" << std::endl;
+			std::cout << "POLL FAILED" << WSAGetLastError() << std::endl;
 			return;
 		}
+		if (first && descriptors[0].revents)
+			reactor.waker.Drain();
+		for (size_t i = 0; i < connections.size(); i++)
+		{
+			Connection& connection = *connections[i];
+			const SHORT revents = descriptors[first + i].revents;
+			if ((revents & POLLWRNORM) && !connection.mux.Flush(connection.socket))
+				connection.closed = true;
+			if ((revents & ~POLLWRNORM) && !ReadConnection(connection))
+				connection.closed = true;
+		}
+	}
+}
+
+
+
+void ServerSideApplication::StopReactors()
+{
+	for (const std::unique_ptr<Reactor>& reactor : m_reactors)
+	{
+		reactor->stopping = true;
+		reactor->waker.Wake();
+	}
+	for (const std::unique_ptr<Reactor>& reactor : m_reactors)
+	{
+		if (reactor->thread.joinable())
+			reactor->thread.join();
+	}
+}
+
+
+
+size_t ServerSideApplication::GetOpenConnections() const
+{
+	size_t open = 0;
+	for (const std::unique_ptr<Reactor>& reactor : m_reactors)
+		open += reactor->load;
+	const size_t peers = m_peerConnections;
+	return open > peers ? open - peers : 0;
+}
+
+
+
+bool ServerSideApplication::IsPeerGreeting(SOCKET socket)
+{
+	StreamPacketHeader header;
+	return recv(socket, reinterpret_cast<char*>(&header), sizeof(header), MSG_PEEK) == sizeof(header) &&
+		header.magic == STREAM_PACKET_MAGIC && header.type == static_cast<uint16_t>(PacketType::ClusterHeartbeat);
+}
+
+
+
+void ServerSideApplication::MarkPeer(Connection& connection)
+{
+	if (connection.peer.exchange(true))
+		return;
+	connection.subscribed = false;
+	m_peerConnections++;
+
+	// the greeting came in after the stream reached the connection, what it queued is of no use there
+	uint32_t sequence = 0;
+	{
+		std::lock_guard<std::mutex> guardLock(m_stationLock);
+		sequence = m_stationState.sequence;
+	}
+	connection.mux.DropAudioBefore(sequence + 1);
+}
+
+
+
+bool ServerSideApplication::ReadConnection(Connection& connection)
+{
+	// one recv per readiness, whatever is left waits for the next poll
+	char buffer[MAX_BUFFER_SIZE];
+	const int size = recv(connection.socket, buffer, sizeof(buffer), 0);
+	if (size == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
+		return true;
+	if (size <= 0)
+		return false;
+	const unsigned long long received = GetServerTime();
+
+	StreamPacketHeader header;
+	const char* payload = nullptr;
+	connection.assembler.Append(buffer, size);
+	while (connection.assembler.Next(header, payload))
+		HandlePacket(connection, header, payload, received);
+	return !connection.assembler.IsCorrupt();
+}
+
+
+
+void ServerSideApplication::HandlePacket(Connection& connection, const StreamPacketHeader& header, const char* payload, unsigned long long received)
+{
+	static const MetricCounter clockRequests("station.clock_requests");
+
+	if (header.type == static_cast<uint16_t>(PacketType::ClockRequest) && header.size == sizeof(ClockExchange))
+	{
+		ClockExchange exchange;
+		std::memcpy(&exchange, payload, sizeof(exchange));
+		exchange.receive = received;
+
+		// stamped when it is written, a frame still going out is not counted as network delay
+		if (SendToConnection(connection, PacketType::ClockResponse, &exchange, sizeof(exchange), &ServerSideApplication::StampTransmit))
+			clockRequests.Add();
+	}
+	else if (header.type == static_cast<uint16_t>(PacketType::Control) && header.size == sizeof(ControlRequest))
+	{
+		ControlRequest request;
+		std::memcpy(&request, payload, sizeof(request));
+		HandleControl(connection, request, received);
+	}
+	else if (header.type == static_cast<uint16_t>(PacketType::Resume) && header.size == sizeof(ResumeRequest))
+	{
+		ResumeRequest request;
+		std::memcpy(&request, payload, sizeof(request));
+		ResumeSession(connection, request);
+	}
+	else if (header.type == static_cast<uint16_t>(PacketType::ClusterHeartbeat))
+	{
+		// another member of the cluster, it does not listen
+		MarkPeer(connection);
+		if (m_cluster)
+			m_cluster->OnHeartbeat(payload, header.size);
+	}
+	else if (header.type == static_cast<uint16_t>(PacketType::PlayoutReport) && header.size == sizeof(PlayoutReport))
+	{
+		PlayoutReport report;
+		std::memcpy(&report, payload, sizeof(report));
+		RecordPlayout(report);
+	}
+	else if (header.type == static_cast<uint16_t>(PacketType::Command))
+	{
+		const std::string message(payload, header.size);
+		if (message == METRICS_COMMAND)
+		{
+			const std::string text = MetricsRegistry::Get().Snapshot().ToString();
+			SendToConnection(connection, PacketType::Metrics, text.data(), static_cast<int>(text.size()));
+		}
 		else
 		{
-			std::cout << "LISTENING" << std::endl;
+			std::cout << message;
 		}
+	}
+}
+
+
 
+void ServerSideApplication::HandleControl(Connection& connection, const ControlRequest& request, unsigned long long received)
+{
+	static const MetricCounter commands("control.commands");
+	static const MetricCounter rejected("control.rejected");
+	static const MetricHistogram ackTime("control.ack_us");
+
+	// a station of another member is not served here, the client goes there; one lookup on the ring.
+	// Every member runs only the default station, a redirect for any other id would name a member that
+	// plays something else under it, so those are refused below like on a server of its own
+	if (m_cluster && request.station == DEFAULT_STATION)
+	{
+		const std::string owner = m_cluster->GetOwner(request.station);
+		if (owner != m_cluster->GetSelf())
 		{
-			std::lock_guard<std::mutex> guardLock(lock);
-			SOCKET acceptSocket = accept(mainSocket, nullptr, nullptr);
-			if (acceptSocket == INVALID_SOCKET)
+			Redirect(connection, request, owner);
+			commands.Add();
+			ackTime.Record(GetServerTime() - received);
+			return;
+		}
+	}
+
+	// a relay keeps the subscriptions of its own listeners, everything else is the upstream station's
+	const ControlCommand command = static_cast<ControlCommand>(request.command);
+	if (IsRelay() && command != ControlCommand::Subscribe && command != ControlCommand::Unsubscribe)
+	{
+		RelayControl(connection, request, received);
+		return;
+	}
+
+	ControlAck ack{};
+	ack.id = request.id;
+	ack.station = request.station;
+	ack.command = request.command;
+	ControlStatus status = ControlStatus::Ok;
+	std::string nowPlaying;
+	{
+		// answered from the state of the last frame, the station itself is only touched by the stream
+		std::lock_guard<std::mutex> guardLock(m_stationLock);
+		if (request.station != DEFAULT_STATION)
+		{
+			status = ControlStatus::UnknownStation;
+		}
+		else
+		{
+			switch (command)
 			{
-				std::cout << "ACCEPT FAILED" << WSAGetLastError() << std::endl;
-				return;
+			case ControlCommand::Subscribe:
+				connection.subscribed = true;
+				break;
+			case ControlCommand::Unsubscribe:
+				connection.subscribed = false;
+				break;
+			case ControlCommand::Seek:
+				if (!m_stationState.seekable)
+				{
+					status = ControlStatus::Rejected;
+					break;
+				}
+				[[fallthrough]];
+			case ControlCommand::Play:
+			case ControlCommand::Pause:
+			case ControlCommand::Skip:
+				m_stationCommands.push_back(request);
+				m_stationChanged.notify_one();
+				break;
+			case ControlCommand::QueryPosition:
+				break;
+			case ControlCommand::NowPlaying:
+				nowPlaying = m_stationState.nowPlaying;
+				break;
+			default:
+				status = ControlStatus::UnknownCommand;
+				break;
 			}
+		}
+		ack.sequence = m_stationState.sequence;
+		ack.position = m_stationState.position;
+		ack.duration = m_stationState.duration;
+		ack.flags = (m_stationState.paused ? CONTROL_ACK_PAUSED : 0) | (m_stationState.seekable ? CONTROL_ACK_SEEKABLE : 0);
+	}
+	ack.status = static_cast<uint8_t>(status);
+	SendControlAck(connection, ack, nowPlaying);
+
+	commands.Add();
+	if (status != ControlStatus::Ok)
+		rejected.Add();
+	ackTime.Record(GetServerTime() - received);
+}
+
+
+
+void ServerSideApplication::Redirect(Connection& connection, const ControlRequest& request, const std::string& owner)
+{
+	static const MetricCounter redirects("cluster.redirects");
+
+	ControlAck ack{};
+	ack.id = request.id;
+	ack.station = request.station;
+	ack.command = request.command;
+	ack.status = static_cast<uint8_t>(ControlStatus::Redirect);
+	SendControlAck(connection, ack, owner);
+	redirects.Add();
+}
+
+
 
-			acceptSockets.push_back(acceptSocket);
-			listeners[acceptSocket] = std::thread(&ServerSideApplication::ListenForMessages, this, std::ref(acceptSockets.back()));
+void ServerSideApplication::SendControlAck(Connection& connection, const ControlAck& ack, const std::string& nowPlaying)
+{
+	ControlAck sent = ack;
+	sent.flags = connection.subscribed ? (ack.flags | CONTROL_ACK_SUBSCRIBED) : (ack.flags & ~CONTROL_ACK_SUBSCRIBED);
+	std::vector<char> packet(sizeof(sent) + nowPlaying.size());
+	std::memcpy(packet.data(), &sent, sizeof(sent));
+	std::copy(nowPlaying.begin(), nowPlaying.end(), packet.begin() + sizeof(sent));
+	SendToConnection(connection, PacketType::ControlAck, packet.data(), static_cast<int>(packet.size()));
+}
+
+
+
+void ServerSideApplication::OpenSessions(const std::vector<std::shared_ptr<Connection>>& connections)
+{
+	{
+		std::lock_guard<std::mutex> guardLock(m_sessionLock);
+		for (const std::shared_ptr<Connection>& connection : connections)
+		{
+			// 0 means no session on the client side
+			uint64_t token = 0;
+			while (!token || m_sessions.count(token))
+				token = m_tokenGenerator();
+			connection->token = token;
+			m_sessions[token].connection = connection;
 		}
 	}
+	for (const std::shared_ptr<Connection>& connection : connections)
+	{
+		const SessionInfo info{ connection->token, 0, 0, 0, 0 };
+		SendToConnection(*connection, PacketType::Session, &info, sizeof(info));
+	}
 }
 
-void ServerSideApplication::ListenForMessages(SOCKET& socket)
+
+
+void ServerSideApplication::DetachSession(Connection& connection)
 {
-	while (m_runningSockets[socket])
+	static const MetricGauge detachedSessions("session.detached");
+
+	const unsigned long long now = GetServerTime();
+	std::lock_guard<std::mutex> guardLock(m_sessionLock);
+	const auto it = m_sessions.find(connection.token);
+	if (it != m_sessions.end() && it->second.connection.lock().get() == &connection && connection.peer)
+	{
+		// a cluster member connects anew, it never resumes
+		m_sessions.erase(it);
+	}
+	else if (it != m_sessions.end() && it->second.connection.lock().get() == &connection)
+	{
+		it->second.connection.reset();
+		it->second.subscribed = connection.subscribed;
+		it->second.detached = now;
+		m_detachedSessions.emplace_back(now, connection.token);
+	}
+
+	// detached in order, a session resumed meanwhile has a different time or none
+	while (!m_detachedSessions.empty() && now - m_detachedSessions.front().first > SESSION_RETENTION * 1000ull)
 	{
-		    Receive(socket,0, [](void* object, int size) {
-			
-			char* message = (char*)object;
-			if (message != nullptr)
-				std::cout << std::string(message, size);
-			
-			});
+		const auto expired = m_sessions.find(m_detachedSessions.front().second);
+		if (expired != m_sessions.end() && expired->second.detached == m_detachedSessions.front().first)
+			m_sessions.erase(expired);
+		m_detachedSessions.pop_front();
 	}
+	detachedSessions.Set(static_cast<int64_t>(m_detachedSessions.size()));
+}
+
+
+
+void ServerSideApplication::ResumeSession(Connection& connection, const ResumeRequest& request)
+{
+	static const MetricCounter resumed("session.resumed");
+	static const MetricCounter unknown("session.unknown");
+	static const MetricCounter resent("session.resent_frames");
+	static const MetricCounter lost("session.lost_frames");
+
+	SessionInfo info{ connection.token, 0, request.sequence + 1, 0, 0 };
+	{
+		std::lock_guard<std::mutex> guardLock(m_sessionLock);
+		const auto it = m_sessions.find(request.token);
+		if (it != m_sessions.end() && request.token != connection.token)
+		{
+			// the old connection may not have noticed the loss yet, the client knows better
+			const std::shared_ptr<Connection> previous = it->second.connection.lock();
+			if (previous)
+				previous->closed = true;
+			connection.subscribed = previous ? previous->subscribed.load() : it->second.subscribed;
+			it->second.connection = connection.weak_from_this();
+			it->second.detached = 0;
+			m_sessions.erase(connection.token);
+			connection.token = request.token;
+			info.token = request.token;
+			info.flags = SESSION_RESUMED;
+		}
+	}
+	if (!(info.flags & SESSION_RESUMED))
+	{
+		// expired or from another server, the client starts over with the session it got on connecting
+		info.flags = SESSION_UNKNOWN;
+		unknown.Add();
+		SendToConnection(connection, PacketType::Session, &info, sizeof(info));
+		return;
+	}
+	resumed.Add();
+
+	// what the client missed: the frames after its last one up to where the live stream starts on this
+	// connection. One the stream did not reach yet starts after the newest frame kept, the stream leaves
+	// out anything older from then on (see Broadcast).
+	std::vector<PacketMux::Packet> missed;
+	if (connection.subscribed)
+		missed = m_ring.GetSince(request.sequence);
+	StreamPacketHeader header;
+	uint32_t liveFrom = request.sequence + 1;
+	if (!missed.empty())
+	{
+		std::memcpy(&header, missed.back()->data(), sizeof(header));
+		liveFrom = header.sequence + 1;
+	}
+	int64_t streamed = -1;
+	if (!connection.firstStreamed.compare_exchange_strong(streamed, liveFrom))
+		liveFrom = static_cast<uint32_t>(streamed);
+	// the join burst of the new connection is part of that; what of it did not go out yet is sent in
+	// order with the rest, what did the client already has
+	connection.mux.DropAudioBefore(liveFrom);
+
+	size_t end = 0;
+	for (; end < missed.size(); end++)
+	{
+		std::memcpy(&header, missed[end]->data(), sizeof(header));
+		if (static_cast<int32_t>(header.sequence - liveFrom) >= 0)
+			break;
+	}
+	missed.erase(missed.begin() + end, missed.end());
+	LimitToAudioLane(missed);
+
+	info.sequence = liveFrom;
+	info.count = static_cast<uint32_t>(missed.size());
+	if (!missed.empty())
+	{
+		std::memcpy(&header, missed.front()->data(), sizeof(header));
+		info.sequence = header.sequence;
+	}
+	const int32_t gap = static_cast<int32_t>(info.sequence - request.sequence - 1);
+	if (gap > 0)
+		lost.Add(static_cast<uint64_t>(gap));
+	resent.Add(missed.size());
+
+	// the answer first, the client then knows where the frames that follow belong
+	if (SendToConnection(connection, PacketType::Session, &info, sizeof(info)))
+		QueueFrames(connection, missed);
+}
+
+
+
+void ServerSideApplication::LimitToAudioLane(std::vector<PacketMux::Packet>& packets)
+{
+	size_t size = 0;
+	for (const PacketMux::Packet& packet : packets)
+		size += packet->size();
+	size_t begin = 0;
+	for (; begin < packets.size() && size > PacketMux::AUDIO_LANE_LIMIT / 2; begin++)
+		size -= packets[begin]->size();
+	packets.erase(packets.begin(), packets.begin() + begin);
+}
+
+
+
+std::vector<PacketMux::Packet> ServerSideApplication::GetJoinBurst(const StreamPacketHeader& live) const
+{
+	if (!m_joinBurst)
+		return {};
+	// the ring has the live frame already, the burst is what went out before it
+	std::vector<PacketMux::Packet> packets = m_ring.GetLast(m_joinBurst + live.duration);
+	StreamPacketHeader header;
+	while (!packets.empty())
+	{
+		std::memcpy(&header, packets.back()->data(), sizeof(header));
+		if (static_cast<int32_t>(header.sequence - live.sequence) < 0)
+			break;
+		packets.pop_back();
+	}
+	LimitToAudioLane(packets);
+	return packets;
+}
+
+
+
+bool ServerSideApplication::QueueFrames(Connection& connection, const std::vector<PacketMux::Packet>& packets)
+{
+	for (const PacketMux::Packet& packet : packets)
+	{
+		if (!connection.mux.Enqueue(PacketLane::Audio, packet))
+		{
+			connection.closed = true;
+			return false;
+		}
+	}
+	if (!connection.mux.Flush(connection.socket))
+	{
+		connection.closed = true;
+		return false;
+	}
+	return true;
+}
+
+
+
+bool ServerSideApplication::SendToConnection(Connection& connection, PacketType type, const void* data, int size, PacketMux::Stamp stamp)
+{
+	const StreamPacketHeader header{ STREAM_PACKET_MAGIC, static_cast<uint32_t>(size), static_cast<uint16_t>(type), 0, 0, 0, 0 };
+	if (connection.closed)
+		return false;
+	if (!connection.mux.Enqueue(PacketLane::Control, PacketMux::MakePacket(header, data, size), stamp) || !connection.mux.Flush(connection.socket))
+	{
+		connection.closed = true;
+		return false;
+	}
+	return true;
+}
+
+
+
+void ServerSideApplication::CloseConnection(Connection& connection)
+{
+	// the stream may be flushing to it right now, the socket goes once that flush is done
+	connection.closed = true;
+	connection.mux.Close();
+	closesocket(connection.socket);
+}
+
+
+
+void ServerSideApplication::RecordPlayout(const PlayoutReport& report)
+{
+	static const MetricHistogram latency("listener.latency_ms");
+	static const MetricHistogram maxLatency("listener.max_latency_ms");
+	static const MetricHistogram queued("listener.queued_ms");
+	static const MetricHistogram deviceLatency("listener.device_latency_us");
+	static const MetricCounter starvations("listener.starvations");
+	static const MetricCounter starved("listener.starved_ms");
+	static const MetricCounter reports("listener.reports");
+
+	reports.Add();
+	starvations.Add(report.starvations);
+	starved.Add(report.starved);
+	if (!(report.flags & PLAYOUT_REPORT_PLAYING))
+		return;
+	latency.Record(report.latency);
+	maxLatency.Record(report.maxLatency);
+	queued.Record(report.queued);
+	if (report.flags & PLAYOUT_REPORT_DEVICE_LATENCY)
+		deviceLatency.Record(report.deviceLatency);
 }
 
 void ServerSideApplication::InitializeServerApplication()
 {
-	listener = std::thread(&ServerSideApplication::ListenForSockets, this);
+	// track loads and ingest never take a core from the reactors or the stream (or the relay)
+	TaskPool::ReserveCores(m_reactorCount + 1);
+	for (unsigned int i = 0; i < m_reactorCount; i++)
+	{
+		m_reactors.push_back(std::make_unique<Reactor>());
+		m_reactors.back()->thread = std::thread(&ServerSideApplication::ServeConnections, this, std::ref(*m_reactors.back()));
+	}
+	std::random_device device;
+	m_tokenGenerator.seed((static_cast<uint64_t>(device()) << 32) | device());
+	listener = std::thread(&ServerSideApplication::AcceptConnections, this);
 }
 
-ServerSideApplication::ServerSideApplication() : SocketCreator(true)
+ServerSideApplication::ServerSideApplication(StreamEncoding encoding, const std::string& library, bool rescan, int port) :
+	SocketCreator(true, port),
+	m_reactorCount(std::max(1u, std::thread::hardware_concurrency() / 2)),
+	m_joinBurst(JOIN_BURST),
+	m_encoding(encoding),
+	m_metricsExporter(GetMetricsSegment(port)),
+	m_ring(BROADCAST_RING_FRAMES),
+	m_upstreamPort(0),
+	m_nextRelayId(1),
+	m_upstreamSession(0),
+	m_lastRelayed(-1),
+	m_resumingUpstream(false)
 {
-	InitializeServerApplication();
+	if (!m_catalog.OpenOrBuild(library, rescan))
+		std::cout << "LIBRARY SCAN FAILED " << library << std::endl;
+	else
+		std::cout << "LIBRARY " << m_catalog.GetTrackCount() << " TRACKS" << std::endl;
+}
+
+ServerSideApplication::ServerSideApplication(int port, const std::string& upstreamHost, int upstreamPort) :
+	SocketCreator(true, port),
+	m_reactorCount(std::max(1u, std::thread::hardware_concurrency() / 2)),
+	m_joinBurst(JOIN_BURST),
+	m_encoding(StreamEncoding::Pcm),
+	m_metricsExporter(GetMetricsSegment(port)),
+	m_ring(BROADCAST_RING_FRAMES),
+	m_upstreamHost(upstreamHost),
+	m_upstreamPort(upstreamPort),
+	m_nextRelayId(1),
+	m_upstreamSession(0),
+	m_lastRelayed(-1),
+	m_resumingUpstream(false)
+{
+}
+
+std::string ServerSideApplication::GetMetricsSegment(int port)
+{
+	return port == PORT ? std::string(METRICS_SEGMENT) : std::string(METRICS_SEGMENT) + "-" + std::to_string(port);
+}
+
+
+
+void ServerSideApplication::JoinCluster(const std::vector<std::string>& seeds)
+{
+	m_cluster = std::make_unique<ClusterMembership>(GetAddress() + ":" + std::to_string(GetPort()), seeds);
 }
 
 
 
 void ServerSideApplication::Wait() noexcept
 {
-	std::vector<std::shared_ptr<Sound>> sounds;
-	for (int i = 0; i < 4; i++)
+	InitializeServerApplication();
+	if (IsRelay())
 	{
-		sounds.push_back(std::make_shared<Sound>("../Music/Song" + std::to_string(i) + ".wav", false));
+		Relay();
+		listener.join();
+		return;
 	}
+
+	Station station(m_catalog.GetPlaylist(), MAX_BUFFER_SIZE, CROSSFADE_MILISECONDS, m_encoding);
 	std::string s;
 	std::cin >> s;
 
-	for (short song = 0; song < sounds.size(); song++)
+	StreamClock clock(GetServerTime());
+
+	static const MetricCounter frames("station.frames");
+	static const MetricGauge ahead("station.ahead_ms");
+	static const MetricHistogram late("station.late_us");
+
+	StationFrame frame;
+	StreamPacketHeader header{ STREAM_PACKET_MAGIC, 0, static_cast<uint16_t>(PacketType::Audio), 0, 0, 0, 0 };
+	bool paused = false;
+	PublishStationState(station, header.sequence, paused);
+	while (true)
 	{
-		std::deque<std::vector<char>> elems;
-		int sleepValue = 0;
-		sounds[song]->GetDividedData(elems, 4096 , &sleepValue);
-		auto format = sounds[song]->GetSoundFile().GetWaveFormat();
+		// a paused station stops its clock, the live edge goes on from the moment it resumes
+		if (ApplyStationCommands(station, paused))
+			clock.Resume(GetServerTime());
+		if (!station.NextFrame(frame))
+			break;
+
+		header.size = static_cast<uint32_t>(frame.size);
+		header.duration = frame.duration;
+		header.timestamp = clock.GetLiveEdge();
 
-		auto res = Sound::ConvertMyWaveFormatToData(format);
+		// how far the pacing runs ahead of the live edge, or how late it sends the frame
+		const long long now = static_cast<long long>(GetServerTime());
+		const long long lead = static_cast<long long>(clock.GetLiveEdge()) - now;
+		ahead.Set(lead / 1000);
+		late.Record(lead < 0 ? -lead : 0);
+		frames.Add();
 
-		while (!elems.empty())
+		const PacketMux::Packet packet = PacketMux::MakePacket(header, frame.data, frame.size);
+		m_ring.Push(header.sequence, packet);
+		Broadcast(packet);
+		PublishStationState(station, header.sequence, paused);
+		header.sequence++;
+		clock.Advance(frame.samples, frame.waveFormat.nSamplesPerSec);
+		std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::microseconds(clock.GetSendTime(PACING_LEAD * 1000ull))));
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(1000000));
+	listener.join();
+}
+
+
+
+bool ServerSideApplication::ApplyStationCommands(Station& station, bool& paused)
+{
+	const bool wasPaused = paused;
+	std::vector<ControlRequest> commands;
+	while (true)
+	{
 		{
-			std::vector<char> data = elems.front();
-			data.insert(data.end(), res.begin(), res.end());
-			for (auto it = acceptSockets.begin(); it != acceptSockets.end();)
+			std::unique_lock<std::mutex> guardLock(m_stationLock);
+			if (paused)
+				m_stationChanged.wait(guardLock, [this]() { return !m_stationCommands.empty(); });
+			commands.swap(m_stationCommands);
+		}
+		if (commands.empty())
+			return wasPaused && !paused;
+
+		// outside the lock, a skip may wait for the next track to load
+		for (const ControlRequest& command : commands)
+		{
+			switch (static_cast<ControlCommand>(command.command))
+			{
+			case ControlCommand::Play:
+				paused = false;
+				break;
+			case ControlCommand::Pause:
+				paused = true;
+				break;
+			case ControlCommand::Skip:
+				station.Skip();
+				break;
+			case ControlCommand::Seek:
+				station.Seek(command.argument);
+				break;
+			default:
+				break;
+			}
+		}
+		commands.clear();
+
+		std::lock_guard<std::mutex> guardLock(m_stationLock);
+		m_stationState.paused = paused;
+		m_stationState.seekable = station.CanSeek();
+	}
+}
+
+
+
+void ServerSideApplication::Broadcast(const PacketMux::Packet& packet)
+{
+	static const MetricGauge listenerCount("station.listeners");
+	static const MetricGauge retiredVersions("station.listeners.retired");
+	static const MetricHistogram broadcastTime("station.broadcast.us");
+	static const MetricCounter burstFrames("accept.burst_frames");
+
+	StreamPacketHeader header;
+	std::memcpy(&header, packet->data(), sizeof(header));
+
+	// one packet for all listeners, a listener that cannot take it now gets it from its reactor
+	const unsigned long long start = GetServerTime();
+	std::vector<PacketMux::Packet> burst;
+	bool burstTaken = false;
+	int64_t listeners = 0;
+	{
+		const auto snapshot = m_connections.Read();
+		for (const std::shared_ptr<Connection>& connection : snapshot)
+		{
+			if (!connection->subscribed || connection->closed)
+				continue;
+			listeners++;
+			// a resumed session was sent the frames up to where its live stream starts, a new listener
+			// gets the recent frames in front of its first live one, from the stream so it gets each once
+			int64_t streamed = connection->firstStreamed.load(std::memory_order_relaxed);
+			if (streamed < 0 && connection->firstStreamed.compare_exchange_strong(streamed, header.sequence))
 			{
-				auto res = Send(*it, data.data(), data.size());
-				if (res == -1)
+				streamed = header.sequence;
+				if (!burstTaken)
 				{
-					m_runningSockets[*it] = false;
-					it = acceptSockets.erase(it);
+					burst = GetJoinBurst(header);
+					burstTaken = true;
 				}
-				else
+				for (const PacketMux::Packet& recent : burst)
+					connection->mux.Enqueue(PacketLane::Audio, recent);
+				burstFrames.Add(burst.size());
+			}
+			if (static_cast<int32_t>(header.sequence - static_cast<uint32_t>(streamed)) < 0)
+				continue;
+			if (!connection->mux.Enqueue(PacketLane::Audio, packet) || !connection->mux.Flush(connection->socket))
+				connection->closed = true;
+		}
+	}
+	const unsigned long long sendTime = GetServerTime() - start;
+	broadcastTime.Record(sendTime);
+	listenerCount.Set(listeners);
+	retiredVersions.Set(static_cast<int64_t>(m_connections.GetRetired()));
+
+	// the share of the frame this took decides whether more listeners are let in
+	m_admission.OnBroadcast(start + sendTime, sendTime, header.duration);
+}
+
+
+
+void ServerSideApplication::Relay()
+{
+	static const MetricCounter connects("relay.upstream.connects");
+
+	while (true)
+	{
+		auto upstream = std::make_shared<UpstreamLink>(m_upstreamHost, m_upstreamPort);
+		if (upstream->IsOpen())
+		{
+			std::cout << "RELAYING " << m_upstreamHost << ":" << m_upstreamPort << std::endl;
+			connects.Add();
+			{
+				std::lock_guard<std::mutex> guardLock(m_upstreamLock);
+				m_upstream = upstream;
+			}
+			// the upstream sends again what was missed meanwhile, as to any listener coming back
+			m_resumingUpstream = false;
+			if (m_upstreamSession && m_lastRelayed >= 0)
+			{
+				const ResumeRequest request{ m_upstreamSession, static_cast<uint32_t>(m_lastRelayed), 0 };
+				m_resumingUpstream = upstream->SendToServer(PacketType::Resume, &request, sizeof(request)) != -1;
+			}
+			upstream->Run([this, &upstream](const StreamPacketHeader& header, const char* payload)
 				{
-					it++;
-				}
+					RelayPacket(*upstream, header, payload);
+				});
+			{
+				// the answers to what was passed on are lost with the connection
+				std::lock_guard<std::mutex> guardLock(m_upstreamLock);
+				m_upstream.reset();
+				m_relayedRequests.clear();
 			}
-			std::this_thread::sleep_for(std::chrono::milliseconds(sleepValue-10));
-			elems.pop_front();
-			
+			std::cout << "UPSTREAM LOST" << std::endl;
 		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(RELAY_RECONNECT_DELAY));
 	}
+}
 
-	std::this_thread::sleep_for(std::chrono::milliseconds(1000000));
-	listener.join();
+
+
+void ServerSideApplication::RelayPacket(const UpstreamLink& upstream, const StreamPacketHeader& header, const char* payload)
+{
+	static const MetricCounter frames("relay.frames");
+	static const MetricCounter unsynchronized("relay.frames.unsynchronized");
+	static const MetricCounter duplicates("relay.frames.duplicate");
+	static const MetricHistogram forwardTime("relay.forward_us");
+
+	if (header.type == static_cast<uint16_t>(PacketType::ControlAck) && header.size >= sizeof(ControlAck))
+	{
+		RelayControlAck(header, payload);
+		return;
+	}
+	if (header.type == static_cast<uint16_t>(PacketType::Session) && header.size == sizeof(SessionInfo))
+	{
+		SessionInfo info;
+		std::memcpy(&info, payload, sizeof(info));
+		OnUpstreamSession(info);
+		return;
+	}
+	if (header.type != static_cast<uint16_t>(PacketType::Audio))
+		return;
+
+	// listeners schedule by the timestamps and sync their clocks to this server, the timestamps move
+	// to its clock; until the first clock exchange is back there is nothing to move them by
+	if (!upstream.IsSynchronized())
+	{
+		unsynchronized.Add();
+		return;
+	}
+	// a reconnect brings the join burst and the frames sent again, some of them went out before
+	if (m_lastRelayed >= 0 && static_cast<int32_t>(header.sequence - static_cast<uint32_t>(m_lastRelayed)) <= 0)
+	{
+		duplicates.Add();
+		return;
+	}
+	MetricTimer timer(forwardTime);
+	if (m_lastRelayed < 0)
+		ResyncStream(header.sequence);
+	m_lastRelayed = header.sequence;
+	StreamPacketHeader relayed = header;
+	relayed.timestamp = upstream.ToLocalTime(header.timestamp);
+	const PacketMux::Packet packet = PacketMux::MakePacket(relayed, payload, header.size);
+	m_ring.Push(header.sequence, packet);
+	Broadcast(packet);
+	frames.Add();
+
+	std::lock_guard<std::mutex> guardLock(m_stationLock);
+	m_stationState.sequence = header.sequence;
+}
+
+
+
+void ServerSideApplication::OnUpstreamSession(const SessionInfo& info)
+{
+	static const MetricCounter sessions("relay.upstream.sessions");
+	static const MetricCounter resumed("relay.upstream.resumed");
+
+	// the session of the new connection comes first, with a Resume out the answer to that decides
+	if (m_resumingUpstream && !(info.flags & (SESSION_RESUMED | SESSION_UNKNOWN)))
+		return;
+	m_resumingUpstream = false;
+	if (info.flags & SESSION_RESUMED)
+	{
+		resumed.Add();
+		return;
+	}
+	if (info.token == m_upstreamSession)
+		return;
+	m_upstreamSession = info.token;
+	m_lastRelayed = -1;
+	sessions.Add();
+}
+
+
+
+void ServerSideApplication::ResyncStream(uint32_t sequence)
+{
+	m_ring.Clear();
+	const auto snapshot = m_connections.Read();
+	for (const std::shared_ptr<Connection>& connection : snapshot)
+	{
+		// one the stream did not reach yet gets its join burst as usual
+		int64_t streamed = connection->firstStreamed.load();
+		while (streamed >= 0 && !connection->firstStreamed.compare_exchange_weak(streamed, sequence))
+			;
+	}
+}
+
+
+
+void ServerSideApplication::RelayControl(Connection& connection, const ControlRequest& request, unsigned long long received)
+{
+	static const MetricCounter relayed("relay.control.forwarded");
+
+	std::shared_ptr<UpstreamLink> upstream;
+	ControlRequest forwarded = request;
+	{
+		std::lock_guard<std::mutex> guardLock(m_upstreamLock);
+		upstream = m_upstream;
+		if (upstream)
+		{
+			forwarded.id = m_nextRelayId++;
+			m_relayedRequests[forwarded.id] = RelayedRequest{ connection.weak_from_this(), request.id, received };
+		}
+	}
+	if (upstream && upstream->SendToServer(PacketType::Control, &forwarded, sizeof(forwarded)) != -1)
+	{
+		relayed.Add();
+		return;
+	}
+
+	if (upstream)
+	{
+		std::lock_guard<std::mutex> guardLock(m_upstreamLock);
+		m_relayedRequests.erase(forwarded.id);
+	}
+	// no upstream to ask, the relay answers for it
+	ControlAck ack{};
+	ack.id = request.id;
+	ack.station = request.station;
+	ack.command = request.command;
+	ack.status = static_cast<uint8_t>(ControlStatus::Rejected);
+	SendControlAck(connection, ack, std::string());
+}
+
+
+
+void ServerSideApplication::RelayControlAck(const StreamPacketHeader& header, const char* payload)
+{
+	static const MetricHistogram ackTime("control.ack_us");
+
+	ControlAck ack;
+	std::memcpy(&ack, payload, sizeof(ack));
+	const std::string nowPlaying(payload + sizeof(ack), header.size - sizeof(ack));
+
+	RelayedRequest request;
+	{
+		std::lock_guard<std::mutex> guardLock(m_upstreamLock);
+		const auto it = m_relayedRequests.find(ack.id);
+		if (it == m_relayedRequests.end())
+			return;
+		request = it->second;
+		m_relayedRequests.erase(it);
+	}
+
+	if (ack.status == static_cast<uint8_t>(ControlStatus::Ok) && ack.station == DEFAULT_STATION)
+	{
+		// what the station looks like upstream, for the acknowledgements the relay gives itself
+		std::lock_guard<std::mutex> guardLock(m_stationLock);
+		m_stationState.position = ack.position;
+		m_stationState.duration = ack.duration;
+		m_stationState.paused = (ack.flags & CONTROL_ACK_PAUSED) != 0;
+		m_stationState.seekable = (ack.flags & CONTROL_ACK_SEEKABLE) != 0;
+		if (!nowPlaying.empty())
+			m_stationState.nowPlaying = nowPlaying;
+	}
+
+	const std::shared_ptr<Connection> connection = request.connection.lock();
+	if (!connection)
+		return;
+	ack.id = request.id;
+	SendControlAck(*connection, ack, nowPlaying);
+	ackTime.Record(GetServerTime() - request.received);
+}
+
+
+
+void ServerSideApplication::PublishStationState(const Station& station, uint32_t sequence, bool paused)
+{
+	std::lock_guard<std::mutex> guardLock(m_stationLock);
+	if (m_stationState.nowPlaying != station.GetNowPlaying())
+		m_stationState.nowPlaying = station.GetNowPlaying();
+	m_stationState.position = station.GetPosition();
+	m_stationState.duration = station.GetDuration();
+	m_stationState.sequence = sequence;
+	m_stationState.paused = paused;
+	m_stationState.seekable = station.CanSeek();
+}
+
+
+
+unsigned long long ServerSideApplication::GetServerTime()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+
+void ServerSideApplication::StampTransmit(char* packet)
+{
+	const uint64_t transmit = GetServerTime();
+	std::memcpy(packet + sizeof(StreamPacketHeader) + offsetof(ClockExchange, transmit), &transmit, sizeof(transmit));
 }
@@ -6,27 +6,203 @@
 #include <string>
 #include "../OpenAL/Sound.h"
 #include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <unordered_map>
+#include <random>
 #include <WS2tcpip.h>
 #include <WinSock2.h>
 #include "../SocketsClientServer/SocketCreator.h"
+#include "Station.h"
+#include "../OpenAL/MusicCatalog.h"
+#include "../SocketsClientServer/Metrics.h"
+#include "../SocketsClientServer/PacketMux.h"
+#include "../SocketsClientServer/PollWaker.h"
+#include "../SocketsClientServer/TaskPool.h"
+#include "BroadcastRing.h"
+#include "UpstreamLink.h"
+#include "ClusterMembership.h"
+#include "AdmissionControl.h"
+#include "ListenerRegistry.h"
+
+constexpr unsigned int CROSSFADE_MILISECONDS = 2000;
+constexpr const char* DEFAULT_LIBRARY = "../Music";
+constexpr const char* METRICS_SEGMENT = "SocketStreamingServer";
+constexpr size_t BROADCAST_RING_FRAMES = 512;                // about 12 seconds of 4096 byte PCM frames
+constexpr unsigned int RELAY_RECONNECT_DELAY = 1000;         // miliseconds
+constexpr unsigned int JOIN_BURST = 2000;                    // miliseconds of recent frames a new listener gets at once, the client prebuffer
+constexpr unsigned int PACING_LEAD = 10;                     // miliseconds a frame is sent ahead of its live edge
+constexpr unsigned int SESSION_RETENTION = 10000;            // miliseconds a lost session can be resumed, within what the ring keeps
 
 
 class ServerSideApplication : public SocketCreator
 {
 private:
-	std::mutex lock;
+	static constexpr int MAX_POLL_WAIT = 100;      // miliseconds, bounds how late closed connections are noticed
+	static constexpr int ADMISSION_RETRY = 10;     // miliseconds the acceptor waits while nothing is admitted
+
+	// One listener. Only its reactor reads from it; the stream queues frames on the audio lane of its
+	// mux and the reactor its answers on the control lane, which overtake any queued audio. Both flush,
+	// the reactor also whenever the socket takes more.
+	struct Connection : std::enable_shared_from_this<Connection>
+	{
+		explicit Connection(SOCKET socket) : socket(socket) {}
+		SOCKET socket;
+		PacketAssembler assembler;
+		PacketMux mux;
+		std::atomic<bool> subscribed = true;
+		std::atomic<bool> peer = false;             // another member of the cluster sending heartbeats, never a listener
+		std::atomic<bool> closed = false;           // whoever notices first sets it, the reactor closes
+		std::atomic<int64_t> firstStreamed = -1;    // first frame the stream queues here, for a resume where the resent ones end
+		uint64_t token = 0;                         // its session, set before the reactor gets it
+	};
+
+	// What a connection leaves behind for its client to come back to, for SESSION_RETENTION.
+	struct Session
+	{
+		std::weak_ptr<Connection> connection;       // the one serving it, expired while detached
+		bool subscribed = true;
+		unsigned long long detached = 0;            // microseconds, when the connection was lost
+	};
+
+	// A thread serving a share of the connections from one WSAPoll. The acceptor hands it new ones
+	// through incoming and wakes its poll.
+	struct Reactor
+	{
+		PollWaker waker;
+		std::mutex lock;
+		std::vector<std::shared_ptr<Connection>> incoming;
+		std::atomic<size_t> load = 0;               // connections handed to it and not closed yet
+		std::atomic<bool> stopping = false;
+		std::thread thread;
+	};
+
+	// The station as of the last frame sent, what acknowledgements report.
+	struct StationState
+	{
+		std::string nowPlaying;
+		unsigned long long position = 0;
+		unsigned long long duration = 0;
+		uint32_t sequence = 0;
+		bool paused = false;
+		bool seekable = false;
+	};
+
+	// A control request a relay passed on upstream under an id of its own, until the answer comes back.
+	struct RelayedRequest
+	{
+		std::weak_ptr<Connection> connection;
+		uint32_t id;                                // the id the listener chose
+		unsigned long long received;
+	};
+
 	std::thread listener;
-	std::unordered_map<SOCKET, std::thread> listeners;
-	std::list<SOCKET> acceptSockets;
-	std::unordered_map<SOCKET, std::atomic_bool> m_runningSockets;
+	ListenerRegistry<Connection> m_connections;
+	std::vector<std::unique_ptr<Reactor>> m_reactors;
+	unsigned int m_reactorCount;
+	AdmissionControl m_admission;
+	std::atomic<size_t> m_peerConnections = 0;      // of the open connections, the ones from cluster members
+	unsigned int m_joinBurst;                       // miliseconds
+	StreamEncoding m_encoding;
+	MusicCatalog m_catalog;
+	MetricsExporter m_metricsExporter;
+
+	std::mutex m_stationLock;
+	std::condition_variable m_stationChanged;
+	StationState m_stationState;
+	std::vector<ControlRequest> m_stationCommands;  // applied by the stream in front of its next frame
+	BroadcastRing m_ring;
+
+	// relay mode: the station comes from another server instead of the library
+	std::string m_upstreamHost;
+	int m_upstreamPort;                             // 0 for an origin
+	std::mutex m_upstreamLock;
+	std::shared_ptr<UpstreamLink> m_upstream;       // while connected
+	std::unordered_map<uint32_t, RelayedRequest> m_relayedRequests;
+	uint32_t m_nextRelayId;
+	uint64_t m_upstreamSession;                     // relay thread only: the session upstream, resumed on reconnecting
+	int64_t m_lastRelayed;                          // relay thread only: newest frame relayed in that session, -1 for none
+	bool m_resumingUpstream;                        // relay thread only: a Resume is out and not answered yet
+
+	std::unique_ptr<ClusterMembership> m_cluster;   // when the server is one of several sharing the stations
+
+	std::mutex m_sessionLock;
+	std::unordered_map<uint64_t, Session> m_sessions;
+	std::deque<std::pair<unsigned long long, uint64_t>> m_detachedSessions;   // by the time they were detached
+	std::mt19937_64 m_tokenGenerator;
+
+	//-- Takes in waiting connections in batches as admission allows and spreads them over the reactors.
+	void AcceptConnections();
+	//-- Reads and flushes the connections of one reactor, WSAPoll tells which are ready.
+	void ServeConnections(Reactor& reactor);
+	void StopReactors();
+	//-- Listener connections open, what admission is bounded by; cluster peers do not count.
+	size_t GetOpenConnections() const;
+	//-- A cluster member's connection starts with a heartbeat, true when one is waiting on the socket already.
+	static bool IsPeerGreeting(SOCKET socket);
+	//-- Takes the connection off the listeners for good, whatever audio is queued on it is dropped.
+	void MarkPeer(Connection& connection);
+	bool ReadConnection(Connection& connection);
+	void HandlePacket(Connection& connection, const StreamPacketHeader& header, const char* payload, unsigned long long received);
+	void HandleControl(Connection& connection, const ControlRequest& request, unsigned long long received);
+	//-- Sends the client to the member of the cluster that owns the station.
+	void Redirect(Connection& connection, const ControlRequest& request, const std::string& owner);
+	void SendControlAck(Connection& connection, const ControlAck& ack, const std::string& nowPlaying);
+	//-- Gives each new connection a session and tells its client the token.
+	void OpenSessions(const std::vector<std::shared_ptr<Connection>>& connections);
+	//-- Keeps the session of a lost connection for SESSION_RETENTION and forgets the ones kept longer.
+	void DetachSession(Connection& connection);
+	//-- Moves the session of the token to the connection and sends the frames its client missed.
+	void ResumeSession(Connection& connection, const ResumeRequest& request);
+	//-- Drops the oldest frames until the rest fits the audio lane next to the live frames.
+	static void LimitToAudioLane(std::vector<PacketMux::Packet>& packets);
+	//-- The last m_joinBurst miliseconds of frames before the live one, what a new listener gets first.
+	std::vector<PacketMux::Packet> GetJoinBurst(const StreamPacketHeader& live) const;
+	//-- Queues frames on the audio lane in one go and flushes, false once the connection is closed.
+	bool QueueFrames(Connection& connection, const std::vector<PacketMux::Packet>& packets);
+	bool SendToConnection(Connection& connection, PacketType type, const void* data, int size, PacketMux::Stamp stamp = nullptr);
+	void CloseConnection(Connection& connection);
+
+	//-- Runs the queued station commands and blocks while the station is paused, true when it resumed.
+	bool ApplyStationCommands(Station& station, bool& paused);
+	void PublishStationState(const Station& station, uint32_t sequence, bool paused);
+	//-- Queues the frame on every subscribed listener, on a new one behind the join burst.
+	void Broadcast(const PacketMux::Packet& packet);
+
+	bool IsRelay() const noexcept { return m_upstreamPort != 0; }
+	//-- Serves the station of the upstream server, reconnecting whenever the connection is lost.
+	void Relay();
+	void RelayPacket(const UpstreamLink& upstream, const StreamPacketHeader& header, const char* payload);
+	//-- The upstream told the relay its session; a new one starts the stream over, see ResyncStream.
+	void OnUpstreamSession(const SessionInfo& info);
+	//-- Empties the ring and moves the listeners already streamed to on to sequence, the first frame of
+	//-- an upstream session whose numbers need not follow the old ones.
+	void ResyncStream(uint32_t sequence);
+	void RelayControl(Connection& connection, const ControlRequest& request, unsigned long long received);
+	void RelayControlAck(const StreamPacketHeader& header, const char* payload);
 
-	void ListenForSockets();
-	void ListenForMessages(SOCKET& socket);
 	void InitializeServerApplication();
+	void RecordPlayout(const PlayoutReport& report);
+	static unsigned long long GetServerTime();
+	static void StampTransmit(char* packet);
 protected:
 
 public:
-	ServerSideApplication();
+	ServerSideApplication(StreamEncoding encoding = StreamEncoding::Pcm, const std::string& library = DEFAULT_LIBRARY, bool rescan = false, int port = PORT);
+	//-- A relay: listens on port and re-serves the station of the server at upstreamHost:upstreamPort
+	//-- without decoding it. Relays may relay relays.
+	ServerSideApplication(int port, const std::string& upstreamHost, int upstreamPort);
+	//-- Name of the shared memory segment the server listening on port exports its metrics to.
+	static std::string GetMetricsSegment(int port);
+	//-- Reactor threads serving the connections, before Wait; by default half the hardware threads. The
+	//-- shared task pool leaves a core to each of them and one to the stream.
+	void SetReactorCount(unsigned int count) noexcept { m_reactorCount = count ? count : 1; }
+	//-- Miliseconds of recent frames a new listener gets at once to start playing right away, before
+	//-- Wait; 0 sends it the live frames only.
+	void SetJoinBurst(unsigned int duration) noexcept { m_joinBurst = duration; }
+	//-- Makes the server a member of the cluster the seeds ("host:port") belong to, before Wait. Every
+	//-- member then serves the stations the ring gives it and redirects requests for the others.
+	void JoinCluster(const std::vector<std::string>& seeds);
+	//-- Starts serving connections, then runs the station or the relay.
 	void Wait() noexcept;
 };
-
@@ -1,7 +1,115 @@
 #include "ServerSideApplication.h"
+#include "IngestPipeline.h"
+#include <cstdlib>
+#include <sstream>
 
-int main()
+// Server [--port port] [--reactors count] [--burst miliseconds] [--relay host:port] [--cluster host:port,...] [--encoding name] [--library path] [--rescan] [--ingest] [--metrics]
+int main(int argc, char* argv[])
 {
-	ServerSideApplication applicatkion;
+	StreamEncoding encoding = StreamEncoding::Pcm;
+	std::string library = DEFAULT_LIBRARY;
+	bool rescan = false;
+	bool ingest = false;
+	bool scrape = false;
+	int port = PORT;
+	unsigned int reactors = 0;
+	int burst = -1;
+	std::string upstream;
+	std::vector<std::string> seeds;
+	bool cluster = false;
+	for (int arg = 1; arg < argc; arg++)
+	{
+		const std::string option = argv[arg];
+		if (option == "--encoding" && arg + 1 < argc)
+			encoding = ParseStreamEncoding(argv[++arg]);
+		else if (option == "--library" && arg + 1 < argc)
+			library = argv[++arg];
+		else if (option == "--rescan")
+			rescan = true;
+		else if (option == "--ingest")
+			ingest = true;
+		else if (option == "--metrics")
+			scrape = true;
+		else if (option == "--port" && arg + 1 < argc)
+			port = std::atoi(argv[++arg]);
+		else if (option == "--reactors" && arg + 1 < argc)
+			reactors = static_cast<unsigned int>(std::atoi(argv[++arg]));
+		else if (option == "--burst" && arg + 1 < argc)
+			burst = std::atoi(argv[++arg]);
+		else if (option == "--relay" && arg + 1 < argc)
+			upstream = argv[++arg];
+		else if (option == "--cluster")
+		{
+			// without seeds the first member of a new cluster, the others name any member that runs
+			cluster = true;
+			std::istringstream list(arg + 1 < argc && argv[arg + 1][0] != '-' ? argv[++arg] : "");
+			std::string seed, host;
+			int seedPort = PORT;
+			while (std::getline(list, seed, ','))
+			{
+				if (SocketCreator::ParseEndpoint(seed, host, seedPort))
+					seeds.push_back(host + ":" + std::to_string(seedPort));
+				else
+					std::cout << "BAD SEED " << seed << std::endl;
+			}
+		}
+	}
+
+	if (scrape)
+	{
+		// metrics of the server running on this machine, read from its shared memory segment
+		SharedMetricsSegment segment;
+		MetricsSnapshot snapshot;
+		if (!segment.Open(ServerSideApplication::GetMetricsSegment(port), false) || !segment.Read(snapshot))
+		{
+			std::cout << "NO RUNNING SERVER" << std::endl;
+			return 1;
+		}
+		snapshot.Print(std::cout);
+		return 0;
+	}
+
+	if (ingest)
+	{
+		// bulk ingest of the whole library, then exit without serving; a station mixing its tracks
+		// live (crossfaded PCM, IMA4) reads them from PCM containers
+		MusicCatalog catalog;
+		if (!catalog.OpenOrBuild(library, true))
+		{
+			std::cout << "LIBRARY SCAN FAILED " << library << std::endl;
+			return 1;
+		}
+		IngestPipeline pipeline(TaskPool::Get(), Station::GetContainerEncoding(encoding, CROSSFADE_MILISECONDS), MAX_BUFFER_SIZE);
+		IngestPipeline::Print(pipeline.Run(catalog.GetPlaylist()), std::cout);
+		return 0;
+	}
+
+	if (!upstream.empty())
+	{
+		std::string host;
+		int upstreamPort = PORT;
+		if (!SocketCreator::ParseEndpoint(upstream, host, upstreamPort))
+		{
+			std::cout << "BAD UPSTREAM " << upstream << std::endl;
+			return 1;
+		}
+		ServerSideApplication relay(port, host, upstreamPort);
+		if (reactors)
+			relay.SetReactorCount(reactors);
+		if (burst >= 0)
+			relay.SetJoinBurst(static_cast<unsigned int>(burst));
+		if (cluster)
+			relay.JoinCluster(seeds);
+		relay.Wait();
+		return 0;
+	}
+
+	ServerSideApplication applicatkion(encoding, library, rescan, port);
+	if (reactors)
+		applicatkion.SetReactorCount(reactors);
+	if (burst >= 0)
+		applicatkion.SetJoinBurst(static_cast<unsigned int>(burst));
+	if (cluster)
+		applicatkion.JoinCluster(seeds);
 	applicatkion.Wait();
 }
\ No newline at end of file
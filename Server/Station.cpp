@@ -0,0 +1,361 @@
+#include "Station.h"
+#include "../OpenAL/AdpcmEncoder.h"
+#include "../OpenAL/LosslessCodec.h"
+
+Station::Station(const std::vector<std::string>& playlist, unsigned int chunkSize, unsigned int crossfadeMiliseconds,
+	StreamEncoding encoding, unsigned int prefetchDepth) :
+	m_playlist(playlist),
+	m_nextIndex(0),
+	m_chunkSize(chunkSize),
+	m_crossfadeMiliseconds(crossfadeMiliseconds),
+	m_encoding(encoding),
+	m_prefetchDepth(std::max(1u, prefetchDepth)),
+	m_fadeLength(0)
+{
+	ZeroMemory(&m_carryFormat, sizeof(m_carryFormat));
+	Prefetch();
+}
+
+
+
+bool Station::NextFrame(StationFrame& frame)
+{
+	while (true)
+	{
+		if (!m_current)
+		{
+			if (!ResolveIncoming())
+				return false;
+			m_current = std::move(m_incoming);
+		}
+
+		if (m_current->mixed ? NextMixedFrame(frame) : NextContainerFrame(frame))
+			return true;
+	}
+}
+
+
+
+bool Station::Seek(unsigned long long miliseconds)
+{
+	if (!m_current)
+		return false;
+	if (!m_current->mixed)
+	{
+		m_current->nextFrame = m_current->container->GetFrameIndex(miliseconds);
+		return true;
+	}
+
+	// a fade already under way starts over, one that was passed only has what is left of the track
+	const MYWAVEFORMATEX waveFormat = m_current->GetWaveFormat();
+	const unsigned long long offset = miliseconds * waveFormat.nSamplesPerSec / 1000 * waveFormat.nBlockAlign;
+	m_current->position = static_cast<ulong>(std::min<unsigned long long>(offset, m_current->GetLength()));
+	if (m_incoming)
+		m_incoming->position = 0;
+	m_fadeLength = std::min(m_fadeLength, m_current->GetRemaining());
+	return true;
+}
+
+
+
+bool Station::Skip()
+{
+	if (!m_current)
+		return false;
+	if (!m_incoming && !ResolveIncoming())
+		return false;
+
+	// nothing is faded into a track that was skipped to, it starts at once on the next frame
+	m_current = std::move(m_incoming);
+	m_fadeLength = 0;
+	return true;
+}
+
+
+
+const std::string& Station::GetNowPlaying() const
+{
+	static const std::string none;
+	return m_current ? m_current->path : none;
+}
+
+
+
+unsigned long long Station::GetPosition() const
+{
+	if (!m_current)
+		return 0;
+	if (!m_current->mixed)
+		return m_current->container->GetFrameTime(m_current->nextFrame);
+	const MYWAVEFORMATEX waveFormat = m_current->GetWaveFormat();
+	if (!waveFormat.nAvgBytesPerSec)
+		return 0;
+	return static_cast<unsigned long long>(m_current->position) * 1000 / waveFormat.nAvgBytesPerSec;
+}
+
+
+
+unsigned long long Station::GetDuration() const
+{
+	return m_current ? m_current->container->GetDuration() : 0;
+}
+
+
+
+bool Station::NextMixedFrame(StationFrame& frame)
+{
+	MYWAVEFORMATEX waveFormat = m_current->GetWaveFormat();
+	if (!m_carry.empty() && !TrackTransition::CanJoin(m_carryFormat, waveFormat))
+		return EncodeCarry(frame, m_carry.size());
+
+	const bool encoded = m_encoding == StreamEncoding::Ima4 && AdpcmEncoder::CanEncode(waveFormat);
+	if (!encoded)
+	{
+		NextPcmChunk(m_liveFrame, waveFormat, m_chunkSize);
+		return SetLiveFrame(frame, waveFormat);
+	}
+
+	// as many whole blocks as fit a frame, what the last chunk left over leads them
+	const MYWAVEFORMATEX imaFormat = AdpcmEncoder::GetIma4Format(waveFormat);
+	const size_t blockSize = static_cast<size_t>(AdpcmEncoder::GetSamplesPerBlock(imaFormat)) * waveFormat.nBlockAlign;
+	NextPcmChunk(m_mixed, waveFormat, std::max<size_t>(1, m_chunkSize / imaFormat.nBlockAlign) * blockSize - m_carry.size());
+	m_carry.insert(m_carry.end(), m_mixed.begin(), m_mixed.end());
+	m_carryFormat = waveFormat;
+
+	// the end of the stream is the only place a block is padded
+	return EncodeCarry(frame, m_current ? m_carry.size() - m_carry.size() % blockSize : m_carry.size());
+}
+
+
+
+bool Station::NextContainerFrame(StationFrame& frame)
+{
+	// frames decode independently, so tracks are joined on frame boundaries without re-encoding
+	const TrackContainer& container = *m_current->container;
+	if (m_current->nextFrame < container.GetFrameCount())
+	{
+		frame.data = container.GetFrame(m_current->nextFrame, frame.size);
+		frame.waveFormat = container.GetWaveFormat();
+		frame.samples = container.GetFrameSamples(m_current->nextFrame);
+		frame.duration = container.GetFrameDuration(m_current->nextFrame++);
+		return true;
+	}
+
+	if (!m_incoming && !ResolveIncoming())
+	{
+		m_current.reset();
+		return false;
+	}
+	m_current = std::move(m_incoming);
+	return false;
+}
+
+
+
+void Station::NextPcmChunk(std::vector<char>& chunk, MYWAVEFORMATEX& waveFormat, size_t size)
+{
+	waveFormat = m_current->GetWaveFormat();
+	chunk.resize(size - size % waveFormat.nBlockAlign);
+	size_t filled = 0;
+
+	while (filled < chunk.size())
+	{
+		// stop in front of the fade zone until the next track is known
+		const ulong maxFade = GetMaxFadeLength(waveFormat);
+		if (!m_incoming && m_current->GetRemaining() <= maxFade)
+			ResolveIncoming();
+
+		const ulong remaining = m_current->GetRemaining();
+		const ulong fade = m_incoming ? m_fadeLength : maxFade;
+		if (remaining > fade)
+		{
+			const size_t bytes = std::min<size_t>(chunk.size() - filled, remaining - fade);
+			Read(*m_current, chunk.data() + filled, bytes);
+			filled += bytes;
+			continue;
+		}
+
+		if (remaining > 0 && m_incoming)
+		{
+			const size_t bytes = std::min<size_t>(chunk.size() - filled, remaining);
+			m_fadeScratch.resize(bytes);
+			Read(*m_current, chunk.data() + filled, bytes);
+			Read(*m_incoming, m_fadeScratch.data(), bytes);
+			TrackTransition::Crossfade(chunk.data() + filled, m_fadeScratch.data(), chunk.data() + filled, bytes,
+				waveFormat, fade - remaining, fade);
+			filled += bytes;
+			continue;
+		}
+
+		if (remaining > 0)
+		{
+			// last track of the playlist, nothing to fade into
+			const size_t bytes = std::min<size_t>(chunk.size() - filled, remaining);
+			Read(*m_current, chunk.data() + filled, bytes);
+			filled += bytes;
+			continue;
+		}
+
+		if (!m_incoming)
+		{
+			m_current.reset();
+			break;
+		}
+
+		// a format change has to start a new chunk, the client picks it up from the packet's format
+		const bool join = CanJoin(*m_current, *m_incoming);
+		m_current = std::move(m_incoming);
+		if (!join)
+			break;
+	}
+
+	chunk.resize(filled);
+}
+
+
+
+bool Station::EncodeCarry(StationFrame& frame, size_t size)
+{
+	if (!size)
+		return false;
+	m_liveFrame = AdpcmEncoder::EncodeIma4(m_carry.data(), size, m_carryFormat);
+	m_carry.erase(m_carry.begin(), m_carry.begin() + size);
+	return SetLiveFrame(frame, AdpcmEncoder::GetIma4Format(m_carryFormat));
+}
+
+
+
+bool Station::SetLiveFrame(StationFrame& frame, const MYWAVEFORMATEX& waveFormat)
+{
+	if (m_liveFrame.empty())
+		return false;
+
+	frame.waveFormat = waveFormat;
+	frame.duration = GetChunkDuration(m_liveFrame, waveFormat);
+	frame.samples = GetChunkSamples(m_liveFrame, waveFormat);
+	const std::vector<char> trailer = Sound::ConvertMyWaveFormatToData(waveFormat);
+	m_liveFrame.insert(m_liveFrame.end(), trailer.begin(), trailer.end());
+	frame.data = m_liveFrame.data();
+	frame.size = m_liveFrame.size();
+	return true;
+}
+
+
+
+unsigned int Station::GetChunkDuration(const std::vector<char>& data, const MYWAVEFORMATEX& waveFormat)
+{
+	if (!waveFormat.nSamplesPerSec)
+		return 0;
+	return static_cast<unsigned int>(static_cast<unsigned long long>(GetChunkSamples(data, waveFormat)) * 1000 / waveFormat.nSamplesPerSec);
+}
+
+
+
+unsigned long Station::GetChunkSamples(const std::vector<char>& data, const MYWAVEFORMATEX& waveFormat)
+{
+	const size_t size = data.size();
+	if (!waveFormat.nBlockAlign)
+		return 0;
+	if (waveFormat.wFormatTag == WAVE_FORMAT_LOSSLESS_RICE)
+		return static_cast<unsigned long>(LosslessCodec::GetFrameCount(data.data(), size));
+	const unsigned int samplesPerBlock = AdpcmEncoder::GetSamplesPerBlock(waveFormat);
+	return static_cast<unsigned long>(size / waveFormat.nBlockAlign * (samplesPerBlock ? samplesPerBlock : 1));
+}
+
+
+
+StreamEncoding Station::GetContainerEncoding(StreamEncoding encoding, unsigned int crossfadeMiliseconds)
+{
+	return IsMixed(encoding, crossfadeMiliseconds) ? StreamEncoding::Pcm : encoding;
+}
+
+
+
+Station::Track Station::LoadTrack(const std::string& path, StreamEncoding encoding, unsigned int chunkSize, bool mixed)
+{
+	Track track;
+	track.path = path;
+	track.mixed = mixed;
+	track.container = FrameCache::Get().Acquire(path, mixed ? StreamEncoding::Pcm : encoding, chunkSize);
+	return track;
+}
+
+
+
+bool Station::IsMixed(StreamEncoding encoding, unsigned int crossfadeMiliseconds) noexcept
+{
+	// joins of IMA4 tracks are only gapless when the blocks run on across them
+	return encoding == StreamEncoding::Ima4 || (encoding == StreamEncoding::Pcm && crossfadeMiliseconds);
+}
+
+
+
+bool Station::CanJoin(const Track& from, const Track& to)
+{
+	return from.mixed == to.mixed
+		&& TrackTransition::CanJoin(from.GetWaveFormat(), to.GetWaveFormat());
+}
+
+
+
+void Station::Prefetch()
+{
+	const bool mixed = IsMixed(m_encoding, m_crossfadeMiliseconds);
+	while (m_pending.size() < m_prefetchDepth && m_nextIndex < m_playlist.size())
+	{
+		// the first track of a cold start is needed right away, later ones only at their boundary
+		const TaskPriority priority = !m_current && m_pending.empty() ? TaskPriority::Interactive : TaskPriority::Prefetch;
+		auto load = std::make_shared<std::packaged_task<Track()>>(
+			std::bind(&Station::LoadTrack, m_playlist[m_nextIndex++], m_encoding, m_chunkSize, mixed));
+
+		PendingTrack pending;
+		pending.track = load->get_future();
+		pending.ticket = TaskPool::Get().Submit(priority, [load]() { (*load)(); });
+		m_pending.push_back(std::move(pending));
+	}
+}
+
+
+
+bool Station::ResolveIncoming()
+{
+	while (!m_pending.empty())
+	{
+		PendingTrack pending = std::move(m_pending.front());
+		m_pending.pop_front();
+		if (pending.track.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			TaskPool::Get().Boost(pending.ticket, TaskPriority::Interactive);
+		Track track = pending.track.get();
+		Prefetch();
+		if (track.IsEmpty())
+			continue;
+
+		m_incoming = std::make_unique<Track>(std::move(track));
+		m_fadeLength = 0;
+		if (m_current && m_current->mixed && m_incoming->mixed
+			&& TrackTransition::CanCrossfade(m_current->GetWaveFormat(), m_incoming->GetWaveFormat()))
+		{
+			const MYWAVEFORMATEX waveFormat = m_current->GetWaveFormat();
+			ulong fade = std::min({ GetMaxFadeLength(waveFormat), m_current->GetLength() / 2, m_incoming->GetLength() / 2 });
+			m_fadeLength = std::min(fade - fade % waveFormat.nBlockAlign, m_current->GetRemaining());
+		}
+		return true;
+	}
+	return false;
+}
+
+
+
+ulong Station::GetMaxFadeLength(const MYWAVEFORMATEX& waveFormat) const
+{
+	return static_cast<ulong>(static_cast<unsigned long long>(m_crossfadeMiliseconds) * waveFormat.nSamplesPerSec / 1000) * waveFormat.nBlockAlign;
+}
+
+
+
+void Station::Read(Track& track, char* output, size_t size)
+{
+	// the container holds the audio trimmed and normalized already
+	track.container->ReadPcm(track.position, output, size);
+	track.position += static_cast<ulong>(size);
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../OpenAL/Sound.h"
+#include "../OpenAL/TrackTransition.h"
+#include "../OpenAL/FrameCache.h"
+#include "../SocketsClientServer/TaskPool.h"
+
+// A wire frame ready to be sent, data stays valid until the next call to Station::NextFrame.
+struct StationFrame
+{
+	const char* data = nullptr;     // payload followed by the wave format trailer
+	size_t size = 0;
+	MYWAVEFORMATEX waveFormat;
+	unsigned int duration = 0;      // miliseconds of audio in the frame, rounded down
+	unsigned long samples = 0;      // sample frames of audio in the frame, what the stream is paced by
+};
+
+
+
+// Continuous playout of a playlist: silent heads and tails are skipped, consecutive tracks are
+// joined gaplessly or crossfaded inside the same chunk, and the next tracks are loaded ahead of time
+// on the shared task pool (the first one interactively, so a cold start streams right away).
+// Every track comes from its pre-packetized container (ingested on first use and shared through the
+// frame cache). Lossless and uncrossfaded PCM frames are handed out straight from the mapping.
+// Crossfaded PCM and IMA4 are mixed live from the tracks' PCM containers, which hold the trimmed and
+// normalized audio; IMA4 encodes that mix as one continuous stream, so only its end (or a change of
+// format) fills the last block with silence and joins stay gapless.
+class Station
+{
+public:
+	static constexpr unsigned int DEFAULT_PREFETCH_DEPTH = 2;
+
+	Station(const std::vector<std::string>& playlist, unsigned int chunkSize, unsigned int crossfadeMiliseconds,
+		StreamEncoding encoding = StreamEncoding::Pcm, unsigned int prefetchDepth = DEFAULT_PREFETCH_DEPTH);
+	bool NextFrame(StationFrame& frame);
+
+	//-- Moves the current track to the given time, a fade into the next track that was passed is shortened.
+	bool Seek(unsigned long long miliseconds);
+	bool CanSeek() const noexcept { return m_current != nullptr; }
+
+	//-- Cuts the current track off, the next frame starts the next one. False on the last track.
+	bool Skip();
+
+	//-- Path of the track playing, empty between tracks.
+	const std::string& GetNowPlaying() const;
+	//-- Miliseconds into the current track and its length, both 0 between tracks.
+	unsigned long long GetPosition() const;
+	unsigned long long GetDuration() const;
+	static unsigned int GetChunkDuration(const std::vector<char>& data, const MYWAVEFORMATEX& waveFormat);
+	static unsigned long GetChunkSamples(const std::vector<char>& data, const MYWAVEFORMATEX& waveFormat);
+	//-- Encoding of the containers a station streaming the given encoding plays its tracks from, what to ingest ahead.
+	static StreamEncoding GetContainerEncoding(StreamEncoding encoding, unsigned int crossfadeMiliseconds);
+
+private:
+	struct Track
+	{
+		std::string path;
+		std::shared_ptr<const TrackContainer> container; // pinned in the frame cache
+		bool mixed = false;                             // its PCM is read and mixed live, otherwise it is played frame by frame
+		ulong position = 0;                             // bytes into the PCM of a mixed track
+		size_t nextFrame = 0;
+		MYWAVEFORMATEX GetWaveFormat() const { return container->GetWaveFormat(); }
+		ulong GetLength() const { return static_cast<ulong>(container->GetPcmSize()); }
+		ulong GetRemaining() const { return GetLength() - position; }
+		bool IsEmpty() const { return !container->IsOpen(); }
+	};
+
+	struct PendingTrack
+	{
+		std::future<Track> track;
+		TaskPool::Ticket ticket;
+	};
+
+	static Track LoadTrack(const std::string& path, StreamEncoding encoding, unsigned int chunkSize, bool mixed);
+	static bool IsMixed(StreamEncoding encoding, unsigned int crossfadeMiliseconds) noexcept;
+	static bool CanJoin(const Track& from, const Track& to);
+	bool NextMixedFrame(StationFrame& frame);
+	bool NextContainerFrame(StationFrame& frame);
+	//-- Up to size bytes of the mix, a change of format ends the chunk early.
+	void NextPcmChunk(std::vector<char>& chunk, MYWAVEFORMATEX& waveFormat, size_t size);
+	//-- Encodes the first size bytes of the carry into the live frame, a last partial block is padded.
+	bool EncodeCarry(StationFrame& frame, size_t size);
+	bool SetLiveFrame(StationFrame& frame, const MYWAVEFORMATEX& waveFormat);
+	void Prefetch();
+	bool ResolveIncoming();
+	ulong GetMaxFadeLength(const MYWAVEFORMATEX& waveFormat) const;
+	void Read(Track& track, char* output, size_t size);
+
+	std::vector<std::string> m_playlist;
+	size_t m_nextIndex;
+	unsigned int m_chunkSize;
+	unsigned int m_crossfadeMiliseconds;
+	StreamEncoding m_encoding;
+	std::unique_ptr<Track> m_current;
+	std::unique_ptr<Track> m_incoming;
+	std::deque<PendingTrack> m_pending;
+	unsigned int m_prefetchDepth;
+	ulong m_fadeLength;
+	std::vector<char> m_fadeScratch;
+	std::vector<char> m_mixed;
+	std::vector<char> m_carry;                      // mixed PCM short of a whole IMA4 block, it leads the next chunk
+	MYWAVEFORMATEX m_carryFormat;
+	std::vector<char> m_liveFrame;
+};
@@ -0,0 +1,86 @@
+#include "UpstreamLink.h"
+#include <chrono>
+#include <cstring>
+#include "../SocketsClientServer/Metrics.h"
+
+UpstreamLink::UpstreamLink(const std::string& host, int port) :
+	SocketCreator(false, port, host),
+	m_clock(ClockSync::DEFAULT_INTERVAL),
+	m_closed(false)
+{
+}
+
+
+
+UpstreamLink::~UpstreamLink()
+{
+	if (!m_closed)
+		CloseSocket();
+}
+
+
+
+void UpstreamLink::Run(const PacketHandler& handler)
+{
+	static const MetricCounter packets("relay.upstream.packets");
+	static const MetricGauge clockOffset("relay.upstream.clock_offset_us");
+
+	PacketAssembler assembler;
+	StreamPacketHeader header;
+	const char* payload = nullptr;
+	while (true)
+	{
+		const int result = Receive(mainSocket, 0, [&](void* received, int receivedSize)
+			{
+				assembler.Append((const char*)received, receivedSize);
+			});
+		const long long received = GetLocalTime();
+		if (result < 0)
+			m_closed = true;
+		if (result <= 0 || assembler.IsCorrupt())
+			break;
+
+		while (assembler.Next(header, payload))
+		{
+			packets.Add();
+			if (header.type == static_cast<uint16_t>(PacketType::ClockResponse) && header.size == sizeof(ClockExchange))
+			{
+				ClockExchange response;
+				std::memcpy(&response, payload, sizeof(response));
+				if (m_clock.OnResponse(response, received))
+					clockOffset.Set(m_clock.GetOffset());
+			}
+			else
+			{
+				handler(header, payload);
+			}
+		}
+
+		ClockExchange request;
+		if (m_clock.NextRequest(GetLocalTime(), request))
+			SendToServer(PacketType::ClockRequest, &request, sizeof(request));
+	}
+}
+
+
+
+int UpstreamLink::SendToServer(PacketType type, const void* data, int size)
+{
+	const StreamPacketHeader header{ STREAM_PACKET_MAGIC, static_cast<uint32_t>(size), static_cast<uint16_t>(type), 0, 0, 0, 0 };
+	std::lock_guard<std::mutex> guardLock(m_sendLock);
+	return SendPacket(mainSocket, header, data, size);
+}
+
+
+
+unsigned long long UpstreamLink::ToLocalTime(unsigned long long upstreamTime) const noexcept
+{
+	return static_cast<unsigned long long>(static_cast<long long>(upstreamTime) + m_clock.GetOffset());
+}
+
+
+
+long long UpstreamLink::GetLocalTime()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
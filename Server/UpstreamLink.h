@@ -0,0 +1,33 @@
+#pragma once
+#include <functional>
+#include <mutex>
+#include "../SocketsClientServer/SocketCreator.h"
+#include "../SocketsClientServer/ClockSync.h"
+
+// The connection of a relay to the server it relays, an origin or another relay. It is the receive path
+// of ClientSideApplication without the audio: packets are reassembled as they arrive, clock exchanges
+// keep the upstream clock on the local one, and every other packet goes to the handler untouched.
+class UpstreamLink : public SocketCreator
+{
+public:
+	using PacketHandler = std::function<void(const StreamPacketHeader& header, const char* payload)>;
+
+	UpstreamLink(const std::string& host, int port);
+	~UpstreamLink();
+
+	//-- Receives until the upstream goes away, the handler runs on the calling thread.
+	void Run(const PacketHandler& handler);
+	//-- Safe from any thread, -1 on error.
+	int SendToServer(PacketType type, const void* data, int size);
+
+	bool IsSynchronized() const noexcept { return m_clock.IsSynchronized(); }
+	//-- An upstream time (packet timestamps, clock exchanges) on the local steady clock.
+	unsigned long long ToLocalTime(unsigned long long upstreamTime) const noexcept;
+
+	static long long GetLocalTime();
+
+private:
+	std::mutex m_sendLock;
+	ClockSync m_clock;              // receiving thread only
+	bool m_closed;                  // Receive failed and closed the socket itself
+};
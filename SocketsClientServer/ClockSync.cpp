@@ -0,0 +1,53 @@
+#include "ClockSync.h"
+#include "Metrics.h"
+#include <algorithm>
+
+ClockSync::ClockSync(unsigned int interval) :
+	m_interval(interval),
+	m_exchanges(0),
+	m_nextRequest(0),
+	m_offset(0),
+	m_delay(0)
+{
+}
+
+
+
+bool ClockSync::NextRequest(long long now, ClockExchange& request)
+{
+	if (now < m_nextRequest)
+		return false;
+
+	// a burst fills the window quickly after connecting, later exchanges only follow the drift
+	m_nextRequest = now + (m_exchanges < WINDOW ? BURST_INTERVAL : m_interval) * 1000ll;
+	request = ClockExchange{ static_cast<uint64_t>(now), 0, 0 };
+	return true;
+}
+
+
+
+bool ClockSync::OnResponse(const ClockExchange& response, long long now)
+{
+	static const MetricCounter dropped("clock.exchange.dropped");
+	static const MetricHistogram delays("clock.exchange.delay_us");
+
+	const long long originate = static_cast<long long>(response.originate);
+	const long long receive = static_cast<long long>(response.receive);
+	const long long transmit = static_cast<long long>(response.transmit);
+	if (now < originate || transmit < receive)
+	{
+		dropped.Add();
+		return false;
+	}
+
+	const Sample sample{ ((originate - receive) + (now - transmit)) / 2, std::max(0ll, (now - originate) - (transmit - receive)) };
+	m_window[m_exchanges % WINDOW] = sample;
+	m_exchanges++;
+	delays.Record(static_cast<uint64_t>(sample.delay));
+
+	const auto end = m_window.begin() + std::min<unsigned long long>(m_exchanges, WINDOW);
+	const Sample& best = *std::min_element(m_window.begin(), end, [](const Sample& left, const Sample& right) { return left.delay < right.delay; });
+	m_offset = best.offset;
+	m_delay = best.delay;
+	return true;
+}
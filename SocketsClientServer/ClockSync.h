@@ -0,0 +1,52 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include "StreamProtocol.h"
+
+// Estimates how the server clock (the one packet timestamps use) maps to a local clock from NTP style
+// exchanges over the stream connection. With t0 = originate, t1 = receive, t2 = transmit and t3 = arrival
+// of the answer, an exchange gives
+//     offset = ((t0 - t1) + (t3 - t2)) / 2      local minus server time
+//     delay  = (t3 - t0) - (t2 - t1)            round trip on the wire
+// The time the server held the request does not count, so it may answer between two frames. Queuing on
+// the way is only known to add to the delay and moves the offset by at most half of it, hence the sample
+// with the smallest delay of the last WINDOW wins (the clock filter of NTP).
+class ClockSync
+{
+public:
+	static constexpr size_t WINDOW = 8;
+	static constexpr unsigned int BURST_INTERVAL = 100;     // miliseconds between requests until the window is full
+	static constexpr unsigned int DEFAULT_INTERVAL = 2000;  // miliseconds between requests afterwards
+
+	explicit ClockSync(unsigned int interval = DEFAULT_INTERVAL);
+
+	//-- Returns true with request filled when the next exchange is due, now is the local clock in microseconds.
+	bool NextRequest(long long now, ClockExchange& request);
+
+	//-- The answer to a request arrived at now (local clock). Answers with impossible times are dropped.
+	bool OnResponse(const ClockExchange& response, long long now);
+
+	bool IsSynchronized() const noexcept { return m_exchanges > 0; }
+	//-- Microseconds to add to a server time to get the local time.
+	long long GetOffset() const noexcept { return m_offset; }
+	//-- Round trip of the exchange the offset comes from, the offset is off by at most half of it.
+	long long GetDelay() const noexcept { return m_delay; }
+	unsigned long long GetExchanges() const noexcept { return m_exchanges; }
+
+	long long ToLocal(unsigned long long serverTime) const noexcept { return static_cast<long long>(serverTime) + m_offset; }
+	unsigned long long ToServer(long long localTime) const noexcept { return static_cast<unsigned long long>(localTime - m_offset); }
+
+private:
+	struct Sample
+	{
+		long long offset;
+		long long delay;
+	};
+
+	unsigned int m_interval;
+	std::array<Sample, WINDOW> m_window{};
+	unsigned long long m_exchanges;
+	long long m_nextRequest;
+	long long m_offset;
+	long long m_delay;
+};
@@ -0,0 +1,266 @@
+#include "EventLoop.h"
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <utility>
+
+void EventLoop::Awaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	waiter.handle = handle;
+	loop.m_waiters.push_back(&waiter);
+}
+
+
+
+EventLoop::Signal::Signal(EventLoop& loop) :
+	m_loop(loop),
+	m_state(std::make_shared<State>())
+{
+}
+
+
+
+void EventLoop::Signal::Raise(unsigned int count)
+{
+	// the loop outlives what it was posted, the signal may not
+	m_loop.Post([&loop = m_loop, weakState = std::weak_ptr<State>(m_state), count]()
+		{
+			const std::shared_ptr<State> state = weakState.lock();
+			if (!state)
+				return;
+			state->raised += count;
+			if (state->waiter)
+				loop.Resume(*state->waiter);
+		});
+}
+
+
+
+Task<unsigned int> EventLoop::Signal::Wait(int timeout)
+{
+	const std::shared_ptr<State> state = m_state;
+	if (!state->raised)
+	{
+		// no socket, only a raise or the deadline wakes it
+		Awaiter awaiter = m_loop.Ready(INVALID_SOCKET, 0, timeout);
+		state->waiter = &awaiter.waiter;
+		co_await awaiter;
+		state->waiter = nullptr;
+	}
+	co_return std::exchange(state->raised, 0u);
+}
+
+
+
+EventLoop::EventLoop() :
+	m_stopping(false)
+{
+}
+
+
+
+EventLoop::~EventLoop()
+{
+	// the frames of the spawned coroutines hold the tasks they await, those go with them
+	m_waiters.clear();
+	const std::vector<void*> roots(m_roots.begin(), m_roots.end());
+	m_roots.clear();
+	for (void* root : roots)
+		std::coroutine_handle<>::from_address(root).destroy();
+}
+
+
+
+void EventLoop::Spawn(Task<> task)
+{
+	// a function must be copyable, the task is shared until the loop takes it
+	auto pending = std::make_shared<Task<>>(std::move(task));
+	Post([this, pending]()
+		{
+			const Root root = Start(std::move(*pending));
+			root.handle.promise().loop = this;
+			m_roots.insert(root.handle.address());
+			root.handle.resume();
+		});
+}
+
+
+
+void EventLoop::Post(std::function<void()> function)
+{
+	{
+		std::lock_guard<std::mutex> guardLock(m_postLock);
+		m_posted.push_back(std::move(function));
+	}
+	m_waker.Wake();
+}
+
+
+
+void EventLoop::Run()
+{
+	std::vector<WSAPOLLFD> descriptors;
+	std::vector<Waiter*> polled;
+	std::vector<Waiter*> due;
+	while (!m_stopping)
+	{
+		RunPosted();
+
+		descriptors.clear();
+		polled.clear();
+		if (m_waker.IsOpen())
+			descriptors.push_back(WSAPOLLFD{ m_waker.GetSocket(), POLLRDNORM, 0 });
+		const size_t first = descriptors.size();
+		Clock::time_point next = Clock::now() + std::chrono::milliseconds(MAX_WAIT);
+		for (Waiter* waiter : m_waiters)
+		{
+			next = std::min(next, waiter->deadline);
+			if (waiter->socket == INVALID_SOCKET)
+				continue;
+			descriptors.push_back(WSAPOLLFD{ waiter->socket, waiter->events, 0 });
+			polled.push_back(waiter);
+		}
+		const int timeout = static_cast<int>(std::max<long long>(0, std::chrono::ceil<std::chrono::milliseconds>(next - Clock::now()).count()));
+		if (descriptors.empty())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+		}
+		else if (WSAPoll(descriptors.data(), static_cast<ULONG>(descriptors.size()), timeout) == SOCKET_ERROR)
+		{
+			std::cout << "POLL FAILED" << WSAGetLastError() << std::endl;
+			return;
+		}
+		if (first && descriptors[0].revents)
+			m_waker.Drain();
+
+		// the ready and the due ones leave the list before any of them runs, they may wait again right away
+		for (size_t i = 0; i < polled.size(); i++)
+			polled[i]->revents = descriptors[first + i].revents;
+		const Clock::time_point now = Clock::now();
+		due.clear();
+		m_waiters.erase(std::remove_if(m_waiters.begin(), m_waiters.end(), [&due, now](Waiter* waiter)
+			{
+				if (!waiter->revents && waiter->deadline > now)
+					return false;
+				due.push_back(waiter);
+				return true;
+			}), m_waiters.end());
+		for (Waiter* waiter : due)
+			waiter->handle.resume();
+	}
+}
+
+
+
+void EventLoop::Stop()
+{
+	m_stopping = true;
+	m_waker.Wake();
+}
+
+
+
+EventLoop::Awaiter EventLoop::Ready(SOCKET socket, SHORT events, int timeout)
+{
+	Awaiter awaiter{ *this, Waiter{ socket, events } };
+	if (timeout >= 0)
+		awaiter.waiter.deadline = Clock::now() + std::chrono::milliseconds(timeout);
+	return awaiter;
+}
+
+
+
+EventLoop::Awaiter EventLoop::Sleep(unsigned int duration)
+{
+	return Ready(INVALID_SOCKET, 0, static_cast<int>(duration));
+}
+
+
+
+Task<int> EventLoop::Recv(SOCKET socket, char* buffer, int size)
+{
+	while (true)
+	{
+		// tried first, the data is often there already
+		const int received = recv(socket, buffer, size, 0);
+		if (received != SOCKET_ERROR || WSAGetLastError() != WSAEWOULDBLOCK)
+			co_return received;
+		co_await Ready(socket, POLLRDNORM);
+	}
+}
+
+
+
+Task<bool> EventLoop::Send(SOCKET socket, const char* data, int size)
+{
+	while (size > 0)
+	{
+		const int sent = send(socket, data, size, 0);
+		if (sent == SOCKET_ERROR)
+		{
+			if (WSAGetLastError() != WSAEWOULDBLOCK)
+				co_return false;
+			co_await Ready(socket, POLLWRNORM);
+			continue;
+		}
+		data += sent;
+		size -= sent;
+	}
+	co_return true;
+}
+
+
+
+Task<bool> EventLoop::Connect(SOCKET socket, sockaddr_in address, int timeout)
+{
+	if (connect(socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != SOCKET_ERROR)
+		co_return true;
+	if (WSAGetLastError() != WSAEWOULDBLOCK)
+		co_return false;
+
+	// WSAPoll of older Windows versions does not report a connect that failed, the timeout ends it then
+	const SHORT revents = co_await Ready(socket, POLLWRNORM, timeout);
+	int error = 0;
+	int length = sizeof(error);
+	co_return (revents & POLLWRNORM) && getsockopt(socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &length) != SOCKET_ERROR && !error;
+}
+
+
+
+EventLoop::Root EventLoop::Start(Task<> task)
+{
+	co_await task;
+}
+
+
+
+void EventLoop::Finish(std::coroutine_handle<> root) noexcept
+{
+	m_roots.erase(root.address());
+	root.destroy();
+}
+
+
+
+void EventLoop::Resume(Waiter& waiter)
+{
+	const auto it = std::find(m_waiters.begin(), m_waiters.end(), &waiter);
+	if (it == m_waiters.end())
+		return;
+	m_waiters.erase(it);
+	waiter.handle.resume();
+}
+
+
+
+void EventLoop::RunPosted()
+{
+	std::vector<std::function<void()>> posted;
+	{
+		std::lock_guard<std::mutex> guardLock(m_postLock);
+		posted.swap(m_posted);
+	}
+	for (const std::function<void()>& function : posted)
+		function();
+}
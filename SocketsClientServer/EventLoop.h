@@ -0,0 +1,137 @@
+#pragma once
+#include <WinSock2.h>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+#include "PollWaker.h"
+#include "Task.h"
+
+// Runs coroutines on one thread over WSAPoll, the way a reactor serves its connections, so a session or a
+// pipeline written as a Task costs its coroutine frame instead of a thread and its stack. A coroutine
+// suspends until a socket is ready, a timer is due or another thread raised a Signal, and the loop resumes
+// it on its thread. Sockets must be non blocking and Winsock started; everything but Spawn, Post, Stop and
+// Signal::Raise is for the coroutines of the loop only.
+class EventLoop
+{
+private:
+	// A suspended coroutine and what it waits for; it lives in the coroutine frame.
+	struct Waiter
+	{
+		SOCKET socket = INVALID_SOCKET;             // none for a timer or a signal
+		SHORT events = 0;
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+		std::coroutine_handle<> handle;
+		SHORT revents = 0;                          // what the poll found, 0 when the deadline passed
+	};
+
+public:
+	using Clock = std::chrono::steady_clock;
+	static constexpr int MAX_WAIT = 1000;           // miliseconds the poll waits at most when nothing is due
+
+	struct Awaiter
+	{
+		EventLoop& loop;
+		Waiter waiter;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle);
+		SHORT await_resume() const noexcept { return waiter.revents; }
+	};
+
+	// Counts what another thread reports, such as OpenAL finishing buffers of a source, for a coroutine of
+	// the loop to await. Raise is safe from any thread for as long as the signal lives; a raise still
+	// posted when the signal goes is dropped.
+	class Signal
+	{
+	public:
+		explicit Signal(EventLoop& loop);
+		Signal(const Signal&) = delete;
+		Signal& operator=(const Signal&) = delete;
+
+		void Raise(unsigned int count = 1);
+		//-- How often it was raised since the last Wait, after waiting for the next raise when there was
+		//-- none; 0 once timeout miliseconds passed (-1 waits for ever).
+		Task<unsigned int> Wait(int timeout = -1);
+
+	private:
+		// shared with the raises on their way to the loop, they must not reach a signal that is gone
+		struct State
+		{
+			unsigned int raised = 0;
+			Waiter* waiter = nullptr;
+		};
+
+		EventLoop& m_loop;
+		std::shared_ptr<State> m_state;
+	};
+
+	EventLoop();
+	~EventLoop();
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator=(const EventLoop&) = delete;
+
+	//-- Runs the coroutine on the loop, from any thread. The loop owns it until it finished, the ones still
+	//-- suspended when the loop is destroyed are destroyed with it.
+	void Spawn(Task<> task);
+	//-- Runs function on the loop thread, from any thread.
+	void Post(std::function<void()> function);
+	//-- Runs the loop on the calling thread until Stop.
+	void Run();
+	//-- From any thread, Run returns once the coroutines resumed meanwhile suspended again.
+	void Stop();
+
+	//-- The events of the socket that happened (POLLERR and POLLHUP too), 0 after timeout miliseconds.
+	Awaiter Ready(SOCKET socket, SHORT events, int timeout = -1);
+	Awaiter Sleep(unsigned int duration);
+	//-- One recv once the socket has data: the bytes read, 0 once the peer closed, SOCKET_ERROR on an error.
+	Task<int> Recv(SOCKET socket, char* buffer, int size);
+	//-- Sends all of it, false on an error.
+	Task<bool> Send(SOCKET socket, const char* data, int size);
+	//-- Connects the socket, false when that failed or took more than timeout miliseconds.
+	Task<bool> Connect(SOCKET socket, sockaddr_in address, int timeout);
+
+private:
+	// A spawned coroutine, it removes itself from the loop once it finished.
+	struct Root
+	{
+		struct promise_type
+		{
+			EventLoop* loop = nullptr;
+
+			Root get_return_object() noexcept { return Root{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			auto final_suspend() noexcept
+			{
+				struct FinalAwaiter
+				{
+					bool await_ready() const noexcept { return false; }
+					void await_suspend(std::coroutine_handle<promise_type> handle) noexcept { handle.promise().loop->Finish(handle); }
+					void await_resume() const noexcept {}
+				};
+				return FinalAwaiter{};
+			}
+			void return_void() noexcept {}
+			void unhandled_exception() noexcept { std::terminate(); }
+		};
+
+		std::coroutine_handle<promise_type> handle;
+	};
+
+	static Root Start(Task<> task);
+	void Finish(std::coroutine_handle<> root) noexcept;
+	//-- Resumes the coroutine of a waiter before what it waited for happened.
+	void Resume(Waiter& waiter);
+	void RunPosted();
+
+	PollWaker m_waker;
+	std::atomic<bool> m_stopping;
+	std::mutex m_postLock;
+	std::vector<std::function<void()>> m_posted;
+	std::vector<Waiter*> m_waiters;
+	std::unordered_set<void*> m_roots;              // the frames of the spawned coroutines
+};
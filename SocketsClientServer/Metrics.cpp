@@ -0,0 +1,436 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	uint64_t GetPercentile(const std::array<uint64_t, HistogramBuckets::COUNT>& buckets, uint64_t count, double fraction)
+	{
+		const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * count + 0.5));
+		uint64_t seen = 0;
+		for (unsigned int i = 0; i < HistogramBuckets::COUNT; i++)
+		{
+			seen += buckets[i];
+			if (seen >= rank)
+				return HistogramBuckets::GetValue(i);
+		}
+		return 0;
+	}
+
+	uint64_t GetTimestamp()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+}
+
+
+
+// A thread's claim on a shard, given back when the thread ends.
+struct ShardLease
+{
+	explicit ShardLease(MetricsRegistry& registry) : registry(registry), shard(registry.AcquireShard(index)) {}
+	~ShardLease() { registry.ReleaseShard(index); }
+
+	MetricsRegistry& registry;
+	size_t index;
+	MetricShard* shard;
+};
+
+
+
+unsigned int HistogramBuckets::GetIndex(uint64_t value) noexcept
+{
+	if (value < SUB_BUCKETS)
+		return static_cast<unsigned int>(value);
+	const unsigned int bits = static_cast<unsigned int>(std::bit_width(value));
+	if (bits > MAX_BITS)
+		return COUNT - 1;
+	const unsigned int shift = bits - 1 - SUB_BUCKET_BITS;
+	return (bits - SUB_BUCKET_BITS) * SUB_BUCKETS + static_cast<unsigned int>((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+
+
+uint64_t HistogramBuckets::GetValue(unsigned int index) noexcept
+{
+	if (index < SUB_BUCKETS)
+		return index;
+	const unsigned int shift = index / SUB_BUCKETS - 1;
+	const uint64_t low = static_cast<uint64_t>(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+	return low + (1ull << shift) / 2;
+}
+
+
+
+void MetricHistogram::Record(uint64_t value) const noexcept
+{
+	MetricShard::Histogram& histogram = MetricsRegistry::Get().GetLocalShard().histograms[m_index];
+	histogram.buckets[HistogramBuckets::GetIndex(value)].fetch_add(1, std::memory_order_relaxed);
+	histogram.sum.fetch_add(value, std::memory_order_relaxed);
+	uint64_t max = histogram.max.load(std::memory_order_relaxed);
+	while (value > max && !histogram.max.compare_exchange_weak(max, value, std::memory_order_relaxed));
+}
+
+
+
+MetricsRegistry& MetricsRegistry::Get()
+{
+	// never destroyed, detached threads may still record while the process exits
+	static MetricsRegistry* registry = new MetricsRegistry();
+	return *registry;
+}
+
+
+
+MetricsRegistry::MetricsRegistry()
+{
+	m_shards[MAX_SHARDS] = new MetricShard();
+}
+
+
+
+size_t MetricsRegistry::Register(const std::string& name, MetricKind kind)
+{
+	std::lock_guard<std::mutex> guardLock(m_lock);
+	for (const auto& slot : m_slots)
+	{
+		if (slot.name == name && slot.kind == kind)
+			return slot.index;
+	}
+
+	static constexpr std::array<size_t, 3> limits = { MetricShard::MAX_COUNTERS, MAX_GAUGES, MetricShard::MAX_HISTOGRAMS };
+	const size_t kindIndex = static_cast<size_t>(kind);
+	if (m_used[kindIndex] + 1 >= limits[kindIndex])
+		return limits[kindIndex] - 1;
+	m_slots.push_back(Slot{ name, kind, m_used[kindIndex]++ });
+	return m_slots.back().index;
+}
+
+
+
+MetricShard& MetricsRegistry::GetLocalShard()
+{
+	thread_local ShardLease lease(*this);
+	return *lease.shard;
+}
+
+
+
+MetricShard* MetricsRegistry::AcquireShard(size_t& lease)
+{
+	for (size_t i = 0; i < MAX_SHARDS; i++)
+	{
+		bool leased = false;
+		if (!m_leased[i].compare_exchange_strong(leased, true))
+			continue;
+
+		MetricShard* shard = m_shards[i].load(std::memory_order_acquire);
+		if (!shard)
+		{
+			shard = new MetricShard();
+			m_shards[i].store(shard, std::memory_order_release);
+		}
+		lease = i;
+		return shard;
+	}
+	lease = MAX_SHARDS;
+	return m_shards[MAX_SHARDS].load(std::memory_order_relaxed);
+}
+
+
+
+void MetricsRegistry::ReleaseShard(size_t lease) noexcept
+{
+	if (lease < MAX_SHARDS)
+		m_leased[lease].store(false, std::memory_order_release);
+}
+
+
+
+MetricsSnapshot MetricsRegistry::Snapshot() const
+{
+	std::vector<Slot> slots;
+	{
+		std::lock_guard<std::mutex> guardLock(m_lock);
+		slots = m_slots;
+	}
+
+	MetricsSnapshot snapshot;
+	snapshot.timestamp = GetTimestamp();
+	snapshot.metrics.reserve(slots.size());
+	std::array<uint64_t, HistogramBuckets::COUNT> buckets;
+	for (const auto& slot : slots)
+	{
+		MetricValue metric;
+		metric.name = slot.name;
+		metric.kind = slot.kind;
+		if (slot.kind == MetricKind::Gauge)
+		{
+			metric.value = m_gauges[slot.index].load(std::memory_order_relaxed);
+			snapshot.metrics.push_back(std::move(metric));
+			continue;
+		}
+
+		buckets.fill(0);
+		for (const auto& entry : m_shards)
+		{
+			const MetricShard* shard = entry.load(std::memory_order_acquire);
+			if (!shard)
+				continue;
+			if (slot.kind == MetricKind::Counter)
+			{
+				metric.value += static_cast<int64_t>(shard->counters[slot.index].load(std::memory_order_relaxed));
+				continue;
+			}
+			const MetricShard::Histogram& histogram = shard->histograms[slot.index];
+			for (unsigned int i = 0; i < HistogramBuckets::COUNT; i++)
+				buckets[i] += histogram.buckets[i].load(std::memory_order_relaxed);
+			metric.histogram.sum += histogram.sum.load(std::memory_order_relaxed);
+			metric.histogram.max = std::max(metric.histogram.max, histogram.max.load(std::memory_order_relaxed));
+		}
+
+		if (slot.kind == MetricKind::Histogram)
+		{
+			HistogramSummary& summary = metric.histogram;
+			for (uint64_t count : buckets)
+				summary.count += count;
+			summary.p50 = GetPercentile(buckets, summary.count, 0.50);
+			summary.p90 = GetPercentile(buckets, summary.count, 0.90);
+			summary.p99 = GetPercentile(buckets, summary.count, 0.99);
+			summary.p999 = GetPercentile(buckets, summary.count, 0.999);
+			metric.value = static_cast<int64_t>(summary.count);
+		}
+		snapshot.metrics.push_back(std::move(metric));
+	}
+	return snapshot;
+}
+
+
+
+void MetricsSnapshot::Print(std::ostream& stream) const
+{
+	for (const auto& metric : metrics)
+	{
+		stream << std::left << std::setw(32) << metric.name << std::right;
+		if (metric.kind != MetricKind::Histogram)
+		{
+			stream << ' ' << metric.value << std::endl;
+			continue;
+		}
+		const HistogramSummary& summary = metric.histogram;
+		stream << " count " << summary.count << " mean " << std::fixed << std::setprecision(1) << summary.GetMean() << std::defaultfloat
+			<< " p50 " << summary.p50 << " p90 " << summary.p90 << " p99 " << summary.p99 << " p999 " << summary.p999
+			<< " max " << summary.max << std::endl;
+	}
+}
+
+
+
+std::string MetricsSnapshot::ToString() const
+{
+	std::ostringstream stream;
+	Print(stream);
+	return stream.str();
+}
+
+
+
+SharedMetricsSegment::~SharedMetricsSegment()
+{
+	Close();
+}
+
+
+
+bool SharedMetricsSegment::Open(const std::string& name, bool create)
+{
+	Close();
+#ifdef _WIN32
+	const std::string path = "Local\\" + name;
+	HANDLE mapping = create
+		? CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, static_cast<DWORD>(SIZE), path.c_str())
+		: OpenFileMappingA(FILE_MAP_READ, FALSE, path.c_str());
+	if (!mapping)
+		return false;
+	m_view = MapViewOfFile(mapping, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, SIZE);
+	if (!m_view)
+	{
+		CloseHandle(mapping);
+		return false;
+	}
+	m_handle = mapping;
+#else
+	const std::string path = "/" + name;
+	const int file = create ? shm_open(path.c_str(), O_CREAT | O_RDWR, 0644) : shm_open(path.c_str(), O_RDONLY, 0);
+	if (file == -1)
+		return false;
+	if (create && ftruncate(file, SIZE) != 0)
+	{
+		close(file);
+		return false;
+	}
+	void* view = mmap(nullptr, SIZE, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file, 0);
+	close(file);
+	if (view == MAP_FAILED)
+		return false;
+	m_view = view;
+#endif
+	m_name = path;
+	m_owner = create;
+	if (create)
+	{
+		std::memset(m_view, 0, SIZE);
+		GetHeader()->magic = MAGIC;
+		GetHeader()->version = VERSION;
+	}
+	return true;
+}
+
+
+
+void SharedMetricsSegment::Close()
+{
+	if (!m_view)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(m_view);
+	CloseHandle(static_cast<HANDLE>(m_handle));
+#else
+	munmap(m_view, SIZE);
+	if (m_owner)
+		shm_unlink(m_name.c_str());
+#endif
+	m_view = nullptr;
+	m_handle = nullptr;
+	m_owner = false;
+}
+
+
+
+void SharedMetricsSegment::Write(const MetricsSnapshot& snapshot)
+{
+	if (!m_view || !m_owner)
+		return;
+
+	SharedMetricsHeader* header = GetHeader();
+	const uint32_t sequence = header->sequence.load(std::memory_order_relaxed);
+	header->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	const size_t count = std::min(snapshot.metrics.size(), MAX_ENTRIES);
+	SharedMetricEntry* entries = GetEntries();
+	for (size_t i = 0; i < count; i++)
+	{
+		const MetricValue& metric = snapshot.metrics[i];
+		SharedMetricEntry entry{};
+		std::memcpy(entry.name, metric.name.data(), std::min(metric.name.size(), sizeof(entry.name) - 1));
+		entry.kind = static_cast<uint32_t>(metric.kind);
+		entry.value = metric.value;
+		entry.count = metric.histogram.count;
+		entry.sum = metric.histogram.sum;
+		entry.max = metric.histogram.max;
+		entry.p50 = metric.histogram.p50;
+		entry.p90 = metric.histogram.p90;
+		entry.p99 = metric.histogram.p99;
+		entry.p999 = metric.histogram.p999;
+		std::memcpy(&entries[i], &entry, sizeof(entry));
+	}
+	header->count = static_cast<uint32_t>(count);
+	header->timestamp = snapshot.timestamp;
+	header->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+
+
+bool SharedMetricsSegment::Read(MetricsSnapshot& snapshot) const
+{
+	if (!m_view)
+		return false;
+
+	const SharedMetricsHeader* header = GetHeader();
+	if (header->magic != MAGIC || header->version != VERSION)
+		return false;
+
+	std::vector<SharedMetricEntry> entries(MAX_ENTRIES);
+	for (int attempt = 0; attempt < 1000; attempt++)
+	{
+		const uint32_t sequence = header->sequence.load(std::memory_order_acquire);
+		if (sequence & 1)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		const size_t count = std::min<size_t>(header->count, MAX_ENTRIES);
+		const uint64_t timestamp = header->timestamp;
+		std::memcpy(entries.data(), GetEntries(), count * sizeof(SharedMetricEntry));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (header->sequence.load(std::memory_order_relaxed) != sequence)
+			continue;
+
+		snapshot.metrics.clear();
+		snapshot.timestamp = timestamp;
+		for (size_t i = 0; i < count; i++)
+		{
+			const SharedMetricEntry& entry = entries[i];
+			MetricValue metric;
+			metric.name.assign(entry.name, std::find(entry.name, entry.name + sizeof(entry.name), '\0'));
+			metric.kind = static_cast<MetricKind>(entry.kind);
+			metric.value = entry.value;
+			metric.histogram = HistogramSummary{ entry.count, entry.sum, entry.max, entry.p50, entry.p90, entry.p99, entry.p999 };
+			snapshot.metrics.push_back(std::move(metric));
+		}
+		return true;
+	}
+	return false;
+}
+
+
+
+MetricsExporter::MetricsExporter(const std::string& segmentName, unsigned int interval) :
+	m_interval(interval),
+	m_stopping(false)
+{
+	if (m_segment.Open(segmentName, true))
+		m_thread = std::thread(&MetricsExporter::Run, this);
+}
+
+
+
+MetricsExporter::~MetricsExporter()
+{
+	{
+		std::lock_guard<std::mutex> guardLock(m_lock);
+		m_stopping = true;
+	}
+	m_wakeUp.notify_all();
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+
+
+void MetricsExporter::Run()
+{
+	std::unique_lock<std::mutex> guardLock(m_lock);
+	while (!m_stopping)
+	{
+		guardLock.unlock();
+		m_segment.Write(MetricsRegistry::Get().Snapshot());
+		guardLock.lock();
+		m_wakeUp.wait_for(guardLock, std::chrono::milliseconds(m_interval), [this]() { return m_stopping; });
+	}
+}
@@ -0,0 +1,267 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class MetricKind : uint32_t
+{
+	Counter,
+	Gauge,
+	Histogram
+};
+
+struct HistogramSummary
+{
+	uint64_t count = 0;
+	uint64_t sum = 0;
+	uint64_t max = 0;
+	uint64_t p50 = 0;
+	uint64_t p90 = 0;
+	uint64_t p99 = 0;
+	uint64_t p999 = 0;
+
+	double GetMean() const noexcept { return count ? static_cast<double>(sum) / count : 0.0; }
+};
+
+struct MetricValue
+{
+	std::string name;
+	MetricKind kind = MetricKind::Counter;
+	int64_t value = 0;                  // counters and gauges
+	HistogramSummary histogram;
+};
+
+struct MetricsSnapshot
+{
+	std::vector<MetricValue> metrics;
+	uint64_t timestamp = 0;             // microseconds since the epoch
+
+	void Print(std::ostream& stream) const;
+	std::string ToString() const;
+};
+
+
+
+// Log-linear buckets in the style of HdrHistogram: values below 16 get a bucket each, every power of
+// two above is split into 16 buckets, so a recorded value is off by at most 1/16 and up to 2^40 fits.
+struct HistogramBuckets
+{
+	static constexpr unsigned int SUB_BUCKET_BITS = 4;
+	static constexpr unsigned int SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+	static constexpr unsigned int MAX_BITS = 40;
+	static constexpr unsigned int COUNT = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	static unsigned int GetIndex(uint64_t value) noexcept;
+
+	//-- Middle of the value range a bucket stands for.
+	static uint64_t GetValue(unsigned int index) noexcept;
+};
+
+// Everything one thread records. Each thread writes its own shard, so the record path is an uncontended
+// relaxed atomic add on memory no other writer touches.
+struct MetricShard
+{
+	static constexpr size_t MAX_COUNTERS = 128;
+	static constexpr size_t MAX_HISTOGRAMS = 16;
+
+	struct Histogram
+	{
+		std::array<std::atomic<uint64_t>, HistogramBuckets::COUNT> buckets{};
+		std::atomic<uint64_t> sum = 0;
+		std::atomic<uint64_t> max = 0;
+	};
+
+	std::array<std::atomic<uint64_t>, MAX_COUNTERS> counters{};
+	std::array<Histogram, MAX_HISTOGRAMS> histograms{};
+};
+
+
+
+// Process-wide set of named metrics. Metrics are registered once (under a lock) and recorded through
+// handles; recording takes no lock and allocates nothing once the thread has its shard. Threads that
+// end hand their shard to the next new thread, the values they recorded stay in it.
+class MetricsRegistry
+{
+public:
+	static constexpr size_t MAX_SHARDS = 32;
+	static constexpr size_t MAX_GAUGES = 64;
+
+	static MetricsRegistry& Get();
+
+	//-- Same name, same slot. The last slot of every kind is shared by all metrics past the limit and not reported.
+	size_t Register(const std::string& name, MetricKind kind);
+
+	MetricShard& GetLocalShard();
+	std::atomic<int64_t>& GetGauge(size_t index) noexcept { return m_gauges[index]; }
+
+	//-- Sums the shards, safe while other threads keep recording.
+	MetricsSnapshot Snapshot() const;
+
+private:
+	struct Slot
+	{
+		std::string name;
+		MetricKind kind;
+		size_t index;
+	};
+
+	MetricsRegistry();
+	MetricShard* AcquireShard(size_t& lease);
+	void ReleaseShard(size_t lease) noexcept;
+
+	mutable std::mutex m_lock;
+	std::vector<Slot> m_slots;
+	std::array<size_t, 3> m_used{};     // slots taken per kind
+	std::array<std::atomic<MetricShard*>, MAX_SHARDS + 1> m_shards{};   // the last one is shared by threads beyond MAX_SHARDS
+	std::array<std::atomic<bool>, MAX_SHARDS> m_leased{};
+	std::array<std::atomic<int64_t>, MAX_GAUGES> m_gauges{};
+
+	friend struct ShardLease;
+};
+
+
+
+// Handles, cheap to copy and meant to be created once, e.g. as function local statics.
+class MetricCounter
+{
+public:
+	explicit MetricCounter(const std::string& name) : m_index(MetricsRegistry::Get().Register(name, MetricKind::Counter)) {}
+	void Add(uint64_t value = 1) const noexcept
+	{
+		MetricsRegistry::Get().GetLocalShard().counters[m_index].fetch_add(value, std::memory_order_relaxed);
+	}
+
+private:
+	size_t m_index;
+};
+
+class MetricGauge
+{
+public:
+	explicit MetricGauge(const std::string& name) : m_value(&MetricsRegistry::Get().GetGauge(MetricsRegistry::Get().Register(name, MetricKind::Gauge))) {}
+	void Set(int64_t value) const noexcept { m_value->store(value, std::memory_order_relaxed); }
+	void Add(int64_t value) const noexcept { m_value->fetch_add(value, std::memory_order_relaxed); }
+
+private:
+	std::atomic<int64_t>* m_value;
+};
+
+class MetricHistogram
+{
+public:
+	explicit MetricHistogram(const std::string& name) : m_index(MetricsRegistry::Get().Register(name, MetricKind::Histogram)) {}
+	void Record(uint64_t value) const noexcept;
+
+private:
+	size_t m_index;
+};
+
+// Records the microseconds between construction and destruction.
+class MetricTimer
+{
+public:
+	explicit MetricTimer(const MetricHistogram& histogram) : m_histogram(histogram), m_start(std::chrono::steady_clock::now()) {}
+	~MetricTimer()
+	{
+		m_histogram.Record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count());
+	}
+
+private:
+	const MetricHistogram& m_histogram;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+
+
+// Shared memory image of the metrics for external scrapers. The writer bumps sequence to an odd value
+// before it rewrites the entries and to the next even value afterwards, a reader copies the entries and
+// retries while sequence was odd or changed, so reading needs no syscall once the segment is mapped.
+//
+// Layout: SharedMetricsHeader, then count * SharedMetricEntry. All fields are naturally aligned.
+struct SharedMetricsHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	std::atomic<uint32_t> sequence;
+	uint32_t count;
+	uint64_t timestamp;                 // microseconds since the epoch of the last publish
+};
+
+struct SharedMetricEntry
+{
+	char name[48];                      // zero terminated
+	uint32_t kind;                      // MetricKind
+	uint32_t reserved;
+	int64_t value;
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+};
+
+class SharedMetricsSegment
+{
+public:
+	static constexpr uint32_t MAGIC = 0x4352544D;   // "MTRC"
+	static constexpr uint32_t VERSION = 1;
+	static constexpr size_t MAX_ENTRIES = MetricShard::MAX_COUNTERS + MetricsRegistry::MAX_GAUGES + MetricShard::MAX_HISTOGRAMS;
+	static constexpr size_t SIZE = sizeof(SharedMetricsHeader) + MAX_ENTRIES * sizeof(SharedMetricEntry);
+
+	SharedMetricsSegment() = default;
+	~SharedMetricsSegment();
+	SharedMetricsSegment(const SharedMetricsSegment&) = delete;
+	SharedMetricsSegment& operator=(const SharedMetricsSegment&) = delete;
+
+	//-- Creates (create) or maps an existing segment of that name.
+	bool Open(const std::string& name, bool create);
+	void Close();
+	bool IsOpen() const noexcept { return m_view != nullptr; }
+
+	void Write(const MetricsSnapshot& snapshot);
+	bool Read(MetricsSnapshot& snapshot) const;
+
+private:
+	SharedMetricsHeader* GetHeader() const noexcept { return static_cast<SharedMetricsHeader*>(m_view); }
+	SharedMetricEntry* GetEntries() const noexcept { return reinterpret_cast<SharedMetricEntry*>(GetHeader() + 1); }
+
+	void* m_view = nullptr;
+	void* m_handle = nullptr;
+	std::string m_name;
+	bool m_owner = false;
+};
+
+
+
+// Publishes a snapshot of the registry into a shared memory segment at a fixed interval.
+class MetricsExporter
+{
+public:
+	static constexpr unsigned int DEFAULT_INTERVAL = 1000;     // miliseconds
+
+	MetricsExporter(const std::string& segmentName, unsigned int interval = DEFAULT_INTERVAL);
+	~MetricsExporter();
+	MetricsExporter(const MetricsExporter&) = delete;
+	MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+	bool IsOpen() const noexcept { return m_segment.IsOpen(); }
+
+private:
+	void Run();
+
+	SharedMetricsSegment m_segment;
+	unsigned int m_interval;
+	std::mutex m_lock;
+	std::condition_variable m_wakeUp;
+	bool m_stopping;
+	std::thread m_thread;
+};
@@ -0,0 +1,202 @@
+#include "PacketMux.h"
+#include "SocketCreator.h"
+#include "Metrics.h"
+#include <chrono>
+#include <cstring>
+
+namespace
+{
+	struct MuxMetrics
+	{
+		MetricCounter sentBytes{ "mux.send.bytes" };
+		MetricCounter blocked{ "mux.send.blocked" };
+		MetricCounter preempted{ "mux.control.preempted" };
+		MetricHistogram controlWait{ "mux.control.wait_us" };
+		MetricCounter droppedFrames{ "mux.audio.dropped" };
+		MetricCounter droppedBytes{ "mux.audio.dropped_bytes" };
+	};
+
+	const MuxMetrics& GetMetrics()
+	{
+		static const MuxMetrics metrics;
+		return metrics;
+	}
+
+	long long Now()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	size_t LaneIndex(PacketLane lane)
+	{
+		return static_cast<size_t>(lane);
+	}
+}
+
+
+
+PacketMux::Packet PacketMux::MakePacket(const StreamPacketHeader& header, const void* payload, size_t size)
+{
+	Packet packet = std::make_shared<std::vector<char>>(sizeof(header) + size);
+	std::memcpy(packet->data(), &header, sizeof(header));
+	if (size)
+		std::memcpy(packet->data() + sizeof(header), payload, size);
+	return packet;
+}
+
+
+
+bool PacketMux::PrepareSocket(SOCKET socket) noexcept
+{
+	return SocketCreator::SetNonBlocking(socket) && SocketCreator::SetSendBufferSize(socket, SEND_BUFFER_SIZE);
+}
+
+
+
+bool PacketMux::Enqueue(PacketLane lane, Packet packet, Stamp stamp)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	if (m_closed)
+		return false;
+	const size_t index = LaneIndex(lane);
+	m_queuedSize[index] += packet->size();
+	m_lanes[index].push_back(Entry{ std::move(packet), stamp, Now() });
+
+	// the listener is that far behind, the oldest audio is the least worth sending; the newest frame stays
+	std::deque<Entry>& audio = m_lanes[LaneIndex(PacketLane::Audio)];
+	size_t& audioSize = m_queuedSize[LaneIndex(PacketLane::Audio)];
+	while (audioSize > AUDIO_LANE_LIMIT && audio.size() > 1)
+	{
+		audioSize -= audio.front().packet->size();
+		GetMetrics().droppedFrames.Add();
+		GetMetrics().droppedBytes.Add(audio.front().packet->size());
+		audio.pop_front();
+	}
+	return true;
+}
+
+
+
+size_t PacketMux::DropAudioBefore(uint32_t sequence)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	std::deque<Entry>& audio = m_lanes[LaneIndex(PacketLane::Audio)];
+	const size_t queued = audio.size();
+	for (auto it = audio.begin(); it != audio.end();)
+	{
+		StreamPacketHeader header;
+		std::memcpy(&header, it->packet->data(), sizeof(header));
+		if (static_cast<int32_t>(header.sequence - sequence) < 0)
+		{
+			m_queuedSize[LaneIndex(PacketLane::Audio)] -= it->packet->size();
+			it = audio.erase(it);
+		}
+		else
+		{
+			it++;
+		}
+	}
+	return queued - audio.size();
+}
+
+
+
+bool PacketMux::Flush(SOCKET socket)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	if (m_closed)
+		return false;
+	while (m_current.packet || StartNext())
+	{
+		const std::vector<char>& bytes = *m_current.packet;
+		const int result = send(socket, bytes.data() + m_currentOffset, static_cast<int>(bytes.size() - m_currentOffset), 0);
+		if (result == SOCKET_ERROR)
+		{
+			if (WSAGetLastError() != WSAEWOULDBLOCK)
+				return false;
+			// the send buffer is full, the poll loop goes on once it drained
+			GetMetrics().blocked.Add();
+			return true;
+		}
+		GetMetrics().sentBytes.Add(result);
+		m_currentOffset += result;
+		if (m_currentOffset < bytes.size())
+			continue;
+
+		if (m_currentLane == PacketLane::Control)
+			GetMetrics().controlWait.Record(Now() - m_current.queued);
+		m_current = Entry{};
+		m_currentOffset = 0;
+	}
+	return true;
+}
+
+
+
+void PacketMux::Close()
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_closed = true;
+	for (size_t i = 0; i < 2; i++)
+	{
+		m_lanes[i].clear();
+		m_queuedSize[i] = 0;
+	}
+	m_current = Entry{};
+}
+
+
+
+bool PacketMux::HasPending() const
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_current.packet || !m_lanes[0].empty() || !m_lanes[1].empty();
+}
+
+
+
+bool PacketMux::IsControlFull() const
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_queuedSize[LaneIndex(PacketLane::Control)] >= CONTROL_LANE_LIMIT;
+}
+
+
+
+size_t PacketMux::GetQueuedSize(PacketLane lane) const
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_queuedSize[LaneIndex(lane)];
+}
+
+
+
+bool PacketMux::StartNext()
+{
+	// control first, at every packet boundary
+	std::deque<Entry>& control = m_lanes[LaneIndex(PacketLane::Control)];
+	std::deque<Entry>& audio = m_lanes[LaneIndex(PacketLane::Audio)];
+	if (!control.empty())
+	{
+		if (!audio.empty())
+			GetMetrics().preempted.Add();
+		m_currentLane = PacketLane::Control;
+	}
+	else if (!audio.empty())
+	{
+		m_currentLane = PacketLane::Audio;
+	}
+	else
+	{
+		return false;
+	}
+
+	std::deque<Entry>& lane = m_lanes[LaneIndex(m_currentLane)];
+	m_current = std::move(lane.front());
+	lane.pop_front();
+	m_queuedSize[LaneIndex(m_currentLane)] -= m_current.packet->size();
+	m_currentOffset = 0;
+	if (m_current.stamp)
+		m_current.stamp(m_current.packet->data());
+	return true;
+}
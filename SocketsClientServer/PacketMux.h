@@ -0,0 +1,72 @@
+#pragma once
+#include <WinSock2.h>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "StreamProtocol.h"
+
+enum class PacketLane : uint8_t
+{
+	Control,        // acknowledgements, clock responses, metrics: somebody waits for them right now
+	Audio           // stream frames, they only have to arrive ahead of the playout
+};
+
+// The outgoing side of one connection that carries both lanes. Packets are queued per lane and written to
+// a non blocking socket by Flush, one whole packet after the other, so whenever a frame is done the next
+// control packet goes out ahead of all queued audio. What is in the kernel send buffer can no longer be
+// overtaken, which is why the socket gets a small one (SEND_BUFFER_SIZE) and the backlog stays here.
+//
+// Every lane has its own budget. Audio beyond AUDIO_LANE_LIMIT drops the oldest frames that did not start
+// yet: a listener that cannot keep up loses audio instead of falling further behind the live edge, and
+// the station never waits for it. Control packets are never dropped, IsControlFull tells the reader of
+// the connection to stop taking requests until the answers are gone.
+class PacketMux
+{
+public:
+	using Packet = std::shared_ptr<std::vector<char>>;
+	//-- Runs on the packet bytes right before the first of them is written, for times that must be current.
+	using Stamp = void (*)(char* packet);
+
+	static constexpr int SEND_BUFFER_SIZE = 16 * 1024;          // about 90 miliseconds of 44.1 kHz stereo PCM
+	static constexpr size_t AUDIO_LANE_LIMIT = 1 << 20;
+	static constexpr size_t CONTROL_LANE_LIMIT = 64 * 1024;
+
+	//-- Header and payload as one packet. Packets without a stamp may be queued on any number of connections.
+	static Packet MakePacket(const StreamPacketHeader& header, const void* payload, size_t size);
+	//-- Non blocking with the small send buffer, the way Flush expects the socket.
+	static bool PrepareSocket(SOCKET socket) noexcept;
+
+	//-- False once the mux is closed.
+	bool Enqueue(PacketLane lane, Packet packet, Stamp stamp = nullptr);
+	//-- Drops the queued audio frames older than sequence that did not start yet, for frames that are about
+	//-- to be queued again in order. Sequence numbers wrap around.
+	size_t DropAudioBefore(uint32_t sequence);
+	//-- Writes what the socket takes without blocking, false on a socket error or once closed.
+	bool Flush(SOCKET socket);
+	//-- Once it returned no Flush writes anymore and the socket may be closed.
+	void Close();
+
+	bool HasPending() const;
+	bool IsControlFull() const;
+	size_t GetQueuedSize(PacketLane lane) const;
+
+private:
+	struct Entry
+	{
+		Packet packet;
+		Stamp stamp;
+		long long queued;           // microseconds, when it was enqueued
+	};
+
+	bool StartNext();
+
+	mutable std::mutex m_lock;
+	std::deque<Entry> m_lanes[2];
+	size_t m_queuedSize[2] = {};    // bytes of the packets that did not start yet
+	Entry m_current{};              // the packet being written, nothing preempts it
+	PacketLane m_currentLane = PacketLane::Control;
+	size_t m_currentOffset = 0;
+	bool m_closed = false;
+};
@@ -0,0 +1,50 @@
+#include "PollWaker.h"
+#include <WS2tcpip.h>
+#include "SocketCreator.h"
+
+PollWaker::PollWaker() :
+	m_socket(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)),
+	m_address{}
+{
+	if (m_socket == INVALID_SOCKET)
+		return;
+	m_address.sin_family = AF_INET;
+	InetPtonA(AF_INET, "127.0.0.1", &m_address.sin_addr.S_un.S_addr);
+	m_address.sin_port = 0;
+	int size = sizeof(m_address);
+	if (bind(m_socket, (SOCKADDR*)&m_address, sizeof(m_address)) == SOCKET_ERROR
+		|| getsockname(m_socket, (SOCKADDR*)&m_address, &size) == SOCKET_ERROR
+		|| !SocketCreator::SetNonBlocking(m_socket))
+	{
+		std::cout << "WAKER FAILED" << WSAGetLastError() << std::endl;
+		closesocket(m_socket);
+		m_socket = INVALID_SOCKET;
+	}
+}
+
+
+
+PollWaker::~PollWaker()
+{
+	if (m_socket != INVALID_SOCKET)
+		closesocket(m_socket);
+}
+
+
+
+void PollWaker::Wake() noexcept
+{
+	// a full socket buffer means a wake up is pending anyway
+	const char signal = 1;
+	sendto(m_socket, &signal, 1, 0, (const SOCKADDR*)&m_address, sizeof(m_address));
+}
+
+
+
+void PollWaker::Drain() noexcept
+{
+	char signals[64];
+	while (recvfrom(m_socket, signals, sizeof(signals), 0, nullptr, nullptr) > 0)
+	{
+	}
+}
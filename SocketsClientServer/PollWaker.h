@@ -0,0 +1,25 @@
+#pragma once
+#include <WinSock2.h>
+
+// Interrupts a WSAPoll from another thread. WSAPoll only waits for sockets, so the waker is one: a UDP
+// socket bound to loopback that Wake sends a datagram to. The polling thread adds GetSocket with
+// POLLRDNORM and calls Drain once it became readable.
+class PollWaker
+{
+public:
+	PollWaker();
+	~PollWaker();
+	PollWaker(const PollWaker&) = delete;
+	PollWaker& operator=(const PollWaker&) = delete;
+
+	bool IsOpen() const noexcept { return m_socket != INVALID_SOCKET; }
+	SOCKET GetSocket() const noexcept { return m_socket; }
+
+	//-- Safe from any thread, wakes the poll once however often it is called before the Drain.
+	void Wake() noexcept;
+	void Drain() noexcept;
+
+private:
+	SOCKET m_socket;
+	sockaddr_in m_address;          // where the socket is bound, Wake sends there
+};
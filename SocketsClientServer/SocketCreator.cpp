@@ -1,22 +1,70 @@
 #include "SocketCreator.h"
+#include "Metrics.h"
 
-SocketCreator::SocketCreator(bool isServer) : mainSocket(0)
+namespace
 {
-	WSADATA data;
-	WORD versionRequested = MAKEWORD(2, 2);
-	int error = WSAStartup(versionRequested, &data);
-	if (error != 0)
+	struct SocketMetrics
 	{
-		std::cout << "Winsock dll not found" << std::endl;
-		return;
+		MetricCounter sentBytes{ "socket.send.bytes" };
+		MetricCounter sendErrors{ "socket.send.errors" };
+		MetricHistogram sendTime{ "socket.send.us" };
+		MetricCounter receivedBytes{ "socket.receive.bytes" };
+		MetricCounter receiveCalls{ "socket.receive.calls" };
+		MetricCounter receiveErrors{ "socket.receive.errors" };
+	};
+
+	const SocketMetrics& GetMetrics()
+	{
+		static const SocketMetrics metrics;
+		return metrics;
 	}
-	CreateMainSocket();
-	ConnectSocket(isServer);
+
+	int CountSent(int result)
+	{
+		if (result < 0)
+			GetMetrics().sendErrors.Add();
+		else
+			GetMetrics().sentBytes.Add(result);
+		return result;
+	}
+
+	// Every connection, reconnects and relay links included, shares the one start of the process.
+	struct SocketLibrary
+	{
+		SocketLibrary() { WSADATA data; started = WSAStartup(MAKEWORD(2, 2), &data) == 0; }
+		~SocketLibrary() { if (started) WSACleanup(); }
+		bool started;
+	};
+}
+
+SocketCreator::SocketCreator(bool isServer, int port, const std::string& host) :
+	mainSocket(INVALID_SOCKET),
+	m_port(port),
+	m_address(host)
+{
+	Open(isServer);
 }
 
 int SocketCreator::Send(SOCKET socket, const void const* object, int objectSize)
 {
-	return send(socket, (char*)object, objectSize, 0);
+	MetricTimer timer(GetMetrics().sendTime);
+	return CountSent(send(socket, (char*)object, objectSize, 0));
+}
+
+
+
+int SocketCreator::SendPacket(SOCKET socket, const StreamPacketHeader& header, const void* payload, int payloadSize)
+{
+	WSABUF buffers[2];
+	buffers[0].buf = (char*)&header;
+	buffers[0].len = sizeof(header);
+	buffers[1].buf = (char*)payload;
+	buffers[1].len = payloadSize;
+	DWORD sent = 0;
+	MetricTimer timer(GetMetrics().sendTime);
+	if (WSASend(socket, buffers, 2, &sent, 0, nullptr, nullptr) == SOCKET_ERROR)
+		return CountSent(-1);
+	return CountSent(static_cast<int>(sent));
 }
 
 
@@ -28,10 +76,17 @@ int SocketCreator::Receive(SOCKET socket, int additionalBytes, const std::functi
 	if (objectReceived != nullptr)
 	    result = recv(socket, objectReceived, MAX_BUFFER_SIZE + additionalBytes, 0);
 	
+	GetMetrics().receiveCalls.Add();
 	if (result >= 0)
+	{
+		GetMetrics().receivedBytes.Add(result);
 		handleObject(objectReceived, result);
+	}
 	else
+	{
+		GetMetrics().receiveErrors.Add();
 		CloseSocket();
+	}
 	free(objectReceived);
 	return result;
 }
@@ -43,13 +98,38 @@ void SocketCreator::CloseSocket() const noexcept
 
 
 
+bool SocketCreator::Reconnect(const std::string& host, int port) noexcept
+{
+	if (mainSocket != INVALID_SOCKET)
+		closesocket(mainSocket);
+	mainSocket = INVALID_SOCKET;
+	m_address = host;
+	m_port = port;
+	Open(false);
+	return IsOpen();
+}
+
+
+
+void SocketCreator::Open(bool isServer) noexcept
+{
+	if (!StartUpSocket())
+	{
+		std::cout << "Winsock dll not found" << std::endl;
+		return;
+	}
+	CreateMainSocket();
+	ConnectSocket(isServer);
+}
+
+
+
 void SocketCreator::CreateMainSocket() noexcept
 {
 	mainSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 	if (mainSocket == INVALID_SOCKET)
 	{
 		std::cout << "INVALID SOCKET" << std::endl;
-		DoCleanup();
 	}
 }
 
@@ -59,22 +139,65 @@ void SocketCreator::ConnectSocket(bool isServer) noexcept
 {
 	sockaddr_in service;
 	service.sin_family = AF_INET;
-	InetPton(AF_INET, _T("127.0.0.1"), &service.sin_addr.S_un.S_addr);
-	service.sin_port = htons(PORT);
+	InetPtonA(AF_INET, m_address.c_str(), &service.sin_addr.S_un.S_addr);
+	service.sin_port = htons(static_cast<u_short>(m_port));
 	auto func = (isServer)? &bind : &connect;
 	if (func(mainSocket, (SOCKADDR*)&service, sizeof(service)) == SOCKET_ERROR)
 	{
 		std::cout << "CONNECTION FAILED!" << WSAGetLastError() << std::endl;
 		CloseSocket();
-		DoCleanup();
+		// a Receive or CloseSocket later must not close a handle that was given out again meanwhile
+		mainSocket = INVALID_SOCKET;
+		return;
 	}
+	if (!isServer)
+		SetNoDelay(mainSocket);
+}
+
+
+
+bool SocketCreator::SetNoDelay(SOCKET socket) noexcept
+{
+	const BOOL noDelay = TRUE;
+	return setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay)) != SOCKET_ERROR;
 }
 
-void SocketCreator::StartUpSocket() noexcept
+
+
+bool SocketCreator::ParseEndpoint(const std::string& text, std::string& host, int& port)
+{
+	const size_t colon = text.rfind(':');
+	const bool portOnly = colon == std::string::npos && !text.empty() && text.find_first_not_of("0123456789") == std::string::npos;
+	host = portOnly || colon == 0 ? address : text.substr(0, colon);
+	if (colon == std::string::npos && !portOnly)
+	{
+		port = PORT;
+		return !host.empty();
+	}
+	const std::string number = portOnly ? text : text.substr(colon + 1);
+	if (number.empty() || number.size() > 5 || number.find_first_not_of("0123456789") != std::string::npos)
+		return false;
+	port = std::stoi(number);
+	return port > 0 && port < 65536;
+}
+
+
+
+bool SocketCreator::SetNonBlocking(SOCKET socket) noexcept
+{
+	u_long nonBlocking = 1;
+	return ioctlsocket(socket, FIONBIO, &nonBlocking) != SOCKET_ERROR;
+}
+
+
+
+bool SocketCreator::SetSendBufferSize(SOCKET socket, int size) noexcept
 {
+	return setsockopt(socket, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&size), sizeof(size)) != SOCKET_ERROR;
 }
 
-void SocketCreator::DoCleanup() noexcept
+bool SocketCreator::StartUpSocket() noexcept
 {
-	WSACleanup();
+	static const SocketLibrary library;
+	return library.started;
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <tchar.h>
 #include <functional>
+#include "StreamProtocol.h"
 
 constexpr int PORT = 55555;
 const std::string address = "127.0.0.1";
@@ -15,18 +16,38 @@ constexpr unsigned int MAX_BUFFER_SIZE = 4096;
 class SocketCreator
 {
 public:
-	virtual inline int GetPort() const noexcept final { return PORT; };
-	virtual inline std::string GetAddress()  const noexcept final { return address; };
-	SocketCreator(bool isServer);
+	virtual inline int GetPort() const noexcept final { return m_port; };
+	virtual inline std::string GetAddress()  const noexcept final { return m_address; };
+	//-- A server binds to host:port, a client connects there.
+	SocketCreator(bool isServer, int port = PORT, const std::string& host = address);
+	//-- False when the socket could not be bound or connected.
+	bool IsOpen() const noexcept { return mainSocket != INVALID_SOCKET; }
 	virtual int Send(SOCKET socket, const void const* object, int objectSize) final;
+	//-- Sends header and payload in one call without copying them together, -1 on error.
+	virtual int SendPacket(SOCKET socket, const StreamPacketHeader& header, const void* payload, int payloadSize) final;
 	virtual int Receive(SOCKET socket, int additionalBytes, const std::function<void(void*, int bytesReceived)>& handleObject) final;
 	virtual void CloseSocket() const noexcept;
+	//-- Turns off Nagle's algorithm, small control packets such as clock exchanges leave at once instead of
+	//-- waiting for the acknowledgement of the previous send.
+	static bool SetNoDelay(SOCKET socket) noexcept;
+	//-- send and recv return WSAEWOULDBLOCK instead of waiting.
+	static bool SetNonBlocking(SOCKET socket) noexcept;
+	//-- Bytes the kernel buffers for sending, whatever is queued there goes out in order.
+	static bool SetSendBufferSize(SOCKET socket, int size) noexcept;
+	//-- "host:port", "port" or "host" (for address and PORT), false when the port is not a number.
+	static bool ParseEndpoint(const std::string& text, std::string& host, int& port);
 protected:
+	//-- Closes the connection and connects to host:port instead, a client only.
+	bool Reconnect(const std::string& host, int port) noexcept;
 	void ConnectSocket(bool isHost) noexcept;
-	void StartUpSocket() noexcept;
-	virtual void DoCleanup() noexcept;
+	//-- Starts Winsock on the first call, it stays up until the process exits. False when it cannot start.
+	static bool StartUpSocket() noexcept;
 	SOCKET mainSocket;
 private:
+	void Open(bool isServer) noexcept;
 	void CreateMainSocket() noexcept;
+
+	int m_port;
+	std::string m_address;
 };
 
@@ -0,0 +1,40 @@
+#include "StreamClock.h"
+#include <algorithm>
+
+StreamClock::StreamClock(unsigned long long start) :
+	m_epoch(start),
+	m_samples(0),
+	m_sampleRate(0),
+	m_liveEdge(start)
+{
+}
+
+
+
+void StreamClock::Resume(unsigned long long now)
+{
+	Rebase(std::max(m_liveEdge, now));
+}
+
+
+
+void StreamClock::Advance(unsigned long samples, unsigned long sampleRate)
+{
+	if (!sampleRate)
+		return;
+	if (sampleRate != m_sampleRate)
+	{
+		Rebase(m_liveEdge);
+		m_sampleRate = sampleRate;
+	}
+	m_samples += samples;
+	m_liveEdge = m_epoch + m_samples * 1000000 / m_sampleRate;
+}
+
+
+
+void StreamClock::Rebase(unsigned long long start)
+{
+	m_epoch = m_liveEdge = start;
+	m_samples = 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+// The live edge of a stream on the clock of its server: where the samples sent so far end, counted from
+// the moment the stream went on air. Counting samples rather than rounded frame durations keeps the stream
+// at the pace it is played at. Times are microseconds.
+class StreamClock
+{
+public:
+	explicit StreamClock(unsigned long long start);
+
+	//-- Timestamp of the next frame.
+	unsigned long long GetLiveEdge() const noexcept { return m_liveEdge; }
+	//-- When the next frame is due to be sent, lead microseconds ahead of its live edge.
+	unsigned long long GetSendTime(unsigned long long lead) const noexcept { return m_liveEdge > lead ? m_liveEdge - lead : 0; }
+
+	//-- The stream was stopped and goes on at now, or at its live edge if that is still ahead.
+	void Resume(unsigned long long now);
+	//-- Moves the live edge past a frame, a change of the sample rate starts counting anew.
+	void Advance(unsigned long samples, unsigned long sampleRate);
+
+private:
+	void Rebase(unsigned long long start);
+
+	unsigned long long m_epoch;
+	unsigned long long m_samples;
+	unsigned long m_sampleRate;
+	unsigned long long m_liveEdge;
+};
@@ -0,0 +1,83 @@
+#include "StreamProtocol.h"
+#include <cstring>
+#include <iterator>
+
+namespace
+{
+	const char* const CONTROL_COMMAND_NAMES[] = { nullptr, "subscribe", "unsubscribe", "play", "pause", "skip", "seek", "position", "nowplaying" };
+	const char* const CONTROL_STATUS_NAMES[] = { "OK", "UNKNOWN COMMAND", "UNKNOWN STATION", "REJECTED", "REDIRECT" };
+}
+
+
+
+const char* GetControlCommandName(ControlCommand command)
+{
+	const size_t index = static_cast<size_t>(command);
+	return index < std::size(CONTROL_COMMAND_NAMES) ? CONTROL_COMMAND_NAMES[index] : nullptr;
+}
+
+
+
+bool FindControlCommand(const char* name, ControlCommand& command)
+{
+	for (size_t index = 1; index < std::size(CONTROL_COMMAND_NAMES); index++)
+	{
+		if (std::strcmp(CONTROL_COMMAND_NAMES[index], name) == 0)
+		{
+			command = static_cast<ControlCommand>(index);
+			return true;
+		}
+	}
+	return false;
+}
+
+
+
+const char* GetControlStatusName(ControlStatus status)
+{
+	const size_t index = static_cast<size_t>(status);
+	return index < std::size(CONTROL_STATUS_NAMES) ? CONTROL_STATUS_NAMES[index] : "?";
+}
+
+
+
+void PacketAssembler::Append(const char* data, size_t size)
+{
+	// handed out packets are gone once more data arrives, drop them before the buffer grows
+	if (m_readOffset)
+	{
+		m_buffer.erase(m_buffer.begin(), m_buffer.begin() + m_readOffset);
+		m_readOffset = 0;
+	}
+	m_buffer.insert(m_buffer.end(), data, data + size);
+}
+
+
+
+bool PacketAssembler::Next(StreamPacketHeader& header, const char*& payload)
+{
+	if (m_corrupt || GetBufferedSize() < sizeof(StreamPacketHeader))
+		return false;
+
+	std::memcpy(&header, m_buffer.data() + m_readOffset, sizeof(header));
+	if (header.magic != STREAM_PACKET_MAGIC || header.size > MAX_PACKET_SIZE)
+	{
+		m_corrupt = true;
+		return false;
+	}
+	if (GetBufferedSize() < sizeof(header) + header.size)
+		return false;
+
+	payload = m_buffer.data() + m_readOffset + sizeof(header);
+	m_readOffset += sizeof(header) + header.size;
+	return true;
+}
+
+
+
+void PacketAssembler::Reset()
+{
+	m_buffer.clear();
+	m_readOffset = 0;
+	m_corrupt = false;
+}
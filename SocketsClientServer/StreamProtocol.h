@@ -0,0 +1,167 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Kept free of Winsock so tools that only speak the protocol build on other platforms too.
+
+constexpr uint32_t STREAM_PACKET_MAGIC = 0x4B50534D;   // "MSPK"
+
+enum class PacketType : uint16_t
+{
+	Audio = 1,      // wire frame: encoded payload followed by the MYWAVEFORMATEX trailer
+	Metrics = 2,        // text snapshot of the server metrics, answer to METRICS_COMMAND
+	Command = 3,        // client to server: text command
+	PlayoutReport = 4,  // client to server: PlayoutReport
+	ClockRequest = 5,   // client to server: ClockExchange with originate set
+	ClockResponse = 6,  // answer to ClockRequest: ClockExchange with receive and transmit added
+	Control = 7,        // client to server: ControlRequest
+	ControlAck = 8,     // answer to Control: ControlAck, for NowPlaying followed by the track name
+	ClusterHeartbeat = 9,   // server to server: "host:port" of the sender, then of the members it hears, space separated
+	Session = 10,       // server to client: SessionInfo, first thing on a connection and the answer to Resume
+	Resume = 11         // client to server: ResumeRequest, first thing on a new connection after losing one
+};
+
+// Text commands a client sends to the server.
+constexpr const char* METRICS_COMMAND = "metrics";
+
+constexpr uint16_t DEFAULT_STATION = 0;
+
+enum class ControlCommand : uint8_t
+{
+	Subscribe = 1,      // the connection receives the station's audio, the default after connecting
+	Unsubscribe = 2,
+	Play = 3,           // resumes a paused station
+	Pause = 4,
+	Skip = 5,           // to the next track
+	Seek = 6,           // argument: miliseconds into the current track
+	QueryPosition = 7,
+	NowPlaying = 8
+};
+
+enum class ControlStatus : uint8_t
+{
+	Ok = 0,             // done, or for Play, Pause, Skip and Seek queued for the station's next frame
+	UnknownCommand = 1,
+	UnknownStation = 2,
+	Rejected = 3,       // not possible right now, such as seeking a track that is mixed live
+	Redirect = 4        // another server of the cluster owns the station, its "host:port" follows the ack
+};
+
+#pragma pack(1)
+// Precedes every packet on the stream, TCP does not keep the boundaries of the sends.
+struct StreamPacketHeader
+{
+	uint32_t magic;
+	uint32_t size;                  // bytes following the header
+	uint16_t type;
+	uint16_t flags;
+	uint32_t sequence;              // counts the packets of the station
+	uint32_t duration;              // miliseconds of audio in the packet
+	uint64_t timestamp;             // microseconds on the server clock at which the packet is live
+};
+
+// What a listener heard during the last report interval.
+struct PlayoutReport
+{
+	uint32_t sequence;              // newest packet queued for playback
+	uint32_t interval;              // miliseconds covered by the report
+	uint32_t latency;               // miliseconds from the live edge to the speaker, newest sample
+	uint32_t minLatency;
+	uint32_t maxLatency;
+	uint32_t queued;                // miliseconds of audio waiting in the output queue
+	uint32_t deviceLatency;         // microseconds the device adds after the queue
+	uint16_t starvations;           // times the output queue ran dry
+	uint16_t flags;                 // PLAYOUT_REPORT_...
+	uint32_t starved;               // miliseconds spent without audio
+};
+
+// One NTP style round trip. originate is on the client clock, receive and transmit on the server clock
+// (the one packet timestamps use), all in microseconds.
+struct ClockExchange
+{
+	uint64_t originate;             // client sent the request
+	uint64_t receive;               // server received it
+	uint64_t transmit;              // server sent the response
+};
+
+struct ControlRequest
+{
+	uint32_t id;                    // chosen by the client, echoed in the acknowledgement
+	uint16_t station;
+	uint8_t command;                // ControlCommand
+	uint8_t reserved;
+	uint64_t argument;
+};
+
+// Every acknowledgement carries the station's state as of the last frame it sent, a command that is
+// queued for the station is not reflected yet.
+struct ControlAck
+{
+	uint32_t id;
+	uint16_t station;
+	uint8_t command;
+	uint8_t status;                 // ControlStatus
+	uint32_t sequence;              // newest packet of the station
+	uint32_t flags;                 // CONTROL_ACK_...
+	uint64_t position;              // miliseconds into the current track
+	uint64_t duration;              // miliseconds the current track lasts
+};
+
+// The server keeps a session for a while after its connection is lost, a client that comes back with
+// the token carries on where it left: same subscription, and the frames it missed are sent again.
+struct SessionInfo
+{
+	uint64_t token;
+	uint32_t flags;                 // SESSION_...
+	uint32_t sequence;              // resumed: the first frame sent again, older ones are lost
+	uint32_t count;                 // resumed: frames sent again, the live stream goes on after them
+	uint32_t reserved;
+};
+
+struct ResumeRequest
+{
+	uint64_t token;
+	uint32_t sequence;              // newest audio packet the client received
+	uint32_t reserved;
+};
+#pragma pack()
+
+constexpr uint16_t PLAYOUT_REPORT_DEVICE_LATENCY = 1;   // deviceLatency was measured (AL_SOFT_source_latency)
+constexpr uint16_t PLAYOUT_REPORT_PLAYING = 2;          // playback has started
+
+constexpr uint32_t CONTROL_ACK_PAUSED = 1;
+constexpr uint32_t CONTROL_ACK_SUBSCRIBED = 2;          // the connection receives the station's audio
+constexpr uint32_t CONTROL_ACK_SEEKABLE = 4;
+
+constexpr uint32_t SESSION_RESUMED = 1;                 // answer to Resume: the session goes on
+constexpr uint32_t SESSION_UNKNOWN = 2;                 // answer to Resume: the token expired, the connection's own session goes on
+
+//-- Lower case name of a command as typed on the client console, nullptr for an unknown one.
+const char* GetControlCommandName(ControlCommand command);
+//-- Command for a name typed on the console, false for an unknown one.
+bool FindControlCommand(const char* name, ControlCommand& command);
+const char* GetControlStatusName(ControlStatus status);
+
+
+
+// Cuts a received byte stream back into packets. Bytes are appended as they arrive, whole packets
+// are handed out in order and stay valid until the next Append.
+class PacketAssembler
+{
+public:
+	static constexpr size_t MAX_PACKET_SIZE = 1 << 20;
+
+	void Append(const char* data, size_t size);
+
+	//-- Returns false when no whole packet is buffered yet or the stream is corrupt (see IsCorrupt).
+	bool Next(StreamPacketHeader& header, const char*& payload);
+	bool IsCorrupt() const noexcept { return m_corrupt; }
+	size_t GetBufferedSize() const noexcept { return m_buffer.size() - m_readOffset; }
+	void Reset();
+
+private:
+	std::vector<char> m_buffer;
+	size_t m_readOffset = 0;
+	bool m_corrupt = false;
+};
@@ -0,0 +1,98 @@
+#pragma once
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+// What a Task hands back to the coroutine awaiting it.
+template <typename T>
+struct TaskResult
+{
+	std::optional<T> value;
+
+	void return_value(T result) { value = std::move(result); }
+	T Take() { return std::move(*value); }
+};
+
+template <>
+struct TaskResult<void>
+{
+	void return_void() noexcept {}
+	void Take() noexcept {}
+};
+
+
+
+// A coroutine returning T to the coroutine that co_awaits it. It only starts once awaited and the awaiting
+// one goes on right where it finished, on the same thread and without a stack of its own; the frame is all
+// it costs. The outermost one is spawned on an EventLoop, which resumes it whenever what it waits for is
+// there. Destroying a Task destroys its coroutine wherever it is suspended.
+template <typename T = void>
+class Task
+{
+public:
+	struct promise_type : TaskResult<T>
+	{
+		std::coroutine_handle<> continuation;      // the coroutine awaiting this one
+
+		Task get_return_object() noexcept { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		auto final_suspend() noexcept
+		{
+			struct FinalAwaiter
+			{
+				bool await_ready() const noexcept { return false; }
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+				{
+					const std::coroutine_handle<> continuation = handle.promise().continuation;
+					return continuation ? continuation : std::noop_coroutine();
+				}
+				void await_resume() const noexcept {}
+			};
+			return FinalAwaiter{};
+		}
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+
+	Task() noexcept = default;
+	Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+	Task& operator=(Task&& other) noexcept
+	{
+		if (this != &other)
+		{
+			if (m_handle)
+				m_handle.destroy();
+			m_handle = std::exchange(other.m_handle, nullptr);
+		}
+		return *this;
+	}
+	~Task()
+	{
+		if (m_handle)
+			m_handle.destroy();
+	}
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	auto operator co_await() const noexcept
+	{
+		struct Awaiter
+		{
+			std::coroutine_handle<promise_type> handle;
+
+			bool await_ready() const noexcept { return !handle || handle.done(); }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+			{
+				handle.promise().continuation = awaiting;
+				return handle;
+			}
+			T await_resume() { return handle.promise().Take(); }
+		};
+		return Awaiter{ m_handle };
+	}
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> handle) noexcept : m_handle(handle) {}
+
+	std::coroutine_handle<promise_type> m_handle;
+};
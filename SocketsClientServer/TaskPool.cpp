@@ -0,0 +1,251 @@
+#include "TaskPool.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+	thread_local const TaskPool* t_pool = nullptr;
+	thread_local size_t t_worker = 0;
+
+	// the cores reserved before the shared pool started, STARTED afterwards
+	constexpr unsigned int STARTED = UINT_MAX;
+	std::atomic<unsigned int> g_reservedCores(0);
+
+	bool PinToCore(unsigned int core)
+	{
+#ifdef _WIN32
+		// an affinity mask covers the processors of one group, beyond that the scheduler places the worker
+		if (core >= sizeof(DWORD_PTR) * CHAR_BIT)
+			return false;
+		return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core) != 0;
+#else
+		cpu_set_t cores;
+		CPU_ZERO(&cores);
+		CPU_SET(core, &cores);
+		return pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores) == 0;
+#endif
+	}
+
+	// Of every pool together.
+	struct PoolMetrics
+	{
+		MetricCounter tasks{ "taskpool.tasks" };
+		MetricCounter steals{ "taskpool.steals" };
+		MetricGauge queued[TaskPool::PRIORITY_COUNT]{
+			MetricGauge("taskpool.queued.interactive"),
+			MetricGauge("taskpool.queued.prefetch"),
+			MetricGauge("taskpool.queued.bulk") };
+	};
+
+	const PoolMetrics& GetMetrics()
+	{
+		static const PoolMetrics metrics;
+		return metrics;
+	}
+}
+
+TaskPool& TaskPool::Get()
+{
+	// with every core reserved one worker is left to the scheduler, the work still has to run
+	static const unsigned int reserved = g_reservedCores.exchange(STARTED);
+	static TaskPool instance(reserved && reserved >= std::thread::hardware_concurrency() ? 1 : 0, reserved ? reserved : NO_PINNING);
+	return instance;
+}
+
+
+
+bool TaskPool::ReserveCores(unsigned int count)
+{
+	unsigned int reserved = g_reservedCores.load();
+	while (reserved != STARTED)
+	{
+		if (g_reservedCores.compare_exchange_weak(reserved, std::min(count, STARTED - 1)))
+			return true;
+	}
+	return false;
+}
+
+
+
+TaskPool::TaskPool(unsigned int threads, unsigned int firstCore) :
+	m_queued(0),
+	m_pending(0),
+	m_nextWorker(0),
+	m_nextId(0),
+	m_steals(0),
+	m_stopping(false)
+{
+	// before any worker, so they outlive the shared pool at exit
+	GetMetrics();
+	for (std::atomic<size_t>& queued : m_queuedAt)
+		queued = 0;
+	const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+	if (firstCore >= cores)
+		firstCore = NO_PINNING;
+	if (!threads)
+		threads = firstCore == NO_PINNING ? cores : cores - firstCore;
+	for (unsigned int i = 0; i < threads; i++)
+		m_workers.push_back(std::make_unique<Worker>());
+	for (unsigned int i = 0; i < threads; i++)
+		m_threads.emplace_back(&TaskPool::Run, this, i, firstCore == NO_PINNING ? NO_PINNING : firstCore + i % (cores - firstCore));
+}
+
+TaskPool::~TaskPool()
+{
+	{
+		std::lock_guard<std::mutex> guardLock(m_idleLock);
+		m_stopping = true;
+	}
+	m_wakeUp.notify_all();
+	for (auto& thread : m_threads)
+		thread.join();
+}
+
+
+
+TaskPool::Ticket TaskPool::Submit(TaskPriority priority, std::function<void()> task)
+{
+	Ticket ticket{ t_pool == this ? t_worker : m_nextWorker++ % m_workers.size(), priority, m_nextId++ };
+	m_pending++;
+	{
+		std::lock_guard<std::mutex> guardLock(m_workers[ticket.worker]->lock);
+		m_workers[ticket.worker]->tasks[static_cast<size_t>(priority)].push_back(Entry{ ticket.id, std::move(task) });
+		Queued(static_cast<size_t>(priority), 1);
+	}
+
+	// taking the lock orders this against a worker that just checked m_queued and is about to sleep
+	{
+		std::lock_guard<std::mutex> guardLock(m_idleLock);
+	}
+	m_wakeUp.notify_one();
+	return ticket;
+}
+
+
+
+bool TaskPool::Boost(Ticket& ticket, TaskPriority priority)
+{
+	Worker& worker = *m_workers[ticket.worker];
+	std::lock_guard<std::mutex> guardLock(worker.lock);
+	std::deque<Entry>& tasks = worker.tasks[static_cast<size_t>(ticket.priority)];
+	const auto entry = std::find_if(tasks.begin(), tasks.end(), [&ticket](const Entry& queued) { return queued.id == ticket.id; });
+	if (entry == tasks.end())
+		return false;
+	if (priority >= ticket.priority)
+		return true;
+
+	// the newest of its new priority, its worker runs it next
+	worker.tasks[static_cast<size_t>(priority)].push_back(std::move(*entry));
+	tasks.erase(entry);
+	Queued(static_cast<size_t>(ticket.priority), -1);
+	Queued(static_cast<size_t>(priority), 1);
+	ticket.priority = priority;
+	return true;
+}
+
+
+
+void TaskPool::Wait()
+{
+	std::unique_lock<std::mutex> guardLock(m_idleLock);
+	m_idle.wait(guardLock, [this]() { return m_pending == 0; });
+}
+
+
+
+void TaskPool::Run(size_t index, unsigned int core)
+{
+	t_pool = this;
+	t_worker = index;
+	if (core != NO_PINNING && !PinToCore(core))
+		std::cout << "TASK POOL WORKER NOT PINNED TO CORE " << core << std::endl;
+	while (true)
+	{
+		std::function<void()> task;
+		if (TryTake(index, task))
+		{
+			task();
+			GetMetrics().tasks.Add();
+			if (--m_pending == 0)
+			{
+				std::lock_guard<std::mutex> guardLock(m_idleLock);
+				m_idle.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> guardLock(m_idleLock);
+		m_wakeUp.wait(guardLock, [this]() { return m_stopping || m_queued > 0; });
+		if (m_stopping && m_queued == 0)
+			return;
+	}
+}
+
+
+
+bool TaskPool::TryTake(size_t index, std::function<void()>& task)
+{
+	// a more urgent task of another worker goes before a less urgent one of its own
+	for (size_t priority = 0; priority < PRIORITY_COUNT; priority++)
+	{
+		if (m_queuedAt[priority] && (TryPop(index, priority, task) || TrySteal(index, priority, task)))
+			return true;
+	}
+	return false;
+}
+
+
+
+bool TaskPool::TryPop(size_t index, size_t priority, std::function<void()>& task)
+{
+	Worker& worker = *m_workers[index];
+	std::lock_guard<std::mutex> guardLock(worker.lock);
+	std::deque<Entry>& tasks = worker.tasks[priority];
+	if (tasks.empty())
+		return false;
+	task = std::move(tasks.back().task);
+	tasks.pop_back();
+	Queued(priority, -1);
+	return true;
+}
+
+
+
+bool TaskPool::TrySteal(size_t thief, size_t priority, std::function<void()>& task)
+{
+	for (size_t i = 1; i < m_workers.size(); i++)
+	{
+		Worker& victim = *m_workers[(thief + i) % m_workers.size()];
+		std::lock_guard<std::mutex> guardLock(victim.lock);
+		std::deque<Entry>& tasks = victim.tasks[priority];
+		if (tasks.empty())
+			continue;
+		task = std::move(tasks.front().task);
+		tasks.pop_front();
+		Queued(priority, -1);
+		m_steals++;
+		GetMetrics().steals.Add();
+		return true;
+	}
+	return false;
+}
+
+
+
+void TaskPool::Queued(size_t priority, int64_t count)
+{
+	m_queued += count;
+	m_queuedAt[priority] += count;
+	GetMetrics().queued[priority].Add(count);
+}
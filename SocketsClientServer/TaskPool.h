@@ -0,0 +1,100 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum class TaskPriority : uint8_t
+{
+	Interactive,    // a listener is waiting for it right now: a seek, a cold start
+	Prefetch,       // needed at the next track boundary
+	Bulk            // ingest and other batch work nobody is waiting for
+};
+
+// Work-stealing thread pool: every worker runs the newest task of its own deque first and, when that
+// is empty, steals the oldest task of another worker. Tasks submitted from a worker stay on it. Each
+// worker keeps a deque per priority and a more urgent task anywhere in the pool runs before a less
+// urgent one, so a seek never queues behind a library ingest.
+//
+// Get is the pool CPU bound work of the server goes to (encoding, loudness analysis, packetizing,
+// frame cache fills) instead of threads of its own. Its workers stay off the cores reserved for the
+// reactors, a burst of ingest therefore never delays the network.
+class TaskPool
+{
+public:
+	static constexpr size_t PRIORITY_COUNT = 3;
+	static constexpr unsigned int NO_PINNING = UINT_MAX;
+
+	// Where a task was queued, to find it again while it waits.
+	struct Ticket
+	{
+		size_t worker = 0;
+		TaskPriority priority = TaskPriority::Bulk;
+		uint64_t id = 0;
+	};
+
+	//-- The shared pool, started on first use.
+	static TaskPool& Get();
+	//-- Keeps the workers of the shared pool off the first count cores, for the threads that must never
+	//-- wait for CPU bound work. Only before the first Get, false afterwards.
+	static bool ReserveCores(unsigned int count);
+
+	//-- threads == 0 starts one worker per core, from firstCore on; worker i is pinned to core
+	//-- firstCore + i, wrapping around the cores there are, unless firstCore is NO_PINNING.
+	explicit TaskPool(unsigned int threads = 0, unsigned int firstCore = NO_PINNING);
+
+	//-- Runs every task already submitted before the workers stop.
+	~TaskPool();
+	TaskPool(const TaskPool&) = delete;
+	TaskPool& operator=(const TaskPool&) = delete;
+
+	Ticket Submit(TaskPriority priority, std::function<void()> task);
+
+	//-- Raises the priority of a task that has not started yet, returns false once it is running.
+	bool Boost(Ticket& ticket, TaskPriority priority);
+
+	//-- Blocks until every submitted task (and the tasks they submitted) has run.
+	void Wait();
+	unsigned int GetThreadCount() const noexcept { return static_cast<unsigned int>(m_threads.size()); }
+	size_t GetQueued(TaskPriority priority) const noexcept { return m_queuedAt[static_cast<size_t>(priority)]; }
+	uint64_t GetSteals() const noexcept { return m_steals; }
+
+private:
+	struct Entry
+	{
+		uint64_t id;
+		std::function<void()> task;
+	};
+
+	struct Worker
+	{
+		std::mutex lock;
+		std::array<std::deque<Entry>, PRIORITY_COUNT> tasks;
+	};
+
+	void Run(size_t index, unsigned int core);
+	bool TryTake(size_t index, std::function<void()>& task);
+	bool TryPop(size_t index, size_t priority, std::function<void()>& task);
+	bool TrySteal(size_t thief, size_t priority, std::function<void()>& task);
+	void Queued(size_t priority, int64_t count);
+
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::vector<std::thread> m_threads;
+	std::mutex m_idleLock;
+	std::condition_variable m_wakeUp;
+	std::condition_variable m_idle;
+	std::atomic<size_t> m_queued;       // waiting in a deque
+	std::array<std::atomic<size_t>, PRIORITY_COUNT> m_queuedAt;
+	std::atomic<size_t> m_pending;      // queued or running
+	std::atomic<size_t> m_nextWorker;
+	std::atomic<uint64_t> m_nextId;
+	std::atomic<uint64_t> m_steals;
+	bool m_stopping;
+};